@@ -0,0 +1,99 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/* yoyo-progress.h: the progress counter yoyo shares with a child, and how
+ * the child advances it without system calls */
+/* Copyright (C) 2020, 2021 Eric Herman <eric@freesa.org> */
+
+#ifndef YOYO_PROGRESS_H
+#define YOYO_PROGRESS_H
+
+#include <stdint.h>
+#include <stdlib.h>		/* getenv, strtol */
+#include <sys/mman.h>		/* mmap */
+
+/*
+ * With YOYO_PROGRESS=1, yoyo starts each child with a memfd holding a
+ * yoyo_progress, the descriptor number in YOYO_PROGRESS_FD. A child maps
+ * it once, then advances count as it completes each piece of work:
+ *
+ *	struct yoyo_progress *progress = yoyo_progress_open();
+ *	...
+ *	while (next_item(&item)) {
+ *		process(&item);
+ *		yoyo_progress_bump(progress);
+ *	}
+ *
+ * yoyo reads count at each check. Until it first changes, the child is
+ * checked through /proc as usual; after that, a count which has not
+ * changed since the previous check is an idle check, and more than
+ * YOYO_MAX_HANGS of them in a row is a hang.
+ *
+ * yoyo_progress_open returns NULL when not run by yoyo, or with
+ * YOYO_PROGRESS unset, and the other functions do nothing with NULL, so
+ * an instrumented program needs no other changes to run on its own.
+ */
+
+#define YOYO_PROGRESS_MAGIC 0x676f7270U	/* "prog" */
+#define YOYO_PROGRESS_VERSION 1
+
+struct yoyo_progress {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t size;
+	/* the yoyo which reads count */
+	uint32_t reader_pid;
+	/* only its changes matter, not its value */
+	uint64_t count;
+	uint64_t reserved[5];
+};
+
+/* map the counter of YOYO_PROGRESS_FD; NULL if there is none */
+static inline struct yoyo_progress *yoyo_progress_open(void)
+{
+	const char *num = getenv("YOYO_PROGRESS_FD");
+	char *end = NULL;
+	long fd = num ? strtol(num, &end, 10) : -1;
+	if (fd < 0 || end == num || *end) {
+		return NULL;
+	}
+	void *addr = mmap(NULL, sizeof(struct yoyo_progress),
+			  PROT_READ | PROT_WRITE, MAP_SHARED, (int)fd, 0);
+	if (addr == MAP_FAILED) {
+		return NULL;
+	}
+	struct yoyo_progress *progress = addr;
+	if (progress->magic != YOYO_PROGRESS_MAGIC
+	    || progress->version != YOYO_PROGRESS_VERSION) {
+		munmap(addr, sizeof(struct yoyo_progress));
+		return NULL;
+	}
+	return progress;
+}
+
+/* from one thread at a time: a plain load and a relaxed store */
+static inline void yoyo_progress_bump(struct yoyo_progress *progress)
+{
+	if (progress) {
+		uint64_t count = __atomic_load_n(&progress->count,
+						 __ATOMIC_RELAXED);
+		__atomic_store_n(&progress->count, count + 1,
+				 __ATOMIC_RELAXED);
+	}
+}
+
+/* from any number of threads, at the cost of a locked add */
+static inline void yoyo_progress_add(struct yoyo_progress *progress,
+				     uint64_t n)
+{
+	if (progress) {
+		__atomic_fetch_add(&progress->count, n, __ATOMIC_RELAXED);
+	}
+}
+
+static inline void yoyo_progress_close(struct yoyo_progress *progress)
+{
+	if (progress) {
+		munmap(progress, sizeof(struct yoyo_progress));
+	}
+}
+
+#endif /* YOYO_PROGRESS_H */
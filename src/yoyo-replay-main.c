@@ -0,0 +1,6 @@
+int yoyo_replay(int argc, char **argv);
+
+int main(int argc, char **argv)
+{
+	return yoyo_replay(argc, argv);
+}
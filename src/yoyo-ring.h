@@ -0,0 +1,118 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/* yoyo-ring.h: the layout of the snapshot ring yoyo publishes, and how to
+ * read it from another process without system calls */
+/* Copyright (C) 2020, 2021 Eric Herman <eric@freesa.org> */
+
+#ifndef YOYO_RING_H
+#define YOYO_RING_H
+
+#include <stddef.h>		/* size_t */
+#include <stdint.h>
+#include <string.h>		/* memcpy */
+
+/*
+ * The file named by YOYO_SNAPSHOT_RING holds a yoyo_ring_header followed
+ * by slot_count slots of slot_size bytes each. Every sampled state_list
+ * is written, with the job's hang counter, to the slot of the next
+ * snapshot number; head is the number of snapshots published so far,
+ * so the latest is number head - 1, in slot (head - 1) % slot_count.
+ *
+ * Each slot is guarded by a sequence lock: seq is odd while the slot is
+ * being written, and is advanced again once the write is complete. A
+ * reader copies the slot and retries if seq was odd or changed.
+ *
+ * Readers should check magic and version, and use header_size, slot_size
+ * and thread_size rather than the sizeof of these structs. The file is
+ * left in place when yoyo exits; writer_pid tells whether it is stale.
+ */
+
+#define YOYO_RING_MAGIC 0x6f796f79U	/* "yoyo" */
+#define YOYO_RING_VERSION 1
+
+struct yoyo_ring_header {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t header_size;
+	uint32_t slot_size;
+	uint32_t slot_count;
+	uint32_t max_threads;
+	uint32_t thread_size;
+	uint32_t writer_pid;
+	/* snapshots published; only ever increases */
+	uint64_t head;
+	uint64_t reserved[3];
+};
+
+struct yoyo_ring_thread {
+	int64_t tid;
+	uint64_t utime;
+	uint64_t stime;
+	uint64_t minflt;
+	uint64_t majflt;
+	uint64_t delayacct_blkio_ticks;
+	int32_t processor;
+	char state;
+	char pad[3];
+};
+
+struct yoyo_ring_slot {
+	uint64_t seq;
+	/* the snapshot number, to tell a reused slot from the one wanted */
+	uint64_t number;
+	/* CLOCK_MONOTONIC */
+	uint64_t timestamp_ns;
+	int64_t pid;
+	/* the job's index in the manifest or on the command line */
+	uint32_t job;
+	/* hung verdicts in a row before this snapshot was judged */
+	uint32_t hang_count;
+	uint32_t max_hangs;
+	/* threads sampled, of which at most max_threads follow */
+	uint32_t len;
+	struct yoyo_ring_thread threads[];
+};
+
+static inline const struct yoyo_ring_slot *yoyo_ring_slot(const struct
+							  yoyo_ring_header
+							  *ring,
+							  uint64_t number)
+{
+	const char *slots = ((const char *)ring) + ring->header_size;
+	uint64_t offset = (number % ring->slot_count) * ring->slot_size;
+	return (const struct yoyo_ring_slot *)(slots + offset);
+}
+
+/* the number of the latest snapshot; -1 if none was published yet */
+static inline int64_t yoyo_ring_latest(const struct yoyo_ring_header *ring)
+{
+	uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+	return ((int64_t)head) - 1;
+}
+
+/* copy snapshot number into out, which has room for size bytes (at most
+ * slot_size are used); returns 0 on success, or -1 if that snapshot was
+ * not yet published or has since been overwritten */
+static inline int yoyo_ring_read(const struct yoyo_ring_header *ring,
+				 uint64_t number, struct yoyo_ring_slot *out,
+				 size_t size)
+{
+	const struct yoyo_ring_slot *slot = yoyo_ring_slot(ring, number);
+	size_t len = (size < ring->slot_size) ? size : ring->slot_size;
+	/* a writer which died mid-write leaves seq odd */
+	for (unsigned tries = 0; tries < (1U << 16); ++tries) {
+		uint64_t seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+		if (seq & 1) {
+			continue;	/* being written */
+		}
+		memcpy(out, slot, len);
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if (__atomic_load_n(&slot->seq, __ATOMIC_RELAXED) != seq) {
+			continue;	/* written while being copied */
+		}
+		out->seq = seq;
+		return (seq && out->number == number) ? 0 : -1;
+	}
+	return -1;
+}
+
+#endif /* YOYO_RING_H */
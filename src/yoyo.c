@@ -3,7 +3,12 @@
 /* Copyright (C) 2020, 2021 Eric Herman <eric@freesa.org> and
         Brett Neumeier <brett@freesa.org> */
 
+#define _GNU_SOURCE		/* getdents64 */
+
 #include "yoyo.h"
+#include "yoyo-progress.h"
+#include "yoyo-ring.h"
+#include <ctype.h>		/* isspace */
 
 /* freestanding headers */
 #include <float.h>
@@ -15,19 +20,35 @@
 #include <stdint.h>
 
 /* hosted headers */
+#include <dirent.h>		/* getdents64 */
+#include <dlfcn.h>		/* dlopen */
 #include <errno.h>
-#include <glob.h>
+#include <fcntl.h>		/* open */
 #include <stdio.h>
 #include <stdlib.h>
 #include <signal.h>
 #include <string.h>		/* strerror */
+#include <time.h>		/* clock_gettime */
+#include <linux/cn_proc.h>	/* proc connector events */
+#include <linux/connector.h>
+#include <linux/netlink.h>
+#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/mman.h>		/* mmap */
+#include <sys/resource.h>	/* setrlimit */
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>		/* fstat */
+#include <sys/syscall.h>	/* SYS_pidfd_open */
+#include <sys/timerfd.h>
+#include <sys/un.h>		/* sockaddr_un */
 #include <sys/types.h>		/* pid_t */
 #include <sys/wait.h>		/* waitpid */
 #include <unistd.h>		/* execvp, fork */
 
 const char *yoyo_version = "0.99.4";
 
-const int default_hang_check_interval = 60;
+const int default_hang_check_interval_ms = 60 * 1000;
 const int default_max_hangs = 5;
 const int default_max_retries = 5;
 
@@ -35,11 +56,92 @@ const int default_max_retries = 5;
 /* globals */
 /*************************************************************************/
 
-/* The sigaction system call provides no obvious way to pass context, so
- * we use global_exit_reason to pass data between functions.
+/* monitor_for_hang reaps the child, and passes back how it exited in
+ * global_exit_reason
  */
 struct exit_reason global_exit_reason;
 
+/* global thresholds for process_looks_hung, can be set via environment;
+ * the churn allows a helper thread to come and go, or to replace
+ * another, without a deadlocked pool looking busy */
+struct hang_thresholds hang_thresholds = {
+	.max_tick_delta = 5,
+	.max_thread_churn = 2,
+};
+
+/* the hang policy of jobs which do not name one, set via environment */
+const struct hang_policy *global_hang_policy = &hang_policy_default;
+const char *global_hang_policy_args = NULL;
+
+/* if YOYO_HEARTBEAT is set, the child is handed the writing end of a
+ * pipe, and the reading end is passed to monitor_for_hang here */
+unsigned heartbeat_ms = 0;
+int global_heartbeat_fd = -1;
+
+/* if YOYO_PROGRESS is set, the child is handed a shared progress counter,
+ * passed to monitor_for_hang here */
+int use_progress = 0;
+struct yoyo_progress *global_progress = NULL;
+
+/* if YOYO_NOTIFY or YOYO_WATCHDOG is set, the child is given a
+ * NOTIFY_SOCKET, whose socket is passed to monitor_for_hang here */
+int use_notify = 0;
+unsigned watchdog_ms = 0;
+int global_notify_fd = -1;
+
+/* if YOYO_OUTPUT_SILENCE is set, the stdout and stderr of the child are
+ * pipes, whose reading ends are passed to monitor_for_hang here */
+unsigned output_silence_ms = 0;
+int global_output_fds[2] = { -1, -1 };
+
+/* if YOYO_LOG_DIR names a directory, the output of each attempt is
+ * written to files there, rotated every YOYO_LOG_SIZE bytes; with
+ * YOYO_LOG_TEE it is passed on to yoyo's stdout and stderr as well;
+ * yoyo() passes the number of earlier attempts to monitor_for_hang in
+ * global_attempts, for the names of the files */
+const char *log_dir = NULL;
+unsigned long long log_size = 64 * 1024 * 1024;
+unsigned log_keep = 3;
+int log_tee = 0;
+unsigned global_attempts = 0;
+
+/* bounds for the adaptive hang check interval, zero meaning "the same as
+ * the hang check interval", thus not adaptive unless set via environment */
+unsigned hang_check_interval_min_ms = 0;
+unsigned hang_check_interval_max_ms = 0;
+
+/* what monitor_child_for_hang is doing, for verbose output and metrics */
+struct monitor_metrics global_monitor_metrics;
+
+/* descendants of the child are monitored unless YOYO_DESCENDANTS=0 */
+int monitor_descendants = 1;
+
+/* if YOYO_PROC_CONNECTOR is set, fork and exit events replace the
+ * children files, unless subscribing is not permitted */
+int use_proc_connector = 0;
+
+/* threads sampling the jobs due in a pass, set with YOYO_SAMPLER_WORKERS */
+unsigned sampler_workers = 1;
+
+/* snapshots are published here if YOYO_SNAPSHOT_RING names a file */
+struct snapshot_ring *global_snapshot_ring = NULL;
+unsigned snapshot_ring_slots = 64;
+unsigned snapshot_ring_threads = 256;
+
+/* every snapshot is appended here if YOYO_TRACE names a file */
+struct trace_writer *global_trace = NULL;
+
+/* counters served on the unix socket named by YOYO_METRICS_SOCKET */
+struct yoyo_stats global_stats;
+int global_metrics_fd = -1;
+
+/* the cost of each poll, dumped on SIGUSR1, and at exit if YOYO_PROFILE */
+struct poll_profile global_poll_profile;
+int yoyo_profile = 0;
+
+/* what the polls made on this thread by get_states_proc have cost */
+static _Thread_local struct poll_cost poll_cost;
+
 /* global verbose, can be set via commandline options, or directly in tests */
 int yoyo_verbose = 0;
 
@@ -69,16 +171,27 @@ int (*yoyo_execvp)(const char *pathname, char *const argv[]) = execvp;
 int (*yoyo_kill)(pid_t pid, int sig) = kill;
 unsigned int (*yoyo_sleep)(unsigned int seconds) = sleep;
 
-/* global pointers to sigaction, waitpid provided for tests */
-int (*yoyo_sigaction)(int signum, const struct sigaction * act,
-		      struct sigaction * oldact) = sigaction;
+/* glibc only gained a pidfd_open wrapper in 2.36 */
+static int pidfd_open_syscall(pid_t pid, unsigned int flags)
+{
+	return (int)syscall(SYS_pidfd_open, pid, flags);
+}
+
+/* global pointers to pidfd_open, epoll_wait provided for testing */
+int (*yoyo_pidfd_open)(pid_t pid, unsigned int flags) = pidfd_open_syscall;
+int (*yoyo_epoll_wait)(int epfd, struct epoll_event * events, int maxevents,
+		       int timeout) = epoll_wait;
+
+/* global pointers to sigprocmask, waitpid provided for tests */
+int (*yoyo_sigprocmask)(int how, const sigset_t *set, sigset_t *oldset) =
+    sigprocmask;
 pid_t (*yoyo_waitpid)(pid_t pid, int *wstatus, int options) = waitpid;
 
 /* global pointers to internal functions */
 struct state_list *(*get_states) (long pid) = get_states_proc;
 void (*free_states)(struct state_list *l) = state_list_free;
 unsigned (*monitor_for_hang)(long child_pid, unsigned max_hangs,
-			     unsigned hang_check_interval) =
+			     unsigned hang_check_interval_ms) =
     monitor_child_for_hang;
 
 #define Die_if_null(ptr) \
@@ -90,6 +203,11 @@ unsigned (*monitor_for_hang)(long child_pid, unsigned max_hangs,
 /*************************************************************************/
 /* functions */
 int print_help(FILE *out);
+static int yoyo_jobs_argv(int argc, char **argv, unsigned max_retries,
+			  unsigned max_hangs, unsigned hang_check_interval_ms);
+static int yoyo_jobs_manifest(int argc, char **argv, unsigned max_retries,
+			      unsigned max_hangs,
+			      unsigned hang_check_interval_ms);
 
 int yoyo_env_default(int default_val, const char *env_var_name)
 {
@@ -97,6 +215,226 @@ int yoyo_env_default(int default_val, const char *env_var_name)
 	return ev ? atoi(ev) : default_val;
 }
 
+int yoyo_parse_ms(const char *str, unsigned *ms)
+{
+	char *end = NULL;
+	errno = 0;
+	double val = strtod(str, &end);
+	double scale = 0.0;
+	if (end == str || errno || !(val >= 0.0)) {
+		scale = 0.0;
+	} else if (strcmp(end, "ms") == 0) {
+		scale = 1.0;
+	} else if (strcmp(end, "s") == 0 || *end == '\0') {
+		scale = 1000.0;
+	}
+	errno = 0;
+	if (!scale) {
+		return -1;
+	}
+
+	double rounded = (val * scale) + 0.5;
+	*ms = (rounded < (double)UINT_MAX) ? (unsigned)rounded : UINT_MAX;
+	return 0;
+}
+
+unsigned yoyo_env_ms(unsigned default_ms, const char *env_var_name)
+{
+	char *ev = getenv(env_var_name);
+	if (!ev) {
+		return default_ms;
+	}
+
+	unsigned ms = 0;
+	if (yoyo_parse_ms(ev, &ms)) {
+		Ylog(0, "%s='%s' is not a duration, using %ums\n",
+		     env_var_name, ev, default_ms);
+		return default_ms;
+	}
+	return ms;
+}
+
+/* the limit yoyo was started with, for its children */
+static struct rlimit saved_open_files_limit = { RLIM_INFINITY, RLIM_INFINITY };
+
+static int open_files_limit_raised = 0;
+
+/* allow as many open files as the hard limit permits */
+void raise_open_files_limit(void)
+{
+	struct rlimit limit;
+	if (getrlimit(RLIMIT_NOFILE, &limit) == 0
+	    && limit.rlim_cur < limit.rlim_max) {
+		saved_open_files_limit = limit;
+		limit.rlim_cur = limit.rlim_max;
+		errno = 0;
+		int err = setrlimit(RLIMIT_NOFILE, &limit);
+		Ylog(err ? 0 : 2, "setrlimit(RLIMIT_NOFILE) returned %d\n", err);
+		open_files_limit_raised = !err;
+	}
+}
+
+/* in the child: a program which uses select(2), or which sizes a table
+ * by the limit, expects the limit it was started with, not yoyo's */
+static void child_restore_open_files_limit(void)
+{
+	if (open_files_limit_raised) {
+		setrlimit(RLIMIT_NOFILE, &saved_open_files_limit);
+	}
+}
+
+/* a pipe for the heartbeats of a child: returns the reading end, and
+ * sets write_fd; both are close-on-exec, and neither blocks */
+static int heartbeat_open(int *write_fd)
+{
+	int fds[2];
+	errno = 0;
+	if (pipe2(fds, O_CLOEXEC | O_NONBLOCK)) {
+		Ylog(0, "pipe2 failed, no heartbeat\n");
+		*write_fd = -1;
+		return -1;
+	}
+	*write_fd = fds[1];
+	return fds[0];
+}
+
+/* null-safe */
+static void close_fds(int *fd, int *other_fd)
+{
+	int *fds[] = { fd, other_fd };
+	for (size_t i = 0; i < 2; ++i) {
+		if (fds[i] && *fds[i] >= 0) {
+			close(*fds[i]);
+			*fds[i] = -1;
+		}
+	}
+}
+
+/* shared memory holding the progress counter of a child: returns the
+ * mapping, and sets fd, close-on-exec, for the child to inherit */
+static struct yoyo_progress *progress_open(int *fd)
+{
+	size_t size = sizeof(struct yoyo_progress);
+	errno = 0;
+	*fd = memfd_create("yoyo-progress", MFD_CLOEXEC);
+	if (*fd < 0 || ftruncate(*fd, (off_t)size)) {
+		Ylog(0, "memfd_create failed, no progress counter\n");
+		close_fds(fd, NULL);
+		return NULL;
+	}
+	void *addr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED,
+			  *fd, 0);
+	if (addr == MAP_FAILED) {
+		Ylog(0, "mmap failed, no progress counter\n");
+		close_fds(fd, NULL);
+		return NULL;
+	}
+	struct yoyo_progress *progress = addr;
+	progress->magic = YOYO_PROGRESS_MAGIC;
+	progress->version = YOYO_PROGRESS_VERSION;
+	progress->size = (uint32_t)size;
+	progress->reader_pid = (uint32_t)getpid();
+	return progress;
+}
+
+/* null-safe */
+static void progress_close(struct yoyo_progress **progress)
+{
+	if (*progress) {
+		munmap(*progress, sizeof(struct yoyo_progress));
+		*progress = NULL;
+	}
+}
+
+/* in the child: keep fd across exec, and say where it is */
+static void child_inherit_fd(int fd, const char *name)
+{
+	if (fd < 0) {
+		return;
+	}
+	char num[24];
+	snprintf(num, sizeof(num), "%d", fd);
+	fcntl(fd, F_SETFD, 0);
+	setenv(name, num, 1);
+}
+
+/* a datagram socket for the sd_notify(3) messages of a child, bound to
+ * an abstract address, which is written to name as NOTIFY_SOCKET is */
+static int notify_open(char *name, size_t size)
+{
+	static unsigned serial = 0;
+	snprintf(name, size, "@yoyo/%ld/%u", (long)getpid(), ++serial);
+
+	struct sockaddr_un addr;
+	memset(&addr, 0x00, sizeof(struct sockaddr_un));
+	addr.sun_family = AF_UNIX;
+	size_t len = strlen(name);
+	len = (len < sizeof(addr.sun_path)) ? len : sizeof(addr.sun_path);
+	memcpy(addr.sun_path + 1, name + 1, len - 1);
+	socklen_t addr_len = offsetof(struct sockaddr_un, sun_path) + len;
+
+	errno = 0;
+	int one = 1;
+	int fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+	if (fd < 0
+	    || setsockopt(fd, SOL_SOCKET, SO_PASSCRED, &one, sizeof(one))
+	    || bind(fd, (struct sockaddr *)&addr, addr_len)) {
+		Ylog(0, "can not bind %s, no notify socket\n", name);
+		close_fds(&fd, NULL);
+	}
+	return fd;
+}
+
+/* pipes for the stdout and stderr of a child: sets read_fds, which do
+ * not block, and write_fds, which do, so that the child is not surprised;
+ * all are close-on-exec; returns 0 on success */
+static int output_open(int read_fds[2], int write_fds[2])
+{
+	for (size_t i = 0; i < 2; ++i) {
+		int fds[2] = { -1, -1 };
+		errno = 0;
+		if (pipe2(fds, O_CLOEXEC)
+		    || fcntl(fds[0], F_SETFL, O_NONBLOCK)) {
+			Ylog(0, "pipe2 failed, output not captured\n");
+			close_fds(&fds[0], &fds[1]);
+			for (size_t j = 0; j < i; ++j) {
+				close_fds(&read_fds[j], &write_fds[j]);
+			}
+			return -1;
+		}
+		read_fds[i] = fds[0];
+		write_fds[i] = fds[1];
+	}
+	return 0;
+}
+
+/* in the child: write to the pipes rather than to yoyo's stdout and
+ * stderr; dup2 clears the close-on-exec flag of the copies */
+static void child_output(int write_fds[2])
+{
+	for (int i = 0; i < 2; ++i) {
+		if (write_fds[i] >= 0) {
+			dup2(write_fds[i], STDOUT_FILENO + i);
+		}
+	}
+}
+
+/* in the child: say where to notify, and how often to, as systemd does */
+static void child_notify(int notify_fd, const char *name, unsigned ms)
+{
+	if (notify_fd < 0) {
+		return;
+	}
+	setenv("NOTIFY_SOCKET", name, 1);
+	if (ms) {
+		char num[24];
+		snprintf(num, sizeof(num), "%llu", 1000ULL * ms);
+		setenv("WATCHDOG_USEC", num, 1);
+		snprintf(num, sizeof(num), "%ld", (long)getpid());
+		setenv("WATCHDOG_PID", num, 1);
+	}
+}
+
 int yoyo(int argc, char **argv)
 {
 	if (argc < 2) {
@@ -113,8 +451,50 @@ int yoyo(int argc, char **argv)
 					   "YOYO_MAX_RETRIES");
 	int max_hangs = yoyo_env_default(default_max_retries,
 					 "YOYO_MAX_HANGS");
-	int hang_check_interval = yoyo_env_default(default_hang_check_interval,
-						   "YOYO_HANG_CHECK_INTERVAL");
+	unsigned hang_check_interval_ms =
+	    yoyo_env_ms(default_hang_check_interval_ms,
+			"YOYO_HANG_CHECK_INTERVAL");
+	hang_check_interval_min_ms =
+	    yoyo_env_ms(hang_check_interval_ms,
+			"YOYO_HANG_CHECK_INTERVAL_MIN");
+	hang_check_interval_max_ms =
+	    yoyo_env_ms(hang_check_interval_ms,
+			"YOYO_HANG_CHECK_INTERVAL_MAX");
+	hang_thresholds.max_thread_churn =
+	    yoyo_env_default(hang_thresholds.max_thread_churn,
+			     "YOYO_MAX_THREAD_CHURN");
+	heartbeat_ms = yoyo_env_ms(0, "YOYO_HEARTBEAT");
+	use_progress = yoyo_env_default(0, "YOYO_PROGRESS");
+	watchdog_ms = yoyo_env_ms(0, "YOYO_WATCHDOG");
+	use_notify = yoyo_env_default(watchdog_ms ? 1 : 0, "YOYO_NOTIFY");
+	output_silence_ms = yoyo_env_ms(0, "YOYO_OUTPUT_SILENCE");
+	log_dir = getenv("YOYO_LOG_DIR");
+	log_dir = (log_dir && *log_dir) ? log_dir : NULL;
+	int size = yoyo_env_default(64 * 1024 * 1024, "YOYO_LOG_SIZE");
+	log_size = (size > 0) ? (unsigned long long)size : 1;
+	int keep = yoyo_env_default(3, "YOYO_LOG_KEEP");
+	log_keep = (keep > 0) ? (unsigned)keep : 0;
+	log_tee = yoyo_env_default(0, "YOYO_LOG_TEE");
+	monitor_descendants = yoyo_env_default(monitor_descendants,
+					       "YOYO_DESCENDANTS");
+	use_proc_connector = yoyo_env_default(use_proc_connector,
+					      "YOYO_PROC_CONNECTOR");
+	yoyo_profile = yoyo_env_default(yoyo_profile, "YOYO_PROFILE");
+	memset(&global_poll_profile, 0x00, sizeof(struct poll_profile));
+	char *policy_spec = getenv("YOYO_HANG_POLICY");
+	if (policy_spec && *policy_spec) {
+		const char *args = NULL;
+		const struct hang_policy *policy =
+		    hang_policy_find(policy_spec, &args);
+		if (!policy) {
+			print_help(Ystderr);
+			return EXIT_FAILURE;
+		}
+		global_hang_policy = policy;
+		global_hang_policy_args = args;
+	}
+	int workers = yoyo_env_default(sampler_workers, "YOYO_SAMPLER_WORKERS");
+	sampler_workers = (workers > 0) ? (unsigned)workers : 1;
 
 	char **child_command_line = argv + 1;
 	int child_command_line_len = argc - 1;
@@ -130,30 +510,102 @@ int yoyo(int argc, char **argv)
 	yoyo_verbose = yoyo_env_default(yoyo_verbose, "YOYO_VERBOSE");
 	Ylog(1, "yoyo_verbose: %d\n", yoyo_verbose);
 
-	// setup global for sharing data with signal handler
+	// /proc files of every monitored thread are kept open
+	raise_open_files_limit();
+
+	char *ring_path = getenv("YOYO_SNAPSHOT_RING");
+	if (ring_path && *ring_path) {
+		int slots = yoyo_env_default(snapshot_ring_slots,
+					     "YOYO_SNAPSHOT_RING_SLOTS");
+		int threads = yoyo_env_default(snapshot_ring_threads,
+					       "YOYO_SNAPSHOT_RING_THREADS");
+		snapshot_ring_close(global_snapshot_ring);
+		global_snapshot_ring =
+		    snapshot_ring_open(ring_path, slots > 0 ? slots : 1,
+				       threads > 0 ? threads : 0);
+	}
+
+	char *trace_path = getenv("YOYO_TRACE");
+	if (trace_path && *trace_path) {
+		trace_writer_close(global_trace);
+		global_trace = trace_writer_open(trace_path);
+	}
+
+	char *metrics_path = getenv("YOYO_METRICS_SOCKET");
+	if (metrics_path && *metrics_path) {
+		if (global_metrics_fd >= 0) {
+			close(global_metrics_fd);
+		}
+		global_metrics_fd = yoyo_metrics_listen(metrics_path);
+	}
+
+	if (strcmp(argv[1], "--jobs") == 0) {
+		return yoyo_jobs_argv(argc - 2, argv + 2, max_retries,
+				      max_hangs, hang_check_interval_ms);
+	} else if (strcmp(argv[1], "--manifest") == 0) {
+		return yoyo_jobs_manifest(argc - 2, argv + 2, max_retries,
+					  max_hangs, hang_check_interval_ms);
+	}
+
+	// setup global for sharing data with monitor_for_hang
 	exit_reason_clear(&global_exit_reason);
+	yoyo_stats_reset(1);
+	yoyo_stats_name(0, child_command_line[0]);
 
-	// now that globals are setup, set the handler
-	struct sigaction our_sigaction;
-	memset(&our_sigaction, 0x00, sizeof(struct sigaction));
-	our_sigaction.sa_handler = exit_reason_child_trap;
-	sigemptyset(&our_sigaction.sa_mask);
-	our_sigaction.sa_flags = 0;
-	yoyo_sigaction(SIGCHLD, &our_sigaction, NULL);
+	// SIGCHLD and SIGUSR1 are only ever read from a signalfd, never
+	// handled; blocked throughout, so none is lost between attempts
+	sigset_t sigchld_mask;
+	sigset_t saved_mask;
+	sigemptyset(&sigchld_mask);
+	sigaddset(&sigchld_mask, SIGCHLD);
+	sigaddset(&sigchld_mask, SIGUSR1);
+	sigemptyset(&saved_mask);
+	yoyo_sigprocmask(SIG_BLOCK, &sigchld_mask, &saved_mask);
 
 	int max_tries = max_retries + 1;
 	for (int i = 0; i < max_tries; ++i) {
 		// reset our exit reason prior to each fork
 		exit_reason_clear(&global_exit_reason);
 
+		int beat_fd = -1;
+		global_heartbeat_fd = heartbeat_ms ? heartbeat_open(&beat_fd)
+		    : -1;
+		int progress_fd = -1;
+		global_progress = use_progress ? progress_open(&progress_fd)
+		    : NULL;
+		char notify_name[sizeof(((struct sockaddr_un *) 0)->sun_path)];
+		global_notify_fd = use_notify ? notify_open(notify_name,
+							    sizeof(notify_name))
+		    : -1;
+		int output_fds[2] = { -1, -1 };
+		if (output_silence_ms || log_dir) {
+			output_open(global_output_fds, output_fds);
+		}
+		global_attempts = i;
+
 		errno = 0;
 		global_exit_reason.child_pid = yoyo_fork();
 
 		if (global_exit_reason.child_pid < 0) {
 			Ylog(0, "fork() failed?\n");
+			close_fds(&global_heartbeat_fd, &beat_fd);
+			close_fds(&progress_fd, &global_notify_fd);
+			progress_close(&global_progress);
+			for (size_t j = 0; j < 2; ++j) {
+				close_fds(&global_output_fds[j],
+					  &output_fds[j]);
+			}
+			yoyo_sigprocmask(SIG_SETMASK, &saved_mask, NULL);
 			return EXIT_FAILURE;
 		} else if (global_exit_reason.child_pid == 0) {
 			// in child process
+			yoyo_sigprocmask(SIG_SETMASK, &saved_mask, NULL);
+			child_restore_open_files_limit();
+			child_inherit_fd(beat_fd, "YOYO_HEARTBEAT_FD");
+			child_inherit_fd(progress_fd, "YOYO_PROGRESS_FD");
+			child_notify(global_notify_fd, notify_name,
+				     watchdog_ms);
+			child_output(output_fds);
 			Ylog(1, "command: %s\n", child_command_line[0]);
 			for (int i = 1; i < child_command_line_len; ++i) {
 				Ylog_append(1, "  arg: %s\n",
@@ -165,10 +617,13 @@ int yoyo(int argc, char **argv)
 
 		Ylog(1, "'%s' child_pid: %ld\n", child_command_line[0],
 		     (long)global_exit_reason.child_pid);
+		close_fds(NULL, &beat_fd);
+		close_fds(&progress_fd, &output_fds[0]);
+		close_fds(&output_fds[1], NULL);
 
 		unsigned killed =
 		    monitor_for_hang(global_exit_reason.child_pid, max_hangs,
-				     hang_check_interval);
+				     hang_check_interval_ms);
 
 		if (!killed && global_exit_reason.exit_code != 0) {
 			snprintf(buf, buflen,
@@ -185,6 +640,8 @@ int yoyo(int argc, char **argv)
 			Ylog(0, "%s", buf);
 			strcat(summary, buf);
 			Ylog_append(0, "%s", summary);
+			yoyo_profile_summary();
+			yoyo_sigprocmask(SIG_SETMASK, &saved_mask, NULL);
 			return EXIT_SUCCESS;
 		} else {
 			char er_buf[250];
@@ -201,12 +658,48 @@ int yoyo(int argc, char **argv)
 	Ylog(0, "'%s' failed.\n", child_command_line[0]);
 	Ylog_append(0, "%s", summary);
 	Ylog_append(0, "Retries limit reached.\n");
+	yoyo_profile_summary();
+	yoyo_sigprocmask(SIG_SETMASK, &saved_mask, NULL);
 	return EXIT_FAILURE;
 }
 
+static int thread_state_compare(const void *a, const void *b)
+{
+	long x = ((const struct thread_state *)a)->pid;
+	long y = ((const struct thread_state *)b)->pid;
+	return (x > y) - (x < y);
+}
+
+static void state_list_sort(struct state_list *l)
+{
+	for (size_t i = 1; i < l->len; ++i) {
+		if (l->states[i].pid < l->states[i - 1].pid) {
+			qsort(l->states, l->len, sizeof(struct thread_state),
+			      thread_state_compare);
+			return;
+		}
+	}
+}
+
+/* a tid may be reused by a new thread; starttime tells them apart */
+static int same_thread(const struct thread_state *a,
+		       const struct thread_state *b)
+{
+	return (a->pid == b->pid)
+	    && (!a->starttime || !b->starttime
+		|| a->starttime == b->starttime);
+}
+
+static unsigned long tick_delta(unsigned long old, unsigned long new)
+{
+	return (new > old) ? (new - old) : 0;
+}
+
 // "next" is an OUT parameter
-int process_looks_hung(struct state_list **next, struct state_list *previous,
-		       struct state_list *current)
+int process_looks_hung_thresholds(const struct hang_thresholds *thresholds,
+				  struct state_list **next,
+				  struct state_list *previous,
+				  struct state_list *current)
 {
 	for (size_t i = 0; i < current->len; ++i) {
 		if (current->states[i].state != 'S') {
@@ -215,34 +708,124 @@ int process_looks_hung(struct state_list **next, struct state_list *previous,
 		}
 	}
 
-	if (!previous || previous->len != current->len) {
-		*next = current;
+	/* threads are matched by tid, so keep both lists in tid order */
+	state_list_sort(current);
+	*next = current;
+
+	if (!previous) {
 		return 0;
 	}
 
-	for (size_t i = 0; i < current->len; ++i) {
-		struct thread_state old_state = previous->states[i];
-		struct thread_state new_state = current->states[i];
-
-		if ((old_state.pid != new_state.pid)
-		    || (new_state.utime > (old_state.utime + 5))
-		    || (new_state.stime > (old_state.stime + 5))
-		    ) {
-			*next = NULL;
-			return 0;
+	size_t common = 0;
+	size_t churn = 0;
+	size_t i = 0;
+	size_t j = 0;
+	while (i < previous->len || j < current->len) {
+		struct thread_state *old_state = previous->states + i;
+		struct thread_state *new_state = current->states + j;
+		if (j == current->len
+		    || (i < previous->len && old_state->pid < new_state->pid)) {
+			++churn;	/* vanished */
+			++i;
+		} else if (i == previous->len
+			   || new_state->pid < old_state->pid) {
+			++churn;	/* appeared */
+			++j;
+		} else if (!same_thread(old_state, new_state)) {
+			churn += 2;	/* tid reused */
+			++i;
+			++j;
+		} else {
+			unsigned long max = thresholds->max_tick_delta;
+			if ((tick_delta(old_state->utime, new_state->utime) >
+			     max)
+			    || (tick_delta(old_state->stime, new_state->stime)
+				> max)) {
+				*next = NULL;
+				return 0;
+			}
+			++common;
+			++i;
+			++j;
 		}
 	}
 
-	*next = current;
+	if (!common || churn > thresholds->max_thread_churn) {
+		Ylog(1, "%zu threads in common, %zu came or went\n", common,
+		     churn);
+		return 0;
+	}
+
 	return 1;
 }
 
-static char *pid_to_stat_pattern(char *buf, long pid)
+struct hang_thresholds hang_thresholds_for_interval(const struct
+						    hang_thresholds *base,
+						    unsigned interval_ms)
+{
+	struct hang_thresholds scaled = *base;
+	unsigned long long reference = default_hang_check_interval_ms;
+	unsigned long long ticks = base->max_tick_delta;
+	scaled.max_tick_delta =
+	    (unsigned long)(((ticks * interval_ms) + reference - 1) / reference);
+	return scaled;
+}
+
+unsigned long long state_list_ticks(const struct state_list *l)
+{
+	unsigned long long ticks = 0;
+	for (size_t i = 0; l && i < l->len; ++i) {
+		ticks += l->states[i].utime + l->states[i].stime;
+	}
+	return ticks;
+}
+
+int ticks_look_busy(unsigned long long ticks, unsigned interval_ms)
+{
+	static long ticks_per_second = 0;
+	if (!ticks_per_second) {
+		ticks_per_second = sysconf(_SC_CLK_TCK);
+		if (ticks_per_second <= 0) {
+			ticks_per_second = 100;
+		}
+	}
+	/* busy: at least half of one CPU over the interval */
+	unsigned long long half_cpu =
+	    (((unsigned long long)ticks_per_second) * interval_ms) / 2000;
+	return ticks > half_cpu;
+}
+
+unsigned next_hang_check_interval(unsigned interval_ms, unsigned min_ms,
+				  unsigned max_ms, int looks_idle,
+				  int looks_busy)
+{
+	if (looks_idle) {
+		interval_ms /= 2;
+	} else if (looks_busy) {
+		interval_ms = (interval_ms > (UINT_MAX / 2)) ? UINT_MAX
+		    : (interval_ms * 2);
+	}
+	if (interval_ms < min_ms) {
+		interval_ms = min_ms;
+	}
+	if (interval_ms > max_ms) {
+		interval_ms = max_ms;
+	}
+	return interval_ms;
+}
+
+int process_looks_hung(struct state_list **next, struct state_list *previous,
+		       struct state_list *current)
+{
+	return process_looks_hung_thresholds(&hang_thresholds, next, previous,
+					     current);
+}
+
+static uint64_t monotonic_ns(void)
 {
-	strcpy(buf, "/proc/");
-	sprintf(buf + strlen(buf), "%ld", pid);
-	strcat(buf, "/task/*/stat");
-	return buf;
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (((uint64_t)now.tv_sec) * 1000000000) + now.tv_nsec;
 }
 
 char *slurp_text(char *buf, size_t buflen, const char *path)
@@ -270,26 +853,107 @@ char *slurp_text(char *buf, size_t buflen, const char *path)
 	return n ? buf : NULL;
 }
 
-int thread_state_from_path(struct thread_state *ts, const char *path)
+/* decode an unsigned decimal, returns NULL if there are no digits */
+static const char *stat_decode(const char *p, unsigned long *val)
 {
-	unsigned fields = 60;
-	const size_t buf_len = FILENAME_MAX + (fields * (sizeof(long) + 1));
-	char buf[buf_len];
-	errno = 0;
-	char *rbuf = slurp_text(buf, buf_len, path);
-	int log_level = (!rbuf && errno != ENOENT) ? 0 : 2;
-	Ylog(log_level, "slurp_text returned %p\n", rbuf);
+	const char *start = p;
+	unsigned long v = 0;
+	while (*p >= '0' && *p <= '9') {
+		v = (v * 10) + (unsigned long)(*p - '0');
+		++p;
+	}
+	*val = v;
+	return (p == start) ? NULL : p;
+}
 
-	const char *stat_scanf =
-	    "%d %*s %c %*d %*d %*d %*d %*d %*u %*lu %*lu %*lu %*lu %lu %lu";
-	errno = 0;
-	int matched = sscanf(buf, stat_scanf, &ts->pid, &ts->state, &ts->utime,
-			     &ts->stime);
+/* field numbers as documented in proc(5) */
+enum proc_stat_field {
+	stat_pid = 1,
+	stat_state = 3,
+	stat_minflt = 10,
+	stat_majflt = 12,
+	stat_utime = 14,
+	stat_stime = 15,
+	stat_num_threads = 20,
+	stat_starttime = 22,
+	stat_processor = 39,
+	stat_delayacct_blkio_ticks = 42
+};
 
-	log_level = (matched != 4) ? 0 : 2;
-	Ylog(log_level, "scanf matched %d of 4 fields for %s\n", matched, path);
+int thread_state_from_stat(struct thread_state *ts, const char *buf)
+{
+	memset(ts, 0x00, sizeof(struct thread_state));
+
+	/* pid, state, utime, stime are required, the rest may be absent */
+	int missing = 4;
+
+	unsigned long val = 0;
+	const char *p = stat_decode(buf, &val);
+	if (p && *p == ' ') {
+		ts->pid = (long)val;
+		--missing;
+		/* the comm may contain spaces and ')', so find the last one */
+		p = strrchr(p, ')');
+	} else {
+		p = NULL;
+	}
+	if (p && p[1] == ' ') {
+		p += 2;
+	} else {
+		p = NULL;
+	}
+
+	for (unsigned field = stat_state; p && *p; ++field) {
+		const char *next = (field == stat_state) ? p + 1 : NULL;
+		switch (field) {
+		case stat_state:
+			ts->state = *p;
+			--missing;
+			break;
+		case stat_minflt:
+			next = stat_decode(p, &ts->minflt);
+			break;
+		case stat_majflt:
+			next = stat_decode(p, &ts->majflt);
+			break;
+		case stat_utime:
+			next = stat_decode(p, &ts->utime);
+			missing -= next ? 1 : 0;
+			break;
+		case stat_stime:
+			next = stat_decode(p, &ts->stime);
+			missing -= next ? 1 : 0;
+			break;
+		case stat_num_threads:
+			next = stat_decode(p, &val);
+			ts->num_threads = (long)val;
+			break;
+		case stat_starttime:
+			next = stat_decode(p, &ts->starttime);
+			break;
+		case stat_processor:
+			next = stat_decode(p, &val);
+			ts->processor = (int)val;
+			break;
+		case stat_delayacct_blkio_ticks:
+			next = stat_decode(p, &ts->delayacct_blkio_ticks);
+			p = NULL;	/* nothing further is of interest */
+			continue;
+		}
+		/* skip whatever remains of this field, and the separator */
+		p = next ? next : p;
+		while (*p && *p != ' ') {
+			++p;
+		}
+		if (*p == ' ') {
+			++p;
+		}
+	}
 
-	return (4 - matched);
+	int log_level = missing ? 0 : 2;
+	Ylog(log_level, "missing %d of 4 required fields\n", missing);
+
+	return missing;
 }
 
 void *calloc_or_log(const char *file, int line, const char *func, size_t nmemb,
@@ -335,151 +999,4449 @@ void state_list_free(struct state_list *l)
 	}
 }
 
-/* errno ENOENT: No such file or directory */
-int ignore_no_such_file(const char *epath, int eerrno)
-{
-	int log_level = (eerrno != ENOENT) ? 0 : 2;
-	Ylog(log_level, "%s (%d)\n", epath, eerrno);
+/* the state of hang_policy_default for an attempt */
+struct sleeping_policy {
+	struct hang_policy_config config;
+	struct state_list *previous;
+	int idle;
+};
 
-	return 0;
+static void *sleeping_policy_init(const struct hang_policy_config *config)
+{
+	struct sleeping_policy *p =
+	    Calloc_or_log(1, sizeof(struct sleeping_policy));
+	if (p) {
+		memset(p, 0x00, sizeof(struct sleeping_policy));
+		p->config = *config;
+	}
+	return p;
 }
 
-struct state_list *get_states_proc(long pid)
+static void sleeping_policy_observe(void *state, struct state_list **snapshot,
+				    unsigned interval_ms)
 {
-	errno = 0;
+	struct sleeping_policy *p = state;
+	/* the tick allowance is for the interval which just passed */
+	struct hang_thresholds thresholds =
+	    hang_thresholds_for_interval(&p->config.thresholds, interval_ms);
+	struct state_list *previous = p->previous;
+	p->idle = process_looks_hung_thresholds(&thresholds, &p->previous,
+						previous, *snapshot);
+	p->config.release(previous);
+	if (p->previous == *snapshot) {
+		*snapshot = NULL;
+	}
+}
 
-	char pattern[FILENAME_MAX + 3];
-	pid_to_stat_pattern(pattern, pid);
+static int sleeping_policy_verdict(void *state)
+{
+	return ((struct sleeping_policy *)state)->idle;
+}
 
-	Ylog(1, "pattern == '%s'\n", pattern);
+static void sleeping_policy_free(void *state)
+{
+	struct sleeping_policy *p = state;
+	if (p) {
+		p->config.release(p->previous);
+		yoyo_free(p);
+	}
+}
 
-	glob_t threads;
-	int (*errfunc)(const char *epath, int eerrno) = ignore_no_such_file;
-	errno = 0;
-	glob(pattern, GLOB_MARK, errfunc, &threads);
+const struct hang_policy hang_policy_default = {
+	.abi_version = YOYO_HANG_POLICY_ABI,
+	.name = "default",
+	.init = sleeping_policy_init,
+	.observe = sleeping_policy_observe,
+	.verdict = sleeping_policy_verdict,
+	.free = sleeping_policy_free,
+};
 
-	size_t len = threads.gl_pathc;
-	Ylog(1, "matches for %ld: %zu\n", pid, len);
-	struct state_list *sl = state_list_new(len);
-	Die_if_null(sl);
+/* the state of hang_policy_cpu for an attempt */
+struct cpu_policy {
+	unsigned long max_tick_delta;
+	int have_ticks;
+	unsigned long long last_ticks;
+	int idle;
+};
 
-	int err = 0;
-	for (size_t i = 0; i < len; ++i) {
-		const char *path = threads.gl_pathv[i];
-		Ylog(1, "\t%s\n", path);
-		struct thread_state *ts = &sl->states[i];
-		err += thread_state_from_path(ts, path);
+static void *cpu_policy_init(const struct hang_policy_config *config)
+{
+	struct cpu_policy *p = Calloc_or_log(1, sizeof(struct cpu_policy));
+	if (!p) {
+		return NULL;
 	}
+	memset(p, 0x00, sizeof(struct cpu_policy));
+	p->max_tick_delta = config->thresholds.max_tick_delta;
+	if (config->args && *config->args) {
+		char *end = NULL;
+		errno = 0;
+		unsigned long ticks = strtoul(config->args, &end, 10);
+		if (*end || errno || config->args[0] == '-') {
+			errno = 0;
+			Ylog(0, "cpu:%s is not a number of ticks\n",
+			     config->args);
+			yoyo_free(p);
+			return NULL;
+		}
+		p->max_tick_delta = ticks;
+	}
+	return p;
+}
 
-	int log_level = err ? 0 : 1;
-	Ylog(log_level, "get_states for pid: %ld errors: %d\n", (long)pid, err);
-
-	globfree(&threads);
+static void cpu_policy_observe(void *state, struct state_list **snapshot,
+			       unsigned interval_ms)
+{
+	struct cpu_policy *p = state;
+	struct hang_thresholds base = {.max_tick_delta = p->max_tick_delta };
+	struct hang_thresholds thresholds =
+	    hang_thresholds_for_interval(&base, interval_ms);
+	unsigned long long ticks = state_list_ticks(*snapshot);
+	p->idle = p->have_ticks
+	    && tick_delta(p->last_ticks, ticks) <= thresholds.max_tick_delta;
+	p->have_ticks = 1;
+	p->last_ticks = ticks;
+}
 
-	return sl;
+static int cpu_policy_verdict(void *state)
+{
+	return ((struct cpu_policy *)state)->idle;
 }
 
-void exit_reason_child_trap(int sig)
+static void cpu_policy_free(void *state)
 {
-	Ylog(1, "exit_reason_child_trap(%d)\n", sig);
+	yoyo_free(state);
+}
 
-	pid_t any_child = -1;
-	int wait_status = 0;
-	int options = 0;
+const struct hang_policy hang_policy_cpu = {
+	.abi_version = YOYO_HANG_POLICY_ABI,
+	.name = "cpu",
+	.init = cpu_policy_init,
+	.observe = cpu_policy_observe,
+	.verdict = cpu_policy_verdict,
+	.free = cpu_policy_free,
+};
+
+static const struct hang_policy *builtin_hang_policies[] = {
+	&hang_policy_default,
+	&hang_policy_cpu,
+};
 
-	pid_t pid = yoyo_waitpid(any_child, &wait_status, options);
+const struct hang_policy *hang_policy_find(const char *spec,
+					   const char **args)
+{
+	const char *colon = strchr(spec, ':');
+	size_t len = colon ? (size_t)(colon - spec) : strlen(spec);
+	*args = colon ? colon + 1 : NULL;
 
-	if (pid == global_exit_reason.child_pid) {
-		exit_reason_set(&global_exit_reason, pid, wait_status);
+	size_t builtins = sizeof(builtin_hang_policies)
+	    / sizeof(builtin_hang_policies[0]);
+	for (size_t i = 0; i < builtins; ++i) {
+		const char *name = builtin_hang_policies[i]->name;
+		if (strlen(name) == len && strncmp(spec, name, len) == 0) {
+			return builtin_hang_policies[i];
+		}
 	}
 
-	if (yoyo_verbose >= 1) {
-		struct exit_reason tmp;
-		exit_reason_set(&tmp, pid, wait_status);
-		size_t len = 255;
-		char buf[len];
-		exit_reason_to_str(&tmp, buf, len);
-		Ylog(1, "exit_reason_child_trap(%d) (%d): %s\n", sig,
-		     wait_status, buf);
+	char path[FILENAME_MAX];
+	if (!memchr(spec, '/', len) || len >= sizeof(path)) {
+		Ylog(0, "no hang policy '%.*s'\n", (int)len, spec);
+		return NULL;
+	}
+	memcpy(path, spec, len);
+	path[len] = '\0';
+	/* never closed: the policy is used until yoyo exits */
+	void *handle = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+	const struct hang_policy *policy =
+	    handle ? dlsym(handle, "yoyo_hang_policy") : NULL;
+	if (policy && policy->abi_version != YOYO_HANG_POLICY_ABI) {
+		Ylog(0, "hang policy in '%s' is for ABI %u, not %u\n", path,
+		     policy->abi_version, (unsigned)YOYO_HANG_POLICY_ABI);
+		dlclose(handle);
+		return NULL;
+	}
+	if (!policy || !policy->init || !policy->observe || !policy->verdict
+	    || !policy->free) {
+		Ylog(0, "no hang policy in '%s': %s\n", path,
+		     handle ? "incomplete yoyo_hang_policy" : dlerror());
+		if (handle) {
+			dlclose(handle);
+		}
+		return NULL;
 	}
+	Ylog(1, "hang policy '%s' from %s\n",
+	     policy->name ? policy->name : "", path);
+	return policy;
 }
 
-int pid_exists(long pid)
+struct proc_sampler *proc_sampler_new(long pid)
 {
-	/*
-	 * If sig is 0, then no signal is sent, but existence and permission
-	 * checks are still performed; this can be used to check for the
-	 * existence of a process ID or process group ID that the caller is
-	 * permitted to signal.
-	 */
-	const int sig_exists = 0;
+	size_t size = sizeof(struct proc_sampler);
+	struct proc_sampler *sampler = Calloc_or_log(1, size);
+	if (!sampler) {
+		return NULL;
+	}
+	memset(sampler, 0x00, size);
+	sampler->pid = pid;
+	sampler->task_fd = -1;
+	return sampler;
+}
 
-	/*
-	 * On success, zero is returned. On error, -1 is returned, and errno
-	 * is set appropriately.
-	 */
-	int rv = yoyo_kill(pid, sig_exists);
-	errno = 0;
+static void proc_sampler_close_fd(struct proc_sampler *sampler, int *fd)
+{
+	if (*fd >= 0) {
+		close(*fd);
+		++sampler->syscalls;
+		++sampler->closes;
+	}
+	*fd = -1;
+}
 
-	return (rv == 0);
+static void proc_sampler_close(struct proc_sampler *sampler,
+			       struct tid_fd *tf)
+{
+	proc_sampler_close_fd(sampler, &tf->fd);
+	proc_sampler_close_fd(sampler, &tf->children_fd);
 }
 
-unsigned term_then_kill(long child_pid, unsigned grace_seconds)
+void proc_sampler_free(struct proc_sampler *sampler)
 {
-	errno = 0;
-	int err = yoyo_kill(child_pid, SIGTERM);
-	/* ESRCH: No such process */
-	int log_level = (err && (errno != ESRCH)) ? 0 : 1;
-	Ylog(log_level, "kill(child_pid, SIGTERM) returned %d\n", err);
+	if (!sampler) {
+		return;
+	}
+	for (size_t i = 0; i < sampler->len; ++i) {
+		proc_sampler_close(sampler, &sampler->tids[i]);
+	}
+	if (sampler->task_fd >= 0) {
+		close(sampler->task_fd);
+	}
+	yoyo_free(sampler->tids);
+	yoyo_free(sampler->spare);
+	yoyo_free(sampler->states);
+	yoyo_free(sampler->found);
+	yoyo_free(sampler->children);
+	yoyo_free(sampler->known_children);
+	yoyo_free(sampler);
+}
+
+static size_t grow_capacity(size_t capacity, size_t needed)
+{
+	capacity = capacity ? capacity : 16;
+	while (capacity < needed) {
+		capacity *= 2;
+	}
+	return capacity;
+}
+
+/* make room for "needed" threads; the spare array is only scratch */
+static int proc_sampler_reserve(struct proc_sampler *sampler, size_t needed)
+{
+	if (needed <= sampler->capacity) {
+		return 0;
+	}
+
+	size_t capacity = grow_capacity(sampler->capacity, needed);
+	size_t size = sizeof(struct tid_fd);
+	struct tid_fd *tids = Calloc_or_log(capacity, size);
+	struct tid_fd *spare = Calloc_or_log(capacity, size);
+	struct thread_state *states =
+	    Calloc_or_log(capacity, sizeof(struct thread_state));
+	if (!tids || !spare || !states) {
+		yoyo_free(tids);
+		yoyo_free(spare);
+		yoyo_free(states);
+		return -1;
+	}
+
+	if (sampler->len) {
+		memcpy(tids, sampler->tids, sampler->len * size);
+	}
+	yoyo_free(sampler->tids);
+	yoyo_free(sampler->spare);
+	yoyo_free(sampler->states);
+	sampler->tids = tids;
+	sampler->spare = spare;
+	sampler->states = states;
+	sampler->capacity = capacity;
+	return 0;
+}
+
+/* grow a reusable array of longs, keeping the first "len" values */
+static int longs_reserve(long **array, size_t len, size_t *capacity,
+			 size_t needed)
+{
+	if (needed <= *capacity) {
+		return 0;
+	}
+
+	size_t new_capacity = grow_capacity(*capacity, needed);
+	long *grown = Calloc_or_log(new_capacity, sizeof(long));
+	if (!grown) {
+		return -1;
+	}
+	if (len) {
+		memcpy(grown, *array, len * sizeof(long));
+	}
+	yoyo_free(*array);
+	*array = grown;
+	*capacity = new_capacity;
+	return 0;
+}
+
+static int longs_append(long **array, size_t *len, size_t *capacity, long val)
+{
+	if (longs_reserve(array, *len, capacity, *len + 1)) {
+		return -1;
+	}
+	(*array)[(*len)++] = val;
+	return 0;
+}
+
+static int long_compare(const void *a, const void *b)
+{
+	long x = *((const long *)a);
+	long y = *((const long *)b);
+	return (x > y) - (x < y);
+}
+
+static int proc_sampler_open_task_dir(struct proc_sampler *sampler)
+{
+	char path[FILENAME_MAX];
+	snprintf(path, FILENAME_MAX, "/proc/%ld/task", sampler->pid);
+
+	Ylog(1, "task dir == '%s'\n", path);
+
+	errno = 0;
+	sampler->task_fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	++sampler->syscalls;
+	if (sampler->task_fd < 0) {
+		/* ENOENT: No such file or directory */
+		int log_level = (errno != ENOENT) ? 0 : 2;
+		Ylog(log_level, "could not open '%s'\n", path);
+		return -1;
+	}
+	++sampler->opens;
+	return 0;
+}
+
+/* collect the tids of the process, in ascending order, in "found";
+ * the task directory stays open and is rewound for each scan */
+static int proc_sampler_scan(struct proc_sampler *sampler)
+{
+	sampler->found_len = 0;
+	if (sampler->task_fd < 0 && proc_sampler_open_task_dir(sampler)) {
+		return 0;
+	}
+
+	errno = 0;
+	off_t pos = lseek(sampler->task_fd, 0, SEEK_SET);
+	++sampler->syscalls;
+	if (pos < 0) {
+		Ylog(0, "lseek of task dir for %ld failed\n", sampler->pid);
+		return 0;
+	}
+
+	alignas(struct dirent64) char buf[8192];
+	int sorted = 1;
+	for (;;) {
+		errno = 0;
+		ssize_t nread = getdents64(sampler->task_fd, buf, sizeof(buf));
+		++sampler->syscalls;
+		sampler->bytes_read += (nread > 0) ? nread : 0;
+		if (nread <= 0) {
+			/* ENOENT: the process exited after the open */
+			int log_level = (nread < 0 && errno != ENOENT) ? 0 : 2;
+			Ylog(log_level, "getdents64 returned %ld\n", (long)nread);
+			break;
+		}
+		for (ssize_t off = 0; off < nread;) {
+			struct dirent64 *d = (struct dirent64 *)(buf + off);
+			off += d->d_reclen;
+			if (d->d_name[0] < '0' || d->d_name[0] > '9') {
+				continue;	/* "." and ".." */
+			}
+			long tid = 0;
+			for (const char *c = d->d_name; *c; ++c) {
+				tid = (tid * 10) + (*c - '0');
+			}
+			if (sampler->found_len
+			    && tid < sampler->found[sampler->found_len - 1]) {
+				sorted = 0;
+			}
+			if (longs_append(&sampler->found, &sampler->found_len,
+					 &sampler->found_capacity, tid)) {
+				return -1;
+			}
+		}
+	}
+	Ylog(1, "tids found for %ld: %zu\n", sampler->pid, sampler->found_len);
+
+	/* the kernel lists tasks in creation order, usually ascending */
+	if (!sorted) {
+		qsort(sampler->found, sampler->found_len, sizeof(long),
+		      long_compare);
+	}
+	return 0;
+}
+
+static int proc_sampler_open(struct proc_sampler *sampler, long tid,
+			     const char *name)
+{
+	char path[FILENAME_MAX];
+	snprintf(path, FILENAME_MAX, "/proc/%ld/task/%ld/%s", sampler->pid,
+		 tid, name);
+
+	errno = 0;
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	++sampler->syscalls;
+	if (fd < 0) {
+		/* ENOENT: the thread exited since the scan */
+		int log_level = (errno != ENOENT) ? 0 : 2;
+		Ylog(log_level, "could not open '%s'\n", path);
+		return -1;
+	}
+	++sampler->opens;
+	return fd;
+}
+
+/* merge the sorted "found" tids with the sorted open files: keep the
+ * files of surviving threads, open new ones, close the vanished ones */
+static void proc_sampler_sync(struct proc_sampler *sampler)
+{
+	struct tid_fd *next = sampler->spare;
+	size_t i = 0;
+	size_t j = 0;
+	size_t n = 0;
+	while (i < sampler->len || j < sampler->found_len) {
+		if (j == sampler->found_len || (i < sampler->len
+						&& sampler->tids[i].tid <
+						sampler->found[j])) {
+			proc_sampler_close(sampler, &sampler->tids[i++]);
+		} else if (i == sampler->len
+			   || sampler->found[j] < sampler->tids[i].tid) {
+			long tid = sampler->found[j++];
+			int fd = proc_sampler_open(sampler, tid, "stat");
+			if (fd >= 0) {
+				next[n].tid = tid;
+				next[n].fd = fd;
+				next[n].children_fd = -1;
+				++n;
+			}
+		} else {
+			next[n++] = sampler->tids[i++];
+			++j;
+		}
+	}
+	sampler->spare = sampler->tids;
+	sampler->tids = next;
+	sampler->len = n;
+}
+
+/* the pids forked by this thread, appended to "children"; returns the
+ * number of errors */
+static int proc_sampler_read_children(struct proc_sampler *sampler,
+				      struct tid_fd *tf, char *buf,
+				      size_t buf_len)
+{
+	/* -2: this kernel or thread has no children file */
+	if (tf->children_fd == -2) {
+		return 0;
+	}
+	if (tf->children_fd < 0) {
+		tf->children_fd = proc_sampler_open(sampler, tf->tid,
+						    "children");
+		if (tf->children_fd < 0) {
+			tf->children_fd = -2;
+			return 0;
+		}
+	}
+
+	ssize_t got = pread(tf->children_fd, buf, buf_len - 1, 0);
+	++sampler->syscalls;
+	if (got <= 0) {
+		return 0;
+	}
+	sampler->bytes_read += got;
+	buf[got] = '\0';
+
+	const char *p = buf;
+	while (*p) {
+		unsigned long pid = 0;
+		const char *next = stat_decode(p, &pid);
+		if (!next) {
+			++p;
+			continue;
+		}
+		if (longs_append(&sampler->children, &sampler->children_len,
+				 &sampler->children_capacity, (long)pid)) {
+			return 1;
+		}
+		p = next;
+	}
+	return 0;
+}
+
+/* re-read every thread into "states" and, if following children, the
+ * pids of the child processes into "children" */
+static int proc_sampler_read(struct proc_sampler *sampler)
+{
+	++sampler->polls;
+	sampler->states_len = 0;
+	sampler->children_len = 0;
+	if (proc_sampler_scan(sampler)
+	    || proc_sampler_reserve(sampler, sampler->found_len)) {
+		return -1;
+	}
+	proc_sampler_sync(sampler);
+
+	unsigned fields = 60;
+	const size_t buf_len = FILENAME_MAX + (fields * (sizeof(long) + 1));
+	char buf[buf_len];
+
+	int err = 0;
+	size_t kept = 0;
+	for (size_t i = 0; i < sampler->len; ++i) {
+		struct tid_fd *tf = &sampler->tids[i];
+		errno = 0;
+		ssize_t got = pread(tf->fd, buf, buf_len - 1, 0);
+		++sampler->syscalls;
+		if (got <= 0) {
+			/* ESRCH: the thread exited since the scan */
+			int log_level = (got < 0 && errno != ESRCH) ? 0 : 2;
+			Ylog(log_level, "pread tid %ld returned %ld\n", tf->tid,
+			     (long)got);
+			proc_sampler_close(sampler, tf);
+			continue;
+		}
+		sampler->bytes_read += got;
+		buf[got] = '\0';
+		Ylog(2, "stat: '%s'\n", buf);
+
+		struct thread_state *ts = &sampler->states[sampler->states_len];
+		uint64_t parse_start = monotonic_ns();
+		if (thread_state_from_stat(ts, buf) == 0) {
+			++sampler->states_len;
+		} else {
+			++err;
+		}
+		sampler->parse_ns += monotonic_ns() - parse_start;
+
+		if (sampler->follow_children) {
+			err += proc_sampler_read_children(sampler, tf, buf,
+							  buf_len);
+		}
+		sampler->tids[kept++] = *tf;
+	}
+	sampler->len = kept;
+
+	if (sampler->children_len > 1) {
+		qsort(sampler->children, sampler->children_len, sizeof(long),
+		      long_compare);
+	}
+
+	int log_level = err ? 0 : 1;
+	Ylog(log_level, "get_states for pid: %ld errors: %d\n", sampler->pid,
+	     err);
+
+	return 0;
+}
+
+/* the cost of each poll also goes to the poll_cost of the thread */
+static int proc_sampler_poll(struct proc_sampler *sampler)
+{
+	unsigned long syscalls = sampler->syscalls;
+	unsigned long bytes_read = sampler->bytes_read;
+	unsigned long long parse_ns = sampler->parse_ns;
+
+	int err = proc_sampler_read(sampler);
+
+	poll_cost.syscalls += sampler->syscalls - syscalls;
+	poll_cost.bytes_read += sampler->bytes_read - bytes_read;
+	poll_cost.parse_ns += sampler->parse_ns - parse_ns;
+	return err;
+}
+
+struct state_list *proc_sampler_sample(struct proc_sampler *sampler)
+{
+	if (proc_sampler_poll(sampler)) {
+		return NULL;
+	}
+
+	struct state_list *sl = state_list_new(sampler->states_len);
+	if (!sl) {
+		return NULL;
+	}
+	if (sl->len) {
+		memcpy(sl->states, sampler->states,
+		       sl->len * sizeof(struct thread_state));
+	}
+	return sl;
+}
+
+struct proc_tree *proc_tree_new(long pid, int descendants)
+{
+	size_t size = sizeof(struct proc_tree);
+	struct proc_tree *tree = Calloc_or_log(1, size);
+	if (!tree) {
+		return NULL;
+	}
+	memset(tree, 0x00, size);
+	tree->root_pid = pid;
+	tree->descendants = descendants;
+	tree->needs_rescan = 1;
+	return tree;
+}
+
+void proc_tree_free(struct proc_tree *tree)
+{
+	if (!tree) {
+		return;
+	}
+	for (size_t i = 0; i < tree->len; ++i) {
+		proc_sampler_free(tree->procs[i]);
+	}
+	yoyo_free(tree->procs);
+	yoyo_free(tree);
+}
+
+static struct proc_sampler *proc_tree_add(struct proc_tree *tree,
+					  struct proc_sampler *parent,
+					  long pid)
+{
+	if (tree->len == tree->capacity) {
+		size_t capacity = grow_capacity(tree->capacity, tree->len + 1);
+		size_t size = sizeof(struct proc_sampler *);
+		struct proc_sampler **procs = Calloc_or_log(capacity, size);
+		if (!procs) {
+			return NULL;
+		}
+		if (tree->len) {
+			memcpy(procs, tree->procs, tree->len * size);
+		}
+		yoyo_free(tree->procs);
+		tree->procs = procs;
+		tree->capacity = capacity;
+	}
+
+	struct proc_sampler *sampler = proc_sampler_new(pid);
+	if (!sampler) {
+		return NULL;
+	}
+	sampler->parent = parent;
+	sampler->follow_children = tree->descendants;
+	tree->procs[tree->len++] = sampler;
+	Ylog(1, "monitoring pid %ld (parent %ld)\n", pid,
+	     parent ? parent->pid : 0);
+	return sampler;
+}
+
+/* a process forked or reaped children since the previous poll: start
+ * sampling the new children and drop the subtrees of the departed */
+static int proc_tree_rescan(struct proc_tree *tree, struct proc_sampler *p)
+{
+	++tree->rescans;
+
+	size_t i = 0;
+	size_t j = 0;
+	while (i < p->known_children_len || j < p->children_len) {
+		long known = (i < p->known_children_len)
+		    ? p->known_children[i] : LONG_MAX;
+		long child = (j < p->children_len) ? p->children[j] : LONG_MAX;
+		if (known < child) {
+			for (size_t k = 0; k < tree->len; ++k) {
+				struct proc_sampler *s = tree->procs[k];
+				if (s->parent == p && s->pid == known) {
+					s->gone = 1;
+				}
+			}
+			++i;
+		} else if (child < known) {
+			if (!proc_tree_add(tree, p, child)) {
+				return -1;
+			}
+			++j;
+		} else {
+			++i;
+			++j;
+		}
+	}
+
+	long *swap = p->known_children;
+	p->known_children = p->children;
+	p->children = swap;
+	size_t swap_len = p->known_children_len;
+	p->known_children_len = p->children_len;
+	p->children_len = swap_len;
+	size_t swap_capacity = p->known_children_capacity;
+	p->known_children_capacity = p->children_capacity;
+	p->children_capacity = swap_capacity;
+	return 0;
+}
+
+static int children_changed(const struct proc_sampler *p)
+{
+	return p->children_len != p->known_children_len
+	    || (p->children_len
+		&& memcmp(p->children, p->known_children,
+			  p->children_len * sizeof(long)));
+}
+
+/* free the samplers of processes which have left the tree */
+static void proc_tree_prune(struct proc_tree *tree)
+{
+	size_t kept = 0;
+	for (size_t i = 0; i < tree->len; ++i) {
+		struct proc_sampler *s = tree->procs[i];
+		if (s->gone) {
+			Ylog(1, "no longer monitoring pid %ld\n", s->pid);
+			proc_sampler_free(s);
+		} else {
+			tree->procs[kept++] = s;
+		}
+	}
+	tree->len = kept;
+}
+
+struct state_list *proc_tree_sample(struct proc_tree *tree)
+{
+	if (!tree->len && !proc_tree_add(tree, NULL, tree->root_pid)) {
+		return NULL;
+	}
+
+	/* parents precede their children, so the loop also visits the
+	 * children which a rescan appends */
+	size_t total = 0;
+	for (size_t i = 0; i < tree->len; ++i) {
+		struct proc_sampler *p = tree->procs[i];
+		if (p->parent && p->parent->gone) {
+			p->gone = 1;
+		}
+		if (p->gone) {
+			continue;
+		}
+		/* with fork and exit events, children files are only read
+		 * to learn the initial tree, or after events were lost */
+		p->follow_children = tree->descendants
+		    && (!tree->events || tree->needs_rescan);
+		if (proc_sampler_poll(p)) {
+			return NULL;
+		}
+		if (p->follow_children && children_changed(p)
+		    && proc_tree_rescan(tree, p)) {
+			return NULL;
+		}
+		total += p->states_len;
+	}
+	tree->needs_rescan = 0;
+
+	struct state_list *sl = state_list_new(total);
+	if (!sl) {
+		return NULL;
+	}
+	size_t n = 0;
+	for (size_t i = 0; i < tree->len; ++i) {
+		struct proc_sampler *p = tree->procs[i];
+		if (!p->gone && p->states_len) {
+			memcpy(sl->states + n, p->states,
+			       p->states_len * sizeof(struct thread_state));
+			n += p->states_len;
+		}
+	}
+	proc_tree_prune(tree);
+
+	return sl;
+}
+
+static struct proc_sampler *proc_tree_find(struct proc_tree *tree, long pid)
+{
+	for (size_t i = 0; i < tree->len; ++i) {
+		if (tree->procs[i]->pid == pid && !tree->procs[i]->gone) {
+			return tree->procs[i];
+		}
+	}
+	return NULL;
+}
+
+/* keep known_children in step with changes learned from events */
+static int known_children_insert(struct proc_sampler *p, long pid)
+{
+	if (longs_reserve(&p->known_children, p->known_children_len,
+			  &p->known_children_capacity,
+			  p->known_children_len + 1)) {
+		return -1;
+	}
+	size_t i = p->known_children_len;
+	while (i && p->known_children[i - 1] > pid) {
+		p->known_children[i] = p->known_children[i - 1];
+		--i;
+	}
+	p->known_children[i] = pid;
+	++p->known_children_len;
+	return 0;
+}
+
+static void known_children_remove(struct proc_sampler *p, long pid)
+{
+	size_t kept = 0;
+	for (size_t i = 0; i < p->known_children_len; ++i) {
+		if (p->known_children[i] != pid) {
+			p->known_children[kept++] = p->known_children[i];
+		}
+	}
+	p->known_children_len = kept;
+}
+
+int proc_tree_forked(struct proc_tree *tree, long parent_tgid, long child_tgid)
+{
+	if (!tree->descendants || proc_tree_find(tree, child_tgid)) {
+		return 0;
+	}
+	struct proc_sampler *parent = proc_tree_find(tree, parent_tgid);
+	if (!parent) {
+		return 0;
+	}
+	if (!proc_tree_add(tree, parent, child_tgid)
+	    || known_children_insert(parent, child_tgid)) {
+		tree->needs_rescan = 1;
+		return -1;
+	}
+	return 1;
+}
+
+int proc_tree_exited(struct proc_tree *tree, long tgid)
+{
+	struct proc_sampler *p = proc_tree_find(tree, tgid);
+	if (!p || !p->parent) {
+		return 0;	/* the root is sampled until it is released */
+	}
+	p->gone = 1;
+	known_children_remove(p->parent, tgid);
+	return 1;
+}
+
+struct proc_connector *proc_connector_open(void)
+{
+	errno = 0;
+	int fd = socket(PF_NETLINK, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC,
+			NETLINK_CONNECTOR);
+	if (fd < 0) {
+		Ylog(1, "netlink connector socket not available\n");
+		return NULL;
+	}
+
+	/* a busy host forks often; try not to overrun between polls */
+	int rcvbuf = 4 * 1024 * 1024;
+	if (setsockopt(fd, SOL_SOCKET, SO_RCVBUFFORCE, &rcvbuf, sizeof(int))) {
+		setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(int));
+	}
+
+	struct sockaddr_nl addr;
+	memset(&addr, 0x00, sizeof(struct sockaddr_nl));
+	addr.nl_family = AF_NETLINK;
+	addr.nl_groups = CN_IDX_PROC;
+	addr.nl_pid = 0;
+
+	alignas(struct nlmsghdr) char buf[NLMSG_SPACE(sizeof(struct cn_msg) +
+						      sizeof(enum
+							     proc_cn_mcast_op))];
+	memset(buf, 0x00, sizeof(buf));
+	struct nlmsghdr *nl = (struct nlmsghdr *)buf;
+	struct cn_msg *cn = (struct cn_msg *)NLMSG_DATA(nl);
+	enum proc_cn_mcast_op op = PROC_CN_MCAST_LISTEN;
+	nl->nlmsg_len = NLMSG_LENGTH(sizeof(struct cn_msg) + sizeof(op));
+	nl->nlmsg_type = NLMSG_DONE;
+	nl->nlmsg_pid = getpid();
+	cn->id.idx = CN_IDX_PROC;
+	cn->id.val = CN_VAL_PROC;
+	cn->len = sizeof(op);
+	memcpy(cn->data, &op, sizeof(op));
+
+	errno = 0;
+	if (bind(fd, (struct sockaddr *)&addr, sizeof(struct sockaddr_nl))
+	    || send(fd, nl, nl->nlmsg_len, 0) < 0) {
+		/* EPERM: subscribing requires CAP_NET_ADMIN */
+		Ylog(1, "could not subscribe to the proc connector\n");
+		close(fd);
+		return NULL;
+	}
+
+	struct proc_connector *connector =
+	    Calloc_or_log(1, sizeof(struct proc_connector));
+	if (!connector) {
+		close(fd);
+		return NULL;
+	}
+	memset(connector, 0x00, sizeof(struct proc_connector));
+	connector->fd = fd;
+	Ylog(1, "subscribed to fork and exit events\n");
+	return connector;
+}
+
+void proc_connector_close(struct proc_connector *connector)
+{
+	if (connector) {
+		close(connector->fd);
+		yoyo_free(connector);
+	}
+}
+
+static void proc_connector_dispatch(struct proc_connector *connector,
+				    struct proc_tree *trees,
+				    const struct proc_event *ev)
+{
+	++connector->events;
+	for (struct proc_tree *tree = trees; tree; tree = tree->next) {
+		if (ev->what == PROC_EVENT_FORK) {
+			const struct fork_proc_event *f = &ev->event_data.fork;
+			/* new threads share the tgid; only follow processes */
+			if (f->child_pid == f->child_tgid) {
+				proc_tree_forked(tree, f->parent_tgid,
+						 f->child_tgid);
+			}
+		} else if (ev->what == PROC_EVENT_EXIT) {
+			const struct exit_proc_event *e = &ev->event_data.exit;
+			if (e->process_pid == e->process_tgid) {
+				proc_tree_exited(tree, e->process_tgid);
+			}
+		}
+	}
+}
+
+int proc_connector_drain(struct proc_connector *connector,
+			 struct proc_tree *trees)
+{
+	alignas(struct nlmsghdr) char buf[8192];
+	int lost = 0;
+	for (;;) {
+		errno = 0;
+		ssize_t len = recv(connector->fd, buf, sizeof(buf), 0);
+		if (len < 0 && errno == ENOBUFS) {
+			/* the socket overran: events were dropped */
+			++connector->overruns;
+			lost = 1;
+			continue;
+		}
+		if (len <= 0) {
+			break;
+		}
+		struct nlmsghdr *nl = (struct nlmsghdr *)buf;
+		for (; NLMSG_OK(nl, (size_t)len); nl = NLMSG_NEXT(nl, len)) {
+			if (nl->nlmsg_type == NLMSG_NOOP
+			    || nl->nlmsg_type == NLMSG_ERROR) {
+				continue;
+			}
+			struct cn_msg *cn = (struct cn_msg *)NLMSG_DATA(nl);
+			if (cn->id.idx != CN_IDX_PROC
+			    || cn->id.val != CN_VAL_PROC) {
+				continue;
+			}
+			proc_connector_dispatch(connector, trees,
+						(struct proc_event *)cn->data);
+		}
+	}
+
+	if (lost) {
+		Ylog(0, "proc connector overrun, rescanning /proc\n");
+		for (struct proc_tree *tree = trees; tree; tree = tree->next) {
+			tree->needs_rescan = 1;
+		}
+	}
+	return lost ? -1 : 0;
+}
+
+/* trees in use by get_states_proc, one per monitored pid */
+struct proc_tree *global_proc_trees = NULL;
+
+struct proc_connector *global_proc_connector = NULL;
+
+/* trees are added, removed, or changed by connector events only with the
+ * write lock held, so that sampler workers may each sample a tree */
+pthread_rwlock_t global_proc_trees_lock = PTHREAD_RWLOCK_INITIALIZER;
+
+struct state_list *get_states_proc(long pid)
+{
+	errno = 0;
+
+	pthread_rwlock_wrlock(&global_proc_trees_lock);
+	struct proc_tree *tree = global_proc_trees;
+	while (tree && tree->root_pid != pid) {
+		tree = tree->next;
+	}
+	if (!tree) {
+		tree = proc_tree_new(pid, monitor_descendants);
+		Die_if_null(tree);
+		tree->next = global_proc_trees;
+		global_proc_trees = tree;
+	}
+
+	if (use_proc_connector && monitor_descendants
+	    && !global_proc_connector) {
+		global_proc_connector = proc_connector_open();
+		if (!global_proc_connector) {
+			Ylog(0, "proc connector unavailable, scanning /proc\n");
+			use_proc_connector = 0;
+		}
+	}
+	if (global_proc_connector) {
+		tree->events = 1;
+		proc_connector_drain(global_proc_connector, global_proc_trees);
+	}
+	pthread_rwlock_unlock(&global_proc_trees_lock);
+
+	pthread_rwlock_rdlock(&global_proc_trees_lock);
+	struct state_list *sl = proc_tree_sample(tree);
+	pthread_rwlock_unlock(&global_proc_trees_lock);
+	Die_if_null(sl);
+
+	return sl;
+}
+
+void get_states_proc_release(long pid)
+{
+	pthread_rwlock_wrlock(&global_proc_trees_lock);
+	struct proc_tree **link = &global_proc_trees;
+	while (*link) {
+		struct proc_tree *tree = *link;
+		if (tree->root_pid == pid) {
+			*link = tree->next;
+			proc_tree_free(tree);
+			break;
+		}
+		link = &tree->next;
+	}
+	if (!global_proc_trees) {
+		proc_connector_close(global_proc_connector);
+		global_proc_connector = NULL;
+	}
+	pthread_rwlock_unlock(&global_proc_trees_lock);
+}
+
+static void sampler_task_run(struct sampler_task *task)
+{
+	memset(&poll_cost, 0x00, sizeof(struct poll_cost));
+	uint64_t start = monotonic_ns();
+	task->states = get_states(task->pid);
+	poll_cost.sample_ns = monotonic_ns() - start;
+	poll_cost.threads = task->states ? task->states->len : 0;
+	task->cost = poll_cost;
+}
+
+static void sampler_pool_stop(struct sampler_pool *pool, unsigned started)
+{
+	pthread_mutex_lock(&pool->lock);
+	pool->stopping = 1;
+	pthread_cond_broadcast(&pool->start);
+	pthread_mutex_unlock(&pool->lock);
+	for (unsigned i = 1; i <= started; ++i) {
+		pthread_join(pool->threads[i], NULL);
+	}
+}
+
+static int shard_take(struct sampler_shard *shard, int from_end, size_t *i)
+{
+	pthread_mutex_lock(&shard->lock);
+	int took = (shard->next < shard->end);
+	if (took) {
+		*i = from_end ? --shard->end : shard->next++;
+	}
+	pthread_mutex_unlock(&shard->lock);
+	return took;
+}
+
+/* steal from the end of the shard with the most tasks left, which is
+ * most likely the one stuck behind a large process */
+static int sampler_pool_steal(struct sampler_pool *pool, unsigned self,
+			      size_t *i)
+{
+	for (;;) {
+		struct sampler_shard *victim = NULL;
+		size_t most = 0;
+		for (unsigned w = 0; w < pool->workers; ++w) {
+			struct sampler_shard *shard = &pool->shards[w];
+			pthread_mutex_lock(&shard->lock);
+			size_t left = shard->end - shard->next;
+			pthread_mutex_unlock(&shard->lock);
+			if (w != self && left > most) {
+				most = left;
+				victim = shard;
+			}
+		}
+		if (!victim) {
+			return 0;
+		}
+		if (shard_take(victim, 1, i)) {
+			++pool->shards[self].stolen;
+			return 1;
+		}
+	}
+}
+
+static void sampler_pool_work(struct sampler_pool *pool, unsigned self)
+{
+	struct sampler_shard *shard = &pool->shards[self];
+	size_t i = 0;
+	while (shard_take(shard, 0, &i)
+	       || sampler_pool_steal(pool, self, &i)) {
+		sampler_task_run(&pool->tasks[i]);
+		++shard->sampled;
+	}
+}
+
+struct sampler_worker {
+	struct sampler_pool *pool;
+	unsigned self;
+};
+
+static void *sampler_pool_thread(void *arg)
+{
+	struct sampler_pool *pool = ((struct sampler_worker *)arg)->pool;
+	unsigned self = ((struct sampler_worker *)arg)->self;
+	yoyo_free(arg);
+
+	unsigned long seen = 0;
+	pthread_mutex_lock(&pool->lock);
+	for (;;) {
+		while (!pool->stopping && pool->passes == seen) {
+			pthread_cond_wait(&pool->start, &pool->lock);
+		}
+		if (pool->stopping) {
+			break;
+		}
+		seen = pool->passes;
+		pthread_mutex_unlock(&pool->lock);
+
+		sampler_pool_work(pool, self);
+
+		pthread_mutex_lock(&pool->lock);
+		if (--pool->busy == 0) {
+			pthread_cond_signal(&pool->done);
+		}
+	}
+	pthread_mutex_unlock(&pool->lock);
+	return NULL;
+}
+
+struct sampler_pool *sampler_pool_new(unsigned workers)
+{
+	workers = workers ? workers : 1;
+	struct sampler_pool *pool =
+	    Calloc_or_log(1, sizeof(struct sampler_pool));
+	if (!pool) {
+		return NULL;
+	}
+	memset(pool, 0x00, sizeof(struct sampler_pool));
+	pool->threads = Calloc_or_log(workers, sizeof(pthread_t));
+	pool->shards = Calloc_or_log(workers, sizeof(struct sampler_shard));
+	if (!pool->threads || !pool->shards) {
+		yoyo_free(pool->threads);
+		yoyo_free(pool->shards);
+		yoyo_free(pool);
+		return NULL;
+	}
+	memset(pool->shards, 0x00, workers * sizeof(struct sampler_shard));
+	pthread_mutex_init(&pool->lock, NULL);
+	pthread_cond_init(&pool->start, NULL);
+	pthread_cond_init(&pool->done, NULL);
+
+	/* worker 0 is whichever thread calls sampler_pool_run */
+	pool->workers = 1;
+	for (unsigned w = 1; w < workers; ++w) {
+		struct sampler_worker *worker =
+		    Calloc_or_log(1, sizeof(struct sampler_worker));
+		if (!worker) {
+			break;
+		}
+		worker->pool = pool;
+		worker->self = w;
+		int err = pthread_create(&pool->threads[w], NULL,
+					 sampler_pool_thread, worker);
+		if (err) {
+			Ylog(0, "pthread_create returned %d\n", err);
+			yoyo_free(worker);
+			break;
+		}
+		++pool->workers;
+	}
+	for (unsigned w = 0; w < pool->workers; ++w) {
+		pthread_mutex_init(&pool->shards[w].lock, NULL);
+	}
+	Ylog(1, "sampler workers: %u\n", pool->workers);
+	return pool;
+}
+
+void sampler_pool_free(struct sampler_pool *pool)
+{
+	if (!pool) {
+		return;
+	}
+	sampler_pool_stop(pool, pool->workers - 1);
+	for (unsigned w = 0; w < pool->workers; ++w) {
+		pthread_mutex_destroy(&pool->shards[w].lock);
+	}
+	pthread_cond_destroy(&pool->done);
+	pthread_cond_destroy(&pool->start);
+	pthread_mutex_destroy(&pool->lock);
+	yoyo_free(pool->shards);
+	yoyo_free(pool->threads);
+	yoyo_free(pool);
+}
+
+void sampler_pool_run(struct sampler_pool *pool, struct sampler_task *tasks,
+		      size_t len)
+{
+	if (!pool || pool->workers < 2 || len < 2) {
+		for (size_t i = 0; i < len; ++i) {
+			sampler_task_run(&tasks[i]);
+		}
+		if (pool) {
+			pool->shards[0].sampled += len;
+		}
+		return;
+	}
+
+	/* contiguous shards of near equal length; the threads are idle, so
+	 * the shards may be set up without taking their locks */
+	unsigned workers = pool->workers;
+	for (unsigned w = 0; w < workers; ++w) {
+		pool->shards[w].next = (len * w) / workers;
+		pool->shards[w].end = (len * (w + 1)) / workers;
+	}
+
+	pthread_mutex_lock(&pool->lock);
+	pool->tasks = tasks;
+	pool->busy = workers - 1;
+	++pool->passes;
+	pthread_cond_broadcast(&pool->start);
+	pthread_mutex_unlock(&pool->lock);
+
+	sampler_pool_work(pool, 0);
+
+	pthread_mutex_lock(&pool->lock);
+	while (pool->busy) {
+		pthread_cond_wait(&pool->done, &pool->lock);
+	}
+	pool->tasks = NULL;
+	pthread_mutex_unlock(&pool->lock);
+}
+
+struct snapshot_ring *snapshot_ring_open(const char *path, unsigned slots,
+					 unsigned max_threads)
+{
+	size_t header_size = sizeof(struct yoyo_ring_header);
+	size_t slot_size = sizeof(struct yoyo_ring_slot)
+	    + (((size_t)max_threads) * sizeof(struct yoyo_ring_thread));
+	/* slots do not share cache lines */
+	slot_size = (slot_size + 63) & ~((size_t)63);
+	slots = slots ? slots : 1;
+
+	struct snapshot_ring *ring =
+	    Calloc_or_log(1, sizeof(struct snapshot_ring));
+	if (!ring) {
+		return NULL;
+	}
+	memset(ring, 0x00, sizeof(struct snapshot_ring));
+	ring->size = header_size + (((size_t)slots) * slot_size);
+
+	/* set up under a temporary name, then renamed into place, so that
+	 * a reader never maps a ring which is partly set up */
+	char tmp[FILENAME_MAX];
+	snprintf(tmp, sizeof(tmp), "%s.XXXXXX", path);
+	errno = 0;
+	int fd = mkstemp(tmp);
+	void *addr = MAP_FAILED;
+	if (fd >= 0 && ftruncate(fd, (off_t)ring->size) == 0) {
+		addr = mmap(NULL, ring->size, PROT_READ | PROT_WRITE,
+			    MAP_SHARED, fd, 0);
+	}
+	if (addr == MAP_FAILED) {
+		Ylog(0, "can not create snapshot ring '%s'\n", tmp);
+		if (fd >= 0) {
+			unlink(tmp);
+			close(fd);
+		}
+		yoyo_free(ring);
+		return NULL;
+	}
+	close(fd);
+
+	struct yoyo_ring_header *header = addr;
+	header->magic = YOYO_RING_MAGIC;
+	header->version = YOYO_RING_VERSION;
+	header->header_size = header_size;
+	header->slot_size = slot_size;
+	header->slot_count = slots;
+	header->max_threads = max_threads;
+	header->thread_size = sizeof(struct yoyo_ring_thread);
+	header->writer_pid = (uint32_t)getpid();
+	ring->header = header;
+
+	if (rename(tmp, path)) {
+		Ylog(0, "rename(%s, %s) failed\n", tmp, path);
+		unlink(tmp);
+		snapshot_ring_close(ring);
+		return NULL;
+	}
+	Ylog(1, "snapshot ring: %s (%u slots of %zu bytes)\n", path, slots,
+	     slot_size);
+	return ring;
+}
+
+void snapshot_ring_close(struct snapshot_ring *ring)
+{
+	if (!ring) {
+		return;
+	}
+	munmap(ring->header, ring->size);
+	yoyo_free(ring);
+}
+
+void snapshot_ring_publish(struct snapshot_ring *ring, unsigned job,
+			   long pid, unsigned hang_count, unsigned max_hangs,
+			   const struct state_list *sl)
+{
+	if (!ring) {
+		return;
+	}
+
+	/* the only writer, so head needs no atomic read */
+	struct yoyo_ring_header *header = ring->header;
+	uint64_t number = header->head;
+	struct yoyo_ring_slot *slot =
+	    (struct yoyo_ring_slot *)yoyo_ring_slot(header, number);
+
+	uint64_t seq = slot->seq;
+	__atomic_store_n(&slot->seq, seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+
+	slot->number = number;
+	slot->timestamp_ns = monotonic_ns();
+	slot->pid = pid;
+	slot->job = job;
+	slot->hang_count = hang_count;
+	slot->max_hangs = max_hangs;
+	slot->len = sl ? sl->len : 0;
+	size_t len = (slot->len < header->max_threads) ? slot->len
+	    : header->max_threads;
+	ring->truncated += (len < slot->len) ? 1 : 0;
+	for (size_t i = 0; i < len; ++i) {
+		const struct thread_state *ts = &sl->states[i];
+		struct yoyo_ring_thread *t = &slot->threads[i];
+		memset(t, 0x00, sizeof(struct yoyo_ring_thread));
+		t->tid = ts->pid;
+		t->utime = ts->utime;
+		t->stime = ts->stime;
+		t->minflt = ts->minflt;
+		t->majflt = ts->majflt;
+		t->delayacct_blkio_ticks = ts->delayacct_blkio_ticks;
+		t->processor = ts->processor;
+		t->state = ts->state;
+	}
+
+	__atomic_store_n(&slot->seq, seq + 2, __ATOMIC_RELEASE);
+	__atomic_store_n(&header->head, number + 1, __ATOMIC_RELEASE);
+}
+
+/*
+ * A trace file is an 8 byte header, "yoyotrc" and a version byte, then
+ * records, each starting with a tag byte:
+ *
+ *	'R' a yoyo opened the trace: varint CLOCK_REALTIME ns; what follows
+ *	    is encoded afresh, as if no snapshot came before
+ *	'S' a snapshot: varint job, pid, ns since the previous snapshot
+ *	    (CLOCK_MONOTONIC), interval_ms and thread count, then for each
+ *	    thread in tid order: varint tid delta, state byte, a byte with a
+ *	    bit per field of trace_fields which differs from that of the
+ *	    same tid in the job's previous snapshot, and for each such bit
+ *	    the zig-zag varint of the difference
+ *
+ * Varints are unsigned LEB128. A thread which did not change takes four
+ * bytes or so, a few percent of its /proc stat line.
+ */
+static const unsigned char trace_magic[8] = "yoyotrc\001";
+
+#define Trace_fields 8
+
+static void trace_fields(const struct thread_state *ts,
+			 uint64_t fields[Trace_fields])
+{
+	fields[0] = ts->utime;
+	fields[1] = ts->stime;
+	fields[2] = ts->minflt;
+	fields[3] = ts->majflt;
+	fields[4] = (uint64_t)ts->num_threads;
+	fields[5] = ts->starttime;
+	fields[6] = (uint64_t)ts->processor;
+	fields[7] = ts->delayacct_blkio_ticks;
+}
+
+static void trace_set_fields(struct thread_state *ts,
+			     const uint64_t fields[Trace_fields])
+{
+	ts->utime = fields[0];
+	ts->stime = fields[1];
+	ts->minflt = fields[2];
+	ts->majflt = fields[3];
+	ts->num_threads = (long)fields[4];
+	ts->starttime = fields[5];
+	ts->processor = (int)fields[6];
+	ts->delayacct_blkio_ticks = fields[7];
+}
+
+static size_t varint_put(unsigned char *p, uint64_t val)
+{
+	size_t len = 0;
+	while (val >= 0x80) {
+		p[len++] = (unsigned char)(val | 0x80);
+		val >>= 7;
+	}
+	p[len++] = (unsigned char)val;
+	return len;
+}
+
+static uint64_t zigzag(uint64_t delta)
+{
+	return (delta << 1) ^ (uint64_t)(((int64_t)delta) >> 63);
+}
+
+static uint64_t unzigzag(uint64_t val)
+{
+	return (val >> 1) ^ (~(val & 1) + 1);
+}
+
+/* the thread of the same tid in a sorted list, searched from *k on */
+static const struct thread_state *trace_base(const struct state_list *l,
+					     size_t *k, long tid)
+{
+	while (l && *k < l->len && l->states[*k].pid < tid) {
+		++*k;
+	}
+	if (l && *k < l->len && l->states[*k].pid == tid) {
+		return &l->states[*k];
+	}
+	return NULL;
+}
+
+/* grow a per-job array of previous snapshots to include job */
+static int trace_jobs_reserve(struct state_list ***previous, size_t *jobs,
+			      unsigned job)
+{
+	if (job < *jobs) {
+		return 0;
+	}
+	size_t len = grow_capacity(*jobs, ((size_t)job) + 1);
+	struct state_list **grown =
+	    Calloc_or_log(len, sizeof(struct state_list *));
+	if (!grown) {
+		return -1;
+	}
+	for (size_t i = 0; i < *jobs; ++i) {
+		grown[i] = (*previous)[i];
+	}
+	yoyo_free(*previous);
+	*previous = grown;
+	*jobs = len;
+	return 0;
+}
+
+static void trace_jobs_free(struct state_list **previous, size_t jobs)
+{
+	for (size_t i = 0; i < jobs; ++i) {
+		state_list_free(previous[i]);
+	}
+	yoyo_free(previous);
+}
+
+static int trace_write(int fd, const unsigned char *buf, size_t len)
+{
+	while (len) {
+		ssize_t wrote = write(fd, buf, len);
+		if (wrote < 0 && errno == EINTR) {
+			continue;
+		} else if (wrote <= 0) {
+			return -1;
+		}
+		buf += wrote;
+		len -= (size_t)wrote;
+	}
+	return 0;
+}
+
+struct trace_writer *trace_writer_open(const char *path)
+{
+	struct trace_writer *writer =
+	    Calloc_or_log(1, sizeof(struct trace_writer));
+	if (!writer) {
+		return NULL;
+	}
+	memset(writer, 0x00, sizeof(struct trace_writer));
+
+	errno = 0;
+	writer->fd = open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC,
+			  0644);
+	struct stat st;
+	if (writer->fd < 0 || fstat(writer->fd, &st)) {
+		Ylog(0, "can not open trace '%s'\n", path);
+		trace_writer_close(writer);
+		return NULL;
+	}
+
+	struct timespec now;
+	clock_gettime(CLOCK_REALTIME, &now);
+	uint64_t realtime_ns = (((uint64_t)now.tv_sec) * 1000000000)
+	    + now.tv_nsec;
+	unsigned char start[sizeof(trace_magic) + 1 + 10];
+	size_t len = 0;
+	if (st.st_size == 0) {
+		memcpy(start, trace_magic, sizeof(trace_magic));
+		len = sizeof(trace_magic);
+	}
+	start[len++] = 'R';
+	len += varint_put(start + len, realtime_ns);
+	if (trace_write(writer->fd, start, len)) {
+		Ylog(0, "can not write trace '%s'\n", path);
+		trace_writer_close(writer);
+		return NULL;
+	}
+	writer->bytes = len;
+	Ylog(1, "trace: %s\n", path);
+	return writer;
+}
+
+void trace_writer_close(struct trace_writer *writer)
+{
+	if (!writer) {
+		return;
+	}
+	if (writer->fd >= 0) {
+		close(writer->fd);
+	}
+	trace_jobs_free(writer->previous, writer->jobs);
+	yoyo_free(writer->buf);
+	yoyo_free(writer);
+}
+
+int trace_writer_append(struct trace_writer *writer, unsigned job, long pid,
+			uint64_t timestamp_ns, unsigned interval_ms,
+			const struct state_list *sl)
+{
+	if (!writer) {
+		return 0;
+	}
+	size_t len = sl ? sl->len : 0;
+	struct state_list *current = state_list_new(len);
+	if (!current || trace_jobs_reserve(&writer->previous, &writer->jobs,
+					   job)) {
+		state_list_free(current);
+		return -1;
+	}
+	if (len) {
+		memcpy(current->states, sl->states,
+		       len * sizeof(struct thread_state));
+	}
+	state_list_sort(current);
+
+	/* a varint is at most 10 bytes */
+	size_t needed = 1 + (5 * 10) + (len * (10 + 2 + (Trace_fields * 10)));
+	if (needed > writer->buf_capacity) {
+		size_t capacity = grow_capacity(writer->buf_capacity, needed);
+		unsigned char *buf = Calloc_or_log(capacity, 1);
+		if (!buf) {
+			state_list_free(current);
+			return -1;
+		}
+		yoyo_free(writer->buf);
+		writer->buf = buf;
+		writer->buf_capacity = capacity;
+	}
+
+	unsigned char *p = writer->buf;
+	*p++ = 'S';
+	p += varint_put(p, job);
+	p += varint_put(p, (uint64_t)pid);
+	p += varint_put(p, timestamp_ns - writer->last_ns);
+	p += varint_put(p, interval_ms);
+	p += varint_put(p, len);
+
+	const struct state_list *previous = writer->previous[job];
+	size_t k = 0;
+	long last_tid = 0;
+	for (size_t i = 0; i < len; ++i) {
+		const struct thread_state *ts = &current->states[i];
+		const struct thread_state *base =
+		    trace_base(previous, &k, ts->pid);
+		uint64_t fields[Trace_fields];
+		uint64_t bases[Trace_fields];
+		trace_fields(ts, fields);
+		memset(bases, 0x00, sizeof(bases));
+		if (base) {
+			trace_fields(base, bases);
+		}
+
+		p += varint_put(p, (uint64_t)(ts->pid - last_tid));
+		last_tid = ts->pid;
+		*p++ = (unsigned char)ts->state;
+		unsigned char *mask = p++;
+		*mask = 0;
+		for (size_t f = 0; f < Trace_fields; ++f) {
+			if (fields[f] != bases[f]) {
+				*mask |= (unsigned char)(1U << f);
+				p += varint_put(p, zigzag(fields[f] - bases[f]));
+			}
+		}
+	}
+
+	size_t size = (size_t)(p - writer->buf);
+	if (trace_write(writer->fd, writer->buf, size)) {
+		Ylog(0, "can not write trace record of %zu bytes\n", size);
+		state_list_free(current);
+		return -1;
+	}
+	state_list_free(writer->previous[job]);
+	writer->previous[job] = current;
+	writer->last_ns = timestamp_ns;
+	++writer->records;
+	writer->bytes += size;
+	return 0;
+}
+
+struct trace_reader *trace_reader_open(const char *path)
+{
+	errno = 0;
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	struct stat st;
+	if (fd < 0 || fstat(fd, &st)) {
+		Ylog(0, "can not read trace '%s'\n", path);
+		if (fd >= 0) {
+			close(fd);
+		}
+		return NULL;
+	}
+
+	size_t size = (size_t)st.st_size;
+	void *addr = MAP_FAILED;
+	if (size >= sizeof(trace_magic)) {
+		addr = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	}
+	close(fd);
+	if (addr == MAP_FAILED
+	    || memcmp(addr, trace_magic, sizeof(trace_magic))) {
+		Ylog(0, "'%s' is not a yoyo trace\n", path);
+		if (addr != MAP_FAILED) {
+			munmap(addr, size);
+		}
+		return NULL;
+	}
+	madvise(addr, size, MADV_SEQUENTIAL);
+
+	struct trace_reader *reader =
+	    Calloc_or_log(1, sizeof(struct trace_reader));
+	if (!reader) {
+		munmap(addr, size);
+		return NULL;
+	}
+	memset(reader, 0x00, sizeof(struct trace_reader));
+	reader->data = addr;
+	reader->size = size;
+	reader->pos = sizeof(trace_magic);
+	return reader;
+}
+
+void trace_reader_close(struct trace_reader *reader)
+{
+	if (!reader) {
+		return;
+	}
+	munmap((void *)reader->data, reader->size);
+	trace_jobs_free(reader->previous, reader->jobs);
+	yoyo_free(reader);
+}
+
+static int trace_get(struct trace_reader *reader, uint64_t *val)
+{
+	uint64_t v = 0;
+	for (unsigned shift = 0; shift < 64; shift += 7) {
+		if (reader->pos == reader->size) {
+			return -1;
+		}
+		unsigned char byte = reader->data[reader->pos++];
+		v |= ((uint64_t)(byte & 0x7F)) << shift;
+		if (!(byte & 0x80)) {
+			*val = v;
+			return 0;
+		}
+	}
+	return -1;
+}
+
+static int trace_get_byte(struct trace_reader *reader, unsigned char *byte)
+{
+	if (reader->pos == reader->size) {
+		return -1;
+	}
+	*byte = reader->data[reader->pos++];
+	return 0;
+}
+
+static int trace_reader_snapshot(struct trace_reader *reader)
+{
+	uint64_t job, pid, delta_ns, interval_ms, len;
+	if (trace_get(reader, &job) || trace_get(reader, &pid)
+	    || trace_get(reader, &delta_ns) || trace_get(reader, &interval_ms)
+	    || trace_get(reader, &len) || job > UINT_MAX
+	    || len > (reader->size - reader->pos) / 3) {
+		return -1;
+	}
+	if (trace_jobs_reserve(&reader->previous, &reader->jobs, job)) {
+		return -1;
+	}
+	struct state_list *current = state_list_new(len);
+	if (!current) {
+		return -1;
+	}
+
+	const struct state_list *previous = reader->previous[job];
+	size_t k = 0;
+	uint64_t tid = 0;
+	for (size_t i = 0; i < len; ++i) {
+		struct thread_state *ts = &current->states[i];
+		uint64_t tid_delta = 0;
+		unsigned char state = 0;
+		unsigned char mask = 0;
+		if (trace_get(reader, &tid_delta)
+		    || trace_get_byte(reader, &state)
+		    || trace_get_byte(reader, &mask)) {
+			state_list_free(current);
+			return -1;
+		}
+		tid += tid_delta;
+		ts->pid = (long)tid;
+		ts->state = (char)state;
+		const struct thread_state *base =
+		    trace_base(previous, &k, ts->pid);
+		uint64_t fields[Trace_fields];
+		memset(fields, 0x00, sizeof(fields));
+		if (base) {
+			trace_fields(base, fields);
+		}
+		for (size_t f = 0; f < Trace_fields; ++f) {
+			uint64_t delta = 0;
+			if (!(mask & (1U << f))) {
+				continue;
+			}
+			if (trace_get(reader, &delta)) {
+				state_list_free(current);
+				return -1;
+			}
+			fields[f] += unzigzag(delta);
+		}
+		trace_set_fields(ts, fields);
+	}
+
+	state_list_free(reader->previous[job]);
+	reader->previous[job] = current;
+	reader->last_ns += delta_ns;
+	reader->job = (unsigned)job;
+	reader->pid = (long)pid;
+	reader->timestamp_ns = reader->last_ns;
+	reader->interval_ms = (interval_ms < UINT_MAX) ? interval_ms : UINT_MAX;
+	reader->states = current;
+	return 1;
+}
+
+int trace_reader_next(struct trace_reader *reader)
+{
+	unsigned char tag = 0;
+	while (!trace_get_byte(reader, &tag)) {
+		if (tag == 'S') {
+			return trace_reader_snapshot(reader);
+		} else if (tag != 'R') {
+			return -1;
+		}
+		/* another yoyo appended to the trace */
+		if (trace_get(reader, &reader->session_ns)) {
+			return -1;
+		}
+		trace_jobs_free(reader->previous, reader->jobs);
+		reader->previous = NULL;
+		reader->jobs = 0;
+		reader->last_ns = 0;
+		++reader->sessions;
+	}
+	reader->states = NULL;
+	return 0;
+}
+
+/* what yoyo-replay has seen of a job */
+struct replay_job {
+	long pid;
+	void *state;
+	unsigned hang_count;
+	unsigned long attempts;
+	unsigned long samples;
+	unsigned long idle_samples;
+	unsigned long hangs;
+};
+
+long yoyo_replay_trace(const char *path, const struct hang_policy *policy,
+		       const struct hang_policy_config *config,
+		       unsigned max_hangs, FILE *out)
+{
+	struct trace_reader *reader = trace_reader_open(path);
+	if (!reader) {
+		return -1;
+	}
+
+	struct replay_job *jobs = NULL;
+	size_t jobs_len = 0;
+	uint64_t first_ns = 0;
+	unsigned long snapshots = 0;
+	long hangs = 0;
+	int more = 0;
+	while ((more = trace_reader_next(reader)) > 0) {
+		if (reader->job >= jobs_len) {
+			size_t len = grow_capacity(jobs_len, reader->job + 1);
+			struct replay_job *grown =
+			    Calloc_or_log(len, sizeof(struct replay_job));
+			if (!grown) {
+				more = -1;
+				break;
+			}
+			memset(grown, 0x00, len * sizeof(struct replay_job));
+			for (size_t i = 0; i < jobs_len; ++i) {
+				grown[i] = jobs[i];
+			}
+			yoyo_free(jobs);
+			jobs = grown;
+			jobs_len = len;
+		}
+		first_ns = snapshots++ ? first_ns : reader->timestamp_ns;
+
+		/* the policy may reorder or keep it, as it may in yoyo */
+		const struct state_list *sl = reader->states;
+		struct state_list *current = state_list_new(sl->len);
+		if (!current) {
+			more = -1;
+			break;
+		}
+		memcpy(current->states, sl->states,
+		       sl->len * sizeof(struct thread_state));
+
+		struct replay_job *job = &jobs[reader->job];
+		if (job->pid != reader->pid || !job->state) {
+			/* a new attempt, or one restarted after a hang */
+			policy->free(job->state);
+			job->state = policy->init(config);
+			job->hang_count = 0;
+			job->attempts += (job->pid != reader->pid) ? 1 : 0;
+			job->pid = reader->pid;
+		}
+		if (!job->state) {
+			state_list_free(current);
+			more = -1;
+			break;
+		}
+		policy->observe(job->state, &current, reader->interval_ms);
+		int idle = policy->verdict(job->state);
+		state_list_free(current);
+		++job->samples;
+		job->idle_samples += idle ? 1 : 0;
+		job->hang_count = idle ? job->hang_count + 1 : 0;
+		if (job->hang_count > max_hangs) {
+			/* yoyo would kill it here; carry on as if it had been
+			 * restarted, whatever the recording yoyo did */
+			double at = (reader->timestamp_ns - first_ns) / 1e9;
+			fprintf(out, "job %u: pid %ld hung at %.3fs\n",
+				reader->job, reader->pid, at);
+			++job->hangs;
+			++hangs;
+			policy->free(job->state);
+			job->state = NULL;
+		}
+	}
+
+	for (size_t i = 0; i < jobs_len; ++i) {
+		struct replay_job *job = &jobs[i];
+		if (job->samples) {
+			fprintf(out, "job %zu: %lu attempt(s), %lu samples,"
+				" %lu idle, %lu hang(s)\n", i, job->attempts,
+				job->samples, job->idle_samples, job->hangs);
+		}
+		policy->free(job->state);
+	}
+	yoyo_free(jobs);
+	if (more < 0) {
+		Ylog(0, "%s: failed after %lu snapshot(s)\n", path, snapshots);
+	}
+	trace_reader_close(reader);
+	return (more < 0) ? -1 : hangs;
+}
+
+static int replay_usage(FILE *out)
+{
+	fprintf(out, "yoyo-replay runs the hang check of yoyo over the ");
+	fprintf(out, "snapshots of trace files\n");
+	fprintf(out, "recorded with YOYO_TRACE, as fast as they can be ");
+	fprintf(out, "read.\n");
+	fprintf(out, "\n");
+	fprintf(out, "Usage: yoyo-replay [options] trace...\n");
+	fprintf(out, "  --max-hangs n              ");
+	fprintf(out, "idle checks before a hang (YOYO_MAX_HANGS)\n");
+	fprintf(out, "  --max-tick-delta n         ");
+	fprintf(out, "ticks per thread per %ds still idle\n",
+		default_hang_check_interval_ms / 1000);
+	fprintf(out, "  --max-thread-churn n       ");
+	fprintf(out, "(YOYO_MAX_THREAD_CHURN)\n");
+	fprintf(out, "  --policy name[:args]       ");
+	fprintf(out, "hang policy (YOYO_HANG_POLICY)\n");
+	fprintf(out, "  --help                     ");
+	fprintf(out, "print this message and exit\n");
+	return 0;
+}
+
+int yoyo_replay(int argc, char **argv)
+{
+	yoyo_verbose = yoyo_env_default(yoyo_verbose, "YOYO_VERBOSE");
+	struct hang_thresholds thresholds = hang_thresholds;
+	thresholds.max_thread_churn =
+	    yoyo_env_default(thresholds.max_thread_churn,
+			     "YOYO_MAX_THREAD_CHURN");
+	int env_max_hangs = yoyo_env_default(default_max_retries,
+					     "YOYO_MAX_HANGS");
+	unsigned max_hangs = env_max_hangs > 0 ? env_max_hangs : 0;
+	const char *policy_spec = getenv("YOYO_HANG_POLICY");
+	policy_spec = (policy_spec && *policy_spec) ? policy_spec : "default";
+
+	int i = 1;
+	for (; i < argc && strncmp(argv[i], "--", 2) == 0; ++i) {
+		if (strcmp(argv[i], "--help") == 0) {
+			replay_usage(Ystdout);
+			return EXIT_SUCCESS;
+		} else if (strcmp(argv[i], "--policy") == 0 && i + 1 < argc) {
+			policy_spec = argv[++i];
+			continue;
+		}
+		char *end = NULL;
+		const char *val = (i + 1 < argc) ? argv[i + 1] : "";
+		errno = 0;
+		unsigned long ul = strtoul(val, &end, 10);
+		if (end == val || *end || errno || val[0] == '-') {
+			Ylog(0, "%s '%s' is not a number\n", argv[i], val);
+			return EXIT_FAILURE;
+		}
+		if (strcmp(argv[i], "--max-hangs") == 0 && ul <= UINT_MAX) {
+			max_hangs = (unsigned)ul;
+		} else if (strcmp(argv[i], "--max-tick-delta") == 0) {
+			thresholds.max_tick_delta = ul;
+		} else if (strcmp(argv[i], "--max-thread-churn") == 0) {
+			thresholds.max_thread_churn = ul;
+		} else {
+			replay_usage(Ystderr);
+			return EXIT_FAILURE;
+		}
+		++i;
+	}
+	if (i == argc) {
+		replay_usage(Ystderr);
+		return EXIT_FAILURE;
+	}
+
+	struct hang_policy_config config = {
+		.thresholds = thresholds,
+		.release = state_list_free,
+	};
+	const struct hang_policy *policy =
+	    hang_policy_find(policy_spec, &config.args);
+	if (!policy) {
+		return EXIT_FAILURE;
+	}
+
+	int failed = 0;
+	for (; i < argc; ++i) {
+		fprintf(Ystdout, "%s:\n", argv[i]);
+		long hangs = yoyo_replay_trace(argv[i], policy, &config,
+					       max_hangs, Ystdout);
+		failed += (hangs < 0) ? 1 : 0;
+	}
+	return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+/* upper bounds of the sample time histogram buckets, the last being
+ * +Inf */
+static const unsigned long long sample_bucket_ns[YOYO_SAMPLE_BUCKETS] = {
+	100 * 1000, 250 * 1000, 500 * 1000,
+	1000 * 1000, 2500 * 1000, 5000 * 1000,
+	10 * 1000 * 1000, 25 * 1000 * 1000, 50 * 1000 * 1000,
+	100 * 1000 * 1000, 250 * 1000 * 1000, 1000 * 1000 * 1000,
+};
+
+int yoyo_stats_reset(size_t len)
+{
+	for (size_t i = 0; i < global_stats.len; ++i) {
+		yoyo_free(global_stats.jobs[i].name);
+	}
+	yoyo_free(global_stats.jobs);
+	memset(&global_stats, 0x00, sizeof(struct yoyo_stats));
+	if (!len) {
+		return 0;
+	}
+
+	struct job_stats *jobs = Calloc_or_log(len, sizeof(struct job_stats));
+	if (!jobs) {
+		return -1;
+	}
+	memset(jobs, 0x00, len * sizeof(struct job_stats));
+	global_stats.jobs = jobs;
+	global_stats.len = len;
+	return 0;
+}
+
+void yoyo_stats_name(size_t job, const char *name)
+{
+	if (job >= global_stats.len) {
+		return;
+	}
+	size_t size = strlen(name) + 1;
+	char *copy = Calloc_or_log(size, 1);
+	if (copy) {
+		memcpy(copy, name, size);
+	}
+	yoyo_free(global_stats.jobs[job].name);
+	global_stats.jobs[job].name = copy;
+}
+
+void yoyo_stats_sample_time(unsigned long long ns)
+{
+	size_t i = 0;
+	while (i < YOYO_SAMPLE_BUCKETS && ns > sample_bucket_ns[i]) {
+		++i;
+	}
+	++global_stats.sample_buckets[i];
+	global_stats.sample_ns_sum += ns;
+	++global_stats.sample_count;
+}
+
+static struct job_stats *job_stats_of(unsigned index)
+{
+	return (index < global_stats.len) ? &global_stats.jobs[index] : NULL;
+}
+
+/* a label value, with backslash, double-quote and newline escaped */
+static void write_label(FILE *out, const char *val)
+{
+	for (const char *p = val ? val : ""; *p; ++p) {
+		if (*p == '\\' || *p == '"') {
+			fprintf(out, "\\%c", *p);
+		} else if (*p == '\n') {
+			fprintf(out, "\\n");
+		} else {
+			fputc(*p, out);
+		}
+	}
+}
+
+static void write_family(FILE *out, const char *name, const char *type,
+			 const char *help)
+{
+	fprintf(out, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+}
+
+static void write_job_sample(FILE *out, const char *name, size_t job,
+			     const char *extra, unsigned long val)
+{
+	fprintf(out, "%s{job=\"", name);
+	write_label(out, global_stats.jobs[job].name);
+	fprintf(out, "\",index=\"%zu\"%s} %lu\n", job, extra, val);
+}
+
+/* one of the per-job counters or gauges, for each of the jobs */
+#define Write_jobs(out, name, type, help, field) \
+	do { \
+		write_family(out, name, type, help); \
+		for (size_t j = 0; j < global_stats.len; ++j) { \
+			write_job_sample(out, name, j, "", \
+					 global_stats.jobs[j].field); \
+		} \
+	} while (0)
+
+int yoyo_metrics_write(FILE *out)
+{
+	Write_jobs(out, "yoyo_attempts_total", "counter",
+		   "Times the command of the job was started.", attempts);
+	Write_jobs(out, "yoyo_hangs_total", "counter",
+		   "Attempts killed because they looked hung.", hangs);
+	Write_jobs(out, "yoyo_samples_total", "counter",
+		   "Times the threads of the job were sampled from /proc.",
+		   samples);
+	Write_jobs(out, "yoyo_threads_sampled_total", "counter",
+		   "Threads read from /proc, summed over the samples.",
+		   threads_sampled);
+	Write_jobs(out, "yoyo_hang_count", "gauge",
+		   "Consecutive samples in which the job looked hung.",
+		   hang_count);
+	Write_jobs(out, "yoyo_running", "gauge",
+		   "1 while an attempt of the job is running.", running);
+
+	write_family(out, "yoyo_hang_check_interval_seconds", "gauge",
+		     "The current interval between samples of the job.");
+	for (size_t j = 0; j < global_stats.len; ++j) {
+		fprintf(out, "yoyo_hang_check_interval_seconds{job=\"");
+		write_label(out, global_stats.jobs[j].name);
+		fprintf(out, "\",index=\"%zu\"} %.3f\n", j,
+			global_stats.jobs[j].interval_ms / 1000.0);
+	}
+
+	write_family(out, "yoyo_kills_total", "counter",
+		     "Signals sent by yoyo to the child of the job.");
+	for (size_t j = 0; j < global_stats.len; ++j) {
+		write_job_sample(out, "yoyo_kills_total", j,
+				 ",signal=\"SIGTERM\"",
+				 global_stats.jobs[j].sigterms);
+		write_job_sample(out, "yoyo_kills_total", j,
+				 ",signal=\"SIGKILL\"",
+				 global_stats.jobs[j].sigkills);
+	}
+
+	write_family(out, "yoyo_exits_total", "counter",
+		     "Attempts which exited, by exit status.");
+	char extra[40];
+	for (size_t j = 0; j < global_stats.len; ++j) {
+		const unsigned long *exits = global_stats.jobs[j].exit_codes;
+		for (int code = 0; code < 256; ++code) {
+			unsigned long n = exits[code];
+			if (n) {
+				snprintf(extra, sizeof(extra),
+					 ",code=\"%d\"", code);
+				write_job_sample(out, "yoyo_exits_total", j,
+						 extra, n);
+			}
+		}
+	}
+
+	write_family(out, "yoyo_signaled_total", "counter",
+		     "Attempts terminated by a signal, by signal number.");
+	for (size_t j = 0; j < global_stats.len; ++j) {
+		const unsigned long *sigs = global_stats.jobs[j].term_signals;
+		for (int sig = 1; sig < 65; ++sig) {
+			unsigned long n = sigs[sig];
+			if (n) {
+				snprintf(extra, sizeof(extra),
+					 ",signal=\"%d\"", sig);
+				write_job_sample(out, "yoyo_signaled_total", j,
+						 extra, n);
+			}
+		}
+	}
+
+	const char *hist = "yoyo_sample_duration_seconds";
+	write_family(out, hist, "histogram",
+		     "Time taken to sample the threads of one job.");
+	unsigned long cumulative = 0;
+	for (size_t i = 0; i < YOYO_SAMPLE_BUCKETS; ++i) {
+		cumulative += global_stats.sample_buckets[i];
+		fprintf(out, "%s_bucket{le=\"%g\"} %lu\n", hist,
+			sample_bucket_ns[i] / 1e9, cumulative);
+	}
+	cumulative += global_stats.sample_buckets[YOYO_SAMPLE_BUCKETS];
+	fprintf(out, "%s_bucket{le=\"+Inf\"} %lu\n", hist, cumulative);
+	fprintf(out, "%s_sum %.9f\n", hist, global_stats.sample_ns_sum / 1e9);
+	fprintf(out, "%s_count %lu\n", hist, global_stats.sample_count);
+
+	write_family(out, "yoyo_metrics_scrapes_total", "counter",
+		     "Connections answered on the metrics socket.");
+	fprintf(out, "yoyo_metrics_scrapes_total %lu\n", global_stats.scrapes);
+
+	return ferror(out) ? -1 : 0;
+}
+
+int yoyo_metrics_listen(const char *path)
+{
+	struct sockaddr_un addr;
+	memset(&addr, 0x00, sizeof(struct sockaddr_un));
+	addr.sun_family = AF_UNIX;
+	if (strlen(path) >= sizeof(addr.sun_path)) {
+		Ylog(0, "metrics socket path too long: %s\n", path);
+		return -1;
+	}
+	strcpy(addr.sun_path, path);
+
+	errno = 0;
+	int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	/* a socket file left behind by an earlier yoyo */
+	unlink(path);
+	errno = 0;
+	if (fd < 0 || bind(fd, (struct sockaddr *)&addr, sizeof(addr))
+	    || listen(fd, 16)) {
+		Ylog(0, "can not listen on metrics socket '%s'\n", path);
+		if (fd >= 0) {
+			close(fd);
+		}
+		return -1;
+	}
+	Ylog(1, "metrics socket: %s\n", path);
+	return fd;
+}
+
+/* waits until fd is ready for events, or the deadline passes; returns 0
+ * if it is ready */
+static int wait_ready(int fd, short events, uint64_t deadline_ns)
+{
+	uint64_t now = monotonic_ns();
+	if (now >= deadline_ns) {
+		return -1;
+	}
+	struct pollfd pfd = { fd, events, 0 };
+	int timeout_ms = (int)((deadline_ns - now + 999999) / 1000000);
+	return (poll(&pfd, 1, timeout_ms) == 1) ? 0 : -1;
+}
+
+/* whatever the request, every connection gets the metrics, behind a
+ * minimal HTTP header for the benefit of HTTP clients; fd is
+ * non-blocking, and the request is read and the answer written only
+ * until the deadline, however the client dribbles its bytes */
+static void yoyo_metrics_answer(int fd, uint64_t deadline_ns)
+{
+	char request[1024];
+	size_t request_len = 0;
+	while (request_len < sizeof(request) - 1) {
+		ssize_t got = recv(fd, request + request_len,
+				   sizeof(request) - 1 - request_len, 0);
+		if (got < 0 && errno == EAGAIN
+		    && !wait_ready(fd, POLLIN, deadline_ns)) {
+			continue;
+		}
+		if (got <= 0) {
+			/* a client which sent no request is answered anyway */
+			break;
+		}
+		request_len += (size_t)got;
+		request[request_len] = '\0';
+		if (strstr(request, "\r\n\r\n") || strstr(request, "\n\n")) {
+			break;
+		}
+	}
+
+	char *body = NULL;
+	size_t body_len = 0;
+	FILE *out = open_memstream(&body, &body_len);
+	if (!out) {
+		return;
+	}
+	++global_stats.scrapes;
+	yoyo_metrics_write(out);
+	fclose(out);
+
+	char header[160];
+	int header_len = snprintf(header, sizeof(header),
+				  "HTTP/1.0 200 OK\r\n"
+				  "Content-Type: text/plain; version=0.0.4\r\n"
+				  "Content-Length: %zu\r\n\r\n", body_len);
+
+	const char *parts[] = { header, body };
+	size_t lens[] = { (size_t)header_len, body_len };
+	for (size_t i = 0; i < 2; ++i) {
+		size_t done = 0;
+		while (done < lens[i]) {
+			ssize_t sent = send(fd, parts[i] + done,
+					    lens[i] - done, MSG_NOSIGNAL);
+			if (sent < 0 && errno == EAGAIN
+			    && !wait_ready(fd, POLLOUT, deadline_ns)) {
+				continue;
+			}
+			if (sent <= 0) {
+				/* a partial answer, which the client can tell
+				 * from the Content-Length */
+				free(body);
+				return;
+			}
+			done += (size_t)sent;
+		}
+	}
+	free(body);
+}
+
+void yoyo_metrics_serve(int listen_fd)
+{
+	/* one deadline for the whole call: whatever the clients do, and
+	 * however many connect, supervision is held up for no longer;
+	 * connections left over are accepted at the next wakeup */
+	uint64_t deadline_ns = monotonic_ns() + (100 * 1000000ULL);
+	while (monotonic_ns() < deadline_ns) {
+		errno = 0;
+		int fd = accept4(listen_fd, NULL, NULL,
+				 SOCK_CLOEXEC | SOCK_NONBLOCK);
+		if (fd < 0) {
+			break;
+		}
+		yoyo_metrics_answer(fd, deadline_ns);
+		close(fd);
+	}
+	errno = 0;
+}
+
+void poll_histogram_add(struct poll_histogram *h, unsigned long long val)
+{
+	/* bucket i holds values up to 2^i - 1; the top bucket takes the rest */
+	size_t i = 0;
+	while (i < 63 && (val >> i)) {
+		++i;
+	}
+	++h->buckets[i];
+	h->min = (!h->count || val < h->min) ? val : h->min;
+	h->max = (val > h->max) ? val : h->max;
+	h->sum += val;
+	++h->count;
+}
+
+unsigned long long poll_histogram_quantile(const struct poll_histogram *h,
+					   double q)
+{
+	unsigned long rank = (unsigned long)((q * h->count) + 0.5);
+	rank = rank ? rank : 1;
+	unsigned long seen = 0;
+	for (size_t i = 0; i < 64; ++i) {
+		seen += h->buckets[i];
+		if (seen >= rank) {
+			unsigned long long top = (i < 63) ? ((1ULL << i) - 1)
+			    : h->max;
+			return (top < h->max) ? top : h->max;
+		}
+	}
+	return h->max;
+}
+
+void poll_profile_add(struct poll_profile *profile,
+		      const struct poll_cost *cost)
+{
+	poll_histogram_add(&profile->sample_ns, cost->sample_ns);
+	poll_histogram_add(&profile->parse_ns, cost->parse_ns);
+	poll_histogram_add(&profile->syscalls, cost->syscalls);
+	poll_histogram_add(&profile->bytes_read, cost->bytes_read);
+	poll_histogram_add(&profile->threads, cost->threads);
+}
+
+int poll_profile_write(const struct poll_profile *profile, FILE *out)
+{
+	const struct poll_histogram *stages[] = {
+		&profile->sample_ns, &profile->parse_ns, &profile->decide_ns,
+		&profile->syscalls, &profile->bytes_read, &profile->threads,
+	};
+	const char *names[] = {
+		"sample ns", "parse ns", "decide ns",
+		"syscalls", "bytes read", "threads",
+	};
+
+	fprintf(out, "yoyo poll profile: %lu polls\n",
+		profile->sample_ns.count);
+	fprintf(out, "%-11s %12s %12s %12s %12s %12s\n", "", "mean", "p50",
+		"p90", "p99", "max");
+	for (size_t i = 0; i < (sizeof(stages) / sizeof(stages[0])); ++i) {
+		const struct poll_histogram *h = stages[i];
+		unsigned long long mean = h->count ? h->sum / h->count : 0;
+		fprintf(out, "%-11s %12llu %12llu %12llu %12llu %12llu\n",
+			names[i], mean, poll_histogram_quantile(h, 0.5),
+			poll_histogram_quantile(h, 0.9),
+			poll_histogram_quantile(h, 0.99), h->max);
+	}
+	return ferror(out) ? -1 : 0;
+}
+
+void yoyo_profile_dump(void)
+{
+	fflush(Ystdout);
+	poll_profile_write(&global_poll_profile, Ystderr);
+}
+
+void yoyo_profile_summary(void)
+{
+	if (yoyo_profile) {
+		yoyo_profile_dump();
+	}
+}
+
+size_t exit_reasons_reap(struct exit_reason **reasons, size_t len)
+{
+	size_t reaped = 0;
+	for (;;) {
+		pid_t any_child = -1;
+		int wait_status = 0;
+		errno = 0;
+		pid_t pid = yoyo_waitpid(any_child, &wait_status, WNOHANG);
+		if (pid <= 0) {
+			/* 0: none have exited, ECHILD: there are none */
+			errno = 0;
+			return reaped;
+		}
+
+		for (size_t i = 0; i < len; ++i) {
+			if (reasons[i] && pid == reasons[i]->child_pid) {
+				exit_reason_set(reasons[i], pid, wait_status);
+				++reaped;
+				break;
+			}
+		}
+
+		if (yoyo_verbose >= 1) {
+			struct exit_reason tmp;
+			exit_reason_set(&tmp, pid, wait_status);
+			size_t len = 255;
+			char buf[len];
+			exit_reason_to_str(&tmp, buf, len);
+			Ylog(1, "reaped (%d): %s\n", wait_status, buf);
+		}
+	}
+}
+
+int exit_reason_reap(struct exit_reason *reason)
+{
+	return exit_reasons_reap(&reason, 1) ? 1 : 0;
+}
+
+int pid_exists(long pid)
+{
+	/*
+	 * If sig is 0, then no signal is sent, but existence and permission
+	 * checks are still performed; this can be used to check for the
+	 * existence of a process ID or process group ID that the caller is
+	 * permitted to signal.
+	 */
+	const int sig_exists = 0;
+
+	/*
+	 * On success, zero is returned. On error, -1 is returned, and errno
+	 * is set appropriately.
+	 */
+	int rv = yoyo_kill(pid, sig_exists);
+	errno = 0;
+
+	return (rv == 0);
+}
+
+static int kill_child(long child_pid, int sig)
+{
+	errno = 0;
+	int err = yoyo_kill(child_pid, sig);
+	/* ESRCH: No such process */
+	int log_level = (err && (errno != ESRCH)) ? 0 : 1;
+	Ylog(log_level, "kill(child_pid, %s) returned %d\n",
+	     (sig == SIGKILL) ? "SIGKILL" : "SIGTERM", err);
+	return err;
+}
+
+unsigned term_then_kill(long child_pid, unsigned grace_seconds)
+{
+	kill_child(child_pid, SIGTERM);
 	yoyo_sleep(grace_seconds);	// pause after term
 
-	if (!pid_exists(child_pid)) {
+	if (!pid_exists(child_pid)) {
+		return 1;
+	}
+
+	kill_child(child_pid, SIGKILL);
+	yoyo_sleep(0);		// yield after kill
+	return 2;
+}
+
+/* The supervision core: SIGCHLD is read from a signalfd, the earliest
+ * deadline of all jobs is kept on a timerfd, and if the kernel has pidfds,
+ * the pidfd of each child is watched as well. All are waited on with a
+ * single epoll_wait, thus all of the supervision logic runs in normal
+ * context, and one wakeup serves every job which is due. */
+struct supervisor {
+	int epoll_fd;
+	int signal_fd;
+	int timer_fd;
+	sigset_t saved_mask;
+	/* NULL unless more than one sampler worker was asked for */
+	struct sampler_pool *pool;
+	/* what is passed on to yoyo's stdout and stderr at a time, and
+	 * whether each is in the epoll set, watched for room */
+	size_t output_chunk[2];
+	int output_watched[2];
+};
+
+#define Fired(fired, event) ((fired) & (1U << (event)))
+
+/* jobs due this close to the earliest deadline are sampled in the same
+ * pass, rather than each getting a wakeup of its own */
+static const uint64_t batch_slack_ns = 10 * 1000 * 1000;
+
+static uint64_t ms_to_ns(unsigned ms)
+{
+	return ((uint64_t)ms) * 1000 * 1000;
+}
+
+static int supervisor_watch(struct supervisor *sv, int fd,
+			    enum supervisor_event event)
+{
+	struct epoll_event ev;
+	memset(&ev, 0x00, sizeof(struct epoll_event));
+	ev.events = EPOLLIN;
+	ev.data.u64 = event;
+	errno = 0;
+	int err = epoll_ctl(sv->epoll_fd, EPOLL_CTL_ADD, fd, &ev);
+	if (err) {
+		Ylog(0, "epoll_ctl(%d) returned %d\n", fd, err);
+	}
+	return err;
+}
+
+/* from the next epoll_wait on, fd wakes yoyo once when it can be
+ * written to, rather than while it can */
+static int supervisor_watch_room(struct supervisor *sv, int fd,
+				 enum supervisor_event event, int *watched)
+{
+	struct epoll_event ev;
+	memset(&ev, 0x00, sizeof(struct epoll_event));
+	ev.events = EPOLLOUT | EPOLLONESHOT;
+	ev.data.u64 = event;
+	errno = 0;
+	int op = *watched ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+	int err = epoll_ctl(sv->epoll_fd, op, fd, &ev);
+	if (err) {
+		Ylog(1, "epoll_ctl(%d, EPOLLOUT) returned %d\n", fd, err);
+	} else {
+		*watched = 1;
+	}
+	return err;
+}
+
+static void supervisor_unwatch(struct supervisor *sv, int fd)
+{
+	epoll_ctl(sv->epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+	errno = 0;
+}
+
+static void supervisor_read_signals(struct supervisor *sv)
+{
+	/* SIGCHLDs coalesce, thus reaping loops over all children */
+	struct signalfd_siginfo info;
+	while (read(sv->signal_fd, &info, sizeof(info)) == sizeof(info)) {
+		if (info.ssi_signo == SIGUSR1) {
+			yoyo_profile_dump();
+		}
+	}
+}
+
+static void supervisor_close(struct supervisor *sv)
+{
+	/* a SIGUSR1 still pending would terminate yoyo once unblocked */
+	if (sv->signal_fd >= 0) {
+		supervisor_read_signals(sv);
+	}
+	int *fds[] = { &sv->timer_fd, &sv->signal_fd, &sv->epoll_fd };
+	for (size_t i = 0; i < (sizeof(fds) / sizeof(fds[0])); ++i) {
+		if (*fds[i] >= 0) {
+			close(*fds[i]);
+			*fds[i] = -1;
+		}
+	}
+	sampler_pool_free(sv->pool);
+	sv->pool = NULL;
+	yoyo_sigprocmask(SIG_SETMASK, &sv->saved_mask, NULL);
+}
+
+static int supervisor_open(struct supervisor *sv)
+{
+	sv->epoll_fd = -1;
+	sv->signal_fd = -1;
+	sv->timer_fd = -1;
+	sv->pool = NULL;
+	for (size_t i = 0; i < 2; ++i) {
+		/* a pipe, with SPLICE_F_NONBLOCK, or a file, does not block;
+		 * otherwise pass on no more than poll(2) promises room for */
+		struct stat st;
+		int big = (fstat(STDOUT_FILENO + i, &st) == 0)
+		    && (S_ISFIFO(st.st_mode) || S_ISREG(st.st_mode));
+		sv->output_chunk[i] = big ? (1 << 16) : PIPE_BUF;
+		sv->output_watched[i] = 0;
+	}
+
+	/* a blocked SIGCHLD stays pending until read from the signalfd;
+	 * SIGUSR1 asks for the poll profile */
+	sigset_t sigchld_mask;
+	sigemptyset(&sigchld_mask);
+	sigaddset(&sigchld_mask, SIGCHLD);
+	sigaddset(&sigchld_mask, SIGUSR1);
+	sigemptyset(&sv->saved_mask);
+	yoyo_sigprocmask(SIG_BLOCK, &sigchld_mask, &sv->saved_mask);
+
+	errno = 0;
+	sv->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	sv->signal_fd = signalfd(-1, &sigchld_mask, SFD_NONBLOCK | SFD_CLOEXEC);
+	sv->timer_fd = timerfd_create(CLOCK_MONOTONIC,
+				      TFD_NONBLOCK | TFD_CLOEXEC);
+	if (sv->epoll_fd < 0 || sv->signal_fd < 0 || sv->timer_fd < 0
+	    || supervisor_watch(sv, sv->signal_fd, SUPERVISOR_EV_SIGCHLD)
+	    || supervisor_watch(sv, sv->timer_fd, SUPERVISOR_EV_TIMER)
+	    || (global_metrics_fd >= 0
+		&& supervisor_watch(sv, global_metrics_fd,
+				    SUPERVISOR_EV_METRICS))) {
+		Ylog(0, "epoll: %d, signalfd: %d, timerfd: %d\n",
+		     sv->epoll_fd, sv->signal_fd, sv->timer_fd);
+		supervisor_close(sv);
+		return -1;
+	}
+	errno = 0;
+	return 0;
+}
+
+/* (re)arm the one-shot timer to fire at an absolute CLOCK_MONOTONIC time,
+ * so that the time spent sampling does not push the schedule back */
+static int supervisor_arm_at(struct supervisor *sv, uint64_t deadline_ns)
+{
+	struct itimerspec when;
+	memset(&when, 0x00, sizeof(struct itimerspec));
+	when.it_value.tv_sec = deadline_ns / 1000000000;
+	when.it_value.tv_nsec = deadline_ns % 1000000000;
+	if (!when.it_value.tv_sec && !when.it_value.tv_nsec) {
+		when.it_value.tv_nsec = 1;	/* zero would disarm */
+	}
+	errno = 0;
+	int err = timerfd_settime(sv->timer_fd, TFD_TIMER_ABSTIME, &when, NULL);
+	if (err) {
+		Ylog(0, "timerfd_settime(%lu) returned %d\n",
+		     (unsigned long)deadline_ns, err);
+	}
+	return err;
+}
+
+/* the deadline after the previous one; if sampling overran one or more
+ * intervals, those are skipped rather than fired back to back */
+static uint64_t next_deadline(uint64_t deadline_ns, uint64_t interval_ns,
+			      uint64_t now_ns)
+{
+	deadline_ns += interval_ns;
+	if (deadline_ns <= now_ns && interval_ns) {
+		uint64_t missed = ((now_ns - deadline_ns) / interval_ns) + 1;
+		Ylog(1, "sampling overran %lu interval(s)\n",
+		     (unsigned long)missed);
+		deadline_ns += missed * interval_ns;
+	}
+	return deadline_ns;
+}
+
+/* block until something is ready; returns a bit per supervisor_event,
+ * or zero if epoll_wait failed */
+static unsigned supervisor_wait(struct supervisor *sv)
+{
+	struct epoll_event events[16];
+	int max_events = sizeof(events) / sizeof(events[0]);
+	int ready = 0;
+	do {
+		errno = 0;
+		ready = yoyo_epoll_wait(sv->epoll_fd, events, max_events, -1);
+	} while (ready < 0 && errno == EINTR);
+	if (ready < 0) {
+		Ylog(0, "epoll_wait returned %d\n", ready);
+		return 0;
+	}
+
+	unsigned fired = 0;
+	for (int i = 0; i < ready; ++i) {
+		fired |= 1U << events[i].data.u64;
+	}
+
+	/* drain, so that the fds are not immediately ready again */
+	ssize_t bytes = 0;
+	if (Fired(fired, SUPERVISOR_EV_SIGCHLD)) {
+		supervisor_read_signals(sv);
+	}
+	if (Fired(fired, SUPERVISOR_EV_TIMER)) {
+		uint64_t expirations = 0;
+		bytes = read(sv->timer_fd, &expirations, sizeof(expirations));
+		Ylog(bytes < 0 ? 2 : 3, "timer expirations: %lu\n",
+		     (unsigned long)expirations);
+	}
+	if (Fired(fired, SUPERVISOR_EV_METRICS)) {
+		yoyo_metrics_serve(global_metrics_fd);
+	}
+	errno = 0;
+	return fired;
+}
+
+/* for when there is no supervision loop: wait without monitoring */
+static void exit_reason_wait(struct exit_reason *reason)
+{
+	int wait_status = 0;
+	errno = 0;
+	pid_t pid = yoyo_waitpid(reason->child_pid, &wait_status, 0);
+	if (pid == reason->child_pid) {
+		exit_reason_set(reason, pid, wait_status);
+	} else {
+		Ylog(0, "waitpid(%ld) returned %ld\n", reason->child_pid,
+		     (long)pid);
+	}
+}
+
+/* with the bounds unset, the interval is fixed */
+static void yoyo_job_interval_bounds(struct yoyo_job *job, unsigned min_ms,
+				     unsigned max_ms)
+{
+	unsigned interval_ms = job->interval_ms;
+	job->interval_min_ms = (min_ms && min_ms < interval_ms) ? min_ms
+	    : interval_ms;
+	job->interval_max_ms = (max_ms > interval_ms) ? max_ms : interval_ms;
+}
+
+int yoyo_job_init(struct yoyo_job *job, char **argv, unsigned max_retries,
+		  unsigned max_hangs, unsigned interval_ms)
+{
+	memset(job, 0x00, sizeof(struct yoyo_job));
+	job->argv = argv;
+	job->max_retries = max_retries;
+	job->max_hangs = max_hangs;
+	job->interval_ms = interval_ms;
+	job->thresholds = hang_thresholds;
+	job->policy = global_hang_policy;
+	job->policy_args = global_hang_policy_args;
+	job->heartbeat_ms = heartbeat_ms;
+	job->heartbeat_fd = -1;
+	job->progress = use_progress;
+	job->notify = use_notify;
+	job->watchdog_ms = watchdog_ms;
+	job->notify_fd = -1;
+	job->output_silence_ms = output_silence_ms;
+	job->output_fds[0] = -1;
+	job->output_fds[1] = -1;
+	job->output_left_fds[0] = -1;
+	job->output_left_fds[1] = -1;
+	job->log_dir = log_dir;
+	job->pidfd = -1;
+	yoyo_job_interval_bounds(job, hang_check_interval_min_ms,
+				 hang_check_interval_max_ms);
+
+	size_t max_tries = ((size_t)max_retries) + 1;
+	size_t size = sizeof(struct exit_reason);
+	job->history = Calloc_or_log(max_tries, size);
+	return job->history ? 0 : -1;
+}
+
+/* null-safe */
+static void job_policy_free(struct yoyo_job *job)
+{
+	if (job->policy_state) {
+		job->policy->free(job->policy_state);
+		job->policy_state = NULL;
+	}
+}
+
+void yoyo_job_release(struct yoyo_job *job)
+{
+	job_policy_free(job);
+	yoyo_free(job->history);
+	job->history = NULL;
+	job->history_len = 0;
+}
+
+static void job_attempt_begin(struct supervisor *sv, struct yoyo_job *job,
+			      long child_pid)
+{
+	job->pid = child_pid;
+	++job->attempts;
+	exit_reason_clear(&job->reason);
+	job->reason.child_pid = child_pid;
+	job->killed = 0;
+	job->hang_count = 0;
+	job->have_ticks = 0;
+	job->last_ticks = 0;
+	job->beats = 0;
+	job->progress_seen = 0;
+	job->ready = 0;
+	job->watchdog_ns = ms_to_ns(job->watchdog_ms);
+	job->watchdog_seen_ns = 0;
+	job->status[0] = '\0';
+	job->output_bytes = 0;
+	job->output_checked_bytes = 0;
+	job->output_seen_ns = 0;
+	job->output_copy[0] = 0;
+	job->output_copy[1] = 0;
+	job->output_held[0] = 0;
+	job->output_held[1] = 0;
+
+	struct hang_policy_config config = {
+		.thresholds = job->thresholds,
+		.args = job->policy_args,
+		.release = free_states,
+	};
+	job_policy_free(job);
+	job->policy_state = job->policy->init(&config);
+	if (!job->policy_state) {
+		Ylog(0, "hang policy '%s' failed, not checking %ld for hangs\n",
+		     job->policy->name, child_pid);
+	}
+
+	/* sampling starts at interval_ms; if the bounds allow, it then
+	 * backs off while the child is busy, and tightens again once a
+	 * snapshot looks idle */
+	job->current_interval_ms = job->interval_ms;
+	memset(&job->metrics, 0x00, sizeof(struct monitor_metrics));
+	job->metrics.interval_min_ms = job->interval_min_ms;
+	job->metrics.interval_max_ms = job->interval_max_ms;
+	job->metrics.interval_ms = job->current_interval_ms;
+	Ylog(1, "interval: %ums (min: %ums, max: %ums)\n",
+	     job->current_interval_ms, job->interval_min_ms,
+	     job->interval_max_ms);
+	job->deadline_ns = monotonic_ns() + ms_to_ns(job->current_interval_ms);
+
+	struct job_stats *stats = job_stats_of(job->index);
+	if (stats) {
+		++stats->attempts;
+		stats->running = 1;
+		stats->hang_count = 0;
+		stats->interval_ms = job->current_interval_ms;
+	}
+
+	/* not required, SIGCHLD suffices, but with a pidfd the wakeup is
+	 * specific to a child */
+	errno = 0;
+	job->pidfd = yoyo_pidfd_open(child_pid, 0);
+	Ylog(job->pidfd < 0 ? 1 : 2, "pidfd_open(%ld) returned %d\n",
+	     child_pid, job->pidfd);
+	if (job->pidfd >= 0
+	    && supervisor_watch(sv, job->pidfd, SUPERVISOR_EV_PIDFD)) {
+		close(job->pidfd);
+		job->pidfd = -1;
+	}
+	errno = 0;
+}
+
+/* The output of an attempt, captured in <dir>/<name>.<job>.<attempt>.log:
+ * once that reaches log_size bytes, it is renamed with a .1 suffix, an
+ * earlier .1 becoming .2 and so on up to log_keep, and a new file is
+ * started. Each file is preallocated with fallocate, so that a child
+ * writing hundreds of MB/s is not slowed by block allocation, and
+ * trimmed to what was written when closed. The child's pipes are
+ * spliced to the file; with YOYO_LOG_TEE, tee first duplicates what is
+ * waiting into a pipe of yoyo's, which is then spliced to yoyo's own
+ * stdout or stderr, thus the output is never copied through memory. */
+struct attempt_log {
+	char *path;
+	int fd;
+	unsigned long long written;
+	/* with YOYO_LOG_TEE, a pipe per stream */
+	int tee_fds[2][2];
+};
+
+static int attempt_log_start(struct attempt_log *log)
+{
+	errno = 0;
+	log->written = 0;
+	log->fd = open(log->path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+		       0644);
+	if (log->fd < 0) {
+		Ylog(0, "can not open %s\n", log->path);
+		return -1;
+	}
+	/* the size stays 0 until written */
+	if (fallocate(log->fd, FALLOC_FL_KEEP_SIZE, 0, (off_t)log_size)) {
+		Ylog(2, "fallocate(%s) failed\n", log->path);
+	}
+	errno = 0;
+	return 0;
+}
+
+/* null-safe; frees what was preallocated but not written */
+static void attempt_log_finish(struct attempt_log *log)
+{
+	if (log->fd < 0) {
+		return;
+	}
+	errno = 0;
+	if (ftruncate(log->fd, (off_t)log->written)) {
+		Ylog(1, "ftruncate(%s) failed\n", log->path);
+	}
+	close_fds(&log->fd, NULL);
+	errno = 0;
+}
+
+static int attempt_log_rotate(struct attempt_log *log)
+{
+	attempt_log_finish(log);
+	size_t len = strlen(log->path) + 16;
+	char from[len];
+	char to[len];
+	for (unsigned k = log_keep; k > 0; --k) {
+		snprintf(from, len, k > 1 ? "%s.%u" : "%s", log->path, k - 1);
+		snprintf(to, len, "%s.%u", log->path, k);
+		/* those not yet written do not exist */
+		rename(from, to);
+	}
+	Ylog(1, "rotated %s\n", log->path);
+	return attempt_log_start(log);
+}
+
+/* null-safe */
+static void attempt_log_close(struct attempt_log *log)
+{
+	if (!log) {
+		return;
+	}
+	attempt_log_finish(log);
+	for (size_t i = 0; i < 2; ++i) {
+		close_fds(&log->tee_fds[i][0], &log->tee_fds[i][1]);
+	}
+	yoyo_free(log);
+}
+
+static struct attempt_log *attempt_log_open(const char *dir, const char *name,
+					    unsigned job, unsigned attempt)
+{
+	const char *base = strrchr(name, '/');
+	base = base ? base + 1 : name;
+	size_t len = strlen(dir) + strlen(base) + 64;
+	size_t size = sizeof(struct attempt_log) + len;
+	struct attempt_log *log = Calloc_or_log(1, size);
+	if (!log) {
+		return NULL;
+	}
+	log->path = (char *)(log + 1);
+	snprintf(log->path, len, "%s/%s.%u.%u.log", dir, base, job, attempt);
+	log->fd = -1;
+	for (size_t i = 0; i < 2; ++i) {
+		log->tee_fds[i][0] = -1;
+		log->tee_fds[i][1] = -1;
+		errno = 0;
+		if (log_tee && pipe2(log->tee_fds[i], O_CLOEXEC | O_NONBLOCK)) {
+			Ylog(0, "pipe2 failed, %s not passed on\n", log->path);
+			attempt_log_close(log);
+			return NULL;
+		}
+	}
+	if (attempt_log_start(log)) {
+		attempt_log_close(log);
+		return NULL;
+	}
+	return log;
+}
+
+/* the bytes which still fit in the current file, rotating if none do */
+static size_t attempt_log_room(struct attempt_log *log, size_t len)
+{
+	if (log->written >= log_size && attempt_log_rotate(log)) {
+		return 0;
+	}
+	unsigned long long room = log_size - log->written;
+	return (len < room) ? len : (size_t)room;
+}
+
+/* 1 if yoyo's stdout (i = 0) or stderr (i = 1) can take more now, 0 if
+ * not yet, or -1 if nothing more can be written to it */
+static int output_room(int i)
+{
+	struct pollfd pfd = { STDOUT_FILENO + i, POLLOUT, 0 };
+	if (poll(&pfd, 1, 0) < 0 || (pfd.revents & (POLLERR | POLLNVAL))) {
+		return -1;
+	}
+	return (pfd.revents & POLLOUT) ? 1 : 0;
+}
+
+/* for when splice is refused; returns -1 if the log can take no more */
+static int attempt_log_write(struct attempt_log *log, const char *buf,
+			     size_t len)
+{
+	for (size_t out = 0; out < len;) {
+		size_t room = attempt_log_room(log, len - out);
+		ssize_t put = room ? write(log->fd, buf + out, room) : -1;
+		if (put <= 0) {
+			return -1;
+		}
+		log->written += (unsigned long long)put;
+		out += (size_t)put;
+	}
+	return 0;
+}
+
+/* write len bytes from buf to fd, or drop them */
+static void write_or_drop(int fd, const char *buf, size_t len)
+{
+	for (ssize_t out = 0, put = 0; out < (ssize_t)len; out += put) {
+		put = write(fd, buf + out, len - out);
+		if (put <= 0) {
+			break;
+		}
+	}
+}
+
+/* splice len bytes waiting in the pipe from to dest, copying them if
+ * splice is refused, as it is for a file opened with O_APPEND, and
+ * dropping what dest has no room for */
+static void splice_or_copy(int from, int dest, size_t len)
+{
+	char buf[4096];
+	while (len) {
+		errno = 0;
+		ssize_t got = splice(from, NULL, dest, NULL, len,
+				     SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+		if (got < 0 && errno == EINVAL) {
+			size_t want = (len < sizeof(buf)) ? len : sizeof(buf);
+			got = read(from, buf, want);
+			if (got > 0) {
+				write_or_drop(dest, buf, (size_t)got);
+			}
+		}
+		if (got <= 0) {
+			break;
+		}
+		len -= (size_t)got;
+	}
+	while (read(from, buf, sizeof(buf)) > 0) {
+		/* the tee pipe is emptied each time */
+	}
+}
+
+/* move what is waiting in src, the pipe of stream i, to the log and, with
+ * YOYO_LOG_TEE, up to tee_len bytes of it to yoyo's stdout or stderr;
+ * returns as splice does */
+static ssize_t attempt_log_move(struct attempt_log *log, int i, int src,
+				size_t tee_len)
+{
+	size_t len = attempt_log_room(log, tee_len ? tee_len : 1 << 16);
+	if (!len) {
+		errno = EIO;
+		return -1;
+	}
+	int tee_fd = tee_len ? log->tee_fds[i][1] : -1;
+	if (tee_fd >= 0) {
+		/* the tee pipe is drained each time, so that it is not
+		 * mistaken for src being empty */
+		ssize_t teed = tee(src, tee_fd, len, SPLICE_F_NONBLOCK);
+		if (teed <= 0) {
+			return teed;
+		}
+		len = (size_t)teed;
+	}
+
+	ssize_t moved = 0;
+	ssize_t got = 0;
+	while ((size_t)moved < len) {
+		got = splice(src, NULL, log->fd, NULL, len - moved,
+			     SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+		if (got <= 0) {
+			break;
+		}
+		moved += got;
+	}
+	log->written += (unsigned long long)moved;
+	if (tee_fd >= 0) {
+		/* only what reached the log; the rest is still in src */
+		int saved_errno = errno;
+		splice_or_copy(log->tee_fds[i][0], STDOUT_FILENO + i, moved);
+		errno = saved_errno;
+	}
+	return moved ? moved : got;
+}
+
+/* the log can take no more, as when its disk is full: rather than close
+ * the child's pipe, and so have it killed by SIGPIPE, its output is
+ * passed on to yoyo's stdout and stderr for the rest of the attempt */
+static void job_log_failed(struct yoyo_job *job)
+{
+	Ylog(0, "%s failed, output of %ld passed on instead\n",
+	     job->log->path, job->pid);
+	attempt_log_close(job->log);
+	job->log = NULL;
+}
+
+/* a reader of yoyo's stdout or stderr is not keeping up: what the child
+ * wrote is left in its pipe, which is not watched until there is room */
+static void job_output_hold(struct supervisor *sv, struct yoyo_job *job,
+			    int i)
+{
+	if (!job->output_held[i]) {
+		Ylog(2, "output %d of %ld held back\n", i + 1, job->pid);
+		supervisor_unwatch(sv, job->output_fds[i]);
+		job->output_held[i] = 1;
+	}
+	supervisor_watch_room(sv, STDOUT_FILENO + i, SUPERVISOR_EV_OUTPUT,
+			      &sv->output_watched[i]);
+}
+
+static void job_output_release(struct supervisor *sv, struct yoyo_job *job,
+			       int i)
+{
+	if (job->output_held[i]) {
+		Ylog(2, "output %d of %ld passed on again\n", i + 1, job->pid);
+		job->output_held[i] = 0;
+		if (supervisor_watch(sv, job->output_fds[i],
+				     SUPERVISOR_EV_OUTPUT)) {
+			/* still read at each deadline */
+			Ylog(1, "output %d of %ld not watched\n", i + 1,
+			     job->pid);
+		}
+	}
+}
+
+/* pass on what an ended attempt left in its pipe i as yoyo's stdout or
+ * stderr makes room for it, dropping what is left at the deadline;
+ * returns non-zero while some is left */
+static int job_output_left(struct supervisor *sv, struct yoyo_job *job,
+			   int i, uint64_t now)
+{
+	char buf[4096];
+	int dest = STDOUT_FILENO + i;
+	size_t chunk = sv->output_chunk[i];
+	while (job->output_left_fds[i] >= 0) {
+		int src = job->output_left_fds[i];
+		int room = output_room(i);
+		if (!room && now < job->output_left_ns) {
+			supervisor_watch_room(sv, dest, SUPERVISOR_EV_OUTPUT,
+					      &sv->output_watched[i]);
+			return 1;
+		}
+		ssize_t got = -1;
+		errno = 0;
+		if (room > 0) {
+			got = splice(src, NULL, dest, NULL, chunk,
+				     SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+		}
+		if (got < 0 && errno == EINVAL) {
+			size_t want = (chunk < sizeof(buf)) ? chunk
+			    : sizeof(buf);
+			got = read(src, buf, want);
+			if (got > 0) {
+				write_or_drop(dest, buf, (size_t)got);
+			}
+		}
+		if (got > 0
+		    || (got < 0 && errno == EAGAIN && output_room(i) == 0)) {
+			continue;
+		}
+		if (got < 0 && errno != EAGAIN) {
+			Ylog(0, "output %d of an ended attempt not all"
+			     " passed on\n", i + 1);
+		}
+		close_fds(&job->output_left_fds[i], NULL);
+	}
+	errno = 0;
+	return 0;
+}
+
+static int job_output_left_open(const struct yoyo_job *job)
+{
+	return job->output_left_fds[0] >= 0 || job->output_left_fds[1] >= 0;
+}
+
+/* pass on what the child wrote to its stdout and stderr, to yoyo's or to
+ * the attempt's log, without copying it through yoyo's memory unless
+ * splice is refused, as it is for a file opened with O_APPEND; only as
+ * much is taken from a pipe as yoyo's stdout or stderr has room for, and
+ * a pipe is closed once the child closes its end, but not because yoyo's
+ * own stdout or stderr fails, in which case the output is dropped */
+static void job_output_forward(struct supervisor *sv, struct yoyo_job *job,
+			       uint64_t now)
+{
+	char buf[4096];
+	struct attempt_log *log = job->log;
+	for (int i = 0; i < 2; ++i) {
+		int dest = STDOUT_FILENO + i;
+		size_t chunk = sv->output_chunk[i];
+		ssize_t got = 0;
+		/* what an earlier attempt left goes first, and while there
+		 * is no room for it, there is none for the rest either */
+		job_output_left(sv, job, i, now);
+		while (job->output_fds[i] >= 0) {
+			int src = job->output_fds[i];
+			/* a log takes all of it, whatever the room */
+			int room = (log && !log_tee) ? 1 : output_room(i);
+			if (!room && !log) {
+				job_output_hold(sv, job, i);
+				break;
+			}
+			job_output_release(sv, job, i);
+			errno = 0;
+			if (room < 0 && !log) {
+				got = read(src, buf, sizeof(buf));
+			} else if (job->output_copy[i]) {
+				size_t want = (chunk < sizeof(buf)) ? chunk
+				    : sizeof(buf);
+				got = read(src, buf, want);
+				int pass_on = (got > 0 && room > 0
+					       && (!log || log_tee));
+				if (got > 0 && log
+				    && attempt_log_write(log, buf, got)) {
+					job_log_failed(job);
+					log = NULL;
+					pass_on = pass_on
+					    || (output_room(i) > 0);
+				}
+				if (pass_on) {
+					write_or_drop(dest, buf, got);
+				}
+			} else if (log) {
+				size_t tee_len = (log_tee && room > 0)
+				    ? chunk : 0;
+				got = attempt_log_move(log, i, src, tee_len);
+				if (got < 0 && errno != EAGAIN
+				    && errno != EINVAL) {
+					job_log_failed(job);
+					log = NULL;
+					continue;
+				}
+			} else {
+				got = splice(src, NULL, dest, NULL, chunk,
+					     SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+			}
+			if (got < 0 && errno == EINVAL
+			    && !job->output_copy[i]) {
+				Ylog(2, "splice of output %d refused\n", i + 1);
+				job->output_copy[i] = 1;
+				continue;
+			}
+			if (got > 0) {
+				job->output_bytes += (unsigned long long)got;
+				job->output_seen_ns = now;
+			} else if (got == 0) {
+				Ylog(2, "child %ld: output %d closed\n",
+				     job->pid, i + 1);
+				close_fds(&job->output_fds[i], NULL);
+			} else if (errno == EAGAIN && !log && room > 0
+				   && output_room(i) == 0) {
+				/* not src being empty, but dest full */
+				job_output_hold(sv, job, i);
+				break;
+			} else if (errno == EAGAIN) {
+				break;
+			} else {
+				/* the pipe from the child does not fail */
+				Ylog(1, "output %d of %ld dropped (%d)\n",
+				     i + 1, job->pid, errno);
+				got = read(src, buf, sizeof(buf));
+				if (got == 0) {
+					close_fds(&job->output_fds[i], NULL);
+				} else if (got < 0) {
+					break;
+				}
+			}
+		}
+	}
+	errno = 0;
+}
+
+static void job_attempt_end(struct supervisor *sv, struct yoyo_job *job)
+{
+	job_policy_free(job);
+	close_fds(&job->heartbeat_fd, NULL);
+	progress_close(&job->progress_map);
+	close_fds(&job->notify_fd, NULL);
+	/* what a slow reader of yoyo's output holds back is passed on from
+	 * the supervision loop, as job_output_left, for no longer than the
+	 * grace period after SIGTERM; anything written to the pipes after
+	 * this, by a descendant, is lost */
+	uint64_t now = monotonic_ns();
+	job_output_forward(sv, job, now);
+	if (!job_output_left_open(job)) {
+		job->output_left_ns = now + ms_to_ns(job->interval_ms);
+	}
+	for (int i = 0; i < 2; ++i) {
+		if (job->output_fds[i] >= 0 && job->output_held[i]) {
+			if (job->output_left_fds[i] < 0) {
+				job->output_left_fds[i] = job->output_fds[i];
+				job->output_fds[i] = -1;
+			} else {
+				Ylog(0, "output %d of %ld not all passed"
+				     " on\n", i + 1, job->pid);
+			}
+		}
+		job->output_held[i] = 0;
+	}
+	close_fds(&job->output_fds[0], &job->output_fds[1]);
+	attempt_log_close(job->log);
+	job->log = NULL;
+	get_states_proc_release(job->pid);
+	if (job->pidfd >= 0) {
+		close(job->pidfd);
+		job->pidfd = -1;
+	}
+	if (job->history && job->history_len <= job->max_retries) {
+		job->history[job->history_len++] = job->reason;
+	}
+	struct job_stats *stats = job_stats_of(job->index);
+	if (stats) {
+		stats->running = 0;
+		if (job->reason.exited) {
+			++stats->exit_codes[job->reason.exit_code & 0xFF];
+		} else if (job->reason.signaled && job->reason.termsig > 0
+			   && job->reason.termsig < 65) {
+			++stats->term_signals[job->reason.termsig];
+		}
+	}
+	job->pid = 0;
+}
+
+static int job_reaped(const struct yoyo_job *job)
+{
+	return job->pid && (job->reason.exited || job->reason.signaled);
+}
+
+/* the deadline of the job has passed: judge current, the snapshot
+ * sampled for this deadline, or move the killing of the child along;
+ * returns non-zero if the attempt is to be abandoned */
+static int job_deadline(struct yoyo_job *job, uint64_t now,
+			struct state_list *current)
+{
+	long child_pid = job->pid;
+	const uint64_t grace_ns = ms_to_ns(job->interval_ms);
+	struct job_stats *stats = job_stats_of(job->index);
+
+	if (job->killed == 1) {
+		/* the grace period after SIGTERM has passed */
+		kill_child(child_pid, SIGKILL);
+		job->killed = 2;
+		if (stats) {
+			++stats->sigkills;
+		}
+		job->deadline_ns = now + grace_ns;
+		return 0;
+	} else if (job->killed == 2) {
+		Ylog(0, "child %ld not reaped after SIGKILL\n", child_pid);
+		return 1;
+	}
+
+	unsigned interval_ms = job->current_interval_ms;
+	struct monitor_metrics *metrics = &job->metrics;
+	unsigned long long ticks = state_list_ticks(current);
+	int busy = job->have_ticks && (ticks > job->last_ticks)
+	    && ticks_look_busy(ticks - job->last_ticks, interval_ms);
+	job->have_ticks = 1;
+	job->last_ticks = ticks;
+	++metrics->samples;
+
+	/* before the policy sees current, which it may keep and then free
+	 * at any time */
+	snapshot_ring_publish(global_snapshot_ring, job->index, child_pid,
+			      job->hang_count, job->max_hangs, current);
+	trace_writer_append(global_trace, job->index, child_pid, now,
+			    interval_ms, current);
+	if (stats) {
+		++stats->samples;
+		stats->threads_sampled += current->len;
+	}
+
+	uint64_t decide_start = monotonic_ns();
+	struct state_list *owned = current;
+	int idle = 0;
+	if (job->policy_state) {
+		job->policy->observe(job->policy_state, &owned, interval_ms);
+		idle = job->policy->verdict(job->policy_state);
+	}
+	poll_histogram_add(&global_poll_profile.decide_ns,
+			   monotonic_ns() - decide_start);
+	if (idle) {
+		++job->hang_count;
+		++metrics->idle_samples;
+		if (job->hang_count > job->max_hangs) {
+			kill_child(child_pid, SIGTERM);
+			job->killed = 1;
+			if (stats) {
+				++stats->hangs;
+				++stats->sigterms;
+			}
+		}
+	} else {
+		job->hang_count = 0;
+		Ylog(1, "Child still appears to be"
+		     " doing something worthwhile\n");
+	}
+	metrics->busy_samples += busy ? 1 : 0;
+	metrics->hang_count = job->hang_count;
+	if (stats) {
+		stats->hang_count = job->hang_count;
+	}
+	free_states(owned);
+
+	if (job->killed) {
+		/* the grace period starts now */
+		job->deadline_ns = monotonic_ns() + grace_ns;
+		return 0;
+	}
+
+	unsigned next_ms = next_hang_check_interval(interval_ms,
+						    job->interval_min_ms,
+						    job->interval_max_ms,
+						    idle, busy);
+	if (next_ms != interval_ms) {
+		Ylog(1, "interval: %ums (min: %ums, max: %ums)\n",
+		     next_ms, job->interval_min_ms, job->interval_max_ms);
+		job->current_interval_ms = next_ms;
+		metrics->interval_ms = next_ms;
+		if (stats) {
+			stats->interval_ms = next_ms;
+		}
+	}
+	job->deadline_ns = next_deadline(job->deadline_ns, ms_to_ns(next_ms),
+					 monotonic_ns());
+	return 0;
+}
+
+/* the child of the job was found hung by other means than /proc */
+static void job_kill_hung(struct yoyo_job *job, uint64_t now)
+{
+	struct job_stats *stats = job_stats_of(job->index);
+	kill_child(job->pid, SIGTERM);
+	job->killed = 1;
+	if (stats) {
+		++stats->hangs;
+		++stats->sigterms;
+	}
+	job->deadline_ns = now + ms_to_ns(job->interval_ms);
+}
+
+/* the child of the job was seen to be alive by other means than /proc;
+ * its next check is at deadline */
+static void job_alive(struct yoyo_job *job, uint64_t deadline)
+{
+	struct job_stats *stats = job_stats_of(job->index);
+	job->hang_count = 0;
+	job->metrics.hang_count = 0;
+	if (stats) {
+		stats->hang_count = 0;
+	}
+	job->deadline_ns = deadline;
+}
+
+/* /proc is sampled until the child first writes to the heartbeat pipe */
+static int job_heartbeat(struct yoyo_job *job, uint64_t now)
+{
+	if (job->heartbeat_fd < 0 || job->killed) {
+		return 0;
+	}
+
+	/* drained at each deadline rather than watched, so that a child
+	 * which beats often does not wake yoyo each time */
+	unsigned long beats = 0;
+	char buf[4096];
+	ssize_t got = 0;
+	while ((got = read(job->heartbeat_fd, buf, sizeof(buf))) > 0) {
+		beats += (unsigned long)got;
+	}
+	errno = 0;
+
+	if (!beats && !job->beats) {
+		return 0;
+	}
+
+	if (beats) {
+		Ylog(job->beats ? 2 : 1, "child %ld: %lu heartbeat(s)\n",
+		     job->pid, beats);
+		job->beats += beats;
+		job_alive(job, next_deadline(job->deadline_ns,
+					     ms_to_ns(job->heartbeat_ms),
+					     monotonic_ns()));
+		return 1;
+	}
+
+	Ylog(0, "no heartbeat from child %ld in %ums\n", job->pid,
+	     job->heartbeat_ms);
+	job_kill_hung(job, now);
+	return 1;
+}
+
+/* /proc is sampled until the child first advances the progress counter */
+static int job_progress(struct yoyo_job *job, uint64_t now)
+{
+	if (!job->progress_map || job->killed) {
+		return 0;
+	}
+
+	/* the child's stores are relaxed, and so is this load: only a
+	 * change matters, not what else the child wrote before it */
+	uint64_t count = __atomic_load_n(&job->progress_map->count,
+					 __ATOMIC_RELAXED);
+	if (count == job->progress_seen && !job->progress_seen) {
+		return 0;
+	}
+
+	struct monitor_metrics *metrics = &job->metrics;
+	uint64_t deadline = next_deadline(job->deadline_ns,
+					  ms_to_ns(job->current_interval_ms),
+					  monotonic_ns());
+	++metrics->samples;
+	if (count != job->progress_seen) {
+		Ylog(job->progress_seen ? 2 : 1, "child %ld: progress %llu\n",
+		     job->pid, (unsigned long long)count);
+		job->progress_seen = count;
+		++metrics->busy_samples;
+		job_alive(job, deadline);
+		return 1;
+	}
+
+	struct job_stats *stats = job_stats_of(job->index);
+	++job->hang_count;
+	++metrics->idle_samples;
+	metrics->hang_count = job->hang_count;
+	if (stats) {
+		stats->hang_count = job->hang_count;
+	}
+	if (job->hang_count > job->max_hangs) {
+		Ylog(0, "progress of child %ld stopped at %llu\n", job->pid,
+		     (unsigned long long)count);
+		job_kill_hung(job, now);
+		return 1;
+	}
+	job->deadline_ns = deadline;
+	return 1;
+}
+
+/* one datagram to NOTIFY_SOCKET: newline separated assignments, of which
+ * READY, WATCHDOG, WATCHDOG_USEC and STATUS are understood */
+static void job_notify_parse(struct yoyo_job *job, char *msg, uint64_t now)
+{
+	char *save = NULL;
+	for (char *line = strtok_r(msg, "\n", &save); line;
+	     line = strtok_r(NULL, "\n", &save)) {
+		if (strcmp(line, "READY=1") == 0) {
+			Ylog(job->ready ? 2 : 1, "child %ld ready\n", job->pid);
+			job->ready = 1;
+			job->watchdog_seen_ns = now;
+		} else if (strcmp(line, "WATCHDOG=1") == 0) {
+			Ylog(3, "child %ld watchdog\n", job->pid);
+			job->watchdog_seen_ns = now;
+		} else if (strcmp(line, "WATCHDOG=trigger") == 0) {
+			Ylog(0, "child %ld triggered its watchdog%s%s\n",
+			     job->pid, job->status[0] ? ", status: " : "",
+			     job->status);
+			job_kill_hung(job, now);
+			return;
+		} else if (strncmp(line, "WATCHDOG_USEC=", 14) == 0) {
+			char *end = NULL;
+			unsigned long long usec = strtoull(line + 14, &end, 10);
+			if (end == line + 14 || *end) {
+				Ylog(0, "child %ld: bad %s\n", job->pid, line);
+				continue;
+			}
+			Ylog(1, "child %ld watchdog: %lluus\n", job->pid, usec);
+			job->watchdog_ns = usec * 1000;
+		} else if (strncmp(line, "STATUS=", 7) == 0) {
+			snprintf(job->status, sizeof(job->status), "%s",
+				 line + 7);
+			Ylog(1, "child %ld status: %s\n", job->pid, job->status);
+		}
+	}
+}
+
+/* read what the child sent to NOTIFY_SOCKET, without blocking; only the
+ * child itself, or a process of the same user, is listened to, as any
+ * process may send to an abstract address.  The socket is drained even
+ * once the child was killed, as epoll would otherwise keep reporting it */
+static void job_notify_read(struct yoyo_job *job, uint64_t now)
+{
+	char msg[4096];
+	union {
+		struct cmsghdr align;
+		char buf[CMSG_SPACE(sizeof(struct ucred))];
+	} control;
+	while (job->notify_fd >= 0) {
+		struct iovec iov = { msg, sizeof(msg) - 1 };
+		struct msghdr header;
+		memset(&header, 0x00, sizeof(struct msghdr));
+		header.msg_iov = &iov;
+		header.msg_iovlen = 1;
+		header.msg_control = control.buf;
+		header.msg_controllen = sizeof(control.buf);
+		ssize_t got = recvmsg(job->notify_fd, &header, MSG_DONTWAIT);
+		if (got < 0) {
+			break;
+		}
+
+		struct ucred cred = { 0, (uid_t)-1, (gid_t)-1 };
+		struct cmsghdr *cmsg = CMSG_FIRSTHDR(&header);
+		if (cmsg && cmsg->cmsg_level == SOL_SOCKET
+		    && cmsg->cmsg_type == SCM_CREDENTIALS) {
+			memcpy(&cred, CMSG_DATA(cmsg), sizeof(struct ucred));
+		}
+		if (cred.pid != job->pid && cred.uid != geteuid()) {
+			Ylog(1, "ignored notify from pid %ld, uid %ld\n",
+			     (long)cred.pid, (long)cred.uid);
+			continue;
+		}
+		if (!job->killed) {
+			msg[got] = '\0';
+			job_notify_parse(job, msg, now);
+		}
+	}
+	errno = 0;
+}
+
+/* /proc is sampled until the child is ready or first pings its watchdog,
+ * and throughout if it has none */
+static int job_watchdog(struct yoyo_job *job, uint64_t now)
+{
+	job_notify_read(job, monotonic_ns());
+	if (job->notify_fd < 0 || job->killed || !job->watchdog_ns
+	    || !job->watchdog_seen_ns) {
+		return 0;
+	}
+
+	uint64_t expires = job->watchdog_seen_ns + job->watchdog_ns;
+	if (now < expires) {
+		job_alive(job, expires);
 		return 1;
 	}
 
-	err = yoyo_kill(child_pid, SIGKILL);
-	/* ESRCH: No such process */
-	log_level = (err && (errno != ESRCH)) ? 0 : 1;
-	Ylog(log_level, "kill(child_pid, SIGKILL) returned %d\n", err);
-	yoyo_sleep(0);		// yield after kill
-	return 2;
+	Ylog(0, "no watchdog from child %ld in %lluus%s%s\n", job->pid,
+	     (unsigned long long)(job->watchdog_ns / 1000),
+	     job->status[0] ? ", status: " : "", job->status);
+	job_kill_hung(job, now);
+	return 1;
+}
+
+/* /proc is sampled until the child first writes to its stdout or stderr,
+ * and once it has closed both */
+static int job_output(struct supervisor *sv, struct yoyo_job *job,
+		      uint64_t now)
+{
+	job_output_forward(sv, job, monotonic_ns());
+	if ((job->output_fds[0] < 0 && job->output_fds[1] < 0)
+	    || job->killed || !job->output_silence_ms || !job->output_seen_ns) {
+		return 0;
+	}
+
+	uint64_t expires = job->output_seen_ns
+	    + ms_to_ns(job->output_silence_ms);
+	if (now < expires) {
+		Ylog(2, "child %ld: %llu bytes of output\n", job->pid,
+		     job->output_bytes - job->output_checked_bytes);
+		job->output_checked_bytes = job->output_bytes;
+		job_alive(job, expires);
+		return 1;
+	}
+
+	Ylog(0, "no output from child %ld in %ums\n", job->pid,
+	     job->output_silence_ms);
+	job_kill_hung(job, now);
+	return 1;
+}
+
+/* null-safe */
+static void job_output_watch(struct supervisor *sv, struct yoyo_job *job,
+			     int output_fds[2])
+{
+	if (job->log_dir && output_fds[0] >= 0) {
+		/* monitor_child_for_hang has no argv, but yoyo() named it */
+		struct job_stats *stats = job_stats_of(job->index);
+		const char *name = job->name ? job->name
+		    : job->argv ? job->argv[0]
+		    : (stats && stats->name) ? stats->name : "child";
+		job->log = attempt_log_open(job->log_dir, name, job->index,
+					    job->attempts);
+		Ylog(job->log ? 1 : 0, "output of %ld %s %s\n", job->pid,
+		     job->log ? "written to" : "not written to",
+		     job->log ? job->log->path : job->log_dir);
+	}
+	for (size_t i = 0; i < 2; ++i) {
+		job->output_fds[i] = output_fds[i];
+		if (output_fds[i] >= 0
+		    && supervisor_watch(sv, output_fds[i],
+					SUPERVISOR_EV_OUTPUT)) {
+			/* still read at each deadline */
+			Ylog(1, "output %zu of %ld not watched\n", i + 1,
+			     job->pid);
+		}
+	}
+}
+
+/* null-safe */
+static void job_notify_watch(struct supervisor *sv, struct yoyo_job *job,
+			     int notify_fd)
+{
+	job->notify_fd = notify_fd;
+	if (notify_fd >= 0
+	    && supervisor_watch(sv, notify_fd, SUPERVISOR_EV_NOTIFY)) {
+		close_fds(&job->notify_fd, NULL);
+	}
+}
+
+static const char *job_name(const struct yoyo_job *job)
+{
+	return job->name ? job->name : job->argv[0];
+}
+
+static int job_spawn(struct supervisor *sv, struct yoyo_job *job)
+{
+	int beat_fd = -1;
+	int heartbeat_fd = job->heartbeat_ms ? heartbeat_open(&beat_fd) : -1;
+	int progress_fd = -1;
+	struct yoyo_progress *progress = job->progress
+	    ? progress_open(&progress_fd) : NULL;
+	char notify_name[sizeof(((struct sockaddr_un *) 0)->sun_path)];
+	int notify_fd = job->notify ? notify_open(notify_name,
+						  sizeof(notify_name)) : -1;
+	int output_fds[2] = { -1, -1 };
+	int output_write_fds[2] = { -1, -1 };
+	if (job->output_silence_ms || job->log_dir) {
+		output_open(output_fds, output_write_fds);
+	}
+
+	errno = 0;
+	pid_t child_pid = yoyo_fork();
+	if (child_pid < 0) {
+		Ylog(0, "fork() failed?\n");
+		close_fds(&heartbeat_fd, &beat_fd);
+		close_fds(&progress_fd, &notify_fd);
+		progress_close(&progress);
+		for (size_t i = 0; i < 2; ++i) {
+			close_fds(&output_fds[i], &output_write_fds[i]);
+		}
+		return -1;
+	} else if (child_pid == 0) {
+		// in child process
+		yoyo_sigprocmask(SIG_SETMASK, &sv->saved_mask, NULL);
+		child_restore_open_files_limit();
+		child_inherit_fd(beat_fd, "YOYO_HEARTBEAT_FD");
+		child_inherit_fd(progress_fd, "YOYO_PROGRESS_FD");
+		child_notify(notify_fd, notify_name, job->watchdog_ms);
+		child_output(output_write_fds);
+		for (char **env = job->env; env && *env; ++env) {
+			putenv(*env);
+		}
+		yoyo_execvp(job->argv[0], job->argv);
+		Ylog(0, "execvp(%s) failed\n", job->argv[0]);
+		_exit(127);
+	}
+
+	Ylog(1, "'%s' child_pid: %ld (attempt %u)\n", job_name(job),
+	     (long)child_pid, job->attempts + 1);
+	close_fds(NULL, &beat_fd);
+	close_fds(&progress_fd, &output_write_fds[0]);
+	close_fds(&output_write_fds[1], NULL);
+	job_attempt_begin(sv, job, child_pid);
+	job->heartbeat_fd = heartbeat_fd;
+	job->progress_map = progress;
+	job_notify_watch(sv, job, notify_fd);
+	job_output_watch(sv, job, output_fds);
+	return 0;
+}
+
+/* an attempt is over: record it and, when restarting, decide whether to */
+static void job_finish(struct supervisor *sv, struct yoyo_job *job,
+		       int respawn)
+{
+	job_attempt_end(sv, job);
+	if (!respawn) {
+		return;
+	}
+
+	const char *name = job_name(job);
+	struct exit_reason *reason = &job->reason;
+	job->succeeded = (!job->killed && reason->exited
+			  && reason->exit_code == 0);
+	if (job->succeeded) {
+		Ylog(0, "Child '%s' completed successfully\n", name);
+		if (job->restart != YOYO_RESTART_ALWAYS) {
+			return;
+		}
+	} else if (!job->killed && reason->exited) {
+		Ylog(0, "Child '%s' exited with status %d\n", name,
+		     reason->exit_code);
+	} else {
+		char er_buf[250];
+		exit_reason_to_str(reason, er_buf, 250);
+		Ylog(0, "Child '%s' killed, exit reason: %s\n", name, er_buf);
+	}
+
+	if (job->restart == YOYO_RESTART_NEVER) {
+		Ylog(0, "'%s' failed, restart is 'never'.\n", name);
+	} else if (job->attempts > job->max_retries) {
+		Ylog(0, "'%s' %s, retries limit reached.\n", name,
+		     job->succeeded ? "not restarted" : "failed");
+	} else if (job_spawn(sv, job)) {
+		Ylog(0, "'%s' could not be restarted\n", name);
+	}
+}
+
+/* run until none of the jobs has a child; with respawn, a child which
+ * did not succeed is restarted while its job has retries left */
+static void supervise(struct supervisor *sv, struct yoyo_job *jobs,
+		      size_t len, int respawn)
+{
+	struct exit_reason *reasons[len];
+	struct yoyo_job *due[len];
+	struct sampler_task samples[len];
+	for (;;) {
+		size_t running = 0;
+		size_t draining = 0;
+		uint64_t earliest = UINT64_MAX;
+		for (size_t i = 0; i < len; ++i) {
+			reasons[i] = jobs[i].pid ? &jobs[i].reason : NULL;
+			if (jobs[i].pid) {
+				++running;
+				if (jobs[i].deadline_ns < earliest) {
+					earliest = jobs[i].deadline_ns;
+				}
+			}
+			if (job_output_left_open(&jobs[i])) {
+				++draining;
+				if (jobs[i].output_left_ns < earliest) {
+					earliest = jobs[i].output_left_ns;
+				}
+			}
+		}
+		if (!running && !draining) {
+			return;
+		}
+
+		/* this also reaps any which exited before the signalfd
+		 * existed */
+		if (exit_reasons_reap(reasons, len)) {
+			for (size_t i = 0; i < len; ++i) {
+				if (job_reaped(&jobs[i])) {
+					Ylog(1, "child %ld exited\n",
+					     jobs[i].pid);
+					job_finish(sv, &jobs[i], respawn);
+				}
+			}
+			continue;
+		}
+
+		supervisor_arm_at(sv, earliest);
+		unsigned fired = supervisor_wait(sv);
+		if (!fired) {
+			for (size_t i = 0; i < len; ++i) {
+				if (jobs[i].pid) {
+					exit_reason_wait(&jobs[i].reason);
+					job_finish(sv, &jobs[i], 0);
+				}
+				close_fds(&jobs[i].output_left_fds[0],
+					  &jobs[i].output_left_fds[1]);
+			}
+			return;
+		}
+
+		if (Fired(fired, SUPERVISOR_EV_NOTIFY)) {
+			uint64_t now = monotonic_ns();
+			for (size_t i = 0; i < len; ++i) {
+				job_notify_read(&jobs[i], now);
+			}
+		}
+		if (Fired(fired, SUPERVISOR_EV_OUTPUT)) {
+			uint64_t now = monotonic_ns();
+			for (size_t i = 0; i < len; ++i) {
+				job_output_forward(sv, &jobs[i], now);
+			}
+		}
+
+		if (Fired(fired, SUPERVISOR_EV_SIGCHLD)
+		    || Fired(fired, SUPERVISOR_EV_PIDFD)) {
+			/* reap first; if a deadline passed as well, the timer
+			 * re-armed for it fires again at once */
+			continue;
+		}
+
+		if (Fired(fired, SUPERVISOR_EV_TIMER)) {
+			/* the timer was armed for the earliest deadline */
+			uint64_t now = monotonic_ns();
+			now = (now < earliest) ? earliest : now;
+			size_t due_len = 0;
+			size_t samples_len = 0;
+			for (size_t i = 0; i < len; ++i) {
+				struct yoyo_job *job = &jobs[i];
+				uint64_t due_by = now + batch_slack_ns;
+				if (job_output_left_open(job)
+				    && job->output_left_ns <= now) {
+					job_output_forward(sv, job, now);
+				}
+				/* each channel by which a child may show it is
+				 * alive returns 1 if that settles the deadline,
+				 * either way, or 0 if /proc is to be sampled */
+				if (job->pid && !job_reaped(job)
+				    && job->deadline_ns <= due_by
+				    && !job_heartbeat(job, now)
+				    && !job_progress(job, now)
+				    && !job_watchdog(job, now)
+				    && !job_output(sv, job, now)) {
+					due[due_len++] = job;
+				}
+			}
+			for (size_t i = 0; i < due_len; ++i) {
+				if (!due[i]->killed) {
+					samples[samples_len].pid = due[i]->pid;
+					samples[samples_len++].states = NULL;
+				}
+			}
+			/* the slow part of a pass, and the only part which the
+			 * pool spreads over its workers */
+			sampler_pool_run(sv->pool, samples, samples_len);
+			for (size_t i = 0; i < samples_len; ++i) {
+				struct poll_cost *cost = &samples[i].cost;
+				yoyo_stats_sample_time(cost->sample_ns);
+				poll_profile_add(&global_poll_profile, cost);
+			}
+			for (size_t i = 0, j = 0; i < due_len; ++i) {
+				struct yoyo_job *job = due[i];
+				struct state_list *current = job->killed ? NULL
+				    : samples[j++].states;
+				if (job_deadline(job, now, current)) {
+					job_finish(sv, job, respawn);
+				}
+			}
+		}
+	}
 }
 
 unsigned monitor_child_for_hang(long child_pid, unsigned max_hangs,
-				unsigned hang_check_interval)
-{
-	unsigned killed = 0;
-	unsigned int hang_count = 0;
-	struct state_list *thread_states = NULL;
-	while (!killed && pid_exists(child_pid)) {
-		unsigned int seconds = hang_check_interval;
-		unsigned int seconds_remaining = yoyo_sleep(seconds);
-		if (seconds_remaining) {
-			Ylog(1, "Interrupted with %u seconds remaining.\n",
-			     seconds_remaining);
-		}
-		struct state_list *previous = thread_states;
-		struct state_list *current = get_states(child_pid);
-		if (process_looks_hung(&thread_states, previous, current)) {
-			++hang_count;
-			if (hang_count > max_hangs) {
-				killed =
-				    term_then_kill(child_pid,
-						   hang_check_interval);
+				unsigned hang_check_interval_ms)
+{
+	struct yoyo_job job;
+	yoyo_job_init(&job, NULL, 0, max_hangs, hang_check_interval_ms);
+
+	struct supervisor sv;
+	if (supervisor_open(&sv)) {
+		Ylog(0, "can not monitor %ld, waiting for it to exit\n",
+		     child_pid);
+		job.reason.child_pid = child_pid;
+		close_fds(&global_heartbeat_fd, NULL);
+		progress_close(&global_progress);
+		close_fds(&global_notify_fd, NULL);
+		/* the child will get EPIPE, or SIGPIPE, if it writes */
+		close_fds(&global_output_fds[0], &global_output_fds[1]);
+		exit_reason_wait(&job.reason);
+		global_exit_reason = job.reason;
+		yoyo_job_release(&job);
+		return 0;
+	}
+
+	/* as if the earlier attempts were made by this job */
+	job.attempts = global_attempts;
+	job_attempt_begin(&sv, &job, child_pid);
+	job.heartbeat_fd = global_heartbeat_fd;
+	global_heartbeat_fd = -1;
+	job.progress_map = global_progress;
+	global_progress = NULL;
+	job_notify_watch(&sv, &job, global_notify_fd);
+	global_notify_fd = -1;
+	job_output_watch(&sv, &job, global_output_fds);
+	global_output_fds[0] = -1;
+	global_output_fds[1] = -1;
+	supervise(&sv, &job, 1, 0);
+	supervisor_close(&sv);
+
+	global_exit_reason = job.reason;
+	global_monitor_metrics = job.metrics;
+	unsigned killed = job.killed;
+	yoyo_job_release(&job);
+	return killed;
+}
+
+int yoyo_jobs(struct yoyo_job *jobs, size_t len)
+{
+	struct supervisor sv;
+	if (supervisor_open(&sv)) {
+		return EXIT_FAILURE;
+	}
+	if (sampler_workers > 1 && len > 1) {
+		unsigned workers = (sampler_workers < len) ? sampler_workers
+		    : (unsigned)len;
+		sv.pool = sampler_pool_new(workers);
+	}
+
+	yoyo_stats_reset(len);
+	for (size_t i = 0; i < len; ++i) {
+		jobs[i].index = (unsigned)i;
+		yoyo_stats_name(i, job_name(&jobs[i]));
+		job_spawn(&sv, &jobs[i]);
+	}
+	supervise(&sv, jobs, len, 1);
+	supervisor_close(&sv);
+
+	size_t failed = 0;
+	Ylog_append(0, "yoyo result summary:\n");
+	for (size_t i = 0; i < len; ++i) {
+		Ylog_append(0, "'%s' %s after %u attempt(s)\n",
+			    job_name(&jobs[i]),
+			    jobs[i].succeeded ? "succeeded" : "failed",
+			    jobs[i].attempts);
+		failed += jobs[i].succeeded ? 0 : 1;
+	}
+	yoyo_profile_summary();
+	return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+/* "--jobs cmd1 args ';' cmd2 args": the ';' arguments are replaced with
+ * NULL, so that each job's argv points into the argv of yoyo */
+static int yoyo_jobs_argv(int argc, char **argv, unsigned max_retries,
+			  unsigned max_hangs, unsigned hang_check_interval_ms)
+{
+	size_t len = 0;
+	for (int i = 0; i < argc; ++i) {
+		int starts_job = (i == 0 || strcmp(argv[i - 1], ";") == 0);
+		if (starts_job && strcmp(argv[i], ";") != 0) {
+			++len;
+		}
+	}
+	if (!len) {
+		print_help(Ystderr);
+		return EXIT_FAILURE;
+	}
+
+	struct yoyo_job *jobs = Calloc_or_log(len, sizeof(struct yoyo_job));
+	if (!jobs) {
+		return EXIT_FAILURE;
+	}
+	size_t j = 0;
+	for (int i = 0; i < argc; ++i) {
+		int starts_job = (i == 0 || argv[i - 1] == NULL);
+		if (strcmp(argv[i], ";") == 0) {
+			argv[i] = NULL;
+		} else if (starts_job) {
+			yoyo_job_init(&jobs[j++], argv + i, max_retries,
+				      max_hangs, hang_check_interval_ms);
+		}
+	}
+
+	int rv = yoyo_jobs(jobs, len);
+
+	for (size_t i = 0; i < len; ++i) {
+		yoyo_job_release(&jobs[i]);
+	}
+	yoyo_free(jobs);
+	return rv;
+}
+
+/* a manifest is read once at startup; the format is line based:
+ *
+ *	# settings before the first stanza are defaults for every job
+ *	max_retries = 3
+ *
+ *	[job web]
+ *	command = ./server --port "8080"
+ *	env = LOG_LEVEL=info
+ *	hang_check_interval = 250ms
+ *	restart = always
+ */
+struct manifest_parser {
+	const char *path;
+	unsigned line;
+	struct yoyo_job defaults;
+	unsigned interval_min_ms;
+	unsigned interval_max_ms;
+	/* the stanza being read */
+	struct yoyo_job job;
+	unsigned job_min_ms;
+	unsigned job_max_ms;
+	unsigned job_line;
+	int in_job;
+};
+
+#define Manifest_error(parser, format, ...) \
+	Ylog(0, "%s:%u: " format "\n", (parser)->path, (parser)->line, \
+	     __VA_ARGS__)
+
+static char *trim(char *str)
+{
+	while (isspace((unsigned char)*str)) {
+		++str;
+	}
+	size_t len = strlen(str);
+	while (len && isspace((unsigned char)str[len - 1])) {
+		str[--len] = '\0';
+	}
+	return str;
+}
+
+/* append to a NULL terminated array of strings */
+static int strings_append(char ***array, char *str)
+{
+	size_t len = 0;
+	while (*array && (*array)[len]) {
+		++len;
+	}
+	char **grown = Calloc_or_log(len + 2, sizeof(char *));
+	if (!grown) {
+		return -1;
+	}
+	for (size_t i = 0; i < len; ++i) {
+		grown[i] = (*array)[i];
+	}
+	grown[len] = str;
+	grown[len + 1] = NULL;
+	yoyo_free(*array);
+	*array = grown;
+	return 0;
+}
+
+/* split a command line into words in place: whitespace separates words,
+ * '...' is literal, and within "..." or outside quotes a backslash
+ * escapes the next character; no other shell syntax is understood */
+static int manifest_split_command(struct manifest_parser *parser, char *str)
+{
+	char *in = str;
+	char *out = str;
+	while (*in) {
+		while (isspace((unsigned char)*in)) {
+			++in;
+		}
+		if (!*in) {
+			break;
+		}
+		char *word = out;
+		char quote = '\0';
+		for (; *in && (quote || !isspace((unsigned char)*in)); ++in) {
+			if (quote == '\'' && *in == '\'') {
+				quote = '\0';
+			} else if (quote == '\'') {
+				*out++ = *in;
+			} else if (*in == '\\' && in[1]) {
+				*out++ = *++in;
+			} else if (*in == '"') {
+				quote = quote ? '\0' : '"';
+			} else if (*in == '\'' && !quote) {
+				quote = '\'';
+			} else {
+				*out++ = *in;
+			}
+		}
+		if (quote) {
+			Manifest_error(parser, "unterminated %c", quote);
+			return -1;
+		}
+		/* the terminator may overwrite the separator just read */
+		int more = (*in != '\0');
+		*out++ = '\0';
+		in += more;
+		if (strings_append(&parser->job.argv, word)) {
+			return -1;
+		}
+	}
+	return 0;
+}
+
+static int manifest_unsigned(struct manifest_parser *parser,
+			     const char *key, const char *val, unsigned *out)
+{
+	char *end = NULL;
+	errno = 0;
+	unsigned long ul = strtoul(val, &end, 10);
+	if (end == val || *end || errno || ul > UINT_MAX || val[0] == '-') {
+		errno = 0;
+		Manifest_error(parser, "%s '%s' is not a number", key, val);
+		return -1;
+	}
+	*out = (unsigned)ul;
+	return 0;
+}
+
+static int manifest_ms(struct manifest_parser *parser, const char *key,
+		       const char *val, unsigned *out)
+{
+	if (yoyo_parse_ms(val, out)) {
+		Manifest_error(parser, "%s '%s' is not a duration", key, val);
+		return -1;
+	}
+	return 0;
+}
+
+static int manifest_setting(struct manifest_parser *parser, char *key,
+			    char *val)
+{
+	struct yoyo_job *job = parser->in_job ? &parser->job
+	    : &parser->defaults;
+	unsigned *min_ms = parser->in_job ? &parser->job_min_ms
+	    : &parser->interval_min_ms;
+	unsigned *max_ms = parser->in_job ? &parser->job_max_ms
+	    : &parser->interval_max_ms;
 
+	if (strcmp(key, "command") == 0 || strcmp(key, "env") == 0) {
+		if (!parser->in_job) {
+			Manifest_error(parser, "%s outside of a [job]", key);
+			return -1;
+		}
+		if (key[0] == 'e') {
+			if (!strchr(val, '=') || val[0] == '=') {
+				Manifest_error(parser, "env '%s' is not "
+					       "NAME=value", val);
+				return -1;
 			}
+			return strings_append(&job->env, val);
+		}
+		if (job->argv) {
+			Manifest_error(parser, "%s", "second command");
+			return -1;
+		}
+		return manifest_split_command(parser, val);
+	} else if (strcmp(key, "max_retries") == 0) {
+		return manifest_unsigned(parser, key, val, &job->max_retries);
+	} else if (strcmp(key, "max_hangs") == 0) {
+		return manifest_unsigned(parser, key, val, &job->max_hangs);
+	} else if (strcmp(key, "max_thread_churn") == 0) {
+		unsigned churn = 0;
+		int err = manifest_unsigned(parser, key, val, &churn);
+		job->thresholds.max_thread_churn = churn;
+		return err;
+	} else if (strcmp(key, "hang_check_interval") == 0) {
+		return manifest_ms(parser, key, val, &job->interval_ms);
+	} else if (strcmp(key, "hang_check_interval_min") == 0) {
+		return manifest_ms(parser, key, val, min_ms);
+	} else if (strcmp(key, "hang_check_interval_max") == 0) {
+		return manifest_ms(parser, key, val, max_ms);
+	} else if (strcmp(key, "heartbeat") == 0) {
+		return manifest_ms(parser, key, val, &job->heartbeat_ms);
+	} else if (strcmp(key, "progress") == 0) {
+		return manifest_unsigned(parser, key, val, &job->progress);
+	} else if (strcmp(key, "log_dir") == 0) {
+		job->log_dir = val;
+		return 0;
+	} else if (strcmp(key, "output_silence") == 0) {
+		return manifest_ms(parser, key, val, &job->output_silence_ms);
+	} else if (strcmp(key, "notify") == 0) {
+		return manifest_unsigned(parser, key, val, &job->notify);
+	} else if (strcmp(key, "watchdog") == 0) {
+		int err = manifest_ms(parser, key, val, &job->watchdog_ms);
+		job->notify = job->watchdog_ms ? 1 : job->notify;
+		return err;
+	} else if (strcmp(key, "hang_policy") == 0) {
+		job->policy = hang_policy_find(val, &job->policy_args);
+		if (!job->policy) {
+			Manifest_error(parser, "hang_policy '%s' not found", val);
+			return -1;
+		}
+		return 0;
+	} else if (strcmp(key, "restart") == 0) {
+		if (strcmp(val, "on-failure") == 0) {
+			job->restart = YOYO_RESTART_ON_FAILURE;
+		} else if (strcmp(val, "always") == 0) {
+			job->restart = YOYO_RESTART_ALWAYS;
+		} else if (strcmp(val, "never") == 0) {
+			job->restart = YOYO_RESTART_NEVER;
 		} else {
-			hang_count = 0;
-			Ylog(1, "Child still appears to be"
-			     " doing something worthwhile\n");
+			Manifest_error(parser, "restart '%s' is not one of "
+				       "on-failure, always, never", val);
+			return -1;
+		}
+		return 0;
+	}
+	Manifest_error(parser, "unknown setting '%s'", key);
+	return -1;
+}
+
+static void manifest_job_start(struct manifest_parser *parser, char *name)
+{
+	parser->job = parser->defaults;
+	parser->job.name = (name && *name) ? name : NULL;
+	parser->job_min_ms = parser->interval_min_ms;
+	parser->job_max_ms = parser->interval_max_ms;
+	parser->job_line = parser->line;
+	parser->in_job = 1;
+}
+
+/* the stanza is complete: set up the next job of the manifest with it */
+static int manifest_job_end(struct manifest_parser *parser,
+			    struct yoyo_manifest *manifest)
+{
+	if (!parser->in_job) {
+		return 0;
+	}
+	parser->in_job = 0;
+
+	struct yoyo_job *from = &parser->job;
+	if (!from->argv) {
+		parser->line = parser->job_line;
+		Manifest_error(parser, "%s", "[job] without a command");
+		yoyo_free(from->env);
+		return -1;
+	}
+
+	struct yoyo_job *job = &manifest->jobs[manifest->len++];
+	int err = yoyo_job_init(job, from->argv, from->max_retries,
+				from->max_hangs, from->interval_ms);
+	job->name = from->name;
+	job->env = from->env;
+	job->restart = from->restart;
+	job->thresholds.max_thread_churn = from->thresholds.max_thread_churn;
+	job->policy = from->policy;
+	job->policy_args = from->policy_args;
+	job->heartbeat_ms = from->heartbeat_ms;
+	job->progress = from->progress;
+	job->notify = from->notify;
+	job->watchdog_ms = from->watchdog_ms;
+	job->output_silence_ms = from->output_silence_ms;
+	job->log_dir = from->log_dir;
+	yoyo_job_interval_bounds(job, parser->job_min_ms, parser->job_max_ms);
+	return err;
+}
+
+static int manifest_line(struct manifest_parser *parser,
+			 struct yoyo_manifest *manifest, char *line)
+{
+	line = trim(line);
+	if (line[0] == '\0' || line[0] == '#') {
+		return 0;
+	}
+
+	size_t len = strlen(line);
+	if (line[0] == '[') {
+		if (line[len - 1] != ']') {
+			Manifest_error(parser, "'%s' is missing ']'", line);
+			return -1;
+		}
+		line[len - 1] = '\0';
+		char *name = trim(line + 1);
+		if (strncmp(name, "job", 3) != 0
+		    || (name[3] && !isspace((unsigned char)name[3]))) {
+			Manifest_error(parser, "[%s] is not a [job]", name);
+			return -1;
 		}
-		free_states(previous);
-		if (thread_states != current) {
-			free_states(current);
+		if (manifest_job_end(parser, manifest)) {
+			return -1;
 		}
+		manifest_job_start(parser, trim(name + 3));
+		return 0;
 	}
-	free_states(thread_states);
-	return killed;
+
+	char *eq = strchr(line, '=');
+	if (!eq) {
+		Manifest_error(parser, "'%s' is not 'setting = value'", line);
+		return -1;
+	}
+	*eq = '\0';
+	return manifest_setting(parser, trim(line), trim(eq + 1));
+}
+
+struct yoyo_manifest *yoyo_manifest_parse(char *text, const char *path,
+					  unsigned max_retries,
+					  unsigned max_hangs,
+					  unsigned interval_ms)
+{
+	struct yoyo_manifest *manifest =
+	    Calloc_or_log(1, sizeof(struct yoyo_manifest));
+	if (!manifest) {
+		yoyo_free(text);
+		return NULL;
+	}
+	memset(manifest, 0x00, sizeof(struct yoyo_manifest));
+	manifest->text = text;
+
+	/* every stanza begins with a '[' line, so this many jobs at most */
+	size_t stanzas = 0;
+	for (const char *line = text; line; line = strchr(line, '\n')) {
+		line += (*line == '\n') ? 1 : 0;
+		while (*line == ' ' || *line == '\t') {
+			++line;
+		}
+		stanzas += (*line == '[') ? 1 : 0;
+	}
+	if (stanzas) {
+		size_t size = sizeof(struct yoyo_job);
+		manifest->jobs = Calloc_or_log(stanzas, size);
+		if (!manifest->jobs) {
+			yoyo_manifest_free(manifest);
+			return NULL;
+		}
+	}
+
+	struct manifest_parser parser;
+	memset(&parser, 0x00, sizeof(struct manifest_parser));
+	parser.path = path;
+	parser.defaults.max_retries = max_retries;
+	parser.defaults.max_hangs = max_hangs;
+	parser.defaults.interval_ms = interval_ms;
+	parser.defaults.thresholds = hang_thresholds;
+	parser.defaults.policy = global_hang_policy;
+	parser.defaults.policy_args = global_hang_policy_args;
+	parser.defaults.heartbeat_ms = heartbeat_ms;
+	parser.defaults.progress = use_progress;
+	parser.defaults.notify = use_notify;
+	parser.defaults.watchdog_ms = watchdog_ms;
+	parser.defaults.output_silence_ms = output_silence_ms;
+	parser.defaults.log_dir = log_dir;
+	parser.interval_min_ms = hang_check_interval_min_ms;
+	parser.interval_max_ms = hang_check_interval_max_ms;
+
+	int err = 0;
+	char *line = text;
+	while (line && !err) {
+		++parser.line;
+		char *next = strchr(line, '\n');
+		if (next) {
+			*next++ = '\0';
+		}
+		err = manifest_line(&parser, manifest, line);
+		line = next;
+	}
+	if (!err) {
+		err = manifest_job_end(&parser, manifest);
+	} else if (parser.in_job) {
+		yoyo_free(parser.job.argv);
+		yoyo_free(parser.job.env);
+	}
+	if (!err && !manifest->len) {
+		Ylog(0, "%s: no [job] in manifest\n", path);
+		err = -1;
+	}
+	if (err) {
+		yoyo_manifest_free(manifest);
+		return NULL;
+	}
+	Ylog(1, "%s: %zu job(s)\n", path, manifest->len);
+	return manifest;
+}
+
+struct yoyo_manifest *yoyo_manifest_load(const char *path,
+					 unsigned max_retries,
+					 unsigned max_hangs,
+					 unsigned interval_ms)
+{
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	struct stat st;
+	if (fd < 0 || fstat(fd, &st)) {
+		Ylog(0, "can not read manifest '%s'\n", path);
+		if (fd >= 0) {
+			close(fd);
+		}
+		return NULL;
+	}
+
+	size_t size = (size_t)st.st_size;
+	char *text = Calloc_or_log(size + 1, 1);
+	size_t used = 0;
+	while (text && used < size) {
+		ssize_t got = read(fd, text + used, size - used);
+		if (got <= 0) {
+			break;
+		}
+		used += (size_t)got;
+	}
+	close(fd);
+	if (!text) {
+		return NULL;
+	}
+	text[used] = '\0';
+
+	return yoyo_manifest_parse(text, path, max_retries, max_hangs,
+				   interval_ms);
+}
+
+void yoyo_manifest_free(struct yoyo_manifest *manifest)
+{
+	if (!manifest) {
+		return;
+	}
+	for (size_t i = 0; i < manifest->len; ++i) {
+		yoyo_free(manifest->jobs[i].argv);
+		yoyo_free(manifest->jobs[i].env);
+		yoyo_job_release(&manifest->jobs[i]);
+	}
+	yoyo_free(manifest->jobs);
+	yoyo_free(manifest->text);
+	yoyo_free(manifest);
+}
+
+static int yoyo_jobs_manifest(int argc, char **argv, unsigned max_retries,
+			      unsigned max_hangs,
+			      unsigned hang_check_interval_ms)
+{
+	if (argc != 1) {
+		print_help(Ystderr);
+		return EXIT_FAILURE;
+	}
+
+	struct yoyo_manifest *manifest =
+	    yoyo_manifest_load(argv[0], max_retries, max_hangs,
+			       hang_check_interval_ms);
+	if (!manifest) {
+		return EXIT_FAILURE;
+	}
+	int rv = yoyo_jobs(manifest->jobs, manifest->len);
+	yoyo_manifest_free(manifest);
+	return rv;
 }
 
 int appendf(char *buf, size_t bufsize, const char *format, ...)
@@ -606,6 +5568,13 @@ int print_help(FILE *out)
 	fprintf(out, "\n");
 	fprintf(out, "Usage: yoyo program program-args...\n");
 	fprintf(out, "or\n");
+	fprintf(out, "  --jobs program args... ';' program args...\n");
+	fprintf(out, "                             ");
+	fprintf(out, "run and monitor many programs\n");
+	fprintf(out, "or\n");
+	fprintf(out, "  --manifest file            ");
+	fprintf(out, "run and monitor the jobs of a manifest\n");
+	fprintf(out, "or\n");
 	fprintf(out, "  --version                  ");
 	fprintf(out, "print version (%s) and exit\n", yoyo_version);
 	fprintf(out, "  --help                     ");
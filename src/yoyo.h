@@ -5,7 +5,10 @@
 #ifndef YOYO_H
 #define YOYO_H
 
+#include <pthread.h>
 #include <stddef.h>		/* size_t */
+#include <stdint.h>		/* uint64_t */
+#include <stdio.h>		/* FILE */
 
 struct thread_state {
 	/* According to POSIX, pid_t is a signed int no wider than long */
@@ -13,6 +16,13 @@ struct thread_state {
 	char state;
 	unsigned long utime;
 	unsigned long stime;
+	/* further fields of /proc/<pid>/task/<tid>/stat, see proc(5) */
+	unsigned long minflt;
+	unsigned long majflt;
+	long num_threads;
+	unsigned long starttime;
+	int processor;
+	unsigned long delayacct_blkio_ticks;
 };
 
 struct state_list {
@@ -20,6 +30,143 @@ struct state_list {
 	size_t len;
 };
 
+/* the open /proc/<pid>/task/<tid>/ file descriptors of a thread */
+struct tid_fd {
+	long tid;
+	int fd;
+	/* "children" file; -1 if not yet opened, -2 if not available */
+	int children_fd;
+};
+
+/* keeps the per-thread stat files of a process open between polls */
+struct proc_sampler {
+	long pid;
+	/* /proc/<pid>/task, rewound and re-read with getdents64 each poll */
+	int task_fd;
+	/* sorted by tid; "spare" is swapped in when the task set changes */
+	struct tid_fd *tids;
+	struct tid_fd *spare;
+	size_t len;
+	size_t capacity;
+	/* the threads read by the most recent poll */
+	struct thread_state *states;
+	size_t states_len;
+	/* reusable buffer of the tids found by the most recent scan */
+	long *found;
+	size_t found_len;
+	size_t found_capacity;
+	/* child pids, sorted, as of this poll and as of the last change */
+	int follow_children;
+	long *children;
+	size_t children_len;
+	size_t children_capacity;
+	long *known_children;
+	size_t known_children_len;
+	size_t known_children_capacity;
+	/* the sampler of the parent process, if part of a proc_tree */
+	struct proc_sampler *parent;
+	int gone;
+	/* running totals, for benchmarks and instrumentation */
+	unsigned long polls;
+	unsigned long syscalls;
+	unsigned long bytes_read;
+	unsigned long opens;
+	unsigned long closes;
+	unsigned long long parse_ns;
+};
+
+/* a process and, optionally, all of its descendant processes */
+struct proc_tree {
+	long root_pid;
+	int descendants;
+	/* parents always precede their children */
+	struct proc_sampler **procs;
+	size_t len;
+	size_t capacity;
+	/* how often a process was found to have forked or reaped children */
+	unsigned long rescans;
+	/* membership is maintained from proc connector events */
+	int events;
+	/* read all children files on the next poll */
+	int needs_rescan;
+	struct proc_tree *next;
+};
+
+/* a netlink proc connector subscription for fork and exit events */
+struct proc_connector {
+	int fd;
+	unsigned long events;
+	unsigned long overruns;
+};
+
+/* what process_looks_hung tolerates while still calling a process hung */
+struct hang_thresholds {
+	/* utime and stime of each thread may grow by at most this many ticks */
+	unsigned long max_tick_delta;
+	/* threads which may appear or vanish between two snapshots */
+	size_t max_thread_churn;
+};
+
+/* what a hang_policy is set up with for each attempt */
+struct hang_policy_config {
+	/* for default_hang_check_interval_ms; hang_thresholds_for_interval
+	 * scales them to the interval of a snapshot */
+	struct hang_thresholds thresholds;
+	/* what followed the ':' of "name:args", or NULL */
+	const char *args;
+	/* frees a snapshot which the policy kept */
+	void (*release)(struct state_list *snapshot);
+};
+
+/* bumped whenever struct hang_policy or struct hang_policy_config
+ * change in a way which a policy built against the old ones would
+ * misread */
+#define YOYO_HANG_POLICY_ABI 1
+
+/* decides from the snapshots of an attempt, in turn, whether it looks
+ * hung; yoyo kills the attempt once more than max_hangs in a row do */
+struct hang_policy {
+	/* YOYO_HANG_POLICY_ABI as the policy was built with; a shared
+	 * object built for another is not loaded */
+	unsigned abi_version;
+	const char *name;
+	/* returns the state of the policy for one attempt, NULL on error */
+	void *(*init)(const struct hang_policy_config *config);
+	/* a snapshot taken interval_ms after the previous one; it may be
+	 * reordered in place, and kept by setting *snapshot to NULL, after
+	 * which yoyo no longer reads it: the policy owns it, and must free
+	 * it with config->release, at the latest in free */
+	void (*observe)(void *state, struct state_list **snapshot,
+			unsigned interval_ms);
+	/* non-zero if the latest snapshot looks hung */
+	int (*verdict)(void *state);
+	/* null-safe */
+	void (*free)(void *state);
+};
+
+/* what monitor_child_for_hang has observed of the current child */
+struct monitor_metrics {
+	unsigned long samples;
+	/* samples which looked hung, and which showed the child busy */
+	unsigned long idle_samples;
+	unsigned long busy_samples;
+	unsigned hang_count;
+	/* the adaptive sampling interval, and its bounds */
+	unsigned interval_ms;
+	unsigned interval_min_ms;
+	unsigned interval_max_ms;
+};
+
+/* what woke the supervision loop, as stored in epoll_event.data.u64 */
+enum supervisor_event {
+	SUPERVISOR_EV_SIGCHLD = 1,
+	SUPERVISOR_EV_TIMER = 2,
+	SUPERVISOR_EV_PIDFD = 3,
+	SUPERVISOR_EV_METRICS = 4,
+	SUPERVISOR_EV_NOTIFY = 5,
+	SUPERVISOR_EV_OUTPUT = 6,
+};
+
 struct exit_reason {
 	long child_pid;
 	int wait_status;
@@ -33,9 +180,100 @@ struct exit_reason {
 	int continued;
 };
 
+/* when a job's child is started again */
+enum yoyo_restart {
+	YOYO_RESTART_ON_FAILURE = 0,
+	YOYO_RESTART_ALWAYS,
+	YOYO_RESTART_NEVER,
+};
+
+/* a command line supervised by yoyo, and its state across attempts */
+struct yoyo_job {
+	/* what to run, and how to judge it */
+	const char *name;
+	char **argv;
+	/* NULL terminated "NAME=value" strings added to the environment */
+	char **env;
+	enum yoyo_restart restart;
+	unsigned max_retries;
+	unsigned max_hangs;
+	unsigned interval_ms;
+	unsigned interval_min_ms;
+	unsigned interval_max_ms;
+	struct hang_thresholds thresholds;
+	const struct hang_policy *policy;
+	const char *policy_args;
+	/* if not zero, the child is given a pipe to write to as it makes
+	 * progress, and once it has, is hung if silent this long */
+	unsigned heartbeat_ms;
+	/* if not zero, the child is given a shared counter to advance as it
+	 * makes progress (see yoyo-progress.h) */
+	unsigned progress;
+	/* if not zero, the child is given a NOTIFY_SOCKET, as systemd does,
+	 * and once it sends READY=1 or WATCHDOG=1, is hung if it does not
+	 * send WATCHDOG=1 within watchdog_ms (or the WATCHDOG_USEC it sent) */
+	unsigned notify;
+	unsigned watchdog_ms;
+	/* if not zero, the stdout and stderr of the child are passed on
+	 * through pipes, and once it has written, is hung if silent this
+	 * long */
+	unsigned output_silence_ms;
+	/* if not NULL, the output of each attempt is written to files in
+	 * this directory rather than to yoyo's stdout and stderr */
+	const char *log_dir;
+
+	/* the position of the job on the command line or in the manifest */
+	unsigned index;
+
+	/* the current attempt; pid is 0 between attempts */
+	long pid;
+	int pidfd;
+	unsigned attempts;
+	unsigned killed;
+	unsigned hang_count;
+	unsigned current_interval_ms;
+	unsigned long long deadline_ns;
+	void *policy_state;
+	/* the reading end of the heartbeat pipe, and the beats read */
+	int heartbeat_fd;
+	unsigned long beats;
+	/* the shared progress counter, and its value at the last check */
+	struct yoyo_progress *progress_map;
+	uint64_t progress_seen;
+	/* the notify socket, and what the child last sent to it */
+	int notify_fd;
+	int ready;
+	unsigned long long watchdog_ns;
+	unsigned long long watchdog_seen_ns;
+	char status[80];
+	/* the reading ends of the stdout and stderr pipes, whether each is
+	 * copied rather than spliced, or held back for a slow reader of
+	 * yoyo's own, and the bytes passed on */
+	int output_fds[2];
+	int output_copy[2];
+	int output_held[2];
+	unsigned long long output_bytes;
+	unsigned long long output_checked_bytes;
+	unsigned long long output_seen_ns;
+	/* the pipes of an ended attempt, held back for a slow reader, and
+	 * when what is still in them is dropped */
+	int output_left_fds[2];
+	unsigned long long output_left_ns;
+	struct attempt_log *log;
+	int have_ticks;
+	unsigned long long last_ticks;
+	struct exit_reason reason;
+	struct monitor_metrics metrics;
+
+	/* how each finished attempt ended */
+	struct exit_reason *history;
+	size_t history_len;
+	int succeeded;
+};
+
 /* advertised constants */
 extern const char *yoyo_version;
-extern const int default_hang_check_interval;
+extern const int default_hang_check_interval_ms;
 extern const int default_max_hangs;
 extern const int default_max_retries;
 
@@ -43,15 +281,360 @@ extern const int default_max_retries;
 
 /* monitor a child process; signal the process if it looks hung */
 unsigned monitor_child_for_hang(long child_pid, unsigned max_hangs,
-				unsigned hang_check_interval);
+				unsigned hang_check_interval_ms);
+
+/* set up a job with the global interval bounds and hang_thresholds;
+ * returns non-zero if the attempt history could not be allocated */
+int yoyo_job_init(struct yoyo_job *job, char **argv, unsigned max_retries,
+		  unsigned max_hangs, unsigned interval_ms);
+void yoyo_job_release(struct yoyo_job *job);
+
+/* run and supervise all of the jobs from one event loop, restarting each
+ * until it succeeds or runs out of retries; returns EXIT_SUCCESS if all
+ * of the jobs succeeded */
+int yoyo_jobs(struct yoyo_job *jobs, size_t len);
+
+/* jobs declared in a manifest; argv, env and name point into text */
+struct yoyo_manifest {
+	struct yoyo_job *jobs;
+	size_t len;
+	char *text;
+};
 
-/* look for evidence of a hung process */
+/* parse manifest text in place, taking ownership of it; the arguments
+ * are the defaults for settings the manifest does not give; returns NULL
+ * after logging the first error, in which case text is freed as well */
+struct yoyo_manifest *yoyo_manifest_parse(char *text, const char *path,
+					  unsigned max_retries,
+					  unsigned max_hangs,
+					  unsigned interval_ms);
+struct yoyo_manifest *yoyo_manifest_load(const char *path,
+					 unsigned max_retries,
+					 unsigned max_hangs,
+					 unsigned interval_ms);
+void yoyo_manifest_free(struct yoyo_manifest *manifest);
+
+/* look for evidence of a hung process, using the global hang_thresholds;
+ * threads are matched by tid, and current is sorted by tid in place */
 int process_looks_hung(struct state_list **next, struct state_list *previous,
 		       struct state_list *current);
 
-/* given a pid, create state_list based on the '/proc' filesystem */
+/* as above, with explicit thresholds */
+int process_looks_hung_thresholds(const struct hang_thresholds *thresholds,
+				  struct state_list **next,
+				  struct state_list *previous,
+				  struct state_list *current);
+
+/* all threads sleeping, with the same set of tasks and almost no
+ * utime or stime: process_looks_hung_thresholds */
+extern const struct hang_policy hang_policy_default;
+
+/* utime and stime summed over all threads growing by no more than the
+ * max_tick_delta, or the number given as "cpu:ticks", whatever the
+ * thread states and churn; for thread pools which come and go */
+extern const struct hang_policy hang_policy_cpu;
+
+/* spec is "name" or "name:args"; a name containing a '/' is a shared
+ * object defining "const struct hang_policy yoyo_hang_policy" with the
+ * abi_version of this yoyo; args is set to what follows the ':', or
+ * NULL; returns NULL if not found */
+const struct hang_policy *hang_policy_find(const char *spec,
+					   const char **args);
+
+/* the tick allowance is calibrated for default_hang_check_interval_ms;
+ * scale it to another interval, rounding up */
+struct hang_thresholds hang_thresholds_for_interval(const struct
+						    hang_thresholds *base,
+						    unsigned interval_ms);
+
+/* the utime and stime of all threads in the list, summed */
+unsigned long long state_list_ticks(const struct state_list *l);
+
+/* whether ticks consumed over an interval amount to over half a CPU */
+int ticks_look_busy(unsigned long long ticks, unsigned interval_ms);
+
+/* the next sampling interval: halved after a snapshot which looks idle,
+ * doubled after one which shows the child busy, kept within the bounds */
+unsigned next_hang_check_interval(unsigned interval_ms, unsigned min_ms,
+				  unsigned max_ms, int looks_idle,
+				  int looks_busy);
+
+/* a duration in milliseconds from the environment: "250ms", "1.5s", or
+ * as before, a plain number of seconds */
+unsigned yoyo_env_ms(unsigned default_ms, const char *env_var_name);
+
+/* the same duration syntax; returns non-zero if str is not a duration */
+int yoyo_parse_ms(const char *str, unsigned *ms);
+
+/* given a pid, create state_list based on the '/proc' filesystem;
+ * the stat files stay open until get_states_proc_release(pid) */
 struct state_list *get_states_proc(long pid);
 
+/* close the stat files cached by get_states_proc for the pid */
+void get_states_proc_release(long pid);
+
+/* what one poll of a job cost yoyo */
+struct poll_cost {
+	/* get_states, of which parsing the stat files, and the decision */
+	unsigned long long sample_ns;
+	unsigned long long parse_ns;
+	unsigned long long decide_ns;
+	unsigned long syscalls;
+	unsigned long bytes_read;
+	unsigned long threads;
+};
+
+/* a histogram with a bucket per power of two */
+struct poll_histogram {
+	unsigned long buckets[64];
+	unsigned long count;
+	unsigned long long sum;
+	unsigned long long min;
+	unsigned long long max;
+};
+
+/* the cost of every poll so far, stage by stage */
+struct poll_profile {
+	struct poll_histogram sample_ns;
+	struct poll_histogram parse_ns;
+	struct poll_histogram decide_ns;
+	struct poll_histogram syscalls;
+	struct poll_histogram bytes_read;
+	struct poll_histogram threads;
+};
+
+void poll_histogram_add(struct poll_histogram *h, unsigned long long val);
+
+/* an upper bound of the q quantile: the top of its bucket, or the max */
+unsigned long long poll_histogram_quantile(const struct poll_histogram *h,
+					   double q);
+
+/* all but decide_ns, which is added on its own once known */
+void poll_profile_add(struct poll_profile *profile,
+		      const struct poll_cost *cost);
+
+/* a table of count, mean, quantiles and max of each stage */
+int poll_profile_write(const struct poll_profile *profile, FILE *out);
+
+/* write the global poll profile to stderr; the summary only does so if
+ * YOYO_PROFILE is set */
+void yoyo_profile_dump(void);
+void yoyo_profile_summary(void);
+
+/* a process to sample in a pass, and its snapshot once sampled */
+struct sampler_task {
+	long pid;
+	struct state_list *states;
+	struct poll_cost cost;
+};
+
+/* the tasks owned by one worker: the owner takes from next, while a
+ * worker which ran out of tasks steals from end */
+struct sampler_shard {
+	pthread_mutex_t lock;
+	size_t next;
+	size_t end;
+	/* written by the owning worker only */
+	unsigned long sampled;
+	unsigned long stolen;
+};
+
+/* worker threads calling get_states for the tasks of a pass; the thread
+ * calling sampler_pool_run is worker 0, so one worker needs no thread */
+struct sampler_pool {
+	unsigned workers;
+	pthread_t *threads;
+	struct sampler_shard *shards;
+
+	pthread_mutex_t lock;
+	pthread_cond_t start;
+	pthread_cond_t done;
+	struct sampler_task *tasks;
+	unsigned long passes;
+	unsigned busy;
+	int stopping;
+};
+
+/* returns NULL if the pool could not be set up */
+struct sampler_pool *sampler_pool_new(unsigned workers);
+void sampler_pool_free(struct sampler_pool *pool);
+
+/* fill in the states of each of the tasks, returning when all are done;
+ * a NULL pool samples them on the calling thread */
+void sampler_pool_run(struct sampler_pool *pool, struct sampler_task *tasks,
+		      size_t len);
+
+/* the writing end of the shared memory snapshot ring of yoyo-ring.h */
+struct yoyo_ring_header;
+struct snapshot_ring {
+	struct yoyo_ring_header *header;
+	size_t size;
+	/* snapshots with more threads than fit in a slot */
+	unsigned long truncated;
+};
+
+/* create the ring file at path, replacing any previous one; returns NULL
+ * if it could not be created */
+struct snapshot_ring *snapshot_ring_open(const char *path, unsigned slots,
+					 unsigned max_threads);
+void snapshot_ring_close(struct snapshot_ring *ring);
+
+/* write the snapshot to the next slot; a NULL ring publishes nothing */
+void snapshot_ring_publish(struct snapshot_ring *ring, unsigned job,
+			   long pid, unsigned hang_count, unsigned max_hangs,
+			   const struct state_list *sl);
+
+/* appends every sampled state_list to a trace file, each thread encoded
+ * as the change from the same tid in the job's previous snapshot */
+struct trace_writer {
+	int fd;
+	/* the previous snapshot of each job, sorted by tid */
+	struct state_list **previous;
+	size_t jobs;
+	uint64_t last_ns;
+	/* a record is encoded here, then written with one write(2) */
+	unsigned char *buf;
+	size_t buf_capacity;
+	unsigned long records;
+	unsigned long long bytes;
+};
+
+/* opens, or creates, the trace file at path for appending; returns NULL
+ * if it could not be opened */
+struct trace_writer *trace_writer_open(const char *path);
+void trace_writer_close(struct trace_writer *writer);
+
+/* a NULL writer records nothing; returns non-zero on error */
+int trace_writer_append(struct trace_writer *writer, unsigned job, long pid,
+			uint64_t timestamp_ns, unsigned interval_ms,
+			const struct state_list *sl);
+
+/* reads back the snapshots of a trace file, in the order written */
+struct trace_reader {
+	const unsigned char *data;
+	size_t size;
+	size_t pos;
+	/* the latest snapshot of each job, sorted by tid */
+	struct state_list **previous;
+	size_t jobs;
+	uint64_t last_ns;
+	/* CLOCK_REALTIME when the recording yoyo opened the trace */
+	uint64_t session_ns;
+	unsigned long sessions;
+
+	/* the snapshot most recently read */
+	unsigned job;
+	long pid;
+	uint64_t timestamp_ns;
+	unsigned interval_ms;
+	const struct state_list *states;
+};
+
+/* maps the trace file; returns NULL if it is not a trace */
+struct trace_reader *trace_reader_open(const char *path);
+void trace_reader_close(struct trace_reader *reader);
+
+/* returns 1 if a snapshot was read, 0 at the end of the trace, or -1 if
+ * the trace is corrupt or truncated */
+int trace_reader_next(struct trace_reader *reader);
+
+/* run the policy over every snapshot of a trace, as yoyo would have,
+ * writing each hang found to out; returns the number of hangs, or -1 if
+ * the trace could not be read */
+long yoyo_replay_trace(const char *path, const struct hang_policy *policy,
+		       const struct hang_policy_config *config,
+		       unsigned max_hangs, FILE *out);
+
+/* counters kept for a job across all of its attempts */
+struct job_stats {
+	char *name;
+	unsigned long attempts;
+	/* attempts killed because they looked hung */
+	unsigned long hangs;
+	unsigned long sigterms;
+	unsigned long sigkills;
+	/* how attempts ended: exit status, or terminating signal 1..64 */
+	unsigned long exit_codes[256];
+	unsigned long term_signals[65];
+	unsigned long samples;
+	unsigned long threads_sampled;
+	/* gauges of the current attempt */
+	unsigned hang_count;
+	unsigned interval_ms;
+	int running;
+};
+
+#define YOYO_SAMPLE_BUCKETS 12
+
+/* what is served on the metrics socket */
+struct yoyo_stats {
+	struct job_stats *jobs;
+	size_t len;
+	/* the time taken to sample a job; not cumulative, unlike the
+	 * exposition format */
+	unsigned long sample_buckets[YOYO_SAMPLE_BUCKETS + 1];
+	unsigned long long sample_ns_sum;
+	unsigned long sample_count;
+	unsigned long scrapes;
+};
+
+/* set up counters for len jobs, discarding any previous ones; the jobs
+ * are named with yoyo_stats_name; returns non-zero on allocation error */
+int yoyo_stats_reset(size_t len);
+void yoyo_stats_name(size_t job, const char *name);
+void yoyo_stats_sample_time(unsigned long long ns);
+
+/* the Prometheus text exposition format of the global yoyo_stats */
+int yoyo_metrics_write(FILE *out);
+
+/* a listening unix socket at path, replacing whatever was there;
+ * returns -1 on error */
+int yoyo_metrics_listen(const char *path);
+
+/* answer each pending connection with the metrics and close it; returns
+ * within about 100ms, leaving any connections not yet accepted */
+void yoyo_metrics_serve(int listen_fd);
+
+/* will return NULL on OOM */
+struct proc_sampler *proc_sampler_new(long pid);
+
+/* re-read the stat file of every thread; opens and closes files only
+ * for threads which have appeared or vanished since the last sample */
+struct state_list *proc_sampler_sample(struct proc_sampler *sampler);
+
+/* null-safe; closes all the file descriptors */
+void proc_sampler_free(struct proc_sampler *sampler);
+
+/* will return NULL on OOM; descendants are followed via the children
+ * files of each thread, and only re-examined when those change */
+struct proc_tree *proc_tree_new(long pid, int descendants);
+
+/* the threads of all processes in the tree */
+struct state_list *proc_tree_sample(struct proc_tree *tree);
+
+/* null-safe; frees all the samplers */
+void proc_tree_free(struct proc_tree *tree);
+
+/* apply a fork or exit event to the tree; returns 1 if it changed */
+int proc_tree_forked(struct proc_tree *tree, long parent_tgid, long child_tgid);
+int proc_tree_exited(struct proc_tree *tree, long tgid);
+
+/* returns NULL if the connector is unavailable, e.g. without
+ * CAP_NET_ADMIN; callers should then fall back to scanning /proc */
+struct proc_connector *proc_connector_open(void);
+
+/* null-safe */
+void proc_connector_close(struct proc_connector *connector);
+
+/* apply all pending events to the linked list of trees; returns -1 if
+ * events were lost, in which case the trees will rescan /proc */
+int proc_connector_drain(struct proc_connector *connector,
+			 struct proc_tree *trees);
+
+/* parse the contents of a /proc/<pid>/task/<tid>/stat file without
+ * allocating; returns the number of required fields which are missing */
+int thread_state_from_stat(struct thread_state *ts, const char *buf);
+
 /* null-safe; frees the states as well as the state_list struct */
 void free_states_wrap(struct state_list *l, void *context);
 
@@ -72,8 +655,13 @@ int appendf(char *buf, size_t bufsize, const char *format, ...);
 void yoyo_log(int loglevel, int prefix, const char *file, int line,
 	      const char *func, const char *format, ...);
 
-/* trap child exits, and capture the exit_reason information */
-void exit_reason_child_trap(int sig);
+/* reap exited children without blocking; returns 1 if the one matching
+ * exit_reason->child_pid was reaped and its exit_reason captured */
+int exit_reason_reap(struct exit_reason *exit_reason);
+
+/* as above, for many; NULL entries are skipped; returns how many of the
+ * exit_reasons were captured */
+size_t exit_reasons_reap(struct exit_reason **exit_reasons, size_t len);
 
 /* zero the struct */
 void exit_reason_clear(struct exit_reason *exit_reason);
@@ -87,4 +675,7 @@ void exit_reason_to_str(struct exit_reason *exit_reason, char *buf, size_t len);
 
 int yoyo(int argc, char **argv);
 
+/* the yoyo-replay tool */
+int yoyo_replay(int argc, char **argv);
+
 #endif /* YOYO_H */
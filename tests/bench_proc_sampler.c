@@ -0,0 +1,122 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/* bench_proc_sampler: compare the cached sampler with fopen-per-poll */
+/* Copyright (C) 2020, 2021 Eric Herman <eric@freesa.org> */
+
+#include "yoyo.h"
+
+#include <glob.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+/* the pre-sampler approach: glob the stat files, fopen/fread/fclose each */
+struct state_list *legacy_get_states(long pid)
+{
+	char pattern[FILENAME_MAX];
+	snprintf(pattern, FILENAME_MAX, "/proc/%ld/task/*/stat", pid);
+
+	glob_t threads;
+	glob(pattern, GLOB_MARK, NULL, &threads);
+
+	struct state_list *sl = state_list_new(threads.gl_pathc);
+	char buf[FILENAME_MAX];
+	for (size_t i = 0; sl && i < threads.gl_pathc; ++i) {
+		if (slurp_text(buf, sizeof(buf), threads.gl_pathv[i])) {
+			thread_state_from_stat(&sl->states[i], buf);
+		}
+	}
+	globfree(&threads);
+	return sl;
+}
+
+/* read-class syscalls, as counted by the kernel in /proc/self/io */
+unsigned long read_syscalls(void)
+{
+	unsigned long syscr = 0;
+	char buf[512];
+	if (slurp_text(buf, sizeof(buf), "/proc/self/io")) {
+		const char *s = strstr(buf, "syscr:");
+		syscr = s ? strtoul(s + strlen("syscr:"), NULL, 10) : 0;
+	}
+	return syscr;
+}
+
+uint64_t now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (((uint64_t)ts.tv_sec) * 1000000000) + ts.tv_nsec;
+}
+
+int block_fds[2];
+void *block_on_pipe(void *arg)
+{
+	(void)arg;
+	char c;
+	return read(block_fds[0], &c, 1) < 0 ? NULL : NULL;
+}
+
+int main(int argc, char **argv)
+{
+	size_t threads = (argc > 1) ? strtoul(argv[1], NULL, 10) : 300;
+	size_t polls = (argc > 2) ? strtoul(argv[2], NULL, 10) : 100;
+
+	if (pipe(block_fds)) {
+		return EXIT_FAILURE;
+	}
+	pthread_t *tids = calloc(threads, sizeof(pthread_t));
+	for (size_t i = 0; tids && i < threads; ++i) {
+		pthread_create(&tids[i], NULL, block_on_pipe, NULL);
+	}
+	long pid = getpid();
+
+	/* slurp_text of /proc/self/io costs one read of its own */
+	unsigned long overhead = read_syscalls();
+	overhead = read_syscalls() - overhead;
+
+	unsigned long syscr = read_syscalls();
+	uint64_t start = now_ns();
+	for (size_t i = 0; i < polls; ++i) {
+		state_list_free(legacy_get_states(pid));
+	}
+	uint64_t legacy_ns = now_ns() - start;
+	unsigned long legacy_syscr = read_syscalls() - syscr - overhead;
+
+	struct proc_sampler *sampler = proc_sampler_new(pid);
+	state_list_free(proc_sampler_sample(sampler));
+	unsigned long sampler_syscalls = sampler->syscalls;
+	syscr = read_syscalls();
+	start = now_ns();
+	for (size_t i = 0; i < polls; ++i) {
+		state_list_free(proc_sampler_sample(sampler));
+	}
+	uint64_t sampler_ns = now_ns() - start;
+	unsigned long sampler_syscr = read_syscalls() - syscr - overhead;
+	sampler_syscalls = sampler->syscalls - sampler_syscalls;
+
+	printf("threads: %zu polls: %zu\n", threads + 1, polls);
+	printf("%-8s %12s %14s %14s\n", "", "ns/poll", "reads/poll",
+	       "syscalls/poll");
+	printf("%-8s %12lu %14.1f %14s\n", "legacy",
+	       (unsigned long)(legacy_ns / polls),
+	       (double)legacy_syscr / polls, "-");
+	printf("%-8s %12lu %14.1f %14.1f\n", "sampler",
+	       (unsigned long)(sampler_ns / polls),
+	       (double)sampler_syscr / polls, (double)sampler_syscalls / polls);
+
+	proc_sampler_free(sampler);
+	for (size_t i = 0; i < threads; ++i) {
+		if (write(block_fds[1], "x", 1) != 1) {
+			perror("write");
+		}
+	}
+	for (size_t i = 0; tids && i < threads; ++i) {
+		pthread_join(tids[i], NULL);
+	}
+	free(tids);
+	return EXIT_SUCCESS;
+}
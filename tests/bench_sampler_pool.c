@@ -0,0 +1,106 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/* bench_sampler_pool: time a sampling pass over many processes, sweeping
+ * the number of sampler workers */
+/* Copyright (C) 2020, 2021 Eric Herman <eric@freesa.org> */
+
+#include "yoyo.h"
+
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+uint64_t now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (((uint64_t)ts.tv_sec) * 1000000000) + ts.tv_nsec;
+}
+
+int block_fds[2];
+void *block_on_pipe(void *arg)
+{
+	(void)arg;
+	char c;
+	return read(block_fds[0], &c, 1) < 0 ? NULL : NULL;
+}
+
+/* a child with this many threads, all blocked until it is killed */
+pid_t spawn_threaded(size_t threads)
+{
+	pid_t pid = fork();
+	if (pid == 0) {
+		pthread_t tid;
+		for (size_t i = 0; i < threads; ++i) {
+			pthread_create(&tid, NULL, block_on_pipe, NULL);
+		}
+		block_on_pipe(NULL);
+		_exit(0);
+	}
+	return pid;
+}
+
+int main(int argc, char **argv)
+{
+	size_t procs = (argc > 1) ? strtoul(argv[1], NULL, 10) : 64;
+	size_t threads = (argc > 2) ? strtoul(argv[2], NULL, 10) : 20;
+	size_t passes = (argc > 3) ? strtoul(argv[3], NULL, 10) : 20;
+	unsigned max_workers = (argc > 4) ? strtoul(argv[4], NULL, 10) : 8;
+
+	if (pipe(block_fds)) {
+		return EXIT_FAILURE;
+	}
+	struct sampler_task *tasks = calloc(procs, sizeof(struct sampler_task));
+	if (!tasks) {
+		return EXIT_FAILURE;
+	}
+	/* the first process dwarfs the others, as one huge job would */
+	for (size_t i = 0; i < procs; ++i) {
+		tasks[i].pid = spawn_threaded(i ? threads : threads * 20);
+	}
+	/* let the threads start, then open the stat files of all of them */
+	usleep(200 * 1000);
+	sampler_pool_run(NULL, tasks, procs);
+	for (size_t i = 0; i < procs; ++i) {
+		state_list_free(tasks[i].states);
+	}
+
+	printf("processes: %zu threads: %zu (first: %zu) passes: %zu\n",
+	       procs, threads, threads * 20, passes);
+	printf("%-8s %12s %10s %10s\n", "workers", "us/pass", "speedup",
+	       "stolen");
+	uint64_t one_worker_ns = 0;
+	for (unsigned workers = 1; workers <= max_workers; workers *= 2) {
+		struct sampler_pool *pool = sampler_pool_new(workers);
+		uint64_t start = now_ns();
+		for (size_t p = 0; p < passes; ++p) {
+			sampler_pool_run(pool, tasks, procs);
+			for (size_t i = 0; i < procs; ++i) {
+				state_list_free(tasks[i].states);
+			}
+		}
+		uint64_t pass_ns = (now_ns() - start) / passes;
+		one_worker_ns = (workers == 1) ? pass_ns : one_worker_ns;
+
+		unsigned long stolen = 0;
+		for (unsigned w = 0; pool && w < pool->workers; ++w) {
+			stolen += pool->shards[w].stolen;
+		}
+		printf("%-8u %12lu %10.2f %10lu\n", workers,
+		       (unsigned long)(pass_ns / 1000),
+		       (double)one_worker_ns / (double)pass_ns, stolen);
+		sampler_pool_free(pool);
+	}
+
+	for (size_t i = 0; i < procs; ++i) {
+		get_states_proc_release(tasks[i].pid);
+		kill(tasks[i].pid, SIGKILL);
+		waitpid(tasks[i].pid, NULL, 0);
+	}
+	free(tasks);
+	return EXIT_SUCCESS;
+}
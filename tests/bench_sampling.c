@@ -0,0 +1,246 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/* bench_sampling: the cost of a poll of fixture processes by thread count */
+/* Copyright (C) 2020, 2021 Eric Herman <eric@freesa.org> */
+
+#include "yoyo.h"
+
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+extern void *(*yoyo_calloc)(size_t nmemb, size_t size);
+/* the stat file of each thread stays open between polls */
+void raise_open_files_limit(void);
+
+unsigned long allocations;
+void *counting_calloc(size_t nmemb, size_t size)
+{
+	++allocations;
+	return calloc(nmemb, size);
+}
+
+uint64_t now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (((uint64_t)ts.tv_sec) * 1000000000) + ts.tv_nsec;
+}
+
+void *block_on_pipe(void *arg)
+{
+	int fd = *(int *)arg;
+	char c;
+	return read(fd, &c, 1) < 0 ? NULL : NULL;
+}
+
+/* a process of threads sleeping in read(2), which looks hung to yoyo,
+ * until the writing end of their pipe is closed */
+struct fixture {
+	pid_t pid;
+	size_t threads;
+	int block_fd;
+};
+
+/* the child reports how many of its threads it managed to start */
+int fixture_start(struct fixture *fixture, size_t threads)
+{
+	int ready[2];
+	int block[2];
+	if (pipe(ready) || pipe(block)) {
+		perror("pipe");
+		return -1;
+	}
+	fixture->pid = fork();
+	if (fixture->pid < 0) {
+		perror("fork");
+		return -1;
+	}
+	if (fixture->pid == 0) {
+		close(ready[0]);
+		close(block[1]);
+		pthread_attr_t attr;
+		pthread_attr_init(&attr);
+		pthread_attr_setstacksize(&attr, PTHREAD_STACK_MIN + 16384);
+		size_t started = 1;
+		for (; started < threads; ++started) {
+			pthread_t tid;
+			if (pthread_create
+			    (&tid, &attr, block_on_pipe, &block[0])) {
+				break;
+			}
+		}
+		ssize_t w = write(ready[1], &started, sizeof(started));
+		block_on_pipe(&block[0]);
+		_exit(w == sizeof(started) ? EXIT_SUCCESS : EXIT_FAILURE);
+	}
+	close(ready[1]);
+	close(block[0]);
+	fixture->block_fd = block[1];
+	ssize_t r = read(ready[0], &fixture->threads, sizeof(size_t));
+	close(ready[0]);
+	return r == sizeof(size_t) ? 0 : -1;
+}
+
+void fixture_stop(struct fixture *fixture)
+{
+	close(fixture->block_fd);
+	kill(fixture->pid, SIGKILL);
+	waitpid(fixture->pid, NULL, 0);
+}
+
+/* per poll averages, the decision included */
+struct result {
+	size_t threads;
+	size_t polls;
+	double ns_per_poll;
+	double ns_per_thread;
+	double decide_ns_per_poll;
+	double syscalls_per_poll;
+	double bytes_per_poll;
+	double allocs_per_poll;
+	unsigned long hung;
+};
+
+void bench_fixture(struct result *result, long pid, size_t polls)
+{
+	struct sampler_task task;
+	memset(&task, 0x00, sizeof(task));
+	task.pid = pid;
+
+	/* the first poll opens the stat files, which is not what we measure,
+	 * and new threads may not yet have gone to sleep */
+	struct state_list *previous = NULL;
+	for (int settled = 0, i = 0; !settled && i < 1000; ++i) {
+		sampler_pool_run(NULL, &task, 1);
+		struct state_list *next = NULL;
+		settled = previous && task.states
+		    && process_looks_hung(&next, previous, task.states);
+		state_list_free(previous);
+		previous = task.states;
+		if (!settled) {
+			usleep(1000);
+		}
+	}
+
+	unsigned long long sample_ns = 0;
+	unsigned long long decide_ns = 0;
+	unsigned long long syscalls = 0;
+	unsigned long long bytes = 0;
+	unsigned long long threads = 0;
+	unsigned long allocs = allocations;
+	for (size_t i = 0; i < polls; ++i) {
+		sampler_pool_run(NULL, &task, 1);
+		sample_ns += task.cost.sample_ns;
+		syscalls += task.cost.syscalls;
+		bytes += task.cost.bytes_read;
+		threads += task.cost.threads;
+
+		uint64_t start = now_ns();
+		struct state_list *next = NULL;
+		if (task.states && process_looks_hung(&next, previous,
+						      task.states)) {
+			++result->hung;
+		}
+		decide_ns += now_ns() - start;
+		state_list_free(previous);
+		previous = task.states;
+	}
+	allocs = allocations - allocs;
+	state_list_free(previous);
+	get_states_proc_release(pid);
+
+	result->polls = polls;
+	result->ns_per_poll = (double)(sample_ns + decide_ns) / polls;
+	result->ns_per_thread = threads ?
+	    (double)(sample_ns + decide_ns) / threads : 0.0;
+	result->decide_ns_per_poll = (double)decide_ns / polls;
+	result->syscalls_per_poll = (double)syscalls / polls;
+	result->bytes_per_poll = (double)bytes / polls;
+	result->allocs_per_poll = (double)allocs / polls;
+}
+
+int main(int argc, char **argv)
+{
+	const char *counts = (argc > 1) ? argv[1] : "1,10,100,1000,10000";
+	size_t polls = (argc > 2) ? strtoul(argv[2], NULL, 10) : 100;
+	const char *results_path = (argc > 3) ? argv[3] : NULL;
+
+	if (!polls) {
+		polls = 1;
+	}
+	raise_open_files_limit();
+	yoyo_calloc = counting_calloc;
+
+	FILE *results = results_path ? fopen(results_path, "w") : NULL;
+	if (results_path && !results) {
+		fprintf(stderr, "%s: %s\n", results_path, strerror(errno));
+		return EXIT_FAILURE;
+	}
+	if (results) {
+		fprintf(results, "threads\tpolls\tns_per_poll\tns_per_thread"
+			"\tdecide_ns_per_poll\tsyscalls_per_poll"
+			"\tbytes_per_poll\tallocs_per_poll\n");
+	}
+	printf("%8s %12s %10s %10s %10s %12s %10s\n", "threads", "ns/poll",
+	       "ns/thread", "decide ns", "syscalls", "bytes", "allocs");
+
+	int failed = 0;
+	for (const char *s = counts; *s;) {
+		char *end = NULL;
+		size_t want = strtoul(s, &end, 10);
+		if (end == s || !want || (*end && *end != ',')) {
+			fprintf(stderr, "bad thread count list '%s'\n", counts);
+			failed = 1;
+			break;
+		}
+		s = (*end == ',') ? end + 1 : end;
+
+		struct fixture fixture;
+		if (fixture_start(&fixture, want)) {
+			failed = 1;
+			break;
+		}
+		if (fixture.threads < want) {
+			fprintf(stderr, "only %zu of %zu threads started\n",
+				fixture.threads, want);
+		}
+		struct result result;
+		memset(&result, 0x00, sizeof(result));
+		result.threads = fixture.threads;
+		bench_fixture(&result, fixture.pid, polls);
+		fixture_stop(&fixture);
+
+		/* threads sleeping in read(2) look hung after the first poll */
+		if (result.hung != polls) {
+			fprintf(stderr, "%zu threads: hung %lu of %zu polls\n",
+				result.threads, result.hung, polls);
+			failed = 1;
+		}
+
+		printf("%8zu %12.0f %10.1f %10.0f %10.1f %12.0f %10.1f\n",
+		       result.threads, result.ns_per_poll, result.ns_per_thread,
+		       result.decide_ns_per_poll, result.syscalls_per_poll,
+		       result.bytes_per_poll, result.allocs_per_poll);
+		if (results) {
+			fprintf(results, "%zu\t%zu\t%.0f\t%.1f\t%.0f\t%.1f"
+				"\t%.0f\t%.1f\n", result.threads, result.polls,
+				result.ns_per_poll, result.ns_per_thread,
+				result.decide_ns_per_poll,
+				result.syscalls_per_poll,
+				result.bytes_per_poll, result.allocs_per_poll);
+		}
+	}
+
+	if (results) {
+		fclose(results);
+	}
+	return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
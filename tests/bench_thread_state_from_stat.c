@@ -0,0 +1,93 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/* bench_thread_state_from_stat: hand-written stat parser versus sscanf */
+/* Copyright (C) 2020, 2021 Eric Herman <eric@freesa.org> */
+
+#include "yoyo.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+/* stat lines as captured from QEMU, a JVM, a shell and a kernel thread */
+const char *corpus[] = {
+	"1754993 (qemu-system-x86) S 1 1754993 1754993 0 -1 138412352 97313"
+	    " 0 174 0 42825 125398 0 0 20 0 10 0 48201 4254715904 1060338"
+	    " 18446744073709551615 1 1 0 0 0 0 268445190 4096 16963 0 0 0 17"
+	    " 3 0 0 5 0 0 0 0 0 0 0 0 0 0",
+	"1755002 (CPU 2/KVM) S 1754992 1754990 1754990 0 -1 138412096 2390 0"
+	    " 31 0 4492748 220595 0 0 20 0 10 0 48201 4254715904 1060338"
+	    " 18446744073709551615 1 1 0 0 0 0 268445190 4096 16963 0 0 0 -1"
+	    " 5 0 0 17 0 0 0 0 0 0 0 0 0 0",
+	"31337 (C2 CompilerThre) S 31300 31300 31300 0 -1 1077936192 884211"
+	    " 0 12 0 917735 12044 0 0 20 0 142 0 7719324 12994306048 1489611"
+	    " 18446744073709551615 94718291243008 94718291244264"
+	    " 140725712633584 0 0 0 4 0 16800975 0 0 0 -1 11 0 0 3 0 0"
+	    " 94718291257296 94718291257960 94718312910848 140725712641379"
+	    " 140725712641920 140725712641920 140725712642014 0",
+	"5909 (bash) S 5903 5909 5903 34816 5909 4194304 2081 17421 0 4 3 1"
+	    " 11 9 20 0 1 0 74270 8736768 1270 18446744073709551615"
+	    " 94386877534208 94386878251749 140737467597520 0 0 0 65536"
+	    " 3670020 1266777851 0 0 0 17 0 0 0 0 0 0 94386878481904"
+	    " 94386878530180 94387656048640 140737467606339 140737467606359"
+	    " 140737467606359 140737467609067 0",
+	"14 (ksoftirqd/0) S 2 0 0 0 -1 69238848 0 0 0 0 0 1731 0 0 20 0 1 0"
+	    " 9 0 0 18446744073709551615 0 0 0 0 0 0 0 2147483647 0 0 0 0 17"
+	    " 0 0 0 0 0 0 0 0 0 0 0 0 0 0",
+};
+
+const size_t corpus_len = sizeof(corpus) / sizeof(corpus[0]);
+
+/* the parser as it was before the hand-written one */
+int sscanf_thread_state(struct thread_state *ts, const char *buf)
+{
+	const char *stat_scanf =
+	    "%ld %*s %c %*d %*d %*d %*d %*d %*u %*lu %*lu %*lu %*lu %lu %lu";
+	return 4 - sscanf(buf, stat_scanf, &ts->pid, &ts->state, &ts->utime,
+			  &ts->stime);
+}
+
+uint64_t now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (((uint64_t)ts.tv_sec) * 1000000000) + ts.tv_nsec;
+}
+
+uint64_t time_parser(int (*parse)(struct thread_state *, const char *),
+		     size_t loops, unsigned long *checksum)
+{
+	struct thread_state ts;
+	uint64_t start = now_ns();
+	for (size_t i = 0; i < loops; ++i) {
+		for (size_t j = 0; j < corpus_len; ++j) {
+			parse(&ts, corpus[j]);
+			*checksum += ts.utime + ts.stime;
+		}
+	}
+	return now_ns() - start;
+}
+
+int main(int argc, char **argv)
+{
+	size_t loops = (argc > 1) ? strtoul(argv[1], NULL, 10) : 200000;
+	size_t lines = loops * corpus_len;
+
+	unsigned long sum_sscanf = 0;
+	unsigned long sum_parser = 0;
+	uint64_t ns_sscanf = time_parser(sscanf_thread_state, loops,
+					 &sum_sscanf);
+	uint64_t ns_parser = time_parser(thread_state_from_stat, loops,
+					 &sum_parser);
+
+	printf("lines: %zu\n", lines);
+	printf("%-8s %10s\n", "", "ns/line");
+	printf("%-8s %10.1f\n", "sscanf", (double)ns_sscanf / lines);
+	printf("%-8s %10.1f\n", "parser", (double)ns_parser / lines);
+
+	/* the comm of "CPU 2/KVM" defeats the sscanf format */
+	if (sum_parser == sum_sscanf) {
+		fprintf(stderr, "expected the checksums to differ\n");
+	}
+	return EXIT_SUCCESS;
+}
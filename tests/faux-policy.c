@@ -0,0 +1,45 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/* faux-policy: a hang policy for yoyo to load, which never finds a hang */
+/* Copyright (C) 2020, 2021 Eric Herman <eric@freesa.org> */
+
+#include "yoyo.h"
+
+#include <stdlib.h>
+
+/* built a second time with an older ABI, which yoyo must refuse */
+#ifndef FAUX_POLICY_ABI
+#define FAUX_POLICY_ABI YOYO_HANG_POLICY_ABI
+#endif
+
+static void *faux_init(const struct hang_policy_config *config)
+{
+	return calloc(1, sizeof(config->thresholds));
+}
+
+static void faux_observe(void *state, struct state_list **snapshot,
+			 unsigned interval_ms)
+{
+	(void)state;
+	(void)snapshot;
+	(void)interval_ms;
+}
+
+static int faux_verdict(void *state)
+{
+	(void)state;
+	return 0;
+}
+
+static void faux_free(void *state)
+{
+	free(state);
+}
+
+const struct hang_policy yoyo_hang_policy = {
+	.abi_version = FAUX_POLICY_ABI,
+	.name = "faux",
+	.init = faux_init,
+	.observe = faux_observe,
+	.verdict = faux_verdict,
+	.free = faux_free,
+};
@@ -3,9 +3,15 @@
 /* Copyright (C) 2020, 2021 Eric Herman <eric@freesa.org> and
         Brett Neumeier <brett@freesa.org> */
 
+#include <limits.h>
+#include <pthread.h>
 #include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/prctl.h>
+#include <sys/wait.h>
+#include <time.h>
 #include <unistd.h>
 
 enum action_type { succeed = 0, fail, hang };
@@ -53,6 +59,214 @@ enum action_type get_action(const char *failpath)
 
 const unsigned ten_minutes = 10 * 60;
 
+/* the background threads of a script, which run while the main thread
+ * sleeps, fails, hangs or succeeds as the failcount says:
+ *	spin	busy loop, always runnable
+ *	deadlock	pairs of threads each locking the mutex the other
+ *		holds, so asleep on a futex; an odd count is rounded up
+ *	read	blocked reading a pipe which is never written
+ *	trickle	asleep, but waking every 100ms to spin for 2ms
+ *	churn	starting a short-lived thread every 10ms
+ *	fork	a child process, asleep until the fixture exits
+ *	grow	touching another MiB of memory every 100ms, up to 64 MiB
+ * for example: "read:100,deadlock:2,fork:1" */
+enum behavior { spin = 0, deadlock, blocking_read, trickle, churn,
+	fork_child, grow, behavior_end
+};
+
+const char *behavior_names[] = { "spin", "deadlock", "read", "trickle",
+	"churn", "fork", "grow"
+};
+
+int never_written[2];
+
+void sleep_ms(unsigned ms)
+{
+	struct timespec ts = { ms / 1000, (ms % 1000) * 1000000L };
+	nanosleep(&ts, NULL);
+}
+
+void block_forever(void)
+{
+	char c;
+	while (1) {
+		if (read(never_written[0], &c, 1) < 0) {
+			pause();
+		}
+	}
+}
+
+void spin_for_ms(unsigned ms)
+{
+	struct timespec start;
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	long elapsed_ms = 0;
+	volatile unsigned long spins = 0;
+	while (elapsed_ms < (long)ms) {
+		++spins;
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		elapsed_ms = ((now.tv_sec - start.tv_sec) * 1000)
+		    + ((now.tv_nsec - start.tv_nsec) / 1000000);
+	}
+}
+
+void *short_lived(void *arg)
+{
+	return arg;
+}
+
+/* each thread of a pair takes its own lock, waits for the other to do
+ * the same, then asks for the other's */
+struct deadlock_pair {
+	pthread_mutex_t locks[2];
+	pthread_barrier_t both_locked;
+};
+
+struct scripted_thread {
+	enum behavior behavior;
+	struct deadlock_pair *pair;
+	int side;
+};
+
+void *run_behavior(void *arg)
+{
+	struct scripted_thread *thread = arg;
+	switch (thread->behavior) {
+	case spin:
+		while (1) {
+			spin_for_ms(1000);
+		}
+		break;
+	case deadlock:
+		pthread_mutex_lock(&thread->pair->locks[thread->side]);
+		pthread_barrier_wait(&thread->pair->both_locked);
+		pthread_mutex_lock(&thread->pair->locks[!thread->side]);
+		break;
+	case blocking_read:
+		block_forever();
+		break;
+	case trickle:
+		while (1) {
+			sleep_ms(100);
+			spin_for_ms(2);
+		}
+		break;
+	case churn:
+		while (1) {
+			pthread_t tid;
+			if (pthread_create(&tid, NULL, short_lived, NULL) == 0) {
+				pthread_join(tid, NULL);
+			}
+			sleep_ms(10);
+		}
+		break;
+	case fork_child:{
+			pid_t pid = fork();
+			if (pid == 0) {
+				/* do not outlive the fixture */
+				prctl(PR_SET_PDEATHSIG, SIGKILL);
+				block_forever();
+			} else if (pid > 0) {
+				waitpid(pid, NULL, 0);
+			}
+			block_forever();
+		}
+		break;
+	case grow:
+		for (size_t mib = 0; mib < 64; ++mib) {
+			char *p = malloc(1024 * 1024);
+			if (p) {
+				memset(p, 0x01, 1024 * 1024);
+			}
+			sleep_ms(100);
+		}
+		block_forever();
+		break;
+	case behavior_end:
+		break;
+	}
+	return NULL;
+}
+
+/* start the threads of a script like "spin:1,read:10"; returns non-zero
+ * if the script does not parse */
+int start_script(const char *script)
+{
+	if (pipe(never_written)) {
+		perror("pipe");
+		return 1;
+	}
+	pthread_attr_t attr;
+	pthread_attr_init(&attr);
+	pthread_attr_setstacksize(&attr, PTHREAD_STACK_MIN + 65536);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+
+	for (const char *s = script; *s;) {
+		size_t len = strcspn(s, ":");
+		enum behavior behavior = spin;
+		while (behavior < behavior_end
+		       && (strlen(behavior_names[behavior]) != len
+			   || strncmp(s, behavior_names[behavior], len))) {
+			++behavior;
+		}
+		char *end = NULL;
+		unsigned long count = 0;
+		if (behavior != behavior_end && s[len] == ':') {
+			count = strtoul(s + len + 1, &end, 10);
+		}
+		if (!end || end == s + len + 1 || (*end && *end != ',')) {
+			fprintf(stderr, "%s:%d bad script '%s'\n", __FILE__,
+				__LINE__, script);
+			pthread_attr_destroy(&attr);
+			return 1;
+		}
+		s = (*end == ',') ? end + 1 : end;
+
+		struct deadlock_pair *pair = NULL;
+		for (unsigned long i = 0; i < count; ++i) {
+			/* never freed: the threads live as long as the process */
+			struct scripted_thread *thread = calloc(1, sizeof(*thread));
+			if (!thread) {
+				perror("calloc");
+				break;
+			}
+			thread->behavior = behavior;
+			if (behavior == deadlock) {
+				if (!pair) {
+					pair = calloc(1, sizeof(*pair));
+					if (!pair) {
+						perror("calloc");
+						free(thread);
+						break;
+					}
+					pthread_mutex_init(&pair->locks[0], NULL);
+					pthread_mutex_init(&pair->locks[1], NULL);
+					pthread_barrier_init(&pair->both_locked, NULL,
+							     2);
+					thread->side = 0;
+					/* round an odd count up to a pair */
+					count += (i + 1 == count);
+				} else {
+					thread->side = 1;
+				}
+				thread->pair = pair;
+				pair = thread->side ? NULL : pair;
+			}
+			pthread_t tid;
+			if (pthread_create(&tid, &attr, run_behavior, thread)) {
+				perror("pthread_create");
+				free(thread);
+				break;
+			}
+		}
+		fprintf(stderr, "%s:%d %s: %lu threads\n", __FILE__, __LINE__,
+			behavior_names[behavior], count);
+	}
+	pthread_attr_destroy(&attr);
+	return 0;
+}
+
 void sighandler_exit_success(int sig)
 {
 	fprintf(stderr, "%s:%d signal %d, exiting\n", __FILE__, __LINE__, sig);
@@ -63,9 +277,14 @@ int main(int argc, char **argv)
 {
 	unsigned delay = (argc > 1) ? atoi(argv[1]) : 0;
 	const char *failpath = (argc > 2) ? argv[2] : getenv("FAILCOUNT");
+	const char *script = (argc > 3) ? argv[3] : getenv("FAUX_ROGUE_SCRIPT");
 
 	signal(SIGTERM, sighandler_exit_success);
 
+	if (script && start_script(script)) {
+		return 126;
+	}
+
 	unsigned remain = sleep(delay);
 
 	enum action_type action = get_action(failpath);
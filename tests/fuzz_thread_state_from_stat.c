@@ -0,0 +1,83 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/* fuzz_thread_state_from_stat: robustness of the /proc stat parser */
+/* Copyright (C) 2020, 2021 Eric Herman <eric@freesa.org> */
+
+#include "yoyo.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+extern int yoyo_verbose;
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+	char buf[2048];
+	size_t len = size < sizeof(buf) - 1 ? size : sizeof(buf) - 1;
+	memcpy(buf, data, len);
+	buf[len] = '\0';
+
+	yoyo_verbose = -1;
+	struct thread_state ts;
+	int missing = thread_state_from_stat(&ts, buf);
+	if (missing < 0 || missing > 4) {
+		abort();
+	}
+	return 0;
+}
+
+#ifndef YOYO_LIBFUZZER
+/* without libFuzzer, mutate a seed line with a deterministic generator */
+const char *seed =
+    "1755002 (CPU 2/KVM) S 1754992 1754990 1754990 0 -1 138412096 2390 0"
+    " 31 0 4492748 220595 0 0 20 0 10 0 48201 4254715904 1060338"
+    " 18446744073709551615 1 1 0 0 0 0 268445190 4096 16963 0 0 0 -1 5 0 0"
+    " 17 0 0 0 0 0 0 0 0 0 0";
+
+uint64_t xorshift(uint64_t *state)
+{
+	uint64_t x = *state;
+	x ^= x << 13;
+	x ^= x >> 7;
+	x ^= x << 17;
+	return *state = x;
+}
+
+int main(int argc, char **argv)
+{
+	unsigned long runs = (argc > 1) ? strtoul(argv[1], NULL, 10) : 1000000;
+	const char interesting[] = "()0123456789 -\n\0xS";
+	uint64_t rng = 0x9E3779B97F4A7C15ULL;
+	size_t seed_len = strlen(seed);
+	uint8_t buf[1024];
+
+	for (unsigned long i = 0; i < runs; ++i) {
+		size_t len = seed_len;
+		memcpy(buf, seed, len);
+		unsigned mutations = 1 + (xorshift(&rng) % 8);
+		for (unsigned m = 0; m < mutations; ++m) {
+			size_t pos = xorshift(&rng) % len;
+			switch (xorshift(&rng) % 4) {
+			case 0:
+				buf[pos] = (uint8_t)xorshift(&rng);
+				break;
+			case 1:
+				buf[pos] = interesting[xorshift(&rng) %
+						       sizeof(interesting)];
+				break;
+			case 2:
+				len = pos + 1;
+				break;
+			case 3:
+				memmove(buf + pos, buf + pos + 1, len - pos - 1);
+				len = len > 1 ? len - 1 : len;
+				break;
+			}
+		}
+		LLVMFuzzerTestOneInput(buf, len);
+	}
+	printf("%lu inputs\n", runs);
+	return EXIT_SUCCESS;
+}
+#endif
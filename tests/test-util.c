@@ -1,8 +1,21 @@
+#include "yoyo.h"
+#include "test-util.h"
+
 #include <limits.h>
 #include <stdarg.h>
 
+#include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <time.h>
+#include <unistd.h>
+
+extern int yoyo_verbose;
+extern FILE *yoyo_stdout;
+extern FILE *yoyo_stderr;
+extern execvp_func yoyo_execvp;
 
 unsigned run_named_test(const char *name, unsigned (*func)(void))
 {
@@ -53,3 +66,110 @@ unsigned check_expression(const char *file, int line, const char *func,
 
 	return 1;
 }
+
+long now_ms(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec * 1000) + (now.tv_nsec / 1000000);
+}
+
+void sleep_ms(unsigned ms)
+{
+	struct timespec ts = { ms / 1000, (ms % 1000) * 1000000L };
+	nanosleep(&ts, NULL);
+}
+
+long cpu_ms(void)
+{
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+	return (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000
+	    + (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1000;
+}
+
+void spin_forever(void)
+{
+	for (volatile unsigned long i = 0;; ++i) {
+	}
+}
+
+int yoyo_test_run(const struct yoyo_test_run *run, int argc, char **argv)
+{
+	memset(run->log, 0x00, run->log_len);
+	FILE *fbuf = fmemopen(run->log, run->log_len, "w");
+	yoyo_stdout = fbuf;
+	yoyo_stderr = fbuf;
+	yoyo_verbose = 0;
+	if (run->execvp) {
+		yoyo_execvp = run->execvp;
+	}
+
+	int saved[2] = { -1, -1 };
+	char out_path[64];
+	if (run->out) {
+		fflush(stdout);
+		fflush(stderr);
+		saved[0] = dup(STDOUT_FILENO);
+		saved[1] = dup(STDERR_FILENO);
+		snprintf(out_path, sizeof(out_path), "/tmp/yoyo_test.%ld.out",
+			 (long)getpid());
+		int fd = open(out_path, O_WRONLY | O_CREAT | O_TRUNC
+			      | run->out_flags, 0600);
+		dup2(fd, STDOUT_FILENO);
+		dup2(fd, STDERR_FILENO);
+		close(fd);
+	}
+
+	char name[80];
+	for (const char **env = run->env; env && *env; ++env) {
+		size_t len = strcspn(*env, "=");
+		snprintf(name, sizeof(name), "%.*s", (int)len, *env);
+		setenv(name, *env + len + ((*env)[len] ? 1 : 0), 1);
+	}
+	int exit_val = yoyo(argc, argv);
+	for (const char **env = run->env; env && *env; ++env) {
+		size_t len = strcspn(*env, "=");
+		snprintf(name, sizeof(name), "%.*s", (int)len, *env);
+		unsetenv(name);
+	}
+
+	if (run->out) {
+		dup2(saved[0], STDOUT_FILENO);
+		dup2(saved[1], STDERR_FILENO);
+		close(saved[0]);
+		close(saved[1]);
+		memset(run->out, 0x00, run->out_len);
+		int fd = open(out_path, O_RDONLY);
+		ssize_t got = read(fd, run->out, run->out_len - 1);
+		run->out[got > 0 ? got : 0] = '\0';
+		close(fd);
+		unlink(out_path);
+	}
+
+	yoyo_execvp = execvp;
+	fflush(fbuf);
+	fclose(fbuf);
+	yoyo_stdout = NULL;
+	yoyo_stderr = NULL;
+	return exit_val;
+}
+
+unsigned check_hang_found(const char *file, int line, const char *func,
+			  int exit_val, long elapsed_ms, const char *log,
+			  const char *expect)
+{
+	unsigned failures = 0;
+	failures += check_expression(file, line, func,
+				     exit_val == EXIT_FAILURE,
+				     "exit_val == EXIT_FAILURE",
+				     "expected %d but was %d", EXIT_FAILURE,
+				     exit_val);
+	failures += check_expression(file, line, func, !!strstr(log, expect),
+				     "strstr(log, expect)",
+				     "no '%s' in: %s", expect, log);
+	failures += check_expression(file, line, func, elapsed_ms < 3000,
+				     "elapsed_ms < 3000",
+				     "expected < 3s but was %ldms", elapsed_ms);
+	return failures;
+}
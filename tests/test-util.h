@@ -20,4 +20,50 @@ unsigned check_expression(const char *file, int line, const char *func,
 
 int failures_to_status(const char *name, unsigned failures);
 
+#include <stddef.h>
+
+long now_ms(void);
+
+void sleep_ms(unsigned ms);
+
+/* the user and system time this process has used */
+long cpu_ms(void);
+
+/* busy, as far as /proc can tell */
+void spin_forever(void);
+
+typedef int (*execvp_func)(const char *pathname, char *const argv[]);
+
+/* a single attempt, found hung at its second idle check, 100ms apart */
+#define YOYO_TEST_QUICK_HANG \
+	"YOYO_MAX_RETRIES=0", "YOYO_MAX_HANGS=1", \
+	"YOYO_HANG_CHECK_INTERVAL=100ms"
+
+struct yoyo_test_run {
+	/* NAME=value settings for this run only, NULL terminated */
+	const char **env;
+	/* if not NULL, the forked child calls this rather than execvp */
+	execvp_func execvp;
+	/* what yoyo logged */
+	char *log;
+	size_t log_len;
+	/* if not NULL, yoyo's stdout and stderr are a file, opened with
+	 * out_flags, the contents of which are read back into out */
+	char *out;
+	size_t out_len;
+	int out_flags;
+};
+
+/* returns what yoyo(argc, argv) returned */
+int yoyo_test_run(const struct yoyo_test_run *run, int argc, char **argv);
+
+/* a run which was to find a hang failed, logging expect, within 3s */
+#define Check_hang_found(exit_val, elapsed_ms, log, expect) \
+	check_hang_found(__FILE__, __LINE__, __func__, \
+			 exit_val, elapsed_ms, log, expect)
+
+unsigned check_hang_found(const char *file, int line, const char *func,
+			  int exit_val, long elapsed_ms, const char *log,
+			  const char *expect);
+
 #endif /* #ifndef TEST_UTIL_H */
@@ -0,0 +1,239 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/* Copyright (C) 2020, 2021 Eric Herman <eric@freesa.org> */
+
+#include "yoyo.h"
+#include "test-util.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define Buflen (80 * 24)
+char buf[Buflen];
+char out[Buflen];
+char dir[64];
+
+/* the contents of dir/name, or NULL if there is no such file */
+static const char *slurp(const char *name, char *contents, size_t size,
+			 struct stat *st)
+{
+	char path[128];
+	snprintf(path, sizeof(path), "%s/%s", dir, name);
+	memset(contents, 0x00, size);
+	int fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		return NULL;
+	}
+	ssize_t got = read(fd, contents, size - 1);
+	contents[got > 0 ? got : 0] = '\0';
+	if (st) {
+		fstat(fd, st);
+	}
+	close(fd);
+	return contents;
+}
+
+/* yoyo's stdout and stderr are read back into out; settings are up to
+ * two more NAME=value, NULL terminated */
+static int run_yoyo(int argc, char **argv, const char **settings)
+{
+	char log_dir[80];
+	snprintf(log_dir, sizeof(log_dir), "YOYO_LOG_DIR=%s", dir);
+	const char *env[4] = { log_dir, NULL, NULL, NULL };
+	for (size_t i = 0; settings && settings[i] && i < 2; ++i) {
+		env[i + 1] = settings[i];
+	}
+	struct yoyo_test_run run = { .env = env, .log = buf,
+		.log_len = Buflen, .out = out, .out_len = Buflen
+	};
+	return yoyo_test_run(&run, argc, argv);
+}
+
+static void remove_logs(void)
+{
+	const char *names[] = { "sh.0.1.log", "sh.0.2.log", "sh.1.1.log",
+		"sh.0.1.log.1", "sh.0.1.log.2", "sh.0.1.log.3"
+	};
+	char path[128];
+	for (size_t i = 0; i < (sizeof(names) / sizeof(names[0])); ++i) {
+		snprintf(path, sizeof(path), "%s/%s", dir, names[i]);
+		unlink(path);
+	}
+}
+
+unsigned test_attempt_log_per_attempt(void)
+{
+	unsigned failures = 0;
+
+	char *argv[] = { "yoyo", "sh", "-c",
+		"echo out; echo err >&2; exit 3", NULL
+	};
+	int argc = (sizeof(argv) / sizeof(argv[0])) - 1;
+
+	const char *settings[] = { "YOYO_MAX_RETRIES=1", NULL };
+	int exit_val = run_yoyo(argc, argv, settings);
+
+	failures += Check(exit_val == EXIT_FAILURE, "expected %d but was %d",
+			  EXIT_FAILURE, exit_val);
+	failures += Check(strcmp(out, "") == 0, "expected nothing but was"
+			  " '%s'", out);
+	char contents[Buflen];
+	struct stat st;
+	for (int i = 1; i <= 2; ++i) {
+		char name[40];
+		snprintf(name, sizeof(name), "sh.0.%d.log", i);
+		const char *log = slurp(name, contents, Buflen, &st);
+		failures += Check(log && strcmp(log, "out\nerr\n") == 0,
+				  "%s: '%s'", name, log ? log : "(none)");
+		/* the preallocation was given back */
+		failures += Check(st.st_size == 8, "%s: %ld bytes", name,
+				  (long)st.st_size);
+		failures += Check(st.st_blocks <= 64, "%s: %ld blocks", name,
+				  (long)st.st_blocks);
+	}
+	remove_logs();
+
+	return failures;
+}
+
+unsigned test_attempt_log_rotation(void)
+{
+	unsigned failures = 0;
+
+	/* 350 lines of 10 bytes */
+	char *argv[] = { "yoyo", "--jobs", "sh", "-c",
+		"i=0; while [ $i -lt 350 ]; do echo 123456789;"
+		    " i=$((i+1)); done", NULL
+	};
+	int argc = (sizeof(argv) / sizeof(argv[0])) - 1;
+
+	const char *settings[] = { "YOYO_LOG_SIZE=1000", "YOYO_LOG_KEEP=2",
+		NULL
+	};
+	int exit_val = run_yoyo(argc, argv, settings);
+
+	failures += Check(exit_val == EXIT_SUCCESS, "expected %d but was %d"
+			  " output: %s", EXIT_SUCCESS, exit_val, buf);
+	char contents[Buflen];
+	struct stat st;
+	const char *names[] = { "sh.0.1.log", "sh.0.1.log.1", "sh.0.1.log.2" };
+	const long sizes[] = { 500, 1000, 1000 };
+	for (size_t i = 0; i < 3; ++i) {
+		const char *log = slurp(names[i], contents, Buflen, &st);
+		failures += Check(log && st.st_size == sizes[i]
+				  && strncmp(log, "123456789\n", 10) == 0,
+				  "%s: %ld bytes", names[i],
+				  log ? (long)st.st_size : -1L);
+	}
+	/* the oldest 1000 bytes are gone */
+	failures += Check(!slurp("sh.0.1.log.3", contents, Buflen, NULL),
+			  "sh.0.1.log.3 kept");
+	remove_logs();
+
+	return failures;
+}
+
+unsigned test_attempt_log_tee(void)
+{
+	unsigned failures = 0;
+
+	char *argv[] = { "yoyo", "--jobs", "sh", "-c", "echo one", ";",
+		"sh", "-c", "echo two >&2", NULL
+	};
+	int argc = (sizeof(argv) / sizeof(argv[0])) - 1;
+
+	const char *settings[] = { "YOYO_LOG_TEE=1", NULL };
+	int exit_val = run_yoyo(argc, argv, settings);
+
+	failures += Check(exit_val == EXIT_SUCCESS, "expected %d but was %d"
+			  " output: %s", EXIT_SUCCESS, exit_val, buf);
+	failures += Check(strstr(out, "one\n") && strstr(out, "two\n"),
+			  "'%s'", out);
+	char contents[Buflen];
+	const char *log = slurp("sh.0.1.log", contents, Buflen, NULL);
+	failures += Check(log && strcmp(log, "one\n") == 0, "'%s'",
+			  log ? log : "(none)");
+	log = slurp("sh.1.1.log", contents, Buflen, NULL);
+	failures += Check(log && strcmp(log, "two\n") == 0, "'%s'",
+			  log ? log : "(none)");
+	remove_logs();
+
+	return failures;
+}
+
+unsigned test_attempt_log_keep_none(void)
+{
+	unsigned failures = 0;
+
+	char *argv[] = { "yoyo", "--jobs", "sh", "-c",
+		"i=0; while [ $i -lt 350 ]; do echo 123456789;"
+		    " i=$((i+1)); done", NULL
+	};
+	int argc = (sizeof(argv) / sizeof(argv[0])) - 1;
+
+	/* taken as 0, rather than as 4 billion files to rename */
+	const char *settings[] = { "YOYO_LOG_SIZE=1000", "YOYO_LOG_KEEP=-1",
+		NULL
+	};
+	int exit_val = run_yoyo(argc, argv, settings);
+
+	failures += Check(exit_val == EXIT_SUCCESS, "expected %d but was %d"
+			  " output: %s", EXIT_SUCCESS, exit_val, buf);
+	char contents[Buflen];
+	struct stat st;
+	const char *log = slurp("sh.0.1.log", contents, Buflen, &st);
+	failures += Check(log && st.st_size == 500, "sh.0.1.log: %ld bytes",
+			  log ? (long)st.st_size : -1L);
+	failures += Check(!slurp("sh.0.1.log.1", contents, Buflen, NULL),
+			  "sh.0.1.log.1 kept");
+	remove_logs();
+
+	return failures;
+}
+
+unsigned test_attempt_log_failed(void)
+{
+	unsigned failures = 0;
+
+	/* the log can not be rotated once its directory is gone */
+	char *argv[] = { "yoyo", "--jobs", "sh", "-c",
+		"echo 123456789; rm -r \"$1\"; sleep 0.2; echo 123456789;"
+		    " sleep 0.2; echo third", "sh", dir, NULL
+	};
+	int argc = (sizeof(argv) / sizeof(argv[0])) - 1;
+
+	const char *settings[] = { "YOYO_LOG_SIZE=15", NULL };
+	int exit_val = run_yoyo(argc, argv, settings);
+	mkdir(dir, 0700);
+
+	/* rather than killed by SIGPIPE */
+	failures += Check(exit_val == EXIT_SUCCESS, "expected %d but was %d"
+			  " output: %s", EXIT_SUCCESS, exit_val, buf);
+	const char *expect = "failed, output of";
+	failures += Check(strstr(buf, expect), "no '%s' in: %s", expect, buf);
+	failures += Check(strcmp(out, "6789\nthird\n") == 0, "'%s'", out);
+
+	return failures;
+}
+
+int main(void)
+{
+	unsigned failures = 0;
+
+	snprintf(dir, sizeof(dir), "/tmp/test_attempt_log.XXXXXX");
+	if (!mkdtemp(dir)) {
+		return failures_to_status("test_attempt_log", 1);
+	}
+
+	failures += run_test(test_attempt_log_per_attempt);
+	failures += run_test(test_attempt_log_rotation);
+	failures += run_test(test_attempt_log_tee);
+	failures += run_test(test_attempt_log_keep_none);
+	failures += run_test(test_attempt_log_failed);
+
+	rmdir(dir);
+	return failures_to_status("test_attempt_log", failures);
+}
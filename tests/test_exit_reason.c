@@ -147,16 +147,23 @@ unsigned test_wait_status_32512(void)
 pid_t faux_wait_return_pid;
 int faux_wait_status;
 
+unsigned faux_waitpid_count;
+
+/* reports faux_wait_return_pid once, then that no child has exited */
 pid_t faux_waitpid(pid_t pid, int *wstatus, int options)
 {
-	(void)pid;
-	(void)options;
+	++faux_waitpid_count;
+	if (pid != -1 || !(options & WNOHANG)) {
+		return -1;
+	}
 
+	pid_t rv = faux_wait_return_pid;
 	*wstatus = faux_wait_status;
-	return faux_wait_return_pid;
+	faux_wait_return_pid = 0;
+	return rv;
 }
 
-unsigned test_exit_reason_child_trap(void)
+unsigned test_exit_reason_reap(void)
 {
 	unsigned failures = 0;
 
@@ -174,15 +181,15 @@ unsigned test_exit_reason_child_trap(void)
 
 	faux_wait_return_pid = global_exit_reason.child_pid + 1;
 	faux_wait_status = 9;
-	int signal = 17;
 
 	yoyo_waitpid = faux_waitpid;
 
-	exit_reason_child_trap(signal);
+	int reaped = exit_reason_reap(&global_exit_reason);
 	fflush(fbuf);
 	fclose(fbuf);
 	fbuf = NULL;
 
+	failures += Check(!reaped, "expected 0 but was %d", reaped);
 	failures +=
 	    Check(!global_exit_reason.termsig, "expected 0 but was %d",
 		  global_exit_reason.termsig);
@@ -197,7 +204,8 @@ unsigned test_exit_reason_child_trap(void)
 	yoyo_stderr = fbuf;
 
 	faux_wait_return_pid = global_exit_reason.child_pid;
-	exit_reason_child_trap(signal);
+	faux_waitpid_count = 0;
+	reaped = exit_reason_reap(&global_exit_reason);
 
 	fflush(fbuf);
 	fclose(fbuf);
@@ -209,6 +217,11 @@ unsigned test_exit_reason_child_trap(void)
 	failures +=
 	    Check(global_exit_reason.termsig, "expected exited but was %d\n",
 		  global_exit_reason.termsig);
+	failures += Check(reaped == 1, "expected 1 but was %d", reaped);
+	/* keeps reaping until no more children have exited */
+	failures +=
+	    Check(faux_waitpid_count == 2, "expected 2 but was %u",
+		  faux_waitpid_count);
 
 	yoyo_stdout = NULL;
 	yoyo_stderr = NULL;
@@ -227,7 +240,7 @@ int main(void)
 	failures += run_test(test_wait_status_2943);
 	failures += run_test(test_wait_status_ffff);
 	failures += run_test(test_wait_status_32512);
-	failures += run_test(test_exit_reason_child_trap);
+	failures += run_test(test_exit_reason_reap);
 
 	return failures_to_status("test_exit_reason", failures);
 }
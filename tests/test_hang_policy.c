@@ -0,0 +1,413 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/* Copyright (C) 2020, 2021 Eric Herman <eric@freesa.org> */
+
+#include "yoyo.h"
+#include "test-util.h"
+
+#include <libgen.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+extern int yoyo_verbose;
+extern FILE *yoyo_stdout;
+extern FILE *yoyo_stderr;
+
+#define Buflen (80 * 24)
+char buf[Buflen];
+FILE *fbuf = NULL;
+
+static void capture_begin(void)
+{
+	memset(buf, 0x00, Buflen);
+	fbuf = fmemopen(buf, Buflen, "w");
+	yoyo_stdout = fbuf;
+	yoyo_stderr = fbuf;
+	yoyo_verbose = 0;
+}
+
+static void capture_end(void)
+{
+	fflush(fbuf);
+	fclose(fbuf);
+	fbuf = NULL;
+	yoyo_stdout = NULL;
+	yoyo_stderr = NULL;
+}
+
+static struct state_list *snapshot(char state, unsigned long ticks,
+				   long first_tid)
+{
+	struct state_list *sl = state_list_new(3);
+	for (size_t i = 0; i < sl->len; ++i) {
+		memset(&sl->states[i], 0x00, sizeof(struct thread_state));
+		/* out of order, as read from /proc */
+		sl->states[i].pid = first_tid + 2 - i;
+		sl->states[i].state = state;
+		sl->states[i].utime = ticks;
+		sl->states[i].stime = 1;
+	}
+	return sl;
+}
+
+/* observe, then free what the policy did not keep */
+static int observe(const struct hang_policy *policy, void *state,
+		   struct state_list *sl, unsigned interval_ms)
+{
+	policy->observe(state, &sl, interval_ms);
+	state_list_free(sl);
+	return policy->verdict(state);
+}
+
+unsigned test_hang_policy_find(void)
+{
+	unsigned failures = 0;
+
+	const char *args = "unset";
+	failures += Check(hang_policy_find("default", &args)
+			  == &hang_policy_default && args == NULL,
+			  "expected default");
+	const char *spec = "cpu:30";
+	failures += Check(hang_policy_find(spec, &args) == &hang_policy_cpu
+			  && args == spec + 4, "expected cpu, args 30");
+
+	capture_begin();
+	const struct hang_policy *p = hang_policy_find("cp", &args);
+	capture_end();
+	failures += Check(p == NULL, "expected NULL");
+	failures += Check(strstr(buf, "no hang policy 'cp'"), "%s", buf);
+
+	capture_begin();
+	p = hang_policy_find("/no/such/policy.so:x", &args);
+	capture_end();
+	failures += Check(p == NULL, "expected NULL");
+	failures += Check(strstr(buf, "/no/such/policy.so"), "%s", buf);
+
+	return failures;
+}
+
+/* path of a shared object built next to this test */
+static void sibling_path(char *path, size_t size, const char *name)
+{
+	char exe[PATH_MAX];
+	ssize_t len = readlink("/proc/self/exe", exe, sizeof(exe) - 1);
+	exe[len > 0 ? len : 0] = '\0';
+	snprintf(path, size, "%s/%s", dirname(exe), name);
+}
+
+unsigned test_hang_policy_shared_object(void)
+{
+	unsigned failures = 0;
+
+	char path[PATH_MAX + 40];
+	sibling_path(path, sizeof(path), "faux-policy.so");
+	strcat(path, ":x");
+	const char *args = NULL;
+	const struct hang_policy *p = hang_policy_find(path, &args);
+	failures += Check(p && strcmp(p->name, "faux") == 0, "expected faux");
+	failures += Check(args && strcmp(args, "x") == 0, "expected x");
+
+	sibling_path(path, sizeof(path), "faux-policy-old.so");
+	capture_begin();
+	p = hang_policy_find(path, &args);
+	capture_end();
+	failures += Check(p == NULL, "expected NULL");
+	failures += Check(strstr(buf, "is for ABI 0, not"), "%s", buf);
+
+	return failures;
+}
+
+static int not_execvp(const char *file, char *const argv[])
+{
+	(void)file;
+	(void)argv;
+	exit(EXIT_SUCCESS);
+}
+
+unsigned test_hang_policy_unknown(void)
+{
+	unsigned failures = 0;
+
+	const char *env[] = { "YOYO_HANG_POLICY=psychic", NULL };
+	struct yoyo_test_run run = {
+		.env = env,
+		.execvp = not_execvp,
+		.log = buf,
+		.log_len = Buflen,
+	};
+	char *argv[] = { "yoyo", "true", NULL };
+	int exit_val = yoyo_test_run(&run, 2, argv);
+
+	failures += Check(exit_val == EXIT_FAILURE, "expected %d but was %d",
+			  EXIT_FAILURE, exit_val);
+	failures += Check(strstr(buf, "no hang policy 'psychic'"), "%s", buf);
+	failures += Check(strstr(buf, "Usage:"), "%s", buf);
+	failures += Check(!strstr(buf, "attempt"), "%s", buf);
+
+	return failures;
+}
+
+unsigned test_hang_policy_default(void)
+{
+	unsigned failures = 0;
+
+	const struct hang_policy *policy = &hang_policy_default;
+	struct hang_policy_config config = {
+		.thresholds = {.max_tick_delta = 5,.max_thread_churn = 0 },
+		.args = NULL,
+		.release = state_list_free,
+	};
+	void *state = policy->init(&config);
+	failures += Check(state, "init returned NULL");
+	if (!state) {
+		return failures;
+	}
+
+	/* nothing to compare with yet */
+	failures += Check(!observe(policy, state, snapshot('S', 10, 100),
+				   60000), "first");
+	failures += Check(observe(policy, state, snapshot('S', 15, 100),
+				  60000), "5 ticks in 60s is idle");
+	failures += Check(!observe(policy, state, snapshot('S', 21, 100),
+				   60000), "6 ticks in 60s is not");
+	/* as with process_looks_hung, a busy snapshot is not kept */
+	failures += Check(!observe(policy, state, snapshot('S', 21, 100),
+				   60000), "nothing to compare with");
+	failures += Check(observe(policy, state, snapshot('S', 21, 100),
+				  60000), "expected idle");
+	failures += Check(!observe(policy, state, snapshot('S', 23, 100),
+				   1000), "2 ticks in 1s is not");
+	failures += Check(!observe(policy, state, snapshot('S', 23, 200),
+				   1000), "different threads");
+	failures += Check(!observe(policy, state, snapshot('R', 23, 200),
+				   1000), "running");
+	failures += Check(!observe(policy, state, snapshot('S', 23, 200),
+				   1000), "nothing to compare with");
+	failures += Check(observe(policy, state, snapshot('S', 24, 200),
+				  1000), "1 tick in 1s is idle");
+	policy->free(state);
+	policy->free(NULL);
+
+	return failures;
+}
+
+unsigned test_hang_policy_cpu(void)
+{
+	unsigned failures = 0;
+
+	const struct hang_policy *policy = &hang_policy_cpu;
+	struct hang_policy_config config = {
+		.thresholds = {.max_tick_delta = 5,.max_thread_churn = 0 },
+		.args = NULL,
+		.release = state_list_free,
+	};
+	void *state = policy->init(&config);
+	failures += Check(state, "init returned NULL");
+	if (!state) {
+		return failures;
+	}
+
+	failures += Check(!observe(policy, state, snapshot('R', 10, 100),
+				   60000), "first");
+	/* 3 threads of 1 tick each, whatever their state or tids */
+	failures += Check(observe(policy, state, snapshot('R', 11, 200),
+				  60000), "3 ticks in 60s is idle");
+	failures += Check(!observe(policy, state, snapshot('S', 13, 300),
+				   60000), "6 ticks in 60s is not");
+	policy->free(state);
+
+	config.args = "60";
+	state = policy->init(&config);
+	failures += Check(!observe(policy, state, snapshot('R', 10, 100),
+				   60000), "first");
+	failures += Check(observe(policy, state, snapshot('R', 30, 100),
+				  60000), "60 ticks in 60s is idle");
+	failures += Check(observe(policy, state, snapshot('R', 30, 100),
+				  60000), "expected idle");
+	policy->free(state);
+
+	config.args = "lots";
+	capture_begin();
+	state = policy->init(&config);
+	capture_end();
+	failures += Check(state == NULL, "expected NULL");
+	failures += Check(strstr(buf, "cpu:lots is not"), "%s", buf);
+
+	return failures;
+}
+
+/* a policy which finds every snapshot after the first hung */
+unsigned long impatient_inits;
+unsigned long impatient_frees;
+
+static void *impatient_init(const struct hang_policy_config *config)
+{
+	++impatient_inits;
+	return calloc(1, sizeof(config->thresholds));
+}
+
+static void impatient_observe(void *state, struct state_list **snapshot,
+			      unsigned interval_ms)
+{
+	(void)snapshot;
+	(void)interval_ms;
+	++*(unsigned long *)state;
+}
+
+static int impatient_verdict(void *state)
+{
+	return *(unsigned long *)state > 1;
+}
+
+static void impatient_free(void *state)
+{
+	impatient_frees += state ? 1 : 0;
+	free(state);
+}
+
+const struct hang_policy impatient_policy = {
+	.abi_version = YOYO_HANG_POLICY_ABI,
+	.name = "impatient",
+	.init = impatient_init,
+	.observe = impatient_observe,
+	.verdict = impatient_verdict,
+	.free = impatient_free,
+};
+
+unsigned test_hang_policy_of_job(void)
+{
+	unsigned failures = 0;
+
+	/* a busy child, which the default policy would never kill */
+	char *argv[] = { "sh", "-c", "while :; do :; done", NULL };
+	struct yoyo_job job;
+	yoyo_job_init(&job, argv, 1, 1, 50);
+	job.policy = &impatient_policy;
+
+	capture_begin();
+	int exit_val = yoyo_jobs(&job, 1);
+	capture_end();
+
+	failures += Check(exit_val == EXIT_FAILURE, "expected %d but was %d",
+			  EXIT_FAILURE, exit_val);
+	failures += Check(job.attempts == 2, "expected 2 but was %u",
+			  job.attempts);
+	failures += Check(strstr(buf, "'sh' failed after 2 attempt(s)"), "%s",
+			  buf);
+	failures += Check(impatient_inits == 2 && impatient_frees == 2,
+			  "inits %lu, frees %lu", impatient_inits,
+			  impatient_frees);
+	yoyo_job_release(&job);
+
+	return failures;
+}
+
+/* a policy which keeps each snapshot, and in verdict empties it, as it
+ * may: the snapshot is its own once kept */
+struct hoarder {
+	void (*release)(struct state_list *snapshot);
+	struct state_list *kept;
+	unsigned long verdicts;
+};
+
+static void *hoarder_init(const struct hang_policy_config *config)
+{
+	struct hoarder *h = calloc(1, sizeof(struct hoarder));
+	if (h) {
+		h->release = config->release;
+	}
+	return h;
+}
+
+static void hoarder_observe(void *state, struct state_list **snapshot,
+			    unsigned interval_ms)
+{
+	(void)interval_ms;
+	struct hoarder *h = state;
+	h->release(h->kept);
+	h->kept = *snapshot;
+	*snapshot = NULL;
+}
+
+static int hoarder_verdict(void *state)
+{
+	struct hoarder *h = state;
+	h->kept->len = 0;
+	return ++h->verdicts > 1;
+}
+
+static void hoarder_free(void *state)
+{
+	struct hoarder *h = state;
+	if (h) {
+		h->release(h->kept);
+	}
+	free(h);
+}
+
+const struct hang_policy hoarder_policy = {
+	.abi_version = YOYO_HANG_POLICY_ABI,
+	.name = "hoarder",
+	.init = hoarder_init,
+	.observe = hoarder_observe,
+	.verdict = hoarder_verdict,
+	.free = hoarder_free,
+};
+
+extern struct trace_writer *global_trace;
+
+unsigned test_hang_policy_keeps_snapshot(void)
+{
+	unsigned failures = 0;
+
+	const char *trace_path = "/tmp/test_hang_policy.trace";
+	unlink(trace_path);
+	global_trace = trace_writer_open(trace_path);
+
+	char *argv[] = { "sleep", "10", NULL };
+	struct yoyo_job job;
+	yoyo_job_init(&job, argv, 0, 1, 50);
+	job.policy = &hoarder_policy;
+
+	capture_begin();
+	int exit_val = yoyo_jobs(&job, 1);
+	capture_end();
+	yoyo_job_release(&job);
+	trace_writer_close(global_trace);
+	global_trace = NULL;
+
+	failures += Check(exit_val == EXIT_FAILURE, "expected %d but was %d",
+			  EXIT_FAILURE, exit_val);
+	/* what was traced is what was sampled, not what the policy made of
+	 * it afterwards */
+	struct trace_reader *r = trace_reader_open(trace_path);
+	failures += Check(r, "trace_reader_open returned NULL");
+	unsigned long snapshots = 0;
+	while (r && trace_reader_next(r) == 1) {
+		++snapshots;
+		failures += Check(r->states->len == 1, "snapshot %lu: %zu",
+				  snapshots, r->states->len);
+	}
+	failures += Check(snapshots >= 2, "only %lu snapshot(s)", snapshots);
+	trace_reader_close(r);
+
+	unlink(trace_path);
+	return failures;
+}
+
+int main(void)
+{
+	unsigned failures = 0;
+
+	failures += run_test(test_hang_policy_find);
+	failures += run_test(test_hang_policy_shared_object);
+	failures += run_test(test_hang_policy_unknown);
+	failures += run_test(test_hang_policy_default);
+	failures += run_test(test_hang_policy_cpu);
+	failures += run_test(test_hang_policy_of_job);
+	failures += run_test(test_hang_policy_keeps_snapshot);
+
+	return failures_to_status("test_hang_policy", failures);
+}
@@ -0,0 +1,98 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/* Copyright (C) 2020, 2021 Eric Herman <eric@freesa.org> */
+
+#include "yoyo.h"
+#include "test-util.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define Buflen (80 * 24)
+char buf[Buflen];
+
+static int run_yoyo(int argc, char **argv)
+{
+	const char *env[] = { YOYO_TEST_QUICK_HANG, "YOYO_HEARTBEAT=300ms",
+		NULL
+	};
+	struct yoyo_test_run run = { .env = env, .log = buf,
+		.log_len = Buflen
+	};
+	return yoyo_test_run(&run, argc, argv);
+}
+
+/* a shell waiting on "sleep" looks hung to /proc, but for the beats;
+ * the pipe is reopened by path, as a shell may not redirect to fd 10+ */
+#define Beat "printf . >/proc/self/fd/$YOYO_HEARTBEAT_FD"
+
+unsigned test_heartbeat_keeps_alive(void)
+{
+	unsigned failures = 0;
+
+	char *argv[] = { "yoyo", "sh", "-c",
+		"for i in 1 2 3 4; do " Beat "; sleep 0.25; done",
+		NULL
+	};
+	int argc = (sizeof(argv) / sizeof(argv[0])) - 1;
+
+	int exit_val = run_yoyo(argc, argv);
+
+	failures += Check(exit_val == EXIT_SUCCESS, "expected %d but was %d"
+			  " output: %s", EXIT_SUCCESS, exit_val, buf);
+	failures += Check(!strstr(buf, "killed"), "%s", buf);
+
+	return failures;
+}
+
+unsigned test_heartbeat_silence_is_a_hang(void)
+{
+	unsigned failures = 0;
+
+	char *argv[] = { "yoyo", "--jobs", "sh", "-c",
+		Beat "; sleep 0.2; " Beat "; while :; do :; done", NULL
+	};
+	int argc = (sizeof(argv) / sizeof(argv[0])) - 1;
+
+	long start = now_ms();
+	int exit_val = run_yoyo(argc, argv);
+	long elapsed = now_ms() - start;
+
+	/* busy, as far as /proc can tell */
+	failures += Check_hang_found(exit_val, elapsed, buf,
+				     "no heartbeat from child");
+
+	return failures;
+}
+
+unsigned test_heartbeat_falls_back_to_proc(void)
+{
+	unsigned failures = 0;
+
+	char *argv[] = { "yoyo", "--jobs", "sleep", "30", ";", "sh", "-c",
+		"test -n \"$YOYO_HEARTBEAT_FD\"", NULL
+	};
+	int argc = (sizeof(argv) / sizeof(argv[0])) - 1;
+
+	long start = now_ms();
+	int exit_val = run_yoyo(argc, argv);
+	long elapsed = now_ms() - start;
+
+	failures += Check_hang_found(exit_val, elapsed, buf,
+				     "'sleep' failed after 1 attempt(s)");
+	const char *expect = "'sh' succeeded after 1 attempt(s)";
+	failures += Check(strstr(buf, expect), "no '%s' in: %s", expect, buf);
+	failures += Check(!strstr(buf, "no heartbeat"), "%s", buf);
+
+	return failures;
+}
+
+int main(void)
+{
+	unsigned failures = 0;
+
+	failures += run_test(test_heartbeat_keeps_alive);
+	failures += run_test(test_heartbeat_silence_is_a_hang);
+	failures += run_test(test_heartbeat_falls_back_to_proc);
+
+	return failures_to_status("test_heartbeat", failures);
+}
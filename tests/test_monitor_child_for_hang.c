@@ -4,16 +4,28 @@
 #include "yoyo.h"
 #include "test-util.h"
 
+#include <errno.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
 #include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
 
 extern int (*yoyo_kill)(pid_t pid, int sig);
 extern unsigned int (*yoyo_sleep)(unsigned int seconds);
 extern struct state_list *(*get_states) (long pid);
 extern void (*free_states)(struct state_list *l);
+extern int (*yoyo_pidfd_open)(pid_t pid, unsigned int flags);
+extern int (*yoyo_epoll_wait)(int epfd, struct epoll_event *events,
+			      int maxevents, int timeout);
+extern pid_t (*yoyo_waitpid)(pid_t pid, int *wstatus, int options);
 
 #include <stdio.h>
 
 extern int yoyo_verbose;
+extern unsigned hang_check_interval_min_ms;
+extern unsigned hang_check_interval_max_ms;
+extern struct monitor_metrics global_monitor_metrics;
 extern FILE *yoyo_stdout;
 extern FILE *yoyo_stderr;
 
@@ -27,6 +39,7 @@ struct monitor_child_context {
 	struct state_list *templates;
 	size_t template_len;
 	unsigned has_exited;
+	unsigned reaped;
 	unsigned sleep_count;
 	unsigned get_states_count;
 	unsigned get_states_sleeping_after;
@@ -36,10 +49,19 @@ struct monitor_child_context {
 	unsigned sig_term_count_to_set_exited;
 	unsigned sig_kill_count;
 	unsigned sig_kill_count_to_set_exited;
+	unsigned wait_count;
+	unsigned pidfd_exit_at;
 };
 
 struct monitor_child_context *ctx = NULL;
 
+int faux_pidfd_open(pid_t pid, unsigned int flags);
+int faux_epoll_wait(int epfd, struct epoll_event *events, int maxevents,
+		    int timeout);
+pid_t faux_waitpid(pid_t pid, int *wstatus, int options);
+int no_pidfd_open(pid_t pid, unsigned int flags);
+int (*real_pidfd_open)(pid_t pid, unsigned int flags);
+
 unsigned test_monitor_and_exit_after_4(void)
 {
 	const long child_pid = 10007;
@@ -64,9 +86,9 @@ unsigned test_monitor_and_exit_after_4(void)
 	ctx->get_states_sleeping_after = 2;
 
 	unsigned max_hangs = 3;
-	unsigned hang_check_interval = default_hang_check_interval;
+	unsigned hang_check_interval_ms = default_hang_check_interval_ms;
 
-	monitor_child_for_hang(child_pid, max_hangs, hang_check_interval);
+	monitor_child_for_hang(child_pid, max_hangs, hang_check_interval_ms);
 
 	failures +=
 	    Check(ctx->sig_term_count == 0, "expected 0 but was %u",
@@ -108,7 +130,7 @@ unsigned test_monitor_requires_sigkill(void)
 	ctx->sig_kill_count_to_set_exited = 1;
 
 	unsigned max_hangs = 3;
-	unsigned hang_check_interval = default_hang_check_interval;
+	unsigned hang_check_interval_ms = default_hang_check_interval_ms;
 
 	const size_t buflen = 80 * 24;
 	char buf[80 * 24];
@@ -118,7 +140,7 @@ unsigned test_monitor_requires_sigkill(void)
 	yoyo_stderr = fbuf;
 	yoyo_verbose = 1;
 
-	monitor_child_for_hang(child_pid, max_hangs, hang_check_interval);
+	monitor_child_for_hang(child_pid, max_hangs, hang_check_interval_ms);
 
 	fflush(fbuf);
 	fclose(fbuf);
@@ -134,6 +156,11 @@ unsigned test_monitor_requires_sigkill(void)
 	    Check(strstr(buf, expect), "'%s' not found in: %s\n\n", expect,
 		  buf);
 
+	expect = "interval: 60000ms (min: 60000ms, max: 60000ms)";
+	failures +=
+	    Check(strstr(buf, expect), "'%s' not found in: %s\n\n", expect,
+		  buf);
+
 	expect = "kill(child_pid, SIGTERM)";
 	failures +=
 	    Check(strstr(buf, expect), "'%s' not found in: %s\n\n", expect,
@@ -152,6 +179,196 @@ unsigned test_monitor_requires_sigkill(void)
 	return failures;
 }
 
+unsigned test_monitor_pidfd_sees_exit(void)
+{
+	const long child_pid = 10007;
+	struct thread_state three_states_a[3] = {
+		{.pid = 10007,.state = 'S',.utime = 3217,.stime = 3259 },
+		{.pid = 10009,.state = 'R',.utime = 6733,.stime = 5333 },
+		{.pid = 10037,.state = 'R',.utime = 0,.stime = 0 }
+	};
+	struct state_list template = {.states = three_states_a,.len = 3 };
+
+	unsigned failures = 0;
+
+	struct monitor_child_context context;
+	memset(&context, 0x00, sizeof(struct monitor_child_context));
+	ctx = &context;
+
+	ctx->failures = &failures;
+	ctx->child_pid = child_pid;
+	ctx->templates = &template;
+	ctx->template_len = 1;
+	ctx->pidfd_exit_at = 3;
+	yoyo_verbose = 0;
+
+	yoyo_pidfd_open = faux_pidfd_open;
+
+	monitor_child_for_hang(child_pid, 3, default_hang_check_interval_ms);
+
+	yoyo_pidfd_open = no_pidfd_open;
+
+	failures +=
+	    Check(ctx->wait_count == 3, "expected 3 but was %u",
+		  ctx->wait_count);
+	failures +=
+	    Check(ctx->get_states_count == 2, "expected 2 but was %u",
+		  ctx->get_states_count);
+	failures += Check(ctx->reaped, "expected reaped");
+	failures +=
+	    Check(ctx->sig_term_count == 0, "expected 0 but was %u",
+		  ctx->sig_term_count);
+	failures +=
+	    Check(ctx->free_states_count == ctx->get_states_count,
+		  "expected %u but was %u", ctx->get_states_count,
+		  ctx->free_states_count);
+
+	return failures;
+}
+
+unsigned test_monitor_real_child_exit_is_prompt(void)
+{
+	unsigned failures = 0;
+
+	int (*saved_kill)(pid_t pid, int sig) = yoyo_kill;
+	unsigned int (*saved_sleep)(unsigned int seconds) = yoyo_sleep;
+	struct state_list *(*saved_get_states)(long pid) = get_states;
+	void (*saved_free_states)(struct state_list *l) = free_states;
+	yoyo_kill = kill;
+	yoyo_sleep = sleep;
+	get_states = get_states_proc;
+	free_states = state_list_free;
+	yoyo_pidfd_open = real_pidfd_open;
+	yoyo_epoll_wait = epoll_wait;
+	yoyo_waitpid = waitpid;
+
+	pid_t child = fork();
+	if (child == 0) {
+		usleep(100 * 1000);
+		_exit(EXIT_SUCCESS);
+	}
+
+	long start = now_ms();
+	unsigned killed = monitor_child_for_hang(child, 3, 60 * 1000);
+	long elapsed = now_ms() - start;
+
+	failures += Check(killed == 0, "expected 0 but was %u", killed);
+	failures += Check(elapsed < 10 * 1000, "expected < 10s but was %ldms",
+			  elapsed);
+	/* already reaped by monitor_child_for_hang */
+	errno = 0;
+	pid_t pid = waitpid(child, NULL, WNOHANG);
+	failures += Check(pid == -1 && errno == ECHILD, "expected ECHILD");
+
+	yoyo_kill = saved_kill;
+	yoyo_sleep = saved_sleep;
+	get_states = saved_get_states;
+	free_states = saved_free_states;
+	yoyo_pidfd_open = no_pidfd_open;
+	yoyo_epoll_wait = faux_epoll_wait;
+	yoyo_waitpid = faux_waitpid;
+
+	return failures;
+}
+
+unsigned test_monitor_real_child_hang_is_killed(void)
+{
+	unsigned failures = 0;
+
+	int (*saved_kill)(pid_t pid, int sig) = yoyo_kill;
+	struct state_list *(*saved_get_states)(long pid) = get_states;
+	void (*saved_free_states)(struct state_list *l) = free_states;
+	yoyo_kill = kill;
+	get_states = get_states_proc;
+	free_states = state_list_free;
+	yoyo_pidfd_open = real_pidfd_open;
+	yoyo_epoll_wait = epoll_wait;
+	yoyo_waitpid = waitpid;
+
+	pid_t child = fork();
+	if (child == 0) {
+		pause();
+		_exit(EXIT_SUCCESS);
+	}
+
+	/* sampled every 250ms: hung at the second sample, and SIGTERM
+	 * ends the grace period early */
+	long start = now_ms();
+	unsigned killed = monitor_child_for_hang(child, 0, 250);
+	long elapsed = now_ms() - start;
+
+	failures += Check(killed == 1, "expected 1 but was %u", killed);
+	failures += Check(elapsed >= 500, "expected >= 500ms but was %ldms",
+			  elapsed);
+	failures += Check(elapsed < 5 * 1000, "expected < 5s but was %ldms",
+			  elapsed);
+
+	yoyo_kill = saved_kill;
+	get_states = saved_get_states;
+	free_states = saved_free_states;
+	yoyo_pidfd_open = no_pidfd_open;
+	yoyo_epoll_wait = faux_epoll_wait;
+	yoyo_waitpid = faux_waitpid;
+
+	return failures;
+}
+
+unsigned test_monitor_busy_child_backs_off(void)
+{
+	unsigned failures = 0;
+
+	int (*saved_kill)(pid_t pid, int sig) = yoyo_kill;
+	struct state_list *(*saved_get_states)(long pid) = get_states;
+	void (*saved_free_states)(struct state_list *l) = free_states;
+	yoyo_kill = kill;
+	get_states = get_states_proc;
+	free_states = state_list_free;
+	yoyo_pidfd_open = real_pidfd_open;
+	yoyo_epoll_wait = epoll_wait;
+	yoyo_waitpid = waitpid;
+	hang_check_interval_min_ms = 50;
+	hang_check_interval_max_ms = 400;
+
+	pid_t child = fork();
+	if (child == 0) {
+		long end = now_ms() + 1500;
+		while (now_ms() < end) {
+			;	/* spin */
+		}
+		_exit(EXIT_SUCCESS);
+	}
+
+	unsigned killed = monitor_child_for_hang(child, 3, 100);
+	struct monitor_metrics *metrics = &global_monitor_metrics;
+
+	failures += Check(killed == 0, "expected 0 but was %u", killed);
+	failures +=
+	    Check(metrics->interval_ms == 400, "expected 400 but was %u",
+		  metrics->interval_ms);
+	failures +=
+	    Check(metrics->interval_min_ms == 50, "expected 50 but was %u",
+		  metrics->interval_min_ms);
+	failures +=
+	    Check(metrics->interval_max_ms == 400, "expected 400 but was %u",
+		  metrics->interval_max_ms);
+	failures += Check(metrics->busy_samples >= 2, "expected >= 2 but was %lu",
+			  metrics->busy_samples);
+	/* 15 samples at a fixed 100ms, fewer once backed off */
+	failures += Check(metrics->samples < 10, "expected < 10 but was %lu",
+			  metrics->samples);
+
+	hang_check_interval_min_ms = 0;
+	hang_check_interval_max_ms = 0;
+	yoyo_kill = saved_kill;
+	get_states = saved_get_states;
+	free_states = saved_free_states;
+	yoyo_pidfd_open = no_pidfd_open;
+	yoyo_epoll_wait = faux_epoll_wait;
+	yoyo_waitpid = faux_waitpid;
+
+	return failures;
+}
+
 /* Test Fixture functions */
 int check_for_proc_end(void)
 {
@@ -283,17 +500,84 @@ unsigned int faux_sleep(unsigned int seconds)
 	return 0;
 }
 
+int faux_pidfd_open(pid_t pid, unsigned int flags)
+{
+	(void)flags;
+	if (pid != ctx->child_pid) {
+		++(*ctx->failures);
+	}
+	/* any fd which epoll accepts will do */
+	return eventfd(0, EFD_CLOEXEC);
+}
+
+/* each wait passes one timer interval, unless the child has exited */
+int faux_epoll_wait(int epfd, struct epoll_event *events, int maxevents,
+		    int timeout)
+{
+	(void)epfd;
+	if (maxevents < 1 || timeout != -1) {
+		++(*ctx->failures);
+	}
+	++ctx->wait_count;
+
+	if (ctx->pidfd_exit_at) {
+		if (ctx->wait_count >= ctx->pidfd_exit_at) {
+			ctx->has_exited = 1;
+			events[0].data.u64 = SUPERVISOR_EV_PIDFD;
+		} else {
+			events[0].data.u64 = SUPERVISOR_EV_TIMER;
+		}
+		return 1;
+	}
+
+	faux_sleep(1);
+	events[0].data.u64 = ctx->has_exited ? SUPERVISOR_EV_SIGCHLD
+	    : SUPERVISOR_EV_TIMER;
+	return 1;
+}
+
+pid_t faux_waitpid(pid_t pid, int *wstatus, int options)
+{
+	if (pid != -1 || !(options & WNOHANG)) {
+		++(*ctx->failures);
+	}
+	if (ctx->has_exited && !ctx->reaped) {
+		ctx->reaped = 1;
+		*wstatus = 0;
+		return ctx->child_pid;
+	}
+	return 0;
+}
+
+/* as with kernels before 5.3: exercise the kill(pid, 0) polling */
+int no_pidfd_open(pid_t pid, unsigned int flags)
+{
+	(void)pid;
+	(void)flags;
+	errno = ENOSYS;
+	return -1;
+}
+
 int main(void)
 {
 	unsigned failures = 0;
 
+	real_pidfd_open = yoyo_pidfd_open;
+
 	yoyo_kill = faux_kill;
+	yoyo_pidfd_open = no_pidfd_open;
 	yoyo_sleep = faux_sleep;
+	yoyo_epoll_wait = faux_epoll_wait;
+	yoyo_waitpid = faux_waitpid;
 	get_states = faux_get_states;
 	free_states = faux_free_states;
 
 	failures += run_test(test_monitor_and_exit_after_4);
 	failures += run_test(test_monitor_requires_sigkill);
+	failures += run_test(test_monitor_pidfd_sees_exit);
+	failures += run_test(test_monitor_real_child_exit_is_prompt);
+	failures += run_test(test_monitor_real_child_hang_is_killed);
+	failures += run_test(test_monitor_busy_child_backs_off);
 
 	return failures_to_status("test_monitor_child_for_hang", failures);
 }
@@ -0,0 +1,90 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/* Copyright (C) 2020, 2021 Eric Herman <eric@freesa.org> */
+
+#include "yoyo.h"
+#include "test-util.h"
+
+#include <unistd.h>
+
+unsigned test_backs_off_while_busy(void)
+{
+	unsigned failures = 0;
+
+	unsigned interval = 1000;
+	interval = next_hang_check_interval(interval, 250, 8000, 0, 1);
+	failures +=
+	    Check(interval == 2000, "expected 2000 but was %u", interval);
+	interval = next_hang_check_interval(interval, 250, 8000, 0, 1);
+	interval = next_hang_check_interval(interval, 250, 8000, 0, 1);
+	interval = next_hang_check_interval(interval, 250, 8000, 0, 1);
+	failures +=
+	    Check(interval == 8000, "expected 8000 but was %u", interval);
+
+	/* neither busy nor idle: keep the pace */
+	interval = next_hang_check_interval(interval, 250, 8000, 0, 0);
+	failures +=
+	    Check(interval == 8000, "expected 8000 but was %u", interval);
+
+	return failures;
+}
+
+unsigned test_tightens_once_idle(void)
+{
+	unsigned failures = 0;
+
+	unsigned interval = 8000;
+	interval = next_hang_check_interval(interval, 250, 8000, 1, 0);
+	failures +=
+	    Check(interval == 4000, "expected 4000 but was %u", interval);
+	for (int i = 0; i < 10; ++i) {
+		interval = next_hang_check_interval(interval, 250, 8000, 1, 0);
+	}
+	failures +=
+	    Check(interval == 250, "expected 250 but was %u", interval);
+
+	/* with equal bounds, the interval is fixed */
+	interval = next_hang_check_interval(60000, 60000, 60000, 1, 0);
+	failures +=
+	    Check(interval == 60000, "expected 60000 but was %u", interval);
+	interval = next_hang_check_interval(60000, 60000, 60000, 0, 1);
+	failures +=
+	    Check(interval == 60000, "expected 60000 but was %u", interval);
+
+	return failures;
+}
+
+unsigned test_ticks_look_busy(void)
+{
+	unsigned failures = 0;
+
+	long hz = sysconf(_SC_CLK_TCK);
+
+	/* a whole CPU for a second */
+	failures += Check(ticks_look_busy(hz, 1000), "expected busy");
+	/* a tenth of a CPU */
+	failures += Check(!ticks_look_busy(hz / 10, 1000), "expected not busy");
+	failures += Check(!ticks_look_busy(0, 1000), "expected not busy");
+
+	struct thread_state two[2] = {
+		{.pid = 10007,.state = 'S',.utime = 3,.stime = 4 },
+		{.pid = 10009,.state = 'R',.utime = 100,.stime = 20 }
+	};
+	struct state_list list = {.states = two,.len = 2 };
+	unsigned long long ticks = state_list_ticks(&list);
+	failures += Check(ticks == 127, "expected 127 but was %llu", ticks);
+	ticks = state_list_ticks(NULL);
+	failures += Check(ticks == 0, "expected 0 but was %llu", ticks);
+
+	return failures;
+}
+
+int main(void)
+{
+	unsigned failures = 0;
+
+	failures += run_test(test_backs_off_while_busy);
+	failures += run_test(test_tightens_once_idle);
+	failures += run_test(test_ticks_look_busy);
+
+	return failures_to_status("test_next_hang_check_interval", failures);
+}
@@ -0,0 +1,204 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/* Copyright (C) 2020, 2021 Eric Herman <eric@freesa.org> */
+
+#include "yoyo.h"
+#include "test-util.h"
+
+#include <signal.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#define Buflen (80 * 24)
+char buf[Buflen];
+
+/* as sd_notify(3) does it */
+static int notify(const char *msg)
+{
+	const char *name = getenv("NOTIFY_SOCKET");
+	if (!name || name[0] != '@') {
+		return -1;
+	}
+	struct sockaddr_un addr;
+	memset(&addr, 0x00, sizeof(struct sockaddr_un));
+	addr.sun_family = AF_UNIX;
+	size_t len = strlen(name);
+	memcpy(addr.sun_path + 1, name + 1, len - 1);
+	socklen_t addr_len = offsetof(struct sockaddr_un, sun_path) + len;
+	int fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+	ssize_t sent = sendto(fd, msg, strlen(msg), 0,
+			      (struct sockaddr *)&addr, addr_len);
+	close(fd);
+	return sent < 0 ? -1 : 0;
+}
+
+/* rather than exec a program, the forked child runs one of these */
+static int fake_execvp(const char *pathname, char *const argv[])
+{
+	(void)argv;
+	if (strcmp(pathname, "pinging") == 0) {
+		const char *usec = getenv("WATCHDOG_USEC");
+		const char *pid = getenv("WATCHDOG_PID");
+		if (!usec || strcmp(usec, "300000") != 0 || !pid
+		    || atol(pid) != (long)getpid()) {
+			_exit(2);
+		}
+		notify("READY=1\nSTATUS=working");
+		/* asleep, as far as /proc can tell */
+		for (int i = 0; i < 8; ++i) {
+			sleep_ms(100);
+			notify("WATCHDOG=1");
+		}
+		_exit(0);
+	} else if (strcmp(pathname, "stuck") == 0) {
+		notify("READY=1\nSTATUS=stuck on item 7");
+		/* busy, as far as /proc can tell */
+		spin_forever();
+	} else if (strcmp(pathname, "usec") == 0) {
+		notify("WATCHDOG_USEC=200000\nWATCHDOG=1");
+		spin_forever();
+	} else if (strcmp(pathname, "trigger") == 0) {
+		notify("READY=1");
+		notify("WATCHDOG=trigger");
+		spin_forever();
+	} else if (strcmp(pathname, "stopping") == 0) {
+		/* still talking in the grace period after SIGTERM */
+		signal(SIGTERM, SIG_IGN);
+		notify("READY=1");
+		notify("WATCHDOG=trigger");
+		sleep_ms(20);
+		notify("STOPPING=1");
+		sleep_ms(30 * 1000);
+	} else if (strcmp(pathname, "uninstrumented") == 0) {
+		sleep_ms(30 * 1000);
+	}
+	_exit(127);
+}
+
+/* with a watchdog period, or with only the notify socket */
+static int run_yoyo(int argc, char **argv, const char *watchdog)
+{
+	char setting[40];
+	snprintf(setting, sizeof(setting), "YOYO_WATCHDOG=%s", watchdog);
+	const char *env[] = { YOYO_TEST_QUICK_HANG,
+		watchdog ? setting : "YOYO_NOTIFY=1", NULL
+	};
+	struct yoyo_test_run run = { .env = env, .execvp = fake_execvp,
+		.log = buf, .log_len = Buflen
+	};
+	return yoyo_test_run(&run, argc, argv);
+}
+
+unsigned test_notify_watchdog_keeps_alive(void)
+{
+	unsigned failures = 0;
+
+	char *argv[] = { "yoyo", "pinging", NULL };
+	int argc = (sizeof(argv) / sizeof(argv[0])) - 1;
+
+	int exit_val = run_yoyo(argc, argv, "300ms");
+
+	failures += Check(exit_val == EXIT_SUCCESS, "expected %d but was %d"
+			  " output: %s", EXIT_SUCCESS, exit_val, buf);
+	failures += Check(!strstr(buf, "killed"), "%s", buf);
+
+	return failures;
+}
+
+unsigned test_notify_watchdog_silence_is_a_hang(void)
+{
+	unsigned failures = 0;
+
+	char *argv[] = { "yoyo", "--jobs", "stuck", ";", "usec", NULL };
+	int argc = (sizeof(argv) / sizeof(argv[0])) - 1;
+
+	long start = now_ms();
+	int exit_val = run_yoyo(argc, argv, "300ms");
+	long elapsed = now_ms() - start;
+
+	failures += Check_hang_found(exit_val, elapsed, buf,
+				     "in 300000us, status: stuck on item 7");
+	/* as the child asked */
+	const char *expect = "in 200000us\n";
+	failures += Check(strstr(buf, expect), "no '%s' in: %s", expect, buf);
+
+	return failures;
+}
+
+unsigned test_notify_without_watchdog(void)
+{
+	unsigned failures = 0;
+
+	/* only the period the child sends is enforced */
+	char *argv[] = { "yoyo", "--jobs", "usec", ";", "trigger", NULL };
+	int argc = (sizeof(argv) / sizeof(argv[0])) - 1;
+
+	long start = now_ms();
+	int exit_val = run_yoyo(argc, argv, NULL);
+	long elapsed = now_ms() - start;
+
+	failures += Check_hang_found(exit_val, elapsed, buf,
+				     "no watchdog from child");
+	const char *expect = "triggered its watchdog";
+	failures += Check(strstr(buf, expect), "no '%s' in: %s", expect, buf);
+
+	return failures;
+}
+
+unsigned test_notify_after_kill_is_drained(void)
+{
+	unsigned failures = 0;
+
+	char *argv[] = { "yoyo", "stopping", NULL };
+	int argc = (sizeof(argv) / sizeof(argv[0])) - 1;
+
+	long start = now_ms();
+	long start_cpu = cpu_ms();
+	int exit_val = run_yoyo(argc, argv, NULL);
+	long cpu = cpu_ms() - start_cpu;
+	long elapsed = now_ms() - start;
+
+	failures += Check_hang_found(exit_val, elapsed, buf,
+				     "triggered its watchdog");
+	/* a datagram left unread would have kept yoyo spinning */
+	failures += Check(cpu < 20 + (elapsed / 4),
+			  "used %ldms of cpu in %ldms", cpu, elapsed);
+
+	return failures;
+}
+
+unsigned test_notify_falls_back_to_proc(void)
+{
+	unsigned failures = 0;
+
+	char *argv[] = { "yoyo", "--jobs", "uninstrumented", NULL };
+	int argc = (sizeof(argv) / sizeof(argv[0])) - 1;
+
+	long start = now_ms();
+	int exit_val = run_yoyo(argc, argv, "300ms");
+	long elapsed = now_ms() - start;
+
+	failures += Check_hang_found(exit_val, elapsed, buf,
+				     "'uninstrumented' failed after 1"
+				     " attempt(s)");
+	failures += Check(!strstr(buf, "watchdog"), "%s", buf);
+
+	return failures;
+}
+
+int main(void)
+{
+	unsigned failures = 0;
+
+	failures += run_test(test_notify_watchdog_keeps_alive);
+	failures += run_test(test_notify_watchdog_silence_is_a_hang);
+	failures += run_test(test_notify_without_watchdog);
+	failures += run_test(test_notify_after_kill_is_drained);
+	failures += run_test(test_notify_falls_back_to_proc);
+
+	return failures_to_status("test_notify", failures);
+}
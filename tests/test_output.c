@@ -0,0 +1,255 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/* Copyright (C) 2020, 2021 Eric Herman <eric@freesa.org> */
+
+#include "yoyo.h"
+#include "test-util.h"
+
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define Buflen (80 * 24)
+char buf[Buflen];
+char out[Buflen];
+
+/* the child's stdout and stderr are yoyo's, read back into out */
+static int run_yoyo(int argc, char **argv, int open_flags)
+{
+	const char *env[] = { YOYO_TEST_QUICK_HANG,
+		"YOYO_OUTPUT_SILENCE=300ms", NULL
+	};
+	struct yoyo_test_run run = { .env = env, .log = buf,
+		.log_len = Buflen, .out = out, .out_len = Buflen,
+		.out_flags = open_flags
+	};
+	return yoyo_test_run(&run, argc, argv);
+}
+
+unsigned test_output_keeps_alive(void)
+{
+	unsigned failures = 0;
+
+	/* a shell waiting on "sleep" looks hung to /proc, but for its
+	 * output */
+	char *argv[] = { "yoyo", "sh", "-c",
+		"for i in 1 2 3 4; do echo out $i; echo err $i >&2;"
+		    " sleep 0.25; done", NULL
+	};
+	int argc = (sizeof(argv) / sizeof(argv[0])) - 1;
+
+	int exit_val = run_yoyo(argc, argv, 0);
+
+	failures += Check(exit_val == EXIT_SUCCESS, "expected %d but was %d"
+			  " output: %s", EXIT_SUCCESS, exit_val, buf);
+	failures += Check(!strstr(buf, "killed"), "%s", buf);
+	const char *expect = "out 1\nerr 1\nout 2\nerr 2\nout 3\nerr 3\n"
+	    "out 4\nerr 4\n";
+	failures += Check(strcmp(out, expect) == 0, "expected '%s' but was"
+			  " '%s'", expect, out);
+
+	return failures;
+}
+
+unsigned test_output_silence_is_a_hang(void)
+{
+	unsigned failures = 0;
+
+	char *argv[] = { "yoyo", "--jobs", "sh", "-c",
+		"echo starting; sleep 0.2; echo working >&2;"
+		    " while :; do :; done", NULL
+	};
+	int argc = (sizeof(argv) / sizeof(argv[0])) - 1;
+
+	long start = now_ms();
+	/* splice refuses O_APPEND, so this is copied */
+	int exit_val = run_yoyo(argc, argv, O_APPEND);
+	long elapsed = now_ms() - start;
+
+	/* busy, as far as /proc can tell */
+	failures += Check_hang_found(exit_val, elapsed, buf,
+				     "no output from child");
+	const char *expect = "starting\nworking\n";
+	failures += Check(strcmp(out, expect) == 0, "expected '%s' but was"
+			  " '%s'", expect, out);
+
+	return failures;
+}
+
+unsigned test_output_reader_stalled(void)
+{
+	unsigned failures = 0;
+
+	/* nobody reads yoyo's stdout, and more is written than fits */
+	fflush(stdout);
+	int saved = dup(STDOUT_FILENO);
+	int fds[2];
+	if (pipe(fds)) {
+		return ++failures;
+	}
+	dup2(fds[1], STDOUT_FILENO);
+	close(fds[1]);
+
+	const char *env[] = { "YOYO_MAX_RETRIES=0",
+		"YOYO_HANG_CHECK_INTERVAL=100ms", "YOYO_OUTPUT_SILENCE=300ms",
+		NULL
+	};
+	struct yoyo_test_run run = { .env = env, .log = buf,
+		.log_len = Buflen
+	};
+	char *argv[] = { "yoyo", "--jobs", "head", "-c", "1000000",
+		"/dev/zero", ";", "true", NULL
+	};
+	int argc = (sizeof(argv) / sizeof(argv[0])) - 1;
+	/* rather than block for ever */
+	alarm(10);
+	long start = now_ms();
+	long start_cpu = cpu_ms();
+	int exit_val = yoyo_test_run(&run, argc, argv);
+	long cpu = cpu_ms() - start_cpu;
+	long elapsed = now_ms() - start;
+	alarm(0);
+
+	dup2(saved, STDOUT_FILENO);
+	close(saved);
+	close(fds[0]);
+
+	/* the other job was still supervised */
+	failures += Check_hang_found(exit_val, elapsed, buf,
+				     "'true' succeeded after 1 attempt(s)");
+	/* nor did yoyo spin on the pipe it could not pass on */
+	failures += Check(cpu < 20 + (elapsed / 4),
+			  "used %ldms of cpu in %ldms", cpu, elapsed);
+
+	return failures;
+}
+
+/* where the sleeper reports when it was told to stop */
+int term_fds[2] = { -1, -1 };
+
+static void sleeper_term(int sig)
+{
+	(void)sig;
+	long when = now_ms();
+	write(term_fds[1], &when, sizeof(when));
+	_exit(EXIT_FAILURE);
+}
+
+/* rather than exec a program, the forked child runs one of these */
+static int fake_execvp(const char *pathname, char *const argv[])
+{
+	(void)argv;
+	if (strcmp(pathname, "writer") == 0) {
+		/* more than fits in yoyo's stdout and the pipe to it */
+		char block[4096];
+		memset(block, 'x', sizeof(block));
+		for (size_t i = 0; i < 25; ++i) {
+			write(STDOUT_FILENO, block, sizeof(block));
+		}
+		_exit(EXIT_SUCCESS);
+	}
+	signal(SIGTERM, sleeper_term);
+	for (;;) {
+		pause();
+	}
+}
+
+unsigned test_output_left_for_stalled_reader(void)
+{
+	unsigned failures = 0;
+
+	const char *manifest = "/tmp/test_output_left.conf";
+	FILE *f = fopen(manifest, "w");
+	if (!f || pipe(term_fds)) {
+		return ++failures;
+	}
+	/* the writer's leftovers wait for up to its interval, while the
+	 * sleeper is to be found hung well within it; the sleeper comes
+	 * first, as without an exec it would keep the writer's pidfd */
+	fprintf(f, "max_retries = 0\n"
+		"[job]\ncommand = sleeper\nmax_hangs = 1\n"
+		"hang_check_interval = 100ms\n"
+		"[job]\ncommand = writer\noutput_silence = 10s\n"
+		"hang_check_interval = 2s\n");
+	fclose(f);
+
+	/* nobody reads yoyo's stdout */
+	fflush(stdout);
+	int saved = dup(STDOUT_FILENO);
+	int fds[2];
+	if (pipe(fds)) {
+		return ++failures;
+	}
+	dup2(fds[1], STDOUT_FILENO);
+	close(fds[1]);
+
+	struct yoyo_test_run run = { .execvp = fake_execvp, .log = buf,
+		.log_len = Buflen
+	};
+	char *argv[] = { "yoyo", "--manifest", (char *)manifest, NULL };
+	int argc = (sizeof(argv) / sizeof(argv[0])) - 1;
+	alarm(10);
+	long start = now_ms();
+	int exit_val = yoyo_test_run(&run, argc, argv);
+	long elapsed = now_ms() - start;
+	alarm(0);
+
+	dup2(saved, STDOUT_FILENO);
+	close(saved);
+	close(fds[0]);
+	unlink(manifest);
+	close(term_fds[1]);
+	long term_at = 0;
+	if (read(term_fds[0], &term_at, sizeof(term_at)) != sizeof(term_at)) {
+		term_at = 0;
+	}
+	close(term_fds[0]);
+
+	failures += Check(exit_val == EXIT_FAILURE, "expected %d but was %d",
+			  EXIT_FAILURE, exit_val);
+	failures += Check(strstr(buf, "'writer' succeeded after 1"), "%s", buf);
+	failures += Check(strstr(buf, "'sleeper' failed after 1"), "%s", buf);
+	/* not held up by the writer's output */
+	failures += Check(term_at && term_at - start < 1000,
+			  "sleeper stopped after %ldms", term_at - start);
+	/* which was dropped once the writer's interval had passed */
+	failures += Check(strstr(buf, "output 1 of an ended attempt not all"),
+			  "%s", buf);
+	failures += Check(elapsed >= 2000 && elapsed < 4000,
+			  "took %ldms", elapsed);
+
+	return failures;
+}
+
+unsigned test_output_falls_back_to_proc(void)
+{
+	unsigned failures = 0;
+
+	char *argv[] = { "yoyo", "--jobs", "sleep", "30", NULL };
+	int argc = (sizeof(argv) / sizeof(argv[0])) - 1;
+
+	long start = now_ms();
+	int exit_val = run_yoyo(argc, argv, 0);
+	long elapsed = now_ms() - start;
+
+	failures += Check_hang_found(exit_val, elapsed, buf,
+				     "'sleep' failed after 1 attempt(s)");
+	failures += Check(!strstr(buf, "no output"), "%s", buf);
+
+	return failures;
+}
+
+int main(void)
+{
+	unsigned failures = 0;
+
+	failures += run_test(test_output_keeps_alive);
+	failures += run_test(test_output_silence_is_a_hang);
+	failures += run_test(test_output_reader_stalled);
+	failures += run_test(test_output_left_for_stalled_reader);
+	failures += run_test(test_output_falls_back_to_proc);
+
+	return failures_to_status("test_output", failures);
+}
@@ -0,0 +1,144 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/* Copyright (C) 2020, 2021 Eric Herman <eric@freesa.org> */
+
+#include "yoyo.h"
+#include "test-util.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+extern FILE *yoyo_stdout;
+extern FILE *yoyo_stderr;
+extern struct poll_profile global_poll_profile;
+
+unsigned test_poll_histogram(void)
+{
+	unsigned failures = 0;
+
+	struct poll_histogram h;
+	memset(&h, 0x00, sizeof(h));
+	for (unsigned long long v = 1; v <= 100; ++v) {
+		poll_histogram_add(&h, v);
+	}
+	poll_histogram_add(&h, 0);
+
+	failures += Check(h.count == 101, "expected 101 but was %lu", h.count);
+	failures += Check(h.min == 0, "expected 0 but was %llu", h.min);
+	failures += Check(h.max == 100, "expected 100 but was %llu", h.max);
+	failures += Check(h.sum == 5050, "expected 5050 but was %llu", h.sum);
+	/* 1 in [1,1], 2 in [2,3], 4 in [4,7] ... 37 in [64,127] */
+	failures += Check(h.buckets[0] == 1 && h.buckets[1] == 1
+			  && h.buckets[2] == 2 && h.buckets[7] == 37,
+			  "unexpected buckets");
+
+	unsigned long long p50 = poll_histogram_quantile(&h, 0.5);
+	failures += Check(p50 == 63, "expected 63 but was %llu", p50);
+	unsigned long long p99 = poll_histogram_quantile(&h, 0.99);
+	failures += Check(p99 == 100, "expected 100 but was %llu", p99);
+
+	struct poll_histogram empty;
+	memset(&empty, 0x00, sizeof(empty));
+	failures += Check(poll_histogram_quantile(&empty, 0.5) == 0,
+			  "expected 0 for an empty histogram");
+
+	return failures;
+}
+
+unsigned test_poll_cost_of_real_sample(void)
+{
+	unsigned failures = 0;
+
+	struct sampler_task task;
+	memset(&task, 0x00, sizeof(task));
+	task.pid = getpid();
+	sampler_pool_run(NULL, &task, 1);
+	/* the second poll re-uses the open files */
+	state_list_free(task.states);
+	sampler_pool_run(NULL, &task, 1);
+
+	struct poll_cost *cost = &task.cost;
+	failures += Check(cost->threads == 1, "expected 1 but was %lu",
+			  cost->threads);
+	/* lseek, getdents64 twice, pread, pread of children */
+	failures += Check(cost->syscalls >= 4, "expected >= 4 but was %lu",
+			  cost->syscalls);
+	failures += Check(cost->bytes_read > 100, "expected > 100 but was %lu",
+			  cost->bytes_read);
+	failures += Check(cost->sample_ns >= cost->parse_ns,
+			  "sample %llu < parse %llu", cost->sample_ns,
+			  cost->parse_ns);
+	failures += Check(cost->parse_ns > 0, "expected parse time");
+
+	state_list_free(task.states);
+	get_states_proc_release(task.pid);
+
+	struct poll_profile profile;
+	memset(&profile, 0x00, sizeof(profile));
+	poll_profile_add(&profile, cost);
+	char buf[2048];
+	FILE *out = fmemopen(buf, sizeof(buf), "w");
+	poll_profile_write(&profile, out);
+	fclose(out);
+	const char *expect[] = { "yoyo poll profile: 1 polls\n", "p99",
+		"sample ns", "parse ns", "decide ns", "syscalls", "bytes read",
+		"threads                1            1            1"
+	};
+	for (size_t i = 0; i < sizeof(expect) / sizeof(expect[0]); ++i) {
+		failures += Check(strstr(buf, expect[i]), "no '%s' in:\n%s",
+				  expect[i], buf);
+	}
+
+	return failures;
+}
+
+/* the job asks its parent, yoyo, for the profile */
+unsigned test_poll_profile_on_sigusr1(void)
+{
+	unsigned failures = 0;
+
+	setenv("YOYO_MAX_RETRIES", "0", 1);
+	setenv("YOYO_HANG_CHECK_INTERVAL", "100ms", 1);
+	char *argv[] = { "yoyo", "--jobs", "sh", "-c",
+		"sleep 0.35; kill -USR1 $PPID; sleep 0.2", NULL
+	};
+	char buf[4096];
+	memset(buf, 0x00, sizeof(buf));
+	FILE *fbuf = fmemopen(buf, sizeof(buf), "w");
+	yoyo_stdout = fbuf;
+	yoyo_stderr = fbuf;
+	int exit_val = yoyo(5, argv);
+	fclose(fbuf);
+	yoyo_stdout = NULL;
+	yoyo_stderr = NULL;
+	unsetenv("YOYO_MAX_RETRIES");
+	unsetenv("YOYO_HANG_CHECK_INTERVAL");
+
+	failures += Check(exit_val == EXIT_SUCCESS, "expected %d but was %d",
+			  EXIT_SUCCESS, exit_val);
+	const char *expect = "yoyo poll profile: ";
+	const char *found = strstr(buf, expect);
+	failures += Check(found, "no '%s' in: %s", expect, buf);
+	failures += Check(found && !strstr(found + 1, expect),
+			  "expected one profile, without YOYO_PROFILE");
+	failures += Check(global_poll_profile.sample_ns.count >= 3,
+			  "expected >= 3 polls, was %lu",
+			  global_poll_profile.sample_ns.count);
+	failures += Check(global_poll_profile.decide_ns.count
+			  == global_poll_profile.sample_ns.count,
+			  "expected a decision per poll");
+
+	return failures;
+}
+
+int main(void)
+{
+	unsigned failures = 0;
+
+	failures += run_test(test_poll_histogram);
+	failures += run_test(test_poll_cost_of_real_sample);
+	failures += run_test(test_poll_profile_on_sigusr1);
+
+	return failures_to_status("test_poll_profile", failures);
+}
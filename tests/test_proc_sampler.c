@@ -0,0 +1,151 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/* Copyright (C) 2020, 2021 Eric Herman <eric@freesa.org> */
+
+#include "yoyo.h"
+#include "test-util.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+void *block_on_pipe(void *arg)
+{
+	int *fds = (int *)arg;
+	char c;
+	if (read(fds[0], &c, 1) < 0) {
+		perror("read");
+	}
+	return NULL;
+}
+
+unsigned test_sampler_keeps_files_open(void)
+{
+	unsigned failures = 0;
+
+	struct proc_sampler *sampler = proc_sampler_new(getpid());
+	failures += Check(sampler, "proc_sampler_new returned NULL");
+	if (!sampler) {
+		return failures;
+	}
+
+	struct state_list *sl = proc_sampler_sample(sampler);
+	failures += Check(sl && sl->len == 1, "expected 1 thread");
+	/* the task directory and the one stat file */
+	failures +=
+	    Check(sampler->opens == 2, "expected 2 but was %lu",
+		  sampler->opens);
+	state_list_free(sl);
+
+	/* rewind the task dir, getdents64 until empty, pread the stat */
+	unsigned long expect_syscalls = sampler->syscalls + 4;
+	sl = proc_sampler_sample(sampler);
+	failures += Check(sl && sl->len == 1, "expected 1 thread");
+	failures +=
+	    Check(sampler->opens == 2, "expected 2 but was %lu",
+		  sampler->opens);
+	failures +=
+	    Check(sampler->syscalls == expect_syscalls,
+		  "expected %lu but was %lu", expect_syscalls,
+		  sampler->syscalls);
+	if (sl && sl->len) {
+		failures +=
+		    Check(sl->states[0].pid == (long)getpid(),
+			  "expected %ld but was %ld", (long)getpid(),
+			  sl->states[0].pid);
+	}
+	state_list_free(sl);
+
+	proc_sampler_free(sampler);
+
+	return failures;
+}
+
+unsigned test_sampler_follows_task_set(void)
+{
+	unsigned failures = 0;
+
+	int fds[2];
+	if (pipe(fds)) {
+		return 1;
+	}
+	pthread_t thread;
+	pthread_create(&thread, NULL, block_on_pipe, fds);
+
+	struct proc_sampler *sampler = proc_sampler_new(getpid());
+
+	struct state_list *sl = NULL;
+	/* the new thread may not yet be visible in /proc */
+	for (int i = 0; i < 100; ++i) {
+		state_list_free(sl);
+		sl = proc_sampler_sample(sampler);
+		if (sl && sl->len == 2) {
+			break;
+		}
+		usleep(1000);
+	}
+	failures +=
+	    Check(sl && sl->len == 2, "expected 2 but was %zu",
+		  sl ? sl->len : 0);
+	state_list_free(sl);
+
+	unsigned long opens = sampler->opens;
+	unsigned long closes = sampler->closes;
+	failures += Check(opens >= 3, "expected 3 but was %lu", opens);
+
+	if (write(fds[1], "x", 1) != 1) {
+		++failures;
+	}
+	pthread_join(thread, NULL);
+
+	sl = proc_sampler_sample(sampler);
+	failures +=
+	    Check(sl && sl->len == 1, "expected 1 but was %zu",
+		  sl ? sl->len : 0);
+	failures +=
+	    Check(sampler->closes == closes + 1, "expected %lu but was %lu",
+		  closes + 1, sampler->closes);
+	failures +=
+	    Check(sampler->opens == opens, "expected %lu but was %lu", opens,
+		  sampler->opens);
+	state_list_free(sl);
+
+	proc_sampler_free(sampler);
+	close(fds[0]);
+	close(fds[1]);
+
+	return failures;
+}
+
+unsigned test_sampler_pid_not_exists(void)
+{
+	unsigned failures = 0;
+
+	struct proc_sampler *sampler = proc_sampler_new(-1);
+	struct state_list *sl = proc_sampler_sample(sampler);
+
+	failures += Check(sl, "expected empty list, not NULL");
+	failures +=
+	    Check(sl && sl->len == 0, "expected 0 but was %zu",
+		  sl ? sl->len : 0);
+	failures +=
+	    Check(sampler->opens == 0, "expected 0 but was %lu",
+		  sampler->opens);
+
+	state_list_free(sl);
+	proc_sampler_free(sampler);
+	proc_sampler_free(NULL);
+
+	return failures;
+}
+
+int main(void)
+{
+	unsigned failures = 0;
+
+	failures += run_test(test_sampler_keeps_files_open);
+	failures += run_test(test_sampler_follows_task_set);
+	failures += run_test(test_sampler_pid_not_exists);
+
+	return failures_to_status("test_proc_sampler", failures);
+}
@@ -0,0 +1,274 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/* Copyright (C) 2020, 2021 Eric Herman <eric@freesa.org> */
+
+#include "yoyo.h"
+#include "test-util.h"
+
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+extern int yoyo_verbose;
+
+/* the child forks a grandchild which blocks on "grandchild_fds", reaps
+ * it, and then blocks on "child_fds" */
+int child_fds[2];
+int grandchild_fds[2];
+
+void block_on(int fd)
+{
+	char c;
+	if (read(fd, &c, 1) < 0) {
+		perror("read");
+	}
+}
+
+long fork_family(void)
+{
+	if (pipe(child_fds) || pipe(grandchild_fds)) {
+		return -1;
+	}
+	pid_t child = fork();
+	if (child == 0) {
+		close(child_fds[1]);
+		pid_t grandchild = fork();
+		if (grandchild == 0) {
+			close(grandchild_fds[1]);
+			block_on(grandchild_fds[0]);
+			_exit(EXIT_SUCCESS);
+		}
+		close(grandchild_fds[0]);
+		close(grandchild_fds[1]);
+		waitpid(grandchild, NULL, 0);
+		block_on(child_fds[0]);
+		_exit(EXIT_SUCCESS);
+	}
+	close(child_fds[0]);
+	close(grandchild_fds[0]);
+	return child;
+}
+
+struct state_list *sample_until_len(struct proc_tree *tree, size_t len)
+{
+	struct state_list *sl = NULL;
+	for (int i = 0; i < 1000; ++i) {
+		state_list_free(sl);
+		sl = proc_tree_sample(tree);
+		if (sl && sl->len == len) {
+			break;
+		}
+		usleep(1000);
+	}
+	return sl;
+}
+
+unsigned test_tree_follows_descendants(void)
+{
+	unsigned failures = 0;
+
+	long child = fork_family();
+	if (child < 0) {
+		return 1;
+	}
+
+	struct proc_tree *tree = proc_tree_new(child, 1);
+
+	struct state_list *sl = sample_until_len(tree, 2);
+	failures +=
+	    Check(sl && sl->len == 2, "expected 2 but was %zu",
+		  sl ? sl->len : 0);
+	failures += Check(tree->len == 2, "expected 2 but was %zu", tree->len);
+	failures += Check(tree->rescans, "expected a rescan");
+	state_list_free(sl);
+
+	/* nothing forked or reaped, nothing to rescan */
+	unsigned long rescans = tree->rescans;
+	sl = proc_tree_sample(tree);
+	state_list_free(sl);
+	failures +=
+	    Check(tree->rescans == rescans, "expected %lu but was %lu",
+		  rescans, tree->rescans);
+
+	/* the grandchild exits and is reaped */
+	close(grandchild_fds[1]);
+	sl = sample_until_len(tree, 1);
+	failures +=
+	    Check(sl && sl->len == 1, "expected 1 but was %zu",
+		  sl ? sl->len : 0);
+	if (sl && sl->len) {
+		failures +=
+		    Check(sl->states[0].pid == child, "expected %ld but was %ld",
+			  child, sl->states[0].pid);
+	}
+	failures += Check(tree->len == 1, "expected 1 but was %zu", tree->len);
+	state_list_free(sl);
+
+	close(child_fds[1]);
+	waitpid(child, NULL, 0);
+
+	sl = proc_tree_sample(tree);
+	failures +=
+	    Check(sl && sl->len == 0, "expected 0 but was %zu",
+		  sl ? sl->len : 0);
+	state_list_free(sl);
+
+	proc_tree_free(tree);
+	proc_tree_free(NULL);
+
+	return failures;
+}
+
+unsigned test_tree_without_descendants(void)
+{
+	unsigned failures = 0;
+
+	long child = fork_family();
+	if (child < 0) {
+		return 1;
+	}
+
+	struct proc_tree *tree = proc_tree_new(child, 0);
+
+	/* give the grandchild time to appear, it should still be ignored */
+	usleep(10000);
+	struct state_list *sl = proc_tree_sample(tree);
+	failures +=
+	    Check(sl && sl->len == 1, "expected 1 but was %zu",
+		  sl ? sl->len : 0);
+	failures += Check(tree->len == 1, "expected 1 but was %zu", tree->len);
+	state_list_free(sl);
+	proc_tree_free(tree);
+
+	close(grandchild_fds[1]);
+	close(child_fds[1]);
+	waitpid(child, NULL, 0);
+
+	return failures;
+}
+
+unsigned test_tree_membership_from_events(void)
+{
+	unsigned failures = 0;
+
+	long child = fork_family();
+	if (child < 0) {
+		return 1;
+	}
+
+	/* wait until the grandchild has been forked */
+	struct proc_tree *tree = proc_tree_new(child, 1);
+	state_list_free(sample_until_len(tree, 2));
+	proc_tree_free(tree);
+
+	tree = proc_tree_new(child, 1);
+	tree->events = 1;
+
+	/* the initial tree is still learned from the children files */
+	struct state_list *sl = proc_tree_sample(tree);
+	failures +=
+	    Check(sl && sl->len == 2, "expected 2 but was %zu",
+		  sl ? sl->len : 0);
+	long grandchild = (sl && sl->len == 2) ? sl->states[1].pid : 0;
+	state_list_free(sl);
+
+	/* afterwards only events change the membership */
+	int changed = proc_tree_exited(tree, grandchild);
+	failures += Check(changed == 1, "expected 1 but was %d", changed);
+	sl = proc_tree_sample(tree);
+	failures +=
+	    Check(sl && sl->len == 1, "expected 1 but was %zu",
+		  sl ? sl->len : 0);
+	state_list_free(sl);
+
+	changed = proc_tree_exited(tree, child);
+	failures += Check(changed == 0, "expected 0 but was %d", changed);
+
+	changed = proc_tree_forked(tree, 1, grandchild);
+	failures += Check(changed == 0, "expected 0 but was %d", changed);
+
+	changed = proc_tree_forked(tree, child, grandchild);
+	failures += Check(changed == 1, "expected 1 but was %d", changed);
+	sl = proc_tree_sample(tree);
+	failures +=
+	    Check(sl && sl->len == 2, "expected 2 but was %zu",
+		  sl ? sl->len : 0);
+	state_list_free(sl);
+
+	proc_tree_free(tree);
+
+	close(grandchild_fds[1]);
+	close(child_fds[1]);
+	waitpid(child, NULL, 0);
+
+	return failures;
+}
+
+unsigned test_proc_connector(void)
+{
+	unsigned failures = 0;
+
+	struct proc_connector *connector = proc_connector_open();
+	if (!connector) {
+		fprintf(stderr, " (proc connector not permitted, skipping)");
+		return 0;
+	}
+
+	long child = fork_family();
+	if (child < 0) {
+		proc_connector_close(connector);
+		return 1;
+	}
+
+	struct proc_tree *tree = proc_tree_new(child, 1);
+	tree->events = 1;
+	struct state_list *sl = NULL;
+	for (int i = 0; i < 1000; ++i) {
+		state_list_free(sl);
+		proc_connector_drain(connector, tree);
+		sl = proc_tree_sample(tree);
+		if (sl && sl->len == 2) {
+			break;
+		}
+		usleep(1000);
+	}
+	failures +=
+	    Check(sl && sl->len == 2, "expected 2 but was %zu",
+		  sl ? sl->len : 0);
+	state_list_free(sl);
+
+	/* the exit of the grandchild arrives as an event */
+	close(grandchild_fds[1]);
+	for (int i = 0; i < 1000 && tree->len != 1; ++i) {
+		usleep(1000);
+		proc_connector_drain(connector, tree);
+		state_list_free(proc_tree_sample(tree));
+	}
+	failures += Check(tree->len == 1, "expected 1 but was %zu", tree->len);
+	failures += Check(connector->events, "expected events");
+
+	proc_tree_free(tree);
+	proc_connector_close(connector);
+	proc_connector_close(NULL);
+
+	close(child_fds[1]);
+	waitpid(child, NULL, 0);
+
+	return failures;
+}
+
+int main(void)
+{
+	unsigned failures = 0;
+
+	yoyo_verbose = -1;
+
+	failures += run_test(test_tree_follows_descendants);
+	failures += run_test(test_tree_without_descendants);
+	failures += run_test(test_tree_membership_from_events);
+	failures += run_test(test_proc_connector);
+
+	return failures_to_status("test_proc_tree", failures);
+}
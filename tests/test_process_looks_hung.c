@@ -7,6 +7,8 @@
 #include <stdio.h>
 #include <string.h>
 
+extern struct hang_thresholds hang_thresholds;
+
 unsigned test_previous_is_null_next_sleeping(void)
 {
 	struct thread_state three_sleeping[3] = {
@@ -84,15 +86,22 @@ unsigned test_all_sleeping_different_length(void)
 	struct state_list *previous = &all_sleeping3;
 	struct state_list *current = &all_sleeping4;
 
+	/* one thread appearing is within the default churn */
 	int hung = process_looks_hung(&next, previous, current);
 
 	unsigned failures = 0;
 
-	failures += Check(hung == 0, "expected 0 but was %d", hung);
+	failures += Check(hung == 1, "expected 1 but was %d", hung);
 
 	failures +=
 	    Check(next == current, "expected %p but was %p", current, next);
 
+	struct hang_thresholds strict = {.max_tick_delta = 5,
+		.max_thread_churn = 0
+	};
+	hung = process_looks_hung_thresholds(&strict, &next, previous, current);
+	failures += Check(hung == 0, "expected 0 but was %d", hung);
+
 	return failures;
 }
 
@@ -159,6 +168,178 @@ unsigned test_sleeping_times_increment_by_17(void)
 	return failures;
 }
 
+unsigned test_matched_by_tid_not_position(void)
+{
+	struct thread_state three_sleeping[3] = {
+		{.pid = 10007,.state = 'S',.utime = 3217,.stime = 3259 },
+		{.pid = 10009,.state = 'S',.utime = 6733,.stime = 5333 },
+		{.pid = 10037,.state = 'S',.utime = 0,.stime = 0 }
+	};
+	struct state_list all_sleeping = {.states = three_sleeping,.len = 3 };
+
+	struct thread_state reordered[3] = {
+		{.pid = 10037,.state = 'S',.utime = 1,.stime = 0 },
+		{.pid = 10007,.state = 'S',.utime = 3218,.stime = 3259 },
+		{.pid = 10009,.state = 'S',.utime = 6733,.stime = 5334 }
+	};
+	struct state_list still_sleeping = {.states = reordered,.len = 3 };
+
+	struct state_list *next = NULL;
+	int hung = process_looks_hung(&next, &all_sleeping, &still_sleeping);
+
+	unsigned failures = 0;
+
+	failures += Check(hung != 0, "expected non-zero");
+	failures +=
+	    Check(next == &still_sleeping, "expected %p but was %p",
+		  &still_sleeping, next);
+	failures +=
+	    Check(reordered[0].pid == 10007, "expected sorted, but was %ld",
+		  reordered[0].pid);
+
+	return failures;
+}
+
+unsigned test_thread_churn_tolerated(void)
+{
+	struct thread_state pool[4] = {
+		{.pid = 10007,.state = 'S',.utime = 3217,.stime = 3259 },
+		{.pid = 10009,.state = 'S',.utime = 6733,.stime = 5333 },
+		{.pid = 10011,.state = 'S',.utime = 6733,.stime = 5333 },
+		{.pid = 10037,.state = 'S',.utime = 0,.stime = 0 }
+	};
+	struct state_list before = {.states = pool,.len = 4 };
+
+	/* 10037 went away, a short-lived helper 10041 appeared */
+	struct thread_state pool_helper[4] = {
+		{.pid = 10007,.state = 'S',.utime = 3217,.stime = 3259 },
+		{.pid = 10009,.state = 'S',.utime = 6733,.stime = 5333 },
+		{.pid = 10011,.state = 'S',.utime = 6733,.stime = 5333 },
+		{.pid = 10041,.state = 'S',.utime = 9,.stime = 9 }
+	};
+	struct state_list after = {.states = pool_helper,.len = 4 };
+
+	struct hang_thresholds strict = {.max_tick_delta = 5,
+		.max_thread_churn = 0
+	};
+	/* the default, under which the helper does not hide the hang */
+	struct hang_thresholds tolerant = hang_thresholds;
+
+	unsigned failures = 0;
+	struct state_list *next = NULL;
+
+	int hung = process_looks_hung_thresholds(&strict, &next, &before,
+						 &after);
+	failures += Check(hung == 0, "expected 0 but was %d", hung);
+	failures += Check(next == &after, "expected %p but was %p", &after, next);
+
+	hung = process_looks_hung_thresholds(&tolerant, &next, &before, &after);
+	failures += Check(hung != 0, "expected non-zero");
+	failures += Check(next == &after, "expected %p but was %p", &after, next);
+
+	/* the helper gone again, the pool as it was */
+	hung = process_looks_hung_thresholds(&tolerant, &next, &after, &before);
+	failures += Check(hung != 0, "expected non-zero");
+
+	/* busy threads in common still count, whatever the churn */
+	pool_helper[1].utime += 6;
+	hung = process_looks_hung_thresholds(&tolerant, &next, &before, &after);
+	failures += Check(hung == 0, "expected 0 but was %d", hung);
+	failures += Check(next == NULL, "expected NULL but was %p", next);
+
+	return failures;
+}
+
+unsigned test_tid_reused(void)
+{
+	struct thread_state old_threads[2] = {
+		{.pid = 10007,.state = 'S',.utime = 1,.stime = 1,.starttime = 5},
+		{.pid = 10009,.state = 'S',.utime = 1,.stime = 1,.starttime = 5}
+	};
+	struct state_list before = {.states = old_threads,.len = 2 };
+
+	struct thread_state new_threads[2] = {
+		{.pid = 10007,.state = 'S',.utime = 1,.stime = 1,.starttime = 5},
+		{.pid = 10009,.state = 'S',.utime = 0,.stime = 0,.starttime = 77}
+	};
+	struct state_list after = {.states = new_threads,.len = 2 };
+
+	struct hang_thresholds one = {.max_tick_delta = 5,
+		.max_thread_churn = 1
+	};
+
+	unsigned failures = 0;
+	struct state_list *next = NULL;
+
+	int hung = process_looks_hung_thresholds(&one, &next, &before, &after);
+	failures += Check(hung == 0, "expected 0 but was %d", hung);
+	failures += Check(next == &after, "expected %p but was %p", &after, next);
+
+	return failures;
+}
+
+unsigned test_no_threads_in_common(void)
+{
+	struct thread_state one_thread[1] = {
+		{.pid = 10007,.state = 'S',.utime = 1,.stime = 1 }
+	};
+	struct state_list before = {.states = one_thread,.len = 1 };
+
+	struct thread_state other_thread[1] = {
+		{.pid = 10009,.state = 'S',.utime = 1,.stime = 1 }
+	};
+	struct state_list after = {.states = other_thread,.len = 1 };
+
+	struct hang_thresholds lax = {.max_tick_delta = 5,
+		.max_thread_churn = 100
+	};
+
+	unsigned failures = 0;
+	struct state_list *next = NULL;
+
+	int hung = process_looks_hung_thresholds(&lax, &next, &before, &after);
+	failures += Check(hung == 0, "expected 0 but was %d", hung);
+
+	return failures;
+}
+
+unsigned test_thresholds_scale_with_interval(void)
+{
+	struct hang_thresholds base = {.max_tick_delta = 5,
+		.max_thread_churn = 2
+	};
+
+	unsigned failures = 0;
+
+	struct hang_thresholds same =
+	    hang_thresholds_for_interval(&base, default_hang_check_interval_ms);
+	failures += Check(same.max_tick_delta == 5, "expected 5 but was %lu",
+			  same.max_tick_delta);
+	failures += Check(same.max_thread_churn == 2, "expected 2 but was %zu",
+			  same.max_thread_churn);
+
+	struct hang_thresholds longer = hang_thresholds_for_interval(&base,
+								     120 *
+								     1000);
+	failures +=
+	    Check(longer.max_tick_delta == 10, "expected 10 but was %lu",
+		  longer.max_tick_delta);
+
+	/* any allowance at all rounds up to at least a tick */
+	struct hang_thresholds shorter = hang_thresholds_for_interval(&base,
+								      250);
+	failures +=
+	    Check(shorter.max_tick_delta == 1, "expected 1 but was %lu",
+		  shorter.max_tick_delta);
+
+	base.max_tick_delta = 0;
+	struct hang_thresholds none = hang_thresholds_for_interval(&base, 250);
+	failures += Check(none.max_tick_delta == 0, "expected 0 but was %lu",
+			  none.max_tick_delta);
+
+	return failures;
+}
+
 int main(void)
 {
 	unsigned failures = 0;
@@ -168,6 +349,11 @@ int main(void)
 	failures += run_test(test_all_sleeping_different_length);
 	failures += run_test(test_times_increment_by_only_one);
 	failures += run_test(test_sleeping_times_increment_by_17);
+	failures += run_test(test_matched_by_tid_not_position);
+	failures += run_test(test_thread_churn_tolerated);
+	failures += run_test(test_tid_reused);
+	failures += run_test(test_no_threads_in_common);
+	failures += run_test(test_thresholds_scale_with_interval);
 
 	return failures_to_status("test_process_looks_hung", failures);
 }
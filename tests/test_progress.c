@@ -0,0 +1,140 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/* Copyright (C) 2020, 2021 Eric Herman <eric@freesa.org> */
+
+#include "yoyo.h"
+#include "yoyo-progress.h"
+#include "test-util.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define Buflen (80 * 24)
+char buf[Buflen];
+
+/* rather than exec a program, the forked child runs one of these */
+static int fake_execvp(const char *pathname, char *const argv[])
+{
+	(void)argv;
+	struct yoyo_progress *progress = yoyo_progress_open();
+	if (strcmp(pathname, "advancing") == 0) {
+		/* asleep, as far as /proc can tell */
+		for (int i = 0; i < 8; ++i) {
+			yoyo_progress_bump(progress);
+			sleep_ms(100);
+		}
+		_exit(progress ? 0 : 1);
+	} else if (strcmp(pathname, "stalling") == 0) {
+		yoyo_progress_add(progress, 3);
+		sleep_ms(150);
+		yoyo_progress_add(progress, 3);
+		spin_forever();
+	} else if (strcmp(pathname, "uninstrumented") == 0) {
+		sleep_ms(30 * 1000);
+	}
+	yoyo_progress_close(progress);
+	_exit(127);
+}
+
+static int run_yoyo(int argc, char **argv, int progress)
+{
+	const char *env[] = { YOYO_TEST_QUICK_HANG,
+		progress ? "YOYO_PROGRESS=1" : "YOYO_PROGRESS=0", NULL
+	};
+	struct yoyo_test_run run = { .env = env, .execvp = fake_execvp,
+		.log = buf, .log_len = Buflen
+	};
+	return yoyo_test_run(&run, argc, argv);
+}
+
+unsigned test_progress_keeps_alive(void)
+{
+	unsigned failures = 0;
+
+	char *argv[] = { "yoyo", "advancing", NULL };
+	int argc = (sizeof(argv) / sizeof(argv[0])) - 1;
+
+	int exit_val = run_yoyo(argc, argv, 1);
+
+	failures += Check(exit_val == EXIT_SUCCESS, "expected %d but was %d"
+			  " output: %s", EXIT_SUCCESS, exit_val, buf);
+	failures += Check(!strstr(buf, "killed"), "%s", buf);
+
+	/* without the counter, the same child looks hung */
+	exit_val = run_yoyo(argc, argv, 0);
+	failures += Check(exit_val == EXIT_FAILURE, "expected %d but was %d",
+			  EXIT_FAILURE, exit_val);
+	failures += Check(strstr(buf, "killed"), "%s", buf);
+
+	return failures;
+}
+
+unsigned test_progress_stopped_is_a_hang(void)
+{
+	unsigned failures = 0;
+
+	char *argv[] = { "yoyo", "--jobs", "stalling", NULL };
+	int argc = (sizeof(argv) / sizeof(argv[0])) - 1;
+
+	long start = now_ms();
+	int exit_val = run_yoyo(argc, argv, 1);
+	long elapsed = now_ms() - start;
+
+	failures += Check_hang_found(exit_val, elapsed, buf,
+				     "progress of child");
+	const char *expect = "stopped at 6";
+	failures += Check(strstr(buf, expect), "no '%s' in: %s", expect, buf);
+
+	return failures;
+}
+
+unsigned test_progress_falls_back_to_proc(void)
+{
+	unsigned failures = 0;
+
+	char *argv[] = { "yoyo", "--jobs", "uninstrumented", NULL };
+	int argc = (sizeof(argv) / sizeof(argv[0])) - 1;
+
+	long start = now_ms();
+	int exit_val = run_yoyo(argc, argv, 1);
+	long elapsed = now_ms() - start;
+
+	failures += Check_hang_found(exit_val, elapsed, buf,
+				     "'uninstrumented' failed after 1"
+				     " attempt(s)");
+	failures += Check(!strstr(buf, "progress of child"), "%s", buf);
+
+	return failures;
+}
+
+unsigned test_progress_open_without_yoyo(void)
+{
+	unsigned failures = 0;
+
+	unsetenv("YOYO_PROGRESS_FD");
+	struct yoyo_progress *progress = yoyo_progress_open();
+	failures += Check(!progress, "expected NULL");
+	yoyo_progress_bump(progress);
+	yoyo_progress_add(progress, 2);
+	yoyo_progress_close(progress);
+
+	setenv("YOYO_PROGRESS_FD", "0x", 1);
+	failures += Check(!yoyo_progress_open(), "expected NULL");
+	setenv("YOYO_PROGRESS_FD", "1000000", 1);
+	failures += Check(!yoyo_progress_open(), "expected NULL");
+	unsetenv("YOYO_PROGRESS_FD");
+
+	return failures;
+}
+
+int main(void)
+{
+	unsigned failures = 0;
+
+	failures += run_test(test_progress_keeps_alive);
+	failures += run_test(test_progress_stopped_is_a_hang);
+	failures += run_test(test_progress_falls_back_to_proc);
+	failures += run_test(test_progress_open_without_yoyo);
+
+	return failures_to_status("test_progress", failures);
+}
@@ -5,7 +5,10 @@
 #include "yoyo.h"
 #include "test-util.h"
 
+#include <errno.h>
+#include <sys/epoll.h>
 #include <sys/types.h>
+#include <sys/wait.h>
 #include <stdio.h>
 #include <string.h>
 #include <signal.h>
@@ -164,6 +167,7 @@ struct monitor_child_context {
 	unsigned sleep_count;
 	size_t current_state;
 	unsigned looks_hung;
+	unsigned reaped;
 };
 
 struct monitor_child_context *ctx = NULL;
@@ -180,7 +184,7 @@ unsigned test_qemu_hung(void)
 	copy_qemu_states_to_global_context(&failures);
 
 	monitor_child_for_hang(child_pid, default_max_hangs,
-			       default_hang_check_interval);
+			       default_hang_check_interval_ms);
 
 	/* fail if it does _not_ look hung */
 	failures += Check(ctx->looks_hung, "expected non-zero hung");
@@ -200,7 +204,7 @@ unsigned test_qemu_last_state_big_counter_increase(void)
 	ctx->state_lists[last]->states[9].utime += 10;
 
 	monitor_child_for_hang(child_pid, default_max_hangs,
-			       default_hang_check_interval);
+			       default_hang_check_interval_ms);
 
 	/* fail if it _does_ look hung */
 	failures +=
@@ -222,7 +226,7 @@ unsigned test_qemu_last_state_running(void)
 	ctx->state_lists[last]->states[9].state = 'R';
 
 	monitor_child_for_hang(child_pid, default_max_hangs,
-			       default_hang_check_interval);
+			       default_hang_check_interval_ms);
 
 	/* fail if it _does_ look hung */
 	failures +=
@@ -244,7 +248,7 @@ unsigned test_qemu_middle_state_big_counter_increase(void)
 	ctx->state_lists[mid]->states[4].utime += 10;
 
 	monitor_child_for_hang(child_pid, default_max_hangs,
-			       default_hang_check_interval);
+			       default_hang_check_interval_ms);
 
 	/* fail if it _does_ look hung */
 	failures +=
@@ -383,13 +387,56 @@ extern int (*yoyo_kill)(pid_t pid, int sig);
 extern unsigned int (*yoyo_sleep)(unsigned int seconds);
 extern struct state_list *(*get_states) (long pid);
 extern void (*free_states)(struct state_list *l);
+extern int (*yoyo_pidfd_open)(pid_t pid, unsigned int flags);
+extern int (*yoyo_epoll_wait)(int epfd, struct epoll_event *events,
+			      int maxevents, int timeout);
+extern pid_t (*yoyo_waitpid)(pid_t pid, int *wstatus, int options);
+
+/* each wait passes one hang_check_interval, then the child exits */
+int faux_epoll_wait(int epfd, struct epoll_event *events, int maxevents,
+		    int timeout)
+{
+	(void)epfd;
+	(void)maxevents;
+	(void)timeout;
+
+	faux_sleep(default_hang_check_interval_ms);
+	events[0].data.u64 = (ctx->current_state < ctx->state_lists_len)
+	    ? SUPERVISOR_EV_TIMER : SUPERVISOR_EV_SIGCHLD;
+	return 1;
+}
+
+pid_t faux_waitpid(pid_t pid, int *wstatus, int options)
+{
+	(void)pid;
+	(void)options;
+
+	*wstatus = 0;
+	if (ctx->current_state < ctx->state_lists_len || ctx->reaped) {
+		return 0;
+	}
+	ctx->reaped = 1;
+	return child_pid;
+}
+
+/* as with kernels before 5.3: exercise the kill(pid, 0) polling */
+int no_pidfd_open(pid_t pid, unsigned int flags)
+{
+	(void)pid;
+	(void)flags;
+	errno = ENOSYS;
+	return -1;
+}
 
 int main(void)
 {
 	unsigned failures = 0;
 
 	yoyo_kill = faux_kill;
+	yoyo_pidfd_open = no_pidfd_open;
 	yoyo_sleep = faux_sleep;
+	yoyo_epoll_wait = faux_epoll_wait;
+	yoyo_waitpid = faux_waitpid;
 	get_states = faux_get_states;
 	free_states = faux_free_states;
 
@@ -0,0 +1,144 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/* Copyright (C) 2020, 2021 Eric Herman <eric@freesa.org> */
+
+#include "yoyo.h"
+#include "test-util.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+extern struct state_list *(*get_states) (long pid);
+
+#define Tasks_len 40
+unsigned sampled_count[Tasks_len + 1];
+pthread_t sampled_by[Tasks_len + 1];
+const long huge_pid = 1;
+
+/* pids are 1 .. Tasks_len; the first one stands in for a huge process */
+struct state_list *faux_get_states(long pid)
+{
+	__atomic_fetch_add(&sampled_count[pid], 1, __ATOMIC_RELAXED);
+	sampled_by[pid] = pthread_self();
+	usleep(pid == huge_pid ? 100 * 1000 : 1000);
+
+	struct state_list *sl = state_list_new(1);
+	sl->states[0].pid = pid;
+	return sl;
+}
+
+static void tasks_init(struct sampler_task *tasks, size_t len)
+{
+	memset(sampled_count, 0x00, sizeof(sampled_count));
+	for (size_t i = 0; i < len; ++i) {
+		tasks[i].pid = (long)(i + 1);
+		tasks[i].states = NULL;
+	}
+}
+
+static unsigned check_tasks(struct sampler_task *tasks, size_t len)
+{
+	unsigned failures = 0;
+	for (size_t i = 0; i < len; ++i) {
+		long pid = tasks[i].pid;
+		failures += Check(sampled_count[pid] == 1,
+				  "pid %ld sampled %u times", pid,
+				  sampled_count[pid]);
+		failures += Check(tasks[i].states
+				  && tasks[i].states->states[0].pid == pid,
+				  "task %zu has the wrong states", i);
+		state_list_free(tasks[i].states);
+		tasks[i].states = NULL;
+	}
+	return failures;
+}
+
+unsigned test_sampler_pool_null(void)
+{
+	unsigned failures = 0;
+
+	struct sampler_task tasks[Tasks_len];
+	tasks_init(tasks, 3);
+	sampler_pool_run(NULL, tasks, 3);
+	failures += check_tasks(tasks, 3);
+	for (size_t i = 0; i < 3; ++i) {
+		failures += Check(pthread_equal(sampled_by[i + 1],
+						pthread_self()),
+				  "expected the calling thread");
+	}
+
+	return failures;
+}
+
+unsigned test_sampler_pool_steals(void)
+{
+	unsigned failures = 0;
+
+	struct sampler_pool *pool = sampler_pool_new(4);
+	failures += Check(pool, "sampler_pool_new returned NULL");
+	if (!pool) {
+		return failures;
+	}
+	failures += Check(pool->workers == 4, "expected 4 but was %u",
+			  pool->workers);
+
+	struct sampler_task tasks[Tasks_len];
+	/* more than one pass, to show that the workers wait for the next */
+	for (int pass = 0; pass < 3; ++pass) {
+		tasks_init(tasks, Tasks_len);
+		sampler_pool_run(pool, tasks, Tasks_len);
+		failures += check_tasks(tasks, Tasks_len);
+	}
+
+	unsigned long sampled = 0;
+	unsigned long stolen = 0;
+	for (unsigned w = 0; w < pool->workers; ++w) {
+		sampled += pool->shards[w].sampled;
+		stolen += pool->shards[w].stolen;
+	}
+	failures += Check(sampled == 3 * Tasks_len, "expected %d but was %lu",
+			  3 * Tasks_len, sampled);
+	/* the first shard is stuck behind the huge process; its other
+	 * tasks are taken by the workers which ran out of their own */
+	failures += Check(stolen >= 3 * 5, "expected >= 15 but was %lu",
+			  stolen);
+	failures += Check(pool->shards[0].sampled < 3 * 5,
+			  "expected < 15 but was %lu",
+			  pool->shards[0].sampled);
+
+	sampler_pool_free(pool);
+	sampler_pool_free(NULL);
+
+	return failures;
+}
+
+unsigned test_sampler_pool_one_worker(void)
+{
+	unsigned failures = 0;
+
+	struct sampler_pool *pool = sampler_pool_new(0);
+	failures += Check(pool && pool->workers == 1, "expected 1 worker");
+	struct sampler_task tasks[Tasks_len];
+	tasks_init(tasks, 5);
+	sampler_pool_run(pool, tasks, 5);
+	failures += check_tasks(tasks, 5);
+	failures += Check(pool && pool->shards[0].sampled == 5,
+			  "expected 5 sampled");
+	sampler_pool_free(pool);
+
+	return failures;
+}
+
+int main(void)
+{
+	unsigned failures = 0;
+
+	get_states = faux_get_states;
+
+	failures += run_test(test_sampler_pool_null);
+	failures += run_test(test_sampler_pool_steals);
+	failures += run_test(test_sampler_pool_one_worker);
+
+	return failures_to_status("test_sampler_pool", failures);
+}
@@ -0,0 +1,208 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/* Copyright (C) 2020, 2021 Eric Herman <eric@freesa.org> */
+
+#include "yoyo.h"
+#include "yoyo-ring.h"
+#include "test-util.h"
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+extern FILE *yoyo_stdout;
+extern FILE *yoyo_stderr;
+
+const char *ring_path = "/tmp/test_snapshot_ring.ring";
+
+/* map the ring as another process would */
+static struct yoyo_ring_header *observe(size_t *size)
+{
+	int fd = open(ring_path, O_RDONLY);
+	if (fd < 0) {
+		return NULL;
+	}
+	*size = (size_t)lseek(fd, 0, SEEK_END);
+	void *addr = mmap(NULL, *size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	return (addr == MAP_FAILED) ? NULL : addr;
+}
+
+static void set_threads(struct state_list *sl, unsigned long ticks)
+{
+	for (size_t i = 0; i < sl->len; ++i) {
+		memset(&sl->states[i], 0x00, sizeof(struct thread_state));
+		sl->states[i].pid = 100 + i;
+		sl->states[i].state = 'S';
+		sl->states[i].utime = ticks;
+		sl->states[i].stime = ticks;
+	}
+}
+
+unsigned test_snapshot_ring_layout(void)
+{
+	unsigned failures = 0;
+
+	struct snapshot_ring *ring = snapshot_ring_open(ring_path, 4, 2);
+	failures += Check(ring, "snapshot_ring_open returned NULL");
+	size_t size = 0;
+	struct yoyo_ring_header *h = observe(&size);
+	failures += Check(h, "could not map %s", ring_path);
+	if (!ring || !h) {
+		return failures;
+	}
+
+	failures += Check(h->magic == YOYO_RING_MAGIC, "magic %x", h->magic);
+	failures += Check(h->version == YOYO_RING_VERSION, "version %u",
+			  h->version);
+	failures += Check(h->slot_count == 4, "expected 4 but was %u",
+			  h->slot_count);
+	failures += Check(h->max_threads == 2, "expected 2 but was %u",
+			  h->max_threads);
+	failures += Check(h->slot_size % 64 == 0, "slot_size %u",
+			  h->slot_size);
+	failures += Check(size == h->header_size + 4 * h->slot_size,
+			  "size %zu", size);
+	failures += Check(h->writer_pid == (uint32_t)getpid(), "writer_pid");
+	failures += Check(yoyo_ring_latest(h) == -1, "expected none yet");
+
+	struct state_list *sl = state_list_new(3);
+	set_threads(sl, 7);
+	snapshot_ring_publish(ring, 2, 4242, 1, 5, sl);
+
+	failures += Check(yoyo_ring_latest(h) == 0, "expected 0 but was %ld",
+			  (long)yoyo_ring_latest(h));
+	char buf[4096];
+	struct yoyo_ring_slot *slot = (struct yoyo_ring_slot *)buf;
+	failures += Check(yoyo_ring_read(h, 0, slot, sizeof(buf)) == 0,
+			  "read failed");
+	failures += Check(slot->pid == 4242 && slot->job == 2
+			  && slot->hang_count == 1 && slot->max_hangs == 5,
+			  "pid %ld job %u hangs %u/%u", (long)slot->pid,
+			  slot->job, slot->hang_count, slot->max_hangs);
+	failures += Check(slot->len == 3, "expected 3 but was %u", slot->len);
+	failures += Check(ring->truncated == 1, "expected 1 but was %lu",
+			  ring->truncated);
+	failures += Check(slot->threads[1].tid == 101
+			  && slot->threads[1].utime == 7
+			  && slot->threads[1].state == 'S', "bad thread");
+	failures += Check(slot->timestamp_ns, "expected a timestamp");
+
+	/* wrap around: 0 and 1 are overwritten by 4 and 5 */
+	for (unsigned long i = 1; i < 6; ++i) {
+		set_threads(sl, i);
+		snapshot_ring_publish(ring, 0, 4242, 0, 5, sl);
+	}
+	failures += Check(yoyo_ring_latest(h) == 5, "expected 5 but was %ld",
+			  (long)yoyo_ring_latest(h));
+	failures += Check(yoyo_ring_read(h, 1, slot, sizeof(buf)) == -1,
+			  "expected 1 to be overwritten");
+	failures += Check(yoyo_ring_read(h, 6, slot, sizeof(buf)) == -1,
+			  "expected 6 to be not yet published");
+	failures += Check(yoyo_ring_read(h, 2, slot, sizeof(buf)) == 0
+			  && slot->threads[0].utime == 2, "expected 2");
+
+	state_list_free(sl);
+	munmap(h, size);
+	snapshot_ring_close(ring);
+	unlink(ring_path);
+
+	return failures;
+}
+
+#define Publish_count 20000
+struct reader_context {
+	const struct yoyo_ring_header *h;
+	unsigned long reads;
+	unsigned long torn;
+};
+
+void *read_while_published(void *arg)
+{
+	struct reader_context *ctx = arg;
+	char buf[4096];
+	struct yoyo_ring_slot *slot = (struct yoyo_ring_slot *)buf;
+	int64_t latest = -1;
+	while (latest < Publish_count - 1) {
+		latest = yoyo_ring_latest(ctx->h);
+		if (latest < 0 || yoyo_ring_read(ctx->h, latest, slot,
+						 sizeof(buf))) {
+			continue;
+		}
+		++ctx->reads;
+		for (uint32_t i = 0; i < slot->len; ++i) {
+			if (slot->threads[i].utime != slot->number
+			    || slot->hang_count != slot->number % 7) {
+				++ctx->torn;
+			}
+		}
+	}
+	return NULL;
+}
+
+unsigned test_snapshot_ring_concurrent_reader(void)
+{
+	unsigned failures = 0;
+
+	struct snapshot_ring *ring = snapshot_ring_open(ring_path, 2, 16);
+	size_t size = 0;
+	struct reader_context ctx = { observe(&size), 0, 0 };
+	if (!ring || !ctx.h) {
+		return 1;
+	}
+
+	pthread_t reader;
+	pthread_create(&reader, NULL, read_while_published, &ctx);
+	struct state_list *sl = state_list_new(16);
+	for (unsigned long i = 0; i < Publish_count; ++i) {
+		set_threads(sl, i);
+		snapshot_ring_publish(ring, 0, 1, i % 7, 5, sl);
+	}
+	pthread_join(reader, NULL);
+
+	failures += Check(ctx.reads > 0, "expected reads");
+	failures += Check(ctx.torn == 0, "%lu torn reads of %lu", ctx.torn,
+			  ctx.reads);
+
+	state_list_free(sl);
+	munmap((void *)ctx.h, size);
+	snapshot_ring_close(ring);
+	unlink(ring_path);
+
+	return failures;
+}
+
+unsigned test_snapshot_ring_bad_path(void)
+{
+	unsigned failures = 0;
+
+	char buf[1024];
+	FILE *fbuf = fmemopen(buf, sizeof(buf), "w");
+	yoyo_stderr = fbuf;
+	struct snapshot_ring *ring =
+	    snapshot_ring_open("/no/such/dir/ring", 4, 4);
+	fclose(fbuf);
+	yoyo_stderr = NULL;
+
+	failures += Check(ring == NULL, "expected NULL");
+	failures += Check(strstr(buf, "can not create snapshot ring"),
+			  "unexpected: %s", buf);
+	snapshot_ring_publish(NULL, 0, 1, 0, 0, NULL);
+	snapshot_ring_close(NULL);
+
+	return failures;
+}
+
+int main(void)
+{
+	unsigned failures = 0;
+
+	failures += run_test(test_snapshot_ring_layout);
+	failures += run_test(test_snapshot_ring_concurrent_reader);
+	failures += run_test(test_snapshot_ring_bad_path);
+
+	return failures_to_status("test_snapshot_ring", failures);
+}
@@ -139,6 +139,7 @@ unsigned test_state_list_pid(void)
 	}
 
 	state_list_free(sl);
+	get_states_proc_release(pid);
 
 	failures +=
 	    Check(mem->frees == mem->allocs, "(frees %zu, allocs %zu)",
@@ -207,6 +208,7 @@ unsigned test_state_list_pid_not_exists(void)
 	failures += Check(sl, "state_list_new returned null");
 
 	state_list_free(sl);
+	get_states_proc_release(bogus_pid);
 
 	failures +=
 	    Check(mem->frees == mem->allocs, "(frees %zu, allocs %zu)",
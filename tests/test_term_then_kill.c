@@ -12,6 +12,7 @@ extern int (*yoyo_kill)(pid_t pid, int sig);
 extern unsigned int (*yoyo_sleep)(unsigned int seconds);
 
 const long child_pid = 10007;
+const unsigned grace_seconds = 60;
 
 struct kill_context {
 	unsigned *failures;
@@ -33,7 +34,7 @@ unsigned test_term_then_kill(void)
 	ctx.sig_term_count = 0;
 	ctx.sig_kill_count = 0;
 	unsigned killed =
-	    term_then_kill(child_pid, default_hang_check_interval);
+	    term_then_kill(child_pid, grace_seconds);
 
 	failures += Check(killed == 1, "expected 1 but was %u", killed);
 
@@ -48,7 +49,7 @@ unsigned test_term_then_kill(void)
 	ctx.persist_after_term = 1;
 	ctx.sig_term_count = 0;
 	ctx.sig_kill_count = 0;
-	killed = term_then_kill(child_pid, default_hang_check_interval);
+	killed = term_then_kill(child_pid, grace_seconds);
 
 	failures += Check(killed == 2, "expected 1 but was %u", killed);
 
@@ -0,0 +1,113 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/* Copyright (C) 2020, 2021 Eric Herman <eric@freesa.org> */
+
+#include "yoyo.h"
+#include "test-util.h"
+
+#include <stdio.h>
+#include <string.h>
+
+extern int yoyo_verbose;
+
+unsigned test_all_fields(void)
+{
+	unsigned failures = 0;
+
+	const char *stat =
+	    "1755002 (CPU 2/KVM) S 1754992 1754990 1754990 0 -1 138412096"
+	    " 2390 0 31 0 4492748 220595 0 0 20 0 10 0 48201 4254715904"
+	    " 1060338 18446744073709551615 1 1 0 0 0 0 268445190 4096 16963"
+	    " 0 0 0 -1 5 0 0 17 0 0 0 0 0 0 0 0 0 0 0 0 0 0";
+	struct thread_state ts;
+
+	int missing = thread_state_from_stat(&ts, stat);
+
+	failures += Check(missing == 0, "expected 0 but was %d", missing);
+	failures +=
+	    Check(ts.pid == 1755002, "expected 1755002 but was %ld", ts.pid);
+	failures += Check(ts.state == 'S', "expected 'S' but was %c", ts.state);
+	failures +=
+	    Check(ts.minflt == 2390, "expected 2390 but was %lu", ts.minflt);
+	failures += Check(ts.majflt == 31, "expected 31 but was %lu", ts.majflt);
+	failures +=
+	    Check(ts.utime == 4492748, "expected 4492748 but was %lu",
+		  ts.utime);
+	failures +=
+	    Check(ts.stime == 220595, "expected 220595 but was %lu", ts.stime);
+	failures +=
+	    Check(ts.num_threads == 10, "expected 10 but was %ld",
+		  ts.num_threads);
+	failures +=
+	    Check(ts.starttime == 48201, "expected 48201 but was %lu",
+		  ts.starttime);
+	failures +=
+	    Check(ts.processor == 5, "expected 5 but was %d", ts.processor);
+	failures +=
+	    Check(ts.delayacct_blkio_ticks == 17, "expected 17 but was %lu",
+		  ts.delayacct_blkio_ticks);
+
+	return failures;
+}
+
+unsigned test_comm_with_spaces_and_parens(void)
+{
+	unsigned failures = 0;
+
+	const char *stat = "4242 (a) b) (c d) R 1 1 1 0 -1 0 0 0 0 0 77 88 0 0";
+	struct thread_state ts;
+
+	int missing = thread_state_from_stat(&ts, stat);
+
+	failures += Check(missing == 0, "expected 0 but was %d", missing);
+	failures += Check(ts.pid == 4242, "expected 4242 but was %ld", ts.pid);
+	failures += Check(ts.state == 'R', "expected 'R' but was %c", ts.state);
+	failures += Check(ts.utime == 77, "expected 77 but was %lu", ts.utime);
+	failures += Check(ts.stime == 88, "expected 88 but was %lu", ts.stime);
+	failures +=
+	    Check(ts.starttime == 0, "expected 0 but was %lu", ts.starttime);
+
+	return failures;
+}
+
+unsigned test_truncated(void)
+{
+	unsigned failures = 0;
+
+	struct thread_state ts;
+	int missing;
+
+	missing = thread_state_from_stat(&ts, "17 (x) S 1 1 1 0 -1 0 0 0 0 0 5");
+	failures += Check(missing == 1, "expected 1 but was %d", missing);
+	failures += Check(ts.utime == 5, "expected 5 but was %lu", ts.utime);
+
+	missing = thread_state_from_stat(&ts, "17 (x) S");
+	failures += Check(missing == 2, "expected 2 but was %d", missing);
+
+	missing = thread_state_from_stat(&ts, "17 (x");
+	failures += Check(missing == 3, "expected 3 but was %d", missing);
+
+	missing = thread_state_from_stat(&ts, "(x) S 1");
+	failures += Check(missing == 4, "expected 4 but was %d", missing);
+
+	missing = thread_state_from_stat(&ts, "");
+	failures += Check(missing == 4, "expected 4 but was %d", missing);
+
+	missing =
+	    thread_state_from_stat(&ts, "17 (x) S 1 1 1 0 -1 0 0 0 0 0 a b");
+	failures += Check(missing == 2, "expected 2 but was %d", missing);
+
+	return failures;
+}
+
+int main(void)
+{
+	unsigned failures = 0;
+
+	yoyo_verbose = -1;
+
+	failures += run_test(test_all_fields);
+	failures += run_test(test_comm_with_spaces_and_parens);
+	failures += run_test(test_truncated);
+
+	return failures_to_status("test_thread_state_from_stat", failures);
+}
@@ -0,0 +1,248 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/* Copyright (C) 2020, 2021 Eric Herman <eric@freesa.org> */
+
+#include "yoyo.h"
+#include "test-util.h"
+
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+extern FILE *yoyo_stdout;
+extern FILE *yoyo_stderr;
+
+const char *trace_path = "/tmp/test_trace.trace";
+
+static void set_thread(struct thread_state *ts, long tid, char state,
+		       unsigned long ticks)
+{
+	memset(ts, 0x00, sizeof(struct thread_state));
+	ts->pid = tid;
+	ts->state = state;
+	ts->utime = ticks;
+	ts->stime = ticks / 2;
+	ts->minflt = 1000 + tid;
+	ts->num_threads = 3;
+	ts->starttime = 77;
+	ts->processor = (int)(tid % 4);
+}
+
+static unsigned check_same(const struct state_list *expected,
+			   const struct trace_reader *reader)
+{
+	unsigned failures = 0;
+	const struct state_list *sl = reader->states;
+	failures += Check(sl && sl->len == expected->len, "len %zu",
+			  sl ? sl->len : 0);
+	for (size_t i = 0; sl && i < sl->len && i < expected->len; ++i) {
+		const struct thread_state *a = &expected->states[i];
+		const struct thread_state *b = &sl->states[i];
+		failures += Check(a->pid == b->pid && a->state == b->state
+				  && a->utime == b->utime
+				  && a->stime == b->stime
+				  && a->minflt == b->minflt
+				  && a->majflt == b->majflt
+				  && a->num_threads == b->num_threads
+				  && a->starttime == b->starttime
+				  && a->processor == b->processor
+				  && a->delayacct_blkio_ticks ==
+				  b->delayacct_blkio_ticks,
+				  "thread %zu: tid %ld vs %ld", i, a->pid,
+				  b->pid);
+	}
+	return failures;
+}
+
+unsigned test_trace_round_trip(void)
+{
+	unsigned failures = 0;
+	unlink(trace_path);
+
+	struct state_list *a = state_list_new(3);
+	set_thread(&a->states[0], 101, 'S', 10);
+	set_thread(&a->states[1], 100, 'R', 20);
+	set_thread(&a->states[2], 4000000, 'S', 30);
+	/* 102 appears, 101 vanishes, and the counters move both ways */
+	struct state_list *b = state_list_new(3);
+	set_thread(&b->states[0], 100, 'S', 25);
+	set_thread(&b->states[1], 102, 'D', 1);
+	set_thread(&b->states[2], 4000000, 'S', 29);
+	b->states[2].majflt = ULONG_MAX;
+	b->states[2].processor = -1;
+	struct state_list *empty = state_list_new(0);
+
+	struct trace_writer *w = trace_writer_open(trace_path);
+	failures += Check(w, "trace_writer_open returned NULL");
+	if (!w) {
+		return failures;
+	}
+	failures += Check(!trace_writer_append(w, 0, 42, 1000, 250, a), "a");
+	failures += Check(!trace_writer_append(w, 3, 43, 2000, 500, a), "a3");
+	failures += Check(!trace_writer_append(w, 0, 42, 3500, 250, b), "b");
+	failures += Check(!trace_writer_append(w, 3, 43, 4000, 500, empty),
+			  "empty");
+	failures += Check(w->records == 4, "records %lu", w->records);
+	/* an unchanged thread costs a few bytes, a large tid delta more */
+	unsigned long long before = w->bytes;
+	failures += Check(!trace_writer_append(w, 0, 42, 5000, 250, b), "b");
+	failures += Check(w->bytes - before <= 8 + 3 * 6, "%llu bytes",
+			  w->bytes - before);
+	trace_writer_close(w);
+
+	/* a second yoyo appends, starting afresh */
+	w = trace_writer_open(trace_path);
+	failures += Check(!trace_writer_append(w, 0, 44, 100, 1000, b), "b2");
+	trace_writer_close(w);
+
+	/* tids are written in order */
+	struct state_list *sorted_a = state_list_new(3);
+	sorted_a->states[0] = a->states[1];
+	sorted_a->states[1] = a->states[0];
+	sorted_a->states[2] = a->states[2];
+
+	struct trace_reader *r = trace_reader_open(trace_path);
+	failures += Check(r, "trace_reader_open returned NULL");
+	if (!r) {
+		return failures;
+	}
+	failures += Check(trace_reader_next(r) == 1, "expected a");
+	failures += Check(r->job == 0 && r->pid == 42 && r->timestamp_ns == 1000
+			  && r->interval_ms == 250, "job %u pid %ld at %lu",
+			  r->job, r->pid, (unsigned long)r->timestamp_ns);
+	failures += check_same(sorted_a, r);
+	failures += Check(trace_reader_next(r) == 1, "expected a3");
+	failures += Check(r->job == 3 && r->pid == 43 && r->interval_ms == 500,
+			  "job %u pid %ld", r->job, r->pid);
+	failures += check_same(sorted_a, r);
+	failures += Check(trace_reader_next(r) == 1, "expected b");
+	failures += Check(r->timestamp_ns == 3500, "at %lu",
+			  (unsigned long)r->timestamp_ns);
+	failures += check_same(b, r);
+	failures += Check(trace_reader_next(r) == 1, "expected empty");
+	failures += check_same(empty, r);
+	failures += Check(trace_reader_next(r) == 1, "expected b again");
+	failures += check_same(b, r);
+	failures += Check(trace_reader_next(r) == 1, "expected b2");
+	failures += Check(r->pid == 44 && r->timestamp_ns == 100,
+			  "pid %ld at %lu", r->pid,
+			  (unsigned long)r->timestamp_ns);
+	failures += Check(r->sessions == 2, "sessions %lu", r->sessions);
+	failures += check_same(b, r);
+	failures += Check(trace_reader_next(r) == 0, "expected the end");
+	trace_reader_close(r);
+
+	/* cut short in the middle of the last record */
+	int fd = open(trace_path, O_WRONLY);
+	off_t size = lseek(fd, 0, SEEK_END);
+	failures += Check(ftruncate(fd, size - 2) == 0, "ftruncate");
+	close(fd);
+	r = trace_reader_open(trace_path);
+	int rv = 1;
+	for (int i = 0; i < 10 && rv == 1; ++i) {
+		rv = trace_reader_next(r);
+	}
+	failures += Check(rv == -1, "expected -1 but was %d", rv);
+	trace_reader_close(r);
+
+	state_list_free(a);
+	state_list_free(b);
+	state_list_free(sorted_a);
+	state_list_free(empty);
+	unlink(trace_path);
+	return failures;
+}
+
+unsigned test_trace_not_a_trace(void)
+{
+	unsigned failures = 0;
+
+	FILE *log = tmpfile();
+	yoyo_stderr = log;
+	FILE *f = fopen(trace_path, "w");
+	fprintf(f, "not a trace\n");
+	fclose(f);
+	failures += Check(!trace_reader_open(trace_path), "expected NULL");
+	unlink(trace_path);
+	failures += Check(!trace_reader_open(trace_path), "expected NULL");
+	failures += Check(yoyo_replay_trace(trace_path, &hang_policy_default,
+					    NULL, 5, log) == -1,
+			  "expected -1");
+	yoyo_stderr = NULL;
+	fclose(log);
+
+	return failures;
+}
+
+unsigned test_trace_replay(void)
+{
+	unsigned failures = 0;
+	unlink(trace_path);
+
+	/* two attempts of job 1: the first idle for 8 checks, the second
+	 * busy; job 0 idle, but with a thread appearing each check */
+	struct trace_writer *w = trace_writer_open(trace_path);
+	struct state_list *sl = state_list_new(4);
+	uint64_t ns = 0;
+	for (unsigned long i = 0; i < 8; ++i) {
+		ns += 1000 * 1000 * 1000;
+		for (size_t t = 0; t < 4; ++t) {
+			set_thread(&sl->states[t], 200 + t, 'S', 50);
+		}
+		trace_writer_append(w, 1, 200, ns, 1000, sl);
+		set_thread(&sl->states[3], 300 + i, 'S', 50);
+		trace_writer_append(w, 0, 300, ns, 1000, sl);
+	}
+	for (unsigned long i = 0; i < 8; ++i) {
+		ns += 1000 * 1000 * 1000;
+		for (size_t t = 0; t < 4; ++t) {
+			set_thread(&sl->states[t], 400 + t, 'S', 50 + 10 * i);
+		}
+		trace_writer_append(w, 1, 400, ns, 1000, sl);
+	}
+	trace_writer_close(w);
+	state_list_free(sl);
+
+	char buf[1024];
+	memset(buf, 0x00, sizeof(buf));
+	FILE *out = fmemopen(buf, sizeof(buf), "w");
+	struct hang_policy_config config = {
+		.thresholds = {.max_tick_delta = 5,.max_thread_churn = 0 },
+		.release = state_list_free,
+	};
+	const struct hang_policy *policy = &hang_policy_default;
+	/* the first check has no previous, so 7 look hung */
+	long hangs = yoyo_replay_trace(trace_path, policy, &config, 5, out);
+	failures += Check(hangs == 1, "expected 1 but was %ld", hangs);
+	hangs = yoyo_replay_trace(trace_path, policy, &config, 7, out);
+	failures += Check(hangs == 0, "expected 0 but was %ld", hangs);
+	config.thresholds.max_thread_churn = 2;
+	hangs = yoyo_replay_trace(trace_path, policy, &config, 5, out);
+	failures += Check(hangs == 2, "expected 2 but was %ld", hangs);
+	/* 10 ticks in 1s is far above 5 in 60s, unless allowed */
+	config.thresholds.max_tick_delta = 600;
+	hangs = yoyo_replay_trace(trace_path, policy, &config, 5, out);
+	failures += Check(hangs == 3, "expected 3 but was %ld", hangs);
+	fclose(out);
+
+	failures += Check(strstr(buf, "job 1: pid 200 hung at 6.000s"),
+			  "%s", buf);
+	failures += Check(strstr(buf, "job 1: 2 attempt(s), 16 samples"),
+			  "%s", buf);
+
+	unlink(trace_path);
+	return failures;
+}
+
+int main(void)
+{
+	unsigned failures = 0;
+
+	failures += run_test(test_trace_round_trip);
+	failures += run_test(test_trace_not_a_trace);
+	failures += run_test(test_trace_replay);
+
+	return failures_to_status("test_trace", failures);
+}
@@ -0,0 +1,72 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/* Copyright (C) 2020, 2021 Eric Herman <eric@freesa.org> */
+
+#include "yoyo.h"
+#include "test-util.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+extern FILE *yoyo_stdout;
+extern FILE *yoyo_stderr;
+
+static unsigned check_env_ms(const char *val, unsigned expect)
+{
+	const char *name = "TEST_YOYO_ENV_MS";
+	if (val) {
+		setenv(name, val, 1);
+	} else {
+		unsetenv(name);
+	}
+	unsigned actual = yoyo_env_ms(1234, name);
+	return Check(actual == expect, "'%s': expected %u but was %u",
+		     val ? val : "(unset)", expect, actual);
+}
+
+unsigned test_yoyo_env_ms(void)
+{
+	unsigned failures = 0;
+
+	failures += check_env_ms(NULL, 1234);
+	/* plain numbers remain seconds */
+	failures += check_env_ms("60", 60 * 1000);
+	failures += check_env_ms("0", 0);
+	failures += check_env_ms("1.5", 1500);
+	failures += check_env_ms("2s", 2000);
+	failures += check_env_ms("250ms", 250);
+	failures += check_env_ms("0.5ms", 1);
+
+	return failures;
+}
+
+unsigned test_yoyo_env_ms_invalid(void)
+{
+	FILE *dev_null = fopen("/dev/null", "w");
+	yoyo_stdout = dev_null;
+	yoyo_stderr = dev_null;
+
+	unsigned failures = 0;
+
+	failures += check_env_ms("", 1234);
+	failures += check_env_ms("soon", 1234);
+	failures += check_env_ms("-1", 1234);
+	failures += check_env_ms("10min", 1234);
+
+	yoyo_stdout = NULL;
+	yoyo_stderr = NULL;
+	if (dev_null) {
+		fclose(dev_null);
+	}
+
+	return failures;
+}
+
+int main(void)
+{
+	unsigned failures = 0;
+
+	failures += run_test(test_yoyo_env_ms);
+	failures += run_test(test_yoyo_env_ms_invalid);
+
+	return failures_to_status("test_yoyo_env_ms", failures);
+}
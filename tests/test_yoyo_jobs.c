@@ -0,0 +1,202 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/* Copyright (C) 2020, 2021 Eric Herman <eric@freesa.org> */
+
+#include "yoyo.h"
+#include "yoyo-ring.h"
+#include "test-util.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+extern int yoyo_verbose;
+extern FILE *yoyo_stdout;
+extern FILE *yoyo_stderr;
+extern struct snapshot_ring *global_snapshot_ring;
+
+#define Buflen (80 * 24)
+char buf[Buflen];
+
+static int run_yoyo(int argc, char **argv)
+{
+	memset(buf, 0x00, Buflen);
+	FILE *fbuf = fmemopen(buf, Buflen, "w");
+	yoyo_stdout = fbuf;
+	yoyo_stderr = fbuf;
+	yoyo_verbose = 0;
+
+	int exit_val = yoyo(argc, argv);
+
+	fflush(fbuf);
+	fclose(fbuf);
+	yoyo_stdout = NULL;
+	yoyo_stderr = NULL;
+	return exit_val;
+}
+
+unsigned test_jobs_all_succeed(void)
+{
+	unsigned failures = 0;
+
+	char *argv[] = { "yoyo", "--jobs", "true", ";", "sh", "-c", "exit 0",
+		NULL
+	};
+	int argc = (sizeof(argv) / sizeof(argv[0])) - 1;
+
+	int exit_val = run_yoyo(argc, argv);
+
+	failures += Check(exit_val == EXIT_SUCCESS, "expected %d but was %d",
+			  EXIT_SUCCESS, exit_val);
+	const char *expect = "'true' succeeded after 1 attempt(s)";
+	failures += Check(strstr(buf, expect), "no '%s' in: %s", expect, buf);
+	expect = "'sh' succeeded after 1 attempt(s)";
+	failures += Check(strstr(buf, expect), "no '%s' in: %s", expect, buf);
+
+	return failures;
+}
+
+unsigned test_jobs_retry_independently(void)
+{
+	unsigned failures = 0;
+
+	setenv("YOYO_MAX_RETRIES", "2", 1);
+	char *argv[] = { "yoyo", "--jobs", "sh", "-c", "exit 3", ";", "true",
+		NULL
+	};
+	int argc = (sizeof(argv) / sizeof(argv[0])) - 1;
+
+	int exit_val = run_yoyo(argc, argv);
+	unsetenv("YOYO_MAX_RETRIES");
+
+	failures += Check(exit_val == EXIT_FAILURE, "expected %d but was %d",
+			  EXIT_FAILURE, exit_val);
+	const char *expect = "'sh' failed after 3 attempt(s)";
+	failures += Check(strstr(buf, expect), "no '%s' in: %s", expect, buf);
+	expect = "'true' succeeded after 1 attempt(s)";
+	failures += Check(strstr(buf, expect), "no '%s' in: %s", expect, buf);
+	expect = "exited with status 3";
+	failures += Check(strstr(buf, expect), "no '%s' in: %s", expect, buf);
+
+	return failures;
+}
+
+unsigned test_jobs_hung_together(void)
+{
+	unsigned failures = 0;
+
+	setenv("YOYO_MAX_RETRIES", "0", 1);
+	setenv("YOYO_MAX_HANGS", "1", 1);
+	setenv("YOYO_HANG_CHECK_INTERVAL", "100ms", 1);
+	setenv("YOYO_SAMPLER_WORKERS", "2", 1);
+	const char *ring_path = "/tmp/test_yoyo_jobs.ring";
+	setenv("YOYO_SNAPSHOT_RING", ring_path, 1);
+	char *argv[] = { "yoyo", "--jobs", "sleep", "30", ";", "sleep", "31",
+		";", "sleep", "32", NULL
+	};
+	int argc = (sizeof(argv) / sizeof(argv[0])) - 1;
+
+	long start = now_ms();
+	int exit_val = run_yoyo(argc, argv);
+	long elapsed = now_ms() - start;
+	unsetenv("YOYO_MAX_RETRIES");
+	unsetenv("YOYO_MAX_HANGS");
+	unsetenv("YOYO_HANG_CHECK_INTERVAL");
+	unsetenv("YOYO_SAMPLER_WORKERS");
+	unsetenv("YOYO_SNAPSHOT_RING");
+
+	failures += Check(exit_val == EXIT_FAILURE, "expected %d but was %d",
+			  EXIT_FAILURE, exit_val);
+	/* supervised side by side, not one after the other */
+	failures += Check(elapsed < 3000, "expected < 3s but was %ldms",
+			  elapsed);
+	const char *expect = "'sleep' failed after 1 attempt(s)";
+	failures += Check(strstr(buf, expect), "no '%s' in: %s", expect, buf);
+	expect = "killed";
+	failures += Check(strstr(buf, expect), "no '%s' in: %s", expect, buf);
+
+	/* each of the three jobs was sampled at least twice */
+	int fd = open(ring_path, O_RDONLY);
+	failures += Check(fd >= 0, "no %s", ring_path);
+	if (fd >= 0) {
+		size_t size = (size_t)lseek(fd, 0, SEEK_END);
+		struct yoyo_ring_header *h =
+		    mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+		close(fd);
+		int64_t latest = (h == MAP_FAILED) ? -1 : yoyo_ring_latest(h);
+		failures += Check(latest >= 5, "expected >= 5 but was %ld",
+				  (long)latest);
+		if (h != MAP_FAILED) {
+			munmap(h, size);
+		}
+	}
+	snapshot_ring_close(global_snapshot_ring);
+	global_snapshot_ring = NULL;
+	unlink(ring_path);
+
+	return failures;
+}
+
+unsigned test_jobs_none(void)
+{
+	unsigned failures = 0;
+
+	char *argv[] = { "yoyo", "--jobs", ";", NULL };
+	int argc = (sizeof(argv) / sizeof(argv[0])) - 1;
+
+	int exit_val = run_yoyo(argc, argv);
+
+	failures += Check(exit_val == EXIT_FAILURE, "expected %d but was %d",
+			  EXIT_FAILURE, exit_val);
+	const char *expect = "Usage";
+	failures += Check(strstr(buf, expect), "no '%s' in: %s", expect, buf);
+
+	return failures;
+}
+
+unsigned test_jobs_keep_open_files_limit(void)
+{
+	unsigned failures = 0;
+
+	struct rlimit saved;
+	getrlimit(RLIMIT_NOFILE, &saved);
+	if (saved.rlim_max <= 512) {
+		return failures;
+	}
+	struct rlimit limit = { 512, saved.rlim_max };
+	setrlimit(RLIMIT_NOFILE, &limit);
+
+	/* yoyo raises its own limit, but not that of its children */
+	char *check = "test \"$(ulimit -Sn)\" = 512";
+	char *argv[] = { "yoyo", "sh", "-c", check, NULL };
+	int argc = (sizeof(argv) / sizeof(argv[0])) - 1;
+	int exit_val = run_yoyo(argc, argv);
+	failures += Check(exit_val == EXIT_SUCCESS, "expected %d but was %d"
+			  " output: %s", EXIT_SUCCESS, exit_val, buf);
+
+	setrlimit(RLIMIT_NOFILE, &limit);
+	char *jobs_argv[] = { "yoyo", "--jobs", "sh", "-c", check, NULL };
+	argc = (sizeof(jobs_argv) / sizeof(jobs_argv[0])) - 1;
+	exit_val = run_yoyo(argc, jobs_argv);
+	failures += Check(exit_val == EXIT_SUCCESS, "expected %d but was %d"
+			  " output: %s", EXIT_SUCCESS, exit_val, buf);
+
+	setrlimit(RLIMIT_NOFILE, &saved);
+	return failures;
+}
+
+int main(void)
+{
+	unsigned failures = 0;
+
+	failures += run_test(test_jobs_all_succeed);
+	failures += run_test(test_jobs_retry_independently);
+	failures += run_test(test_jobs_hung_together);
+	failures += run_test(test_jobs_none);
+	failures += run_test(test_jobs_keep_open_files_limit);
+
+	return failures_to_status("test_yoyo_jobs", failures);
+}
@@ -24,12 +24,12 @@ extern fork_func yoyo_fork;
 typedef int (*execvp_func)(const char *pathname, char *const argv[]);
 extern execvp_func yoyo_execvp;
 
-typedef int (*sigaction_func)(int signum, const struct sigaction * act,
-			      struct sigaction * oldact);
-extern sigaction_func yoyo_sigaction;
+typedef int (*sigprocmask_func)(int how, const sigset_t *set,
+				sigset_t *oldset);
+extern sigprocmask_func yoyo_sigprocmask;
 
 typedef unsigned (*monitor_for_hang_func)(long child_pid, unsigned max_hangs,
-					  unsigned hang_check_interval);
+					  unsigned hang_check_interval_ms);
 extern monitor_for_hang_func monitor_for_hang;
 
 FILE *dev_null;
@@ -53,18 +53,19 @@ int fake_counting_execvp(const char *pathname, char *const *argv)
 	return 0;
 }
 
-int stashed_signum;
-struct sigaction stash_act;
-struct sigaction stash_oldact;
-int stash_sigaction(int signum, const struct sigaction *act,
-		    struct sigaction *oldact)
+unsigned sigprocmask_count;
+int stashed_first_how;
+int stashed_first_blocks_sigchld;
+int stashed_last_how;
+int stash_sigprocmask(int how, const sigset_t *set, sigset_t *oldset)
 {
-	stashed_signum = signum;
-	if (act) {
-		stash_act = *act;
+	if (!sigprocmask_count++) {
+		stashed_first_how = how;
+		stashed_first_blocks_sigchld = sigismember(set, SIGCHLD);
 	}
-	if (oldact) {
-		stash_oldact = *oldact;
+	stashed_last_how = how;
+	if (oldset) {
+		sigemptyset(oldset);
 	}
 	return 0;
 }
@@ -73,10 +74,10 @@ unsigned monitor_for_hang_count;
 int *fake_wait_status;
 size_t fake_wait_status_len;
 unsigned fake_monitor_for_hang_func(long child_pid, unsigned max_hangs,
-				    unsigned hang_check_interval)
+				    unsigned hang_check_interval_ms)
 {
 	(void)max_hangs;
-	(void)hang_check_interval;
+	(void)hang_check_interval_ms;
 
 	int wait_status = -1;
 	if (monitor_for_hang_count < fake_wait_status_len) {
@@ -97,15 +98,16 @@ unsigned test_fake_fork(void)
 	stash_pathname = NULL;
 	stash_argv = NULL;
 	fake_counting_fork_rv = 0;
-	stashed_signum = 0;
-	memset(&stash_act, 0x00, sizeof(struct sigaction));
-	memset(&stash_oldact, 0x00, sizeof(struct sigaction));
+	sigprocmask_count = 0;
+	stashed_first_how = -1;
+	stashed_first_blocks_sigchld = 0;
+	stashed_last_how = -1;
 	monitor_for_hang_count = 0;
 	fake_wait_status_len = 0;
 
 	yoyo_fork = fake_counting_fork;
 	yoyo_execvp = fake_counting_execvp;
-	yoyo_sigaction = stash_sigaction;
+	yoyo_sigprocmask = stash_sigprocmask;
 	monitor_for_hang = fake_monitor_for_hang_func;
 
 	unsigned failures = 0;
@@ -148,19 +150,20 @@ unsigned test_fake_fork(void)
 			  "expected %s but was %s", child_argv0,
 			  stash_pathname);
 
+	/* SIGCHLD is blocked, to be read from a signalfd */
 	failures +=
-	    Check(stashed_signum == SIGCHLD, "expected SIGCHLD (%d) but was %d",
-		  SIGCHLD, stashed_signum);
+	    Check(stashed_first_how == SIG_BLOCK, "expected SIG_BLOCK (%d)"
+		  " but was %d", SIG_BLOCK, stashed_first_how);
+	failures +=
+	    Check(stashed_first_blocks_sigchld == 1, "expected SIGCHLD");
 
-	void (*actual_handler)(int) = stash_act.sa_handler;
-	void (*expect_handler)(int) = exit_reason_child_trap;
+	/* the child gets the original mask back before exec */
 	failures +=
-	    Check(actual_handler == expect_handler,
-		  "expected &exit_reason_child_trap (%p) but was %p",
-		  expect_handler, actual_handler);
+	    Check(sigprocmask_count == 2, "expected 2 but was %u",
+		  sigprocmask_count);
 	failures +=
-	    Check(stash_oldact.sa_handler == NULL, "expected NULL but was %p",
-		  stash_oldact);
+	    Check(stashed_last_how == SIG_SETMASK, "expected SIG_SETMASK (%d)"
+		  " but was %d", SIG_SETMASK, stashed_last_how);
 
 	failures +=
 	    Check(monitor_for_hang_count == 0, "expected 0 but was %u",
@@ -310,7 +313,7 @@ unsigned test_child_works_first_time(void)
 
 	yoyo_fork = fake_counting_fork;
 	yoyo_execvp = fake_counting_execvp;
-	yoyo_sigaction = stash_sigaction;
+	yoyo_sigprocmask = stash_sigprocmask;
 	monitor_for_hang = fake_monitor_for_hang_func;
 
 	const size_t buflen = 80 * 24;
@@ -367,7 +370,7 @@ unsigned test_child_works_last_time(void)
 
 	yoyo_fork = fake_counting_fork;
 	yoyo_execvp = fake_counting_execvp;
-	yoyo_sigaction = stash_sigaction;
+	yoyo_sigprocmask = stash_sigprocmask;
 	monitor_for_hang = fake_monitor_for_hang_func;
 
 	const size_t buflen = 80 * 24;
@@ -424,7 +427,7 @@ unsigned test_child_hangs_every_time(void)
 
 	yoyo_fork = fake_counting_fork;
 	yoyo_execvp = fake_counting_execvp;
-	yoyo_sigaction = stash_sigaction;
+	yoyo_sigprocmask = stash_sigprocmask;
 	monitor_for_hang = fake_monitor_for_hang_func;
 
 	const size_t buflen = 80 * 24;
@@ -485,7 +488,7 @@ unsigned test_child_killed_every_time(void)
 
 	yoyo_fork = fake_counting_fork;
 	yoyo_execvp = fake_counting_execvp;
-	yoyo_sigaction = stash_sigaction;
+	yoyo_sigprocmask = stash_sigprocmask;
 	monitor_for_hang = fake_monitor_for_hang_func;
 
 	const size_t buflen = 80 * 24;
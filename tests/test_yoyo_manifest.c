@@ -0,0 +1,273 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/* Copyright (C) 2020, 2021 Eric Herman <eric@freesa.org> */
+
+#include "yoyo.h"
+#include "test-util.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+extern int yoyo_verbose;
+extern FILE *yoyo_stdout;
+extern FILE *yoyo_stderr;
+
+#define Buflen (80 * 24)
+char buf[Buflen];
+FILE *fbuf = NULL;
+
+static void capture_begin(void)
+{
+	memset(buf, 0x00, Buflen);
+	fbuf = fmemopen(buf, Buflen, "w");
+	yoyo_stdout = fbuf;
+	yoyo_stderr = fbuf;
+	yoyo_verbose = 0;
+}
+
+static void capture_end(void)
+{
+	fflush(fbuf);
+	fclose(fbuf);
+	fbuf = NULL;
+	yoyo_stdout = NULL;
+	yoyo_stderr = NULL;
+}
+
+static struct yoyo_manifest *parse(const char *text)
+{
+	return yoyo_manifest_parse(strdup(text), "test.manifest", 5, 6, 1000);
+}
+
+unsigned test_manifest_parse(void)
+{
+	unsigned failures = 0;
+
+	const char *text = "# defaults for all jobs\n"
+	    "max_retries = 2\n"
+	    "hang_check_interval = 250ms\n"
+	    "\n"
+	    "[job web]\n"
+	    "  command = ./server --name 'a b' \"c \\\"d\\\"\" e\\ f\n"
+	    "  env = PORT=8080\n"
+	    "  env = EMPTY=\n"
+	    "  restart = always\n"
+	    "[job]\n"
+	    "command=sleep 1\n"
+	    "max_hangs = 3\n"
+	    "max_retries = 0\n"
+	    "max_thread_churn = 4\n"
+	    "hang_policy = cpu:20\n"
+	    "heartbeat = 30s\n"
+	    "progress = 1\n"
+	    "watchdog = 20s\n"
+	    "output_silence = 300\n"
+	    "log_dir = /var/log/sleeper\n"
+	    "hang_check_interval = 2s\n"
+	    "hang_check_interval_min = 500ms\n"
+	    "hang_check_interval_max = 8s\n" "restart = never\n";
+
+	capture_begin();
+	struct yoyo_manifest *m = parse(text);
+	capture_end();
+
+	failures += Check(m, "NULL manifest, output: %s", buf);
+	if (!m) {
+		return failures;
+	}
+	failures += Check(m->len == 2, "expected 2 but was %zu", m->len);
+	if (m->len != 2) {
+		yoyo_manifest_free(m);
+		return failures;
+	}
+
+	struct yoyo_job *web = &m->jobs[0];
+	failures += Check(web->name && strcmp(web->name, "web") == 0,
+			  "expected 'web' but was '%s'", web->name);
+	const char *argv[] = { "./server", "--name", "a b", "c \"d\"", "e f" };
+	size_t argc = sizeof(argv) / sizeof(argv[0]);
+	for (size_t i = 0; i < argc; ++i) {
+		failures += Check(strcmp(web->argv[i], argv[i]) == 0,
+				  "argv[%zu] expected '%s' but was '%s'", i,
+				  argv[i], web->argv[i]);
+	}
+	failures += Check(web->argv[argc] == NULL, "expected NULL");
+	failures += Check(strcmp(web->env[0], "PORT=8080") == 0,
+			  "expected 'PORT=8080' but was '%s'", web->env[0]);
+	failures += Check(strcmp(web->env[1], "EMPTY=") == 0,
+			  "expected 'EMPTY=' but was '%s'", web->env[1]);
+	failures += Check(web->env[2] == NULL, "expected NULL");
+	failures += Check(web->restart == YOYO_RESTART_ALWAYS, "restart %d",
+			  web->restart);
+	failures += Check(web->max_retries == 2, "expected 2 but was %u",
+			  web->max_retries);
+	failures += Check(web->max_hangs == 6, "expected 6 but was %u",
+			  web->max_hangs);
+	failures += Check(web->interval_ms == 250, "expected 250 but was %u",
+			  web->interval_ms);
+	failures += Check(web->interval_min_ms == 250,
+			  "expected 250 but was %u", web->interval_min_ms);
+	failures += Check(web->history, "expected a history");
+	failures += Check(web->policy == &hang_policy_default,
+			  "expected the default policy");
+
+	struct yoyo_job *sleeper = &m->jobs[1];
+	failures += Check(sleeper->name == NULL, "expected NULL name");
+	failures += Check(strcmp(sleeper->argv[0], "sleep") == 0
+			  && strcmp(sleeper->argv[1], "1") == 0
+			  && sleeper->argv[2] == NULL, "bad argv");
+	failures += Check(sleeper->env == NULL, "expected no env");
+	failures += Check(sleeper->restart == YOYO_RESTART_NEVER,
+			  "restart %d", sleeper->restart);
+	failures += Check(sleeper->max_retries == 0, "expected 0 but was %u",
+			  sleeper->max_retries);
+	failures += Check(sleeper->max_hangs == 3, "expected 3 but was %u",
+			  sleeper->max_hangs);
+	failures += Check(sleeper->thresholds.max_thread_churn == 4,
+			  "expected 4 but was %zu",
+			  sleeper->thresholds.max_thread_churn);
+	failures += Check(sleeper->policy == &hang_policy_cpu
+			  && strcmp(sleeper->policy_args, "20") == 0,
+			  "expected cpu:20");
+	failures += Check(sleeper->heartbeat_ms == 30000,
+			  "expected 30000 but was %u", sleeper->heartbeat_ms);
+	failures += Check(sleeper->progress == 1, "expected 1 but was %u",
+			  sleeper->progress);
+	failures += Check(sleeper->notify && sleeper->watchdog_ms == 20000,
+			  "expected 20000 but was %u", sleeper->watchdog_ms);
+	failures += Check(sleeper->output_silence_ms == 300000,
+			  "expected 300000 but was %u",
+			  sleeper->output_silence_ms);
+	failures += Check(sleeper->log_dir
+			  && strcmp(sleeper->log_dir, "/var/log/sleeper") == 0,
+			  "expected /var/log/sleeper");
+	failures += Check(sleeper->interval_ms == 2000,
+			  "expected 2000 but was %u", sleeper->interval_ms);
+	failures += Check(sleeper->interval_min_ms == 500,
+			  "expected 500 but was %u", sleeper->interval_min_ms);
+	failures += Check(sleeper->interval_max_ms == 8000,
+			  "expected 8000 but was %u", sleeper->interval_max_ms);
+
+	yoyo_manifest_free(m);
+	return failures;
+}
+
+unsigned test_manifest_errors(void)
+{
+	unsigned failures = 0;
+
+	struct {
+		const char *text;
+		const char *expect;
+	} cases[] = {
+		{ "", "no [job]" },
+		{ "command = true\n", "test.manifest:1: command outside" },
+		{ "[job]\ncommand = true\nbogus = 1\n", ":3: unknown setting" },
+		{ "[job]\ncommand = sh -c 'exit 1\n", ":2: unterminated '" },
+		{ "[job a]\nenv = X=1\n[job b]\ncommand = true\n",
+		 ":1: [job] without a command" },
+		{ "[job]\ncommand = true\nmax_hangs = -1\n", "not a number" },
+		{ "[job]\ncommand = true\nhang_check_interval = 1h\n",
+		 "not a duration" },
+		{ "[job]\ncommand = true\nrestart = sometimes\n",
+		 "is not one of" },
+		{ "[job]\ncommand = true\nenv = NOVALUE\n", "not NAME=value" },
+		{ "[jobs]\ncommand = true\n", "is not a [job]" },
+		{ "[job\ncommand = true\n", "missing ']'" },
+		{ "[job]\ncommand = a\ncommand = b\n", ":3: second command" },
+		{ "[job]\ncommand = true\nhang_policy = psychic\n",
+		 ":3: hang_policy 'psychic' not found" },
+	};
+	size_t len = sizeof(cases) / sizeof(cases[0]);
+
+	for (size_t i = 0; i < len; ++i) {
+		capture_begin();
+		struct yoyo_manifest *m = parse(cases[i].text);
+		capture_end();
+		failures += Check(m == NULL, "case %zu: expected NULL", i);
+		failures += Check(strstr(buf, cases[i].expect),
+				  "case %zu: no '%s' in: %s", i,
+				  cases[i].expect, buf);
+		yoyo_manifest_free(m);
+	}
+
+	return failures;
+}
+
+unsigned test_manifest_run(void)
+{
+	unsigned failures = 0;
+
+	char path[] = "/tmp/test_yoyo_manifest.XXXXXX";
+	int fd = mkstemp(path);
+	if (fd < 0) {
+		return 1;
+	}
+	const char *text = "hang_check_interval = 100ms\n"
+	    "[job env]\n"
+	    "command = sh -c 'test \"$YOYO_TEST_X\" = \"x y\"'\n"
+	    "env = YOYO_TEST_X=x y\n"
+	    "[job again]\n"
+	    "command = true\n"
+	    "max_retries = 2\n"
+	    "restart = always\n"
+	    "[job once]\n" "command = false\n" "restart = never\n";
+	ssize_t len = (ssize_t)strlen(text);
+	if (write(fd, text, len) != len) {
+		++failures;
+	}
+	close(fd);
+
+	char *argv[] = { "yoyo", "--manifest", path, NULL };
+	int argc = 3;
+	capture_begin();
+	int exit_val = yoyo(argc, argv);
+	capture_end();
+	unlink(path);
+
+	failures += Check(exit_val == EXIT_FAILURE, "expected %d but was %d",
+			  EXIT_FAILURE, exit_val);
+	const char *expect[] = {
+		"'env' succeeded after 1 attempt(s)",
+		"'again' succeeded after 3 attempt(s)",
+		"'once' failed after 1 attempt(s)",
+		"'once' failed, restart is 'never'",
+	};
+	for (size_t i = 0; i < sizeof(expect) / sizeof(expect[0]); ++i) {
+		failures += Check(strstr(buf, expect[i]), "no '%s' in: %s",
+				  expect[i], buf);
+	}
+	failures += Check(getenv("YOYO_TEST_X") == NULL, "env leaked");
+
+	return failures;
+}
+
+unsigned test_manifest_missing(void)
+{
+	unsigned failures = 0;
+
+	char *argv[] = { "yoyo", "--manifest", "/no/such/manifest", NULL };
+	capture_begin();
+	int exit_val = yoyo(3, argv);
+	capture_end();
+
+	failures += Check(exit_val == EXIT_FAILURE, "expected %d but was %d",
+			  EXIT_FAILURE, exit_val);
+	const char *expect = "can not read manifest '/no/such/manifest'";
+	failures += Check(strstr(buf, expect), "no '%s' in: %s", expect, buf);
+
+	return failures;
+}
+
+int main(void)
+{
+	unsigned failures = 0;
+
+	failures += run_test(test_manifest_parse);
+	failures += run_test(test_manifest_errors);
+	failures += run_test(test_manifest_run);
+	failures += run_test(test_manifest_missing);
+
+	return failures_to_status("test_yoyo_manifest", failures);
+}
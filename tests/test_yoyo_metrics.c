@@ -0,0 +1,224 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/* Copyright (C) 2020, 2021 Eric Herman <eric@freesa.org> */
+
+#include "yoyo.h"
+#include "test-util.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+extern FILE *yoyo_stdout;
+extern FILE *yoyo_stderr;
+extern struct yoyo_stats global_stats;
+extern int global_metrics_fd;
+
+const char *socket_path = "/tmp/test_yoyo_metrics.sock";
+
+unsigned test_metrics_write(void)
+{
+	unsigned failures = 0;
+
+	yoyo_stats_reset(2);
+	yoyo_stats_name(0, "say \"hi\"");
+	yoyo_stats_name(1, "b");
+	global_stats.jobs[0].attempts = 3;
+	global_stats.jobs[0].exit_codes[3] = 2;
+	global_stats.jobs[0].term_signals[15] = 1;
+	global_stats.jobs[0].sigterms = 1;
+	global_stats.jobs[1].hang_count = 4;
+	global_stats.jobs[1].interval_ms = 250;
+	yoyo_stats_sample_time(50 * 1000);
+	yoyo_stats_sample_time(3 * 1000 * 1000);
+	yoyo_stats_sample_time(5ULL * 1000 * 1000 * 1000);
+
+	char *buf = NULL;
+	size_t len = 0;
+	FILE *out = open_memstream(&buf, &len);
+	int err = yoyo_metrics_write(out);
+	fclose(out);
+	failures += Check(err == 0, "expected 0 but was %d", err);
+
+	const char *expect[] = {
+		"# TYPE yoyo_attempts_total counter\n",
+		"yoyo_attempts_total{job=\"say \\\"hi\\\"\",index=\"0\"} 3\n",
+		"yoyo_attempts_total{job=\"b\",index=\"1\"} 0\n",
+		"yoyo_exits_total{job=\"say \\\"hi\\\"\",index=\"0\","
+		    "code=\"3\"} 2\n",
+		"yoyo_signaled_total{job=\"say \\\"hi\\\"\",index=\"0\","
+		    "signal=\"15\"} 1\n",
+		"yoyo_kills_total{job=\"say \\\"hi\\\"\",index=\"0\","
+		    "signal=\"SIGTERM\"} 1\n",
+		"yoyo_hang_count{job=\"b\",index=\"1\"} 4\n",
+		"yoyo_hang_check_interval_seconds{job=\"b\",index=\"1\"} "
+		    "0.250\n",
+		"# TYPE yoyo_sample_duration_seconds histogram\n",
+		"yoyo_sample_duration_seconds_bucket{le=\"0.0001\"} 1\n",
+		"yoyo_sample_duration_seconds_bucket{le=\"0.0025\"} 1\n",
+		"yoyo_sample_duration_seconds_bucket{le=\"0.005\"} 2\n",
+		"yoyo_sample_duration_seconds_bucket{le=\"1\"} 2\n",
+		"yoyo_sample_duration_seconds_bucket{le=\"+Inf\"} 3\n",
+		"yoyo_sample_duration_seconds_count 3\n",
+	};
+	for (size_t i = 0; i < sizeof(expect) / sizeof(expect[0]); ++i) {
+		failures += Check(strstr(buf, expect[i]), "no '%s' in:\n%s",
+				  expect[i], buf);
+	}
+	/* only exit codes and signals which happened are listed */
+	failures += Check(!strstr(buf, "code=\"0\""), "unexpected code 0");
+	free(buf);
+
+	yoyo_stats_reset(0);
+	return failures;
+}
+
+unsigned test_metrics_serve(void)
+{
+	unsigned failures = 0;
+
+	int listen_fd = yoyo_metrics_listen(socket_path);
+	failures += Check(listen_fd >= 0, "could not listen");
+	if (listen_fd < 0) {
+		return failures;
+	}
+
+	struct sockaddr_un addr;
+	memset(&addr, 0x00, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, socket_path);
+	int client = socket(AF_UNIX, SOCK_STREAM, 0);
+	int err = connect(client, (struct sockaddr *)&addr, sizeof(addr));
+	failures += Check(err == 0, "connect returned %d", err);
+	const char *request = "GET /metrics HTTP/1.0\r\n\r\n";
+	if (write(client, request, strlen(request)) < 0) {
+		++failures;
+	}
+
+	yoyo_metrics_serve(listen_fd);
+
+	char buf[8192];
+	size_t used = 0;
+	ssize_t got = 0;
+	while ((got = read(client, buf + used, sizeof(buf) - 1 - used)) > 0) {
+		used += (size_t)got;
+	}
+	buf[used] = '\0';
+	close(client);
+
+	failures += Check(strncmp(buf, "HTTP/1.0 200 OK\r\n", 17) == 0,
+			  "unexpected: %s", buf);
+	const char *expect = "yoyo_metrics_scrapes_total 1\n";
+	failures += Check(strstr(buf, expect), "no '%s' in:\n%s", expect, buf);
+
+	/* nothing pending: returns at once */
+	yoyo_metrics_serve(listen_fd);
+
+	close(listen_fd);
+	unlink(socket_path);
+	global_stats.scrapes = 0;
+	return failures;
+}
+
+unsigned test_metrics_serve_silent_clients(void)
+{
+	unsigned failures = 0;
+
+	int listen_fd = yoyo_metrics_listen(socket_path);
+	failures += Check(listen_fd >= 0, "could not listen");
+	if (listen_fd < 0) {
+		return failures;
+	}
+
+	struct sockaddr_un addr;
+	memset(&addr, 0x00, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, socket_path);
+	int clients[4];
+	size_t len = sizeof(clients) / sizeof(clients[0]);
+	for (size_t i = 0; i < len; ++i) {
+		clients[i] = socket(AF_UNIX, SOCK_STREAM, 0);
+		int err = connect(clients[i], (struct sockaddr *)&addr,
+				  sizeof(addr));
+		failures += Check(err == 0, "connect returned %d", err);
+	}
+
+	/* none of them sends a request: they share one deadline, rather
+	 * than each getting one of their own */
+	long start = now_ms();
+	yoyo_metrics_serve(listen_fd);
+	long elapsed = now_ms() - start;
+	failures += Check(elapsed < 250, "expected < 250ms but was %ldms",
+			  elapsed);
+	failures += Check(global_stats.scrapes >= 1, "expected an answer");
+
+	for (size_t i = 0; i < len; ++i) {
+		close(clients[i]);
+	}
+	yoyo_metrics_serve(listen_fd);
+
+	close(listen_fd);
+	unlink(socket_path);
+	global_stats.scrapes = 0;
+	return failures;
+}
+
+unsigned test_metrics_from_jobs(void)
+{
+	unsigned failures = 0;
+
+	setenv("YOYO_MAX_RETRIES", "1", 1);
+	setenv("YOYO_METRICS_SOCKET", socket_path, 1);
+	char *argv[] = { "yoyo", "--jobs", "sh", "-c", "exit 3", ";", "true",
+		NULL
+	};
+	char buf[2048];
+	FILE *fbuf = fmemopen(buf, sizeof(buf), "w");
+	yoyo_stdout = fbuf;
+	yoyo_stderr = fbuf;
+	int exit_val = yoyo(7, argv);
+	fclose(fbuf);
+	yoyo_stdout = NULL;
+	yoyo_stderr = NULL;
+	unsetenv("YOYO_MAX_RETRIES");
+	unsetenv("YOYO_METRICS_SOCKET");
+
+	failures += Check(exit_val == EXIT_FAILURE, "expected %d but was %d",
+			  EXIT_FAILURE, exit_val);
+	failures += Check(global_metrics_fd >= 0, "expected a socket");
+	failures += Check(global_stats.len == 2, "expected 2 but was %zu",
+			  global_stats.len);
+	if (global_stats.len == 2) {
+		struct job_stats *sh = &global_stats.jobs[0];
+		failures += Check(strcmp(sh->name, "sh") == 0, "name %s",
+				  sh->name);
+		failures += Check(sh->attempts == 2, "expected 2 but was %lu",
+				  sh->attempts);
+		failures += Check(sh->exit_codes[3] == 2,
+				  "expected 2 but was %lu", sh->exit_codes[3]);
+		failures += Check(sh->running == 0, "expected not running");
+		struct job_stats *t = &global_stats.jobs[1];
+		failures += Check(t->attempts == 1 && t->exit_codes[0] == 1,
+				  "true: %lu attempts", t->attempts);
+	}
+
+	close(global_metrics_fd);
+	global_metrics_fd = -1;
+	unlink(socket_path);
+	yoyo_stats_reset(0);
+	return failures;
+}
+
+int main(void)
+{
+	unsigned failures = 0;
+
+	failures += run_test(test_metrics_write);
+	failures += run_test(test_metrics_serve);
+	failures += run_test(test_metrics_serve_silent_clients);
+	failures += run_test(test_metrics_from_jobs);
+
+	return failures_to_status("test_yoyo_metrics", failures);
+}